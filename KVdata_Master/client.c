@@ -10,85 +10,135 @@
 #include <netinet/tcp.h>
 #include "assert.h" 
 #include <unistd.h>
+#include "slave.h"
+#include "reactor.h"
+
 /*
- * 根据已连接文件描述符创建新的客户端状态c
- * (1)设置文件描述符cfd为O_NONBLOCK(非阻塞)
- * (2)禁用 Nagle 算法
- * (3)开启 TCP 的 keep alive 选项
- * (4)将已连接描述符添加进行红黑树句柄中进行监听读事件,并设置回调函数为recvData函数
- * 
- * 返回值：客户端状态
+ * 设置已连接套接字 fd 的选项：非阻塞、禁用 Nagle 算法，以及按配置开启 keep alive
+ * 成功返回 AE_OK ，失败返回 AE_ERR
  */
-KVClient *createClient(int fd)
+static int setClientSocketOptions(int fd)
 {
     int flags;
 
     //获取文件描述符fd的flags
     if ((flags = fcntl(fd, F_GETFL)) == -1) {
-        printf("fcntl(F_GETFL) err: %s\n", strerror(errno));
-        return NULL;
+        serverLog(KVDATA_WARNING, "fcntl(F_GETFL) err: %s\n", strerror(errno));
+        return AE_ERR;
     }
 
     //设置文件描述符fd为O_NONBLOCK(非阻塞)
     if (fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) {
-        printf("fcntl(F_SETFL,O_NONBLOCK) err: %s\n", strerror(errno));
-        return NULL;
+        serverLog(KVDATA_WARNING, "fcntl(F_SETFL,O_NONBLOCK) err: %s\n", strerror(errno));
+        return AE_ERR;
     }
 
     //禁用 Nagle 算法,小报文可以发送，毕竟客户端的每个请求命令都不大
     int val=1; 
     if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &val, sizeof(val)) == -1)
     {
-        printf("setsockopt close TCP_NODELAY err: %s\n", strerror(errno));
-        return NULL;
+        serverLog(KVDATA_WARNING, "setsockopt close TCP_NODELAY err: %s\n", strerror(errno));
+        return AE_ERR;
     }
 
     //开启 TCP 的 keep alive 选项
     int yes = 1;
     if (server.tcpkeepalive && setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &yes, sizeof(yes)) == -1) {
-        printf("setsockopt open SO_KEEPALIVE err: %s\n", strerror(errno));
-        return NULL;
+        serverLog(KVDATA_WARNING, "setsockopt open SO_KEEPALIVE err: %s\n", strerror(errno));
+        return AE_ERR;
     }
+    return AE_OK;
+}
+
+/*
+ * 根据已连接文件描述符创建新的客户端状态c
+ * (1)设置文件描述符cfd为O_NONBLOCK(非阻塞)
+ * (2)禁用 Nagle 算法
+ * (3)开启 TCP 的 keep alive 选项
+ * (4)将已连接描述符添加进行红黑树句柄中进行监听读事件,并设置回调函数为recvData函数
+ * 客户端属于调用本函数的线程所运行的 reactor
+ * fd 为 -1 时创建没有连接的伪客户端，不设置套接字、不注册事件，也不计入客户端链表，
+ * 它的回复会被丢弃，可以用来单独测试协议解析
+ * 
+ * 返回值：客户端状态
+ */
+KVClient *createClient(int fd)
+{
+    // fd 为 -1 时创建没有连接的伪客户端
+    if (fd != -1 && setClientSocketOptions(fd) == AE_ERR) return NULL;
+
     // 从查询缓存重读取内容，创建参数，并执行命令
     // 为新创建的客户端分配空间
     KVClient *c = zmalloc(sizeof(KVClient));
+    // 客户端所属的 reactor
+    c->reactor = currentReactor;
 
     //将已连接描述符添加进行红黑树句柄中进行监听读事件
     //并设置回调函数为recvData函数
-    aeCreateFileEvent(server.eventsLoop, fd, AE_READABLE,recvData, c);
+    //添加失败时（比如事件处理器无法扩容）放弃这个客户端，由调用者关闭套接字
+    if (fd != -1 && aeCreateFileEvent(c->reactor->el, fd, AE_READABLE,recvData, c) == AE_ERR) {
+        zfree(c);
+        return NULL;
+    }
 
     // 默认选0号数据库
     selectDb(c,0);
     // client的套接字
     c->fd = fd;
+    // 客户端的地址，由 accept 之后设置
+    c->ip[0] = '\0';
+    c->port = 0;
     // 回复缓冲区的偏移量
     c->bufpos = 0;
+    // 已发送字节
+    c->sentlen = 0;
+    // 不在待写链表中
+    c->pending_write_node.value = c;
     // 查询缓存区
     c->querybuf = sdsnewlen("",0);
     // 命令参数数量
     c->argc = 0;
     // 命令参数
     c->argv = NULL;
+    c->argv_len = 0;
+    // 缓存的参数对象
+    c->argv_pool_len = 0;
     // 当前执行的命令和最近一次执行的命令
     c->cmd = c->lastcmd = NULL;  
     // 查询缓冲区中未读入的命令内容数量
     c->multibulklen = 0;
     // 读入的参数的长度
     c->bulklen = -1; 
-    //当前命令名字的长度
-    c->execlen = 0;
     // client的状态 FLAG
     c->flags = 0;
     // 设置创建client的时间和最后一次互动的时间
     c->ctime = c->lastinteraction = server.unixtime;
     // 回复链表
     c->reply = listCreate();
+    listSetFreeMethod(c->reply,decrRefCountVoid);
+    listSetDupMethod(c->reply,dupClientReplyValue);
     // 回复链表的字节量
     c->reply_bytes = 0;
+    // 客户端名字
+    c->name = NULL;
+    // 事务状态
+    initClientMultiState(c);
+    // 复制相关状态
+    c->replstate = KVDATA_REPL_NONE;
+    c->reploff = 0;
+    c->repl_ack_off = 0;
+    c->repldbfd = -1;
+    c->replpreamble = NULL;
+    c->repldboff = 0;
+    c->repldbsize = 0;
 
-    // 将真正的client放在服务器的客户端链表中
-    if (fd != -1) 
-    listAddNodeTail(server.clients,c);
+    // 将真正的client放在服务器的客户端链表中，并计入已连接客户端数量
+    c->client_list_node = NULL;
+    if (fd != -1) {
+        listAddNodeTail(c->reactor->clients,c);
+        c->client_list_node = listLast(c->reactor->clients);
+        __atomic_add_fetch(&server.connected_clients,1,__ATOMIC_RELAXED);
+    }
 
     //初始化被监视的键列表
     c->watched_keys = listCreate();
@@ -107,7 +157,7 @@ void freeClient(KVClient *c)
     listNode *ln;
     //如果是从服务器与主节点断开连接
     if (server.master && c->flags & KVDATA_MASTER) {
-        printf("Connection with master lost.\n");
+        serverLog(KVDATA_NOTICE, "Connection with master lost.\n");
         //则将server.master对应客户端复制到则将server.CacheMaster上
         replicationCacheMaster(c);
         return;
@@ -115,9 +165,17 @@ void freeClient(KVClient *c)
 
     //如果是主服务器与从节点断开连接
     if ((c->flags & KVDATA_SLAVE)) {
-        printf("Connection with slave %s:%d lost.\n", c->ip,c->port);
+        serverLog(KVDATA_NOTICE, "Connection with slave %s:%d lost.\n", c->ip,c->port);
     }
     
+    // 从待写链表和待读链表中移除客户端
+    if (c->flags & KVDATA_PENDING_WRITE) removeClientFromPendingWriteQueue(c);
+    if (c->flags & KVDATA_PENDING_READ) {
+        ln = listSearchKey(c->reactor->clients_pending_read,c);
+        assert(ln != NULL);
+        listUnlinkNode(c->reactor->clients_pending_read,ln);
+    }
+
     //释放客户端对应的查询缓冲区
     sdsfree(c->querybuf);
     c->querybuf = NULL;
@@ -127,8 +185,8 @@ void freeClient(KVClient *c)
 
     // 关闭套接字，并从事件处理器中删除该描述符对应的事件
     if (c->fd != -1) {
-        aeDeleteFileEvent(server.eventsLoop,c->fd,AE_READABLE);
-        aeDeleteFileEvent(server.eventsLoop,c->fd,AE_WRITABLE);
+        aeDeleteFileEvent(c->reactor->el,c->fd,AE_READABLE);
+        aeDeleteFileEvent(c->reactor->el,c->fd,AE_WRITABLE);
         close(c->fd);
     }
     //如果客户端是从节点
@@ -143,7 +201,8 @@ void freeClient(KVClient *c)
         list *l = server.slaves;
         ln = listSearchKey(l,c);
         assert(ln != NULL);
-        listDelNode(l,ln);
+        // 客户端结构在下面从客户端链表中删除时释放，这里只解除链接
+        listUnlinkNode(l,ln);
     }
 
 
@@ -153,19 +212,21 @@ void freeClient(KVClient *c)
     freeClientArgv(c);
     // 清除参数空间
     zfree(c->argv);
+    // 释放缓存的参数对象
+    while (c->argv_pool_len) decrRefCount(c->argv_pool[--c->argv_pool_len]);
     // 释放客户端名字对象
     if (c->name) decrRefCount(c->name);
     // // 清除事务状态信息
     // freeClientMultiState(c);
 
     // 从服务器的客户端链表中删除自身
-    if (c->fd != -1) {
-        ln = listSearchKey(server.clients,c);
-        listDelNode(server.clients,ln);
+    if (c->client_list_node) {
+        __atomic_sub_fetch(&server.connected_clients,1,__ATOMIC_RELAXED);
+        listDelNode(c->reactor->clients,c->client_list_node);
+    } else {
+        // 不在客户端链表中（比如被缓存的主服务器），直接释放客户端 KVClient 结构本身
+        zfree(c);
     }
-    // 释放客户端 KVClient 结构本身
-    // if(c != NULL)
-    // zfree(c);
 }
 
 /*
@@ -173,10 +234,30 @@ void freeClient(KVClient *c)
  */
 void freeClientArgv(KVClient *c) {
     int j;
-    for (j = 0; j < c->argc; j++)
-        decrRefCount(c->argv[j]);
+    for (j = 0; j < c->argc; j++) {
+        robj *o = c->argv[j];
+        sds s = o->ptr;
+
+        // 只被参数数组引用的小参数对象缓存起来，解析下一条命令时复用
+        // 被数据库、事务队列等引用的对象不能复用
+        if (o->refcount == 1 && o->encoding == STRING &&
+            c->argv_pool_len < KVDATA_ARGV_POOL_SIZE &&
+            sdslen(s)+sdsavail(s) <= KVDATA_ARGV_POOL_MAX_LEN)
+        {
+            c->argv_pool[c->argv_pool_len++] = o;
+        } else {
+            decrRefCount(o);
+        }
+    }
     c->argc = 0;
     c->cmd = NULL;
+
+    // 参数很多的命令，释放它的参数数组，避免一直占用内存
+    if (c->argv_len > KVDATA_ARGV_POOL_SIZE) {
+        zfree(c->argv);
+        c->argv = NULL;
+        c->argv_len = 0;
+    }
 }
 
 
@@ -8,6 +8,9 @@
 #include "multi.h"
 #define KVDATA_REPLY_CHUNK_BYTES (16*1024)//回复缓冲块的大小限制
 #define KVDATA_RUN_ID_SIZE 40  //服务器的运行id字符串长度
+#define KVDATA_IP_STR_LEN 46   //ip地址字符串的最大长度，和 INET6_ADDRSTRLEN 相同
+#define KVDATA_ARGV_POOL_SIZE 16      //每个客户端缓存的参数对象数量，也是命令之间保留的参数数组长度
+#define KVDATA_ARGV_POOL_MAX_LEN 1024 //只缓存空间不超过这个长度的参数对象
 /* 客户端状态标志 */
 #define KVDATA_SLAVE (1<<0)   /* 客户端是从服务器状态 */
 #define KVDATA_MASTER (1<<1)  /* 客户端是主服务器状态 */
@@ -19,7 +22,7 @@
 // #define KVDATA_UNBLOCKED (1<<7) /* This client was unblocked and is stored in*/
 // #define KVDATA_LUA_CLIENT (1<<8) /* This is a non connected client used by Lua */
 // #define KVDATA_ASKING (1<<9)     /* Client issued the ASKING command */
-// #define KVDATA_CLOSE_ASAP (1<<10)/* Close this client ASAP */
+#define KVDATA_CLOSE_ASAP (1<<10) /* I/O 线程中读写出错，由主线程尽快释放客户端 */
 // #define KVDATA_UNIX_SOCKET (1<<11) /* Client connected via Unix domain socket */
 #define KVDATA_DIRTY_EXEC (1<<12)  /* 表示事务在命令入队时出现了错，标志表示事务的安全性已经被破坏 */
 #define KVDATA_MASTER_FORCE_REPLY (1<<13)  /* 从服务器需要向主服务器发送REPLICATION ACK命令 */
@@ -27,6 +30,10 @@
 // #define KVDATA_FORCE_REPL (1<<15)  /* Force replication of current cmd. */
 // #define KVDATA_PRE_PSYNC (1<<16)   /* Instance don't understand PSYNC. */
 // #define KVDATA_READONLY (1<<17)    /* Cluster client is in read-only state. */
+#define KVDATA_PENDING_WRITE (1<<18)  /* 客户端在待写链表中，等待 beforeSleep 中写出回复 */
+#define KVDATA_PENDING_READ (1<<19)   /* 客户端在待读链表中，等待 I/O 线程读取并解析 */
+#define KVDATA_PENDING_COMMAND (1<<20) /* I/O 线程已解析出一条完整命令，等待主线程执行 */
+#define KVDATA_FORWARDED (1<<21)      /* 命令已转发给拥有键的 reactor 执行，等待执行结果 */
 
 /*
  * 因为多路 I/O 复用的缘故，需要为每个客户端维持一个状态。
@@ -41,11 +48,21 @@ typedef struct KVClient {
     // 套接字描述符
     int fd;
 
+    // 客户端所属的 reactor ，套接字由该 reactor 的事件处理器监听
+    struct kvReactor *reactor;
+
+    // 客户端在待写链表中的节点，用于在 O(1) 复杂度内将客户端移出待写链表
+    // 节点嵌在客户端结构中，加入待写链表时不需要分配内存，是否在链表中由 KVDATA_PENDING_WRITE 标志表示
+    listNode pending_write_node;
+
+    // 客户端在所属 reactor 客户端链表中的节点，用于在 O(1) 复杂度内将客户端移出客户端链表
+    listNode *client_list_node;
+
     //客户端的端口号
     int port;
 
     //客户端ip地址
-    char*ip;
+    char ip[KVDATA_IP_STR_LEN];
 
     // 当前正在使用的数据库
     KVdataDb *db;
@@ -56,15 +73,19 @@ typedef struct KVClient {
     // 命令参数对象数组
     robj **argv;
 
+    // 参数数组的长度
+    int argv_len;
+
+    // 执行完命令之后缓存下来的参数对象，解析下一条命令时复用，避免每个参数都分配内存
+    robj *argv_pool[KVDATA_ARGV_POOL_SIZE];
+    int argv_pool_len;
+
     // 当前命令的参数个数————仅在解析命令请求时使用
     int multibulklen;   
 
     // 命令内容的长度【各参数的长度】————仅在解析命令请求时使用
     long bulklen;  
 
-    //当前命令名字的长度，如SET：3
-    long execlen;
-
     // 回复链表，链表实现可变大小缓冲区，用于保存那些长度比较大的回复
     list *reply;
 
@@ -0,0 +1,34 @@
+#include "clock.h"
+#include <sys/time.h>
+#include "util.h"
+
+__thread kvClock cachedClock;
+
+/*
+ * 刷新当前线程的缓存时钟
+ * 由 aeProcessEvents 在每次迭代中调用，线程开始运行事件处理器之前也要调用一次
+ */
+void updateCachedClock(void) {
+    struct timeval tv;
+
+    cachedClock.mono_us = getMonotonicUs();
+    gettimeofday(&tv, NULL);
+    cachedClock.unix_us = ((long long)tv.tv_sec)*1000000+tv.tv_usec;
+    cachedClock.offset_us = cachedClock.unix_us-(long long)cachedClock.mono_us;
+}
+
+/*
+ * 开始执行一条命令，mono_us 为 call 测量命令耗时时读取的单调时钟
+ * 只有顶层命令会更新命令时间，EXEC 中的命令沿用 EXEC 的命令时间
+ */
+void clockEnterCommand(uint64_t mono_us) {
+    if (cachedClock.call_depth++ == 0)
+        cachedClock.cmd_ms = ((long long)mono_us+cachedClock.offset_us)/1000;
+}
+
+/*
+ * 命令执行完毕
+ */
+void clockLeaveCommand(void) {
+    cachedClock.call_depth--;
+}
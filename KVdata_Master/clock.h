@@ -0,0 +1,51 @@
+#ifndef KVDATA_CLOCK_H
+#define KVDATA_CLOCK_H
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * 缓存的时钟
+ *
+ * 每个运行事件处理器的线程（主线程和各个 reactor）各有一份，
+ * 由 aeProcessEvents 在每次迭代中刷新，热路径直接读取缓存，不再调用 gettimeofday 。
+ *
+ * 时间的使用规则：
+ * (1) 事件循环本身（时间事件的到达时间、文件事件的最近活动时间、慢查询日志的时间等）
+ *     使用本次迭代缓存的时间。
+ * (2) 命令使用命令时间。call 在执行顶层命令之前，用测量命令耗时时已经读取的单调时钟
+ *     换算出墙上时间，不需要额外的系统调用，一条命令执行期间看到的时间不变。
+ *     EXEC 执行事务中的命令时不再更新命令时间，整个事务看到的都是 EXEC 开始的时间，
+ *     事务中的过期判断和过期时间的计算互相一致。
+ *     从服务器执行主服务器传来的命令时，同样使用自己的命令时间判断过期。
+ * (3) 需要准确时间的后台任务（定期删除过期键的抽样）以及不在事件循环中运行的代码
+ *     （RDB 子进程、载入 RDB 文件）直接调用 mstime() 。
+ */
+typedef struct kvClock {
+    // 单调时钟（微秒），用于时间事件
+    uint64_t mono_us;
+    // 墙上时间（微秒格式的 UNIX 时间）
+    long long unix_us;
+    // 墙上时间减去单调时钟，用于由单调时钟换算墙上时间
+    long long offset_us;
+    // 正在执行的命令的命令时间（毫秒格式的 UNIX 时间）
+    long long cmd_ms;
+    // 正在执行的命令的嵌套层数，EXEC 中的命令为 2
+    int call_depth;
+} kvClock;
+
+// 当前线程的缓存时钟
+extern __thread kvClock cachedClock;
+
+// 缓存的单调时钟（微秒）
+#define clockMonotonicUs() (cachedClock.mono_us)
+// 缓存的墙上时间（毫秒）
+#define clockUnixMs() (cachedClock.unix_us/1000)
+// 缓存的墙上时间（秒）
+#define clockUnixSec() ((time_t)(cachedClock.unix_us/1000000))
+// 命令判断过期、计算过期时间时使用的当前时间（毫秒），不在命令中时为缓存的墙上时间
+#define commandTimeMs() (cachedClock.call_depth ? cachedClock.cmd_ms : clockUnixMs())
+
+void updateCachedClock(void);
+void clockEnterCommand(uint64_t mono_us);
+void clockLeaveCommand(void);
+#endif
@@ -0,0 +1,205 @@
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "server.h"
+#include "ioThreads.h"
+#include "reactor.h"
+#include "evict.h"
+#include "util.h"
+
+/*
+ * 将 "yes"/"no" 转换为 1/0 ，无法识别时返回 -1
+ */
+int yesnotoi(char *s) {
+    if (!strcasecmp(s,"yes")) return 1;
+    else if (!strcasecmp(s,"no")) return 0;
+    else return -1;
+}
+
+/*
+ * 从命令行参数中载入服务器配置，在 initServer 之后调用，覆盖默认值
+ * 参数的格式为 --<选项名> <值>，比如：
+ *
+ * ./go 6668 --io-threads 4
+ *
+ * 遇到无法识别的选项或错误的值时，打印错误并退出
+ */
+void loadServerConfigFromArgv(int argc, char **argv) {
+    for (int j = 0; j < argc; j += 2) {
+        char *name = argv[j], *value;
+        char *err = NULL;
+
+        // 选项必须以 -- 开头，并且带有一个值
+        if (strncmp(name,"--",2) != 0 || j+1 >= argc) {
+            err = "Bad option format, expected --<option> <value>";
+            goto loaderr;
+        }
+        name += 2;
+        value = argv[j+1];
+
+        if (!strcasecmp(name,"io-threads")) {
+            // I/O 线程数量（包括主线程）
+            server.io_threads_num = atoi(value);
+            if (server.io_threads_num < 1 || server.io_threads_num > IO_THREADS_MAX_NUM) {
+                err = "Invalid number of I/O threads";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(name,"io-threads-do-reads")) {
+            // 是否由 I/O 线程读取和解析查询缓冲区
+            if ((server.io_threads_do_reads = yesnotoi(value)) == -1) {
+                err = "argument must be 'yes' or 'no'";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(name,"reactors")) {
+            // reactor 数量，每个 reactor 一个线程、一个事件处理器和一个键空间分片
+            server.reactors_num = atoi(value);
+            if (server.reactors_num < 1 || server.reactors_num > KVDATA_REACTORS_MAX) {
+                err = "Invalid number of reactors";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(name,"event-backend")) {
+            // 事件处理器使用的多路复用后端
+            if (!strcasecmp(value,"epoll")) {
+                server.event_backend = AE_BACKEND_EPOLL;
+            } else if (!strcasecmp(value,"io_uring")) {
+                server.event_backend = AE_BACKEND_URING;
+            } else {
+                err = "argument must be 'epoll' or 'io_uring'";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(name,"maxclients")) {
+            // 最大客户端数量，启动时会根据它提升打开文件数量的限制
+            server.maxclients = atoi(value);
+            if (server.maxclients < 1) {
+                err = "Invalid max clients limit";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(name,"tcp-backlog")) {
+            // listen 的待连接队列长度
+            server.tcp_backlog = atoi(value);
+            if (server.tcp_backlog < 1) {
+                err = "Invalid backlog value";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(name,"loglevel")) {
+            // 日志级别
+            if (!strcasecmp(value,"debug")) server.verbosity = KVDATA_DEBUG;
+            else if (!strcasecmp(value,"verbose")) server.verbosity = KVDATA_VERBOSE;
+            else if (!strcasecmp(value,"notice")) server.verbosity = KVDATA_NOTICE;
+            else if (!strcasecmp(value,"warning")) server.verbosity = KVDATA_WARNING;
+            else {
+                err = "Invalid log level. Must be one of debug, verbose, notice, warning";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(name,"hz")) {
+            // 每秒执行 serverCron 的次数
+            server.hz = atoi(value);
+            if (server.hz < KVDATA_MIN_HZ || server.hz > KVDATA_MAX_HZ) {
+                err = "Invalid hz value, must be between 1 and 500";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(name,"logfile")) {
+            // 日志文件，"" 表示标准输出
+            server.logfile = value;
+        } else if (!strcasecmp(name,"slowlog-log-slower-than")) {
+            // 慢查询日志的阈值（微秒），负数表示关闭
+            server.slowlog_log_slower_than = strtoll(value,NULL,10);
+        } else if (!strcasecmp(name,"slowlog-max-len")) {
+            // 慢查询日志最多保存的条数
+            if (atol(value) < 0) {
+                err = "Invalid slowlog max length";
+                goto loaderr;
+            }
+            server.slowlog_max_len = strtoul(value,NULL,10);
+        } else if (!strcasecmp(name,"maxmemory")) {
+            // 内存上限，可以带有单位，比如 100mb ， 0 表示不限制
+            int memerr;
+            long long maxmemory = memtoll(value,&memerr);
+            if (memerr || maxmemory < 0) {
+                err = "Invalid maxmemory value";
+                goto loaderr;
+            }
+            server.maxmemory = maxmemory;
+        } else if (!strcasecmp(name,"maxmemory-policy")) {
+            // 超过内存上限时的淘汰策略
+            if ((server.maxmemory_policy = maxmemoryPolicyFromName(value)) == -1) {
+                err = "Invalid maxmemory policy. Must be one of volatile-lru, volatile-ttl, "
+                      "allkeys-lru, allkeys-lfu, noeviction";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(name,"maxmemory-samples")) {
+            // 淘汰时每个数据库每轮抽样的键数量
+            server.maxmemory_samples = atoi(value);
+            if (server.maxmemory_samples < 1 ||
+                server.maxmemory_samples > KVDATA_MAXMEMORY_SAMPLES_MAX) {
+                err = "Invalid maxmemory-samples, must be between 1 and 64";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(name,"activedefrag")) {
+            // 是否开启主动碎片整理
+            if ((server.active_defrag_enabled = yesnotoi(value)) == -1) {
+                err = "argument must be 'yes' or 'no'";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(name,"active-defrag-ignore-bytes")) {
+            // 碎片少于这么多字节时不整理，可以带有单位
+            int memerr;
+            long long bytes = memtoll(value,&memerr);
+            if (memerr || bytes < 0) {
+                err = "Invalid active-defrag-ignore-bytes value";
+                goto loaderr;
+            }
+            server.active_defrag_ignore_bytes = bytes;
+        } else if (!strcasecmp(name,"active-defrag-threshold-lower") ||
+                   !strcasecmp(name,"active-defrag-threshold-upper")) {
+            // 开始整理和以最大力度整理的碎片率（百分比）
+            int perc = atoi(value);
+            if (perc < 0 || perc > 1000) {
+                err = "Invalid fragmentation threshold, must be between 0 and 1000";
+                goto loaderr;
+            }
+            if (!strcasecmp(name,"active-defrag-threshold-lower"))
+                server.active_defrag_threshold_lower = perc;
+            else
+                server.active_defrag_threshold_upper = perc;
+        } else if (!strcasecmp(name,"active-defrag-cycle-min") ||
+                   !strcasecmp(name,"active-defrag-cycle-max")) {
+            // 整理占用的 CPU 时间百分比的范围
+            int perc = atoi(value);
+            if (perc < 1 || perc > 99) {
+                err = "Invalid active defrag CPU percentage, must be between 1 and 99";
+                goto loaderr;
+            }
+            if (!strcasecmp(name,"active-defrag-cycle-min"))
+                server.active_defrag_cycle_min = perc;
+            else
+                server.active_defrag_cycle_max = perc;
+        } else {
+            err = "Bad directive or wrong number of arguments";
+            goto loaderr;
+        }
+        continue;
+
+    loaderr:
+        printf("\n*** FATAL CONFIG ERROR ***\n");
+        printf(">>> '%s %s'\n", argv[j], j+1 < argc ? argv[j+1] : "");
+        printf("%s\n", err);
+        exit(1);
+    }
+
+    // 多 reactor 模式下每个 reactor 自己完成读写，不能再使用 I/O 线程
+    if (server.reactors_num > 1 && server.io_threads_num > 1) {
+        printf("\n*** FATAL CONFIG ERROR ***\n");
+        printf("--reactors and --io-threads can't be used together\n");
+        exit(1);
+    }
+
+    // io_uring 后端自己批量完成套接字读写，不能再使用 I/O 线程
+    if (server.event_backend == AE_BACKEND_URING && server.io_threads_num > 1) {
+        printf("\n*** FATAL CONFIG ERROR ***\n");
+        printf("--event-backend io_uring and --io-threads can't be used together\n");
+        exit(1);
+    }
+}
@@ -0,0 +1,6 @@
+#ifndef KVDATA_CONFIG_H
+#define KVDATA_CONFIG_H
+
+void loadServerConfigFromArgv(int argc, char **argv);
+int yesnotoi(char *s);
+#endif
@@ -6,6 +6,8 @@
 #include "assert.h"
 #include "server.h"
 #include "zmalloc.h"
+#include "clock.h"
+#include "evict.h"
 /*
  * 将客户端的目标数据库切换为 id 所指定的数据库
  */
@@ -45,123 +47,64 @@ long long emptyDb() {
         // 记录被删除键的数量
         removed += dictSize(server.db[j].DB);
 
+        // 先清空过期键索引，其中的节点由数据库字典释放
+        dictEmpty(server.db[j].expires);
         // 删除所有键值对
         dictEmpty(server.db[j].DB);
-        // 删除所有键的过期时间
-        dictEmpty(server.db[j].expires);
     }
     // 返回键的数量
     return removed;
 }
 
-/*
- * 清空字典上的所有哈希表节点，并重置字典属性
- * T = O(N)
- */
-void dictEmpty(dict *d) {
-
-    // 删除两个哈希表上的所有节点
-    dictClear(d,&d->ht[0]);
-    dictClear(d,&d->ht[1]);
-    // 重置属性 
-    d->rehashidx = -1;
-}
-
-/*
- * 删除哈希表上的所有节点，并重置哈希表的各项属性
- */
-int dictClear(dict *d, dictht *ht) {
-    // 遍历整个哈希表
-    for (unsigned long i = 0; i < ht->size && ht->used > 0; i++) {
-        dictEntry *he;
-
-        // 跳过空索引
-        if ((he = ht->table[i]) == NULL) 
-        continue;
-
-        // 遍历整个链表
-        while(he) {
-            // 删除键
-            sdsfree(he->key);
-            // 删除值
-            decrRefCount(he->val);
-            // 释放节点
-            zfree(he);
-            // 更新已使用节点计数
-            ht->used--;
-            // 处理下个节点
-            he = he->next;
-        }
-    }
-    // 释放哈希表结构
-    zfree(ht->table);
-    //重置指定哈希表内的各项属性
-    ht->table = NULL;   //哈希表数组
-    ht->size = 0;       //哈希表大小（table数组的大小）
-    ht->sizemask = 0;   //哈希表大小掩码
-    ht->used = 0;       //该哈希表已有节点的数量
-
-    return DICT_OK; 
-}
 /*
  * 返回给定 key 的过期时间。
- * 如果键没有设置过期时间，那么返回 0。
+ * 过期时间保存在数据库节点中，只需要查找一次数据库字典。
+ * 如果键不存在，或者没有设置过期时间，那么返回 -1。
  */
 long long getExpire(KVdataDb *db, robj *key) {
-    dictEntry *de;
-    
-    // 获取键的过期时间
-    // 如果过期时间不存在，那么直接返回
-    if (dictSize(db->expires) == 0 || (de = dictFind(db->expires,key->ptr)) == NULL) 
-        return -1;
-    //键key是在过期字典中查找到的的，意味着在主字典应该也能查找到
-    assert(dictFind(db->DB,key->ptr) != NULL);
-    // 返回过期时间
+    dictEntry *de = dictFind(db->DB,key->ptr);
+
+    if (de == NULL || de->expire == 0) return -1;
     return de->expire;
 }
 
 /*
  * 为执行写入操作而取出键 key 在数据库 db 中的值。
  * 找到时返回值对象，没找到返回 NULL 。
+ * 键已经过期时会被删除，并且当作不存在处理。
  */
 robj *lookupKey(KVdataDb *db, robj *key) {
-    // 检查 key 是否过期，过期时释放该键
-    expireIfNeeded(db,key);
-
-    // 查找并返回 key 的值对象
-    // 查找键空间
+    // 查找键空间，节点中同时保存着键的过期时间
     dictEntry *de = dictFind(db->DB,key->ptr);
-    // 节点存在
-    if (de) {    
-        // 取出值
-        robj *val = dictGetVal(de);
-        return val;
-    } else {
-        // 节点不存在
-        return NULL;
-    }
+
+    // 节点不存在，或者键已经过期并被删除
+    if (de == NULL || expireIfNeeded(db,de)) return NULL;
+    // 取出值，并更新它的访问信息
+    // 有 RDB 子进程时不修改，避免引起不必要的写时复制
+    robj *val = dictGetVal(de);
+    if (server.rdb_child_pid == -1) objectTouch(val);
+    return val;
 }
 
 
 /*
- * 检查 key 是否已经过期，如果是的话，将它从数据库中删除。
+ * 检查数据库节点 de 中的键是否已经过期，如果是的话，将它从数据库中删除。
  * 返回 0 表示键没有过期时间，或者键未过期。
- * 返回 1 表示键已经因为过期而被删除了。
+ * 返回 1 表示键已经因为过期而被删除了，de 已经被释放。
  */
-void expireIfNeeded(KVdataDb *db, robj *key) {
-    // 取出键的过期时间
-    uint64_t when = getExpire(db,key);
-    uint64_t now = mstime();
-    printf("when to expire:%ld  ,   now:%ld\n",when,now);
-    // 该键没有过期时间
-    if (when <= 0) return;
-
-    // 运行到这里，表示键带有过期时间，并且服务器为主节点
+int expireIfNeeded(KVdataDb *db, dictEntry *de) {
+    // 该键没有过期时间，不需要读取当前时间
+    if (de->expire == 0) return 0;
+
     // 如果未过期，返回 0
-    if (now <= when) return;
+    // 使用命令时间，不需要读取系统时间，事务中的命令看到的时间相同
+    if (commandTimeMs() <= (long long)de->expire) return 0;
 
     // 将过期键从数据库中删除
-    dbDelete(db,key);
+    robj key = {.encoding = STRING, .refcount = 1, .ptr = de->key};
+    dbDelete(db,&key);
+    __atomic_add_fetch(&server.stat_expiredkeys, 1, __ATOMIC_RELAXED);
+    return 1;
 }
 
 /*
@@ -169,10 +112,13 @@ void expireIfNeeded(KVdataDb *db, robj *key) {
  * 删除成功返回 1 ，因为键不存在而导致删除失败时，返回 0 。
  */
 int dbDelete(KVdataDb *db, robj *key) {
+    dictEntry *de = dictFind(db->DB,key->ptr);
+
+    // 键不存在
+    if (de == NULL) return 0;
 
-    // 删除键的过期时间
-    if (dictSize(db->expires) > 0) 
-    dictDelete(db->expires,key->ptr);
+    // 先从过期键索引中移除节点，节点随后由数据库字典释放
+    if (de->expire) dictDelete(db->expires,de->key);
 
     // 删除键值对
     if (dictDelete(db->DB,key->ptr) == DICT_OK) {
@@ -183,16 +129,160 @@ int dbDelete(KVdataDb *db, robj *key) {
     }
 }
 
+/*
+ * 数据库节点
+ *
+ * 数据库字典的节点由 dbAdd 分配，节点、键和较短的值在同一次分配中：
+ *
+ *   | dictEntry | robj | 值的 sds | 键的 sds |
+ *
+ * 字符串值的长度不超过 KVDATA_DB_EMBED_VALUE_MAX 时，值被复制到节点中的 robj 和 sds 里，
+ * 节点的 val 指向这个内嵌的 EMBSTR 编码的 robj ；否则节点中没有 robj 和值的 sds 两部分，
+ * val 指向单独分配的值对象（STRING 或者 INT 编码，INT 编码的值可能是共享整数对象）。
+ * 键保存在节点的最后，过期字典共享整个节点；节点只会被主动碎片整理移动，
+ * 移动时由 dbDefragEntry 修正两个字典中的指针。
+ * 内嵌的值对象不能被 incrRefCount/decrRefCount ，只能由数据库读取和覆写。
+ */
+
+// 节点中内嵌的值对象的位置，只有节点带有内嵌的值时才能访问
+#define dbEntryEmbeddedVal(de) ((robj*)((dictEntry*)(de)+1))
+// 节点的值是否内嵌在节点中
+#define dbEntryHasEmbeddedVal(de) ((de)->val == (void*)dbEntryEmbeddedVal(de))
+
+/*
+ * 值对象 val 是否可以复制到节点中
+ */
+static int dbCanEmbedValue(robj *val) {
+    return sdsEncodedObject(val) && sdslen(val->ptr) <= KVDATA_DB_EMBED_VALUE_MAX;
+}
+
+/*
+ * 设置值对象 val 的访问信息，共享对象被多个键和线程引用，不记录访问信息
+ */
+static void dbSetValLRU(robj *val, unsigned int lru) {
+    if (val->refcount != KVDATA_SHARED_REFCOUNT) val->lru = lru;
+}
+
+/*
+ * 创建键为 key ，值为 val 的数据库节点
+ * 节点接管调用者的一个 val 引用，值被复制到节点中时释放这个引用
+ */
+static dictEntry *dbCreateEntry(sds key, robj *val) {
+    size_t keysize = sdsEmbedSize(sdslen(key));
+    size_t valsize = 0;
+    dictEntry *de;
+    char *p;
+
+    // sds 的头部是紧凑排列的，值和键的 sds 之间不需要对齐
+    if (dbCanEmbedValue(val))
+        valsize = sdsEmbedSize(sdslen(val->ptr));
+
+    de = zmalloc(sizeof(dictEntry)+(valsize ? sizeof(robj)+valsize : 0)+keysize);
+    p = (char*)(de+1);
+    if (valsize) {
+        robj *o = dbEntryEmbeddedVal(de);
+
+        o->encoding = EMBSTR;
+        o->lru = objectInitialLRU();
+        o->refcount = 1;
+        o->ptr = sdsEmbed(p+sizeof(robj), valsize, val->ptr, sdslen(val->ptr));
+        de->val = o;
+        p += sizeof(robj)+valsize;
+        decrRefCount(val);
+    } else {
+        dbSetValLRU(val,objectInitialLRU());
+        de->val = val;
+    }
+    de->key = sdsEmbed(p, keysize, key, sdslen(key));
+    de->expire = 0;
+    return de;
+}
+
+/*
+ * 将数据库节点 de 的值设置为 val ，并释放旧值
+ * 节点接管调用者的一个 val 引用
+ * 节点带有内嵌的值并且空间足够时，新值被原地复制到节点中，否则通过指针引用 val
+ * 新值继承旧值的访问信息，LFU 的访问计数器不会因为覆写而清零
+ */
+static void dbEntrySetVal(dictEntry *de, robj *val) {
+    robj *old = de->val;
+
+    if (dbEntryHasEmbeddedVal(de) && dbCanEmbedValue(val) &&
+        sdslen(val->ptr) <= sdslen(old->ptr)+sdsavail(old->ptr))
+    {
+        old->ptr = sdscpylen(old->ptr, val->ptr, sdslen(val->ptr));
+        decrRefCount(val);
+        return;
+    }
+    dbSetValLRU(val,old->lru);
+    de->val = val;
+    if (old != dbEntryEmbeddedVal(de)) decrRefCount(old);
+}
+
+/*
+ * 释放数据库节点，用作数据库字典的节点释放函数
+ * 键和内嵌的值随节点一起释放
+ */
+void dbEntryDestructor(void *privdata, dictEntry *de) {
+    KVDATA_NOTUSED(privdata);
+    if (!dbEntryHasEmbeddedVal(de)) decrRefCount(de->val);
+    zfree(de);
+}
+
+/*
+ * 主动碎片整理数据库节点 de
+ * 单独分配的值的 sds 和节点本身（连同其中的键和内嵌的值）在分配器认为需要时被移动，
+ * 节点内部的指针和过期字典中的槽位随之修正。单独分配的值对象来自 slab 池，不需要整理。
+ * 返回节点的新地址，由调用者写回数据库字典；节点没有移动时返回 NULL 。
+ * *hits 和 *misses 分别累加被移动和不需要移动的分配的数量
+ */
+dictEntry *dbDefragEntry(KVdataDb *db, dictEntry *de, long long *hits, long long *misses) {
+    robj *val = de->val;
+    // 节点中的键和内嵌的值的 sds 相对节点起始地址的偏移，移动后按偏移修正指针
+    ptrdiff_t keyoff = (char*)de->key-(char*)de, valoff = 0;
+    dictEntry *newde;
+
+    if (dbEntryHasEmbeddedVal(de)) {
+        valoff = (char*)val->ptr-(char*)de;
+    } else if (val->refcount == 1 && val->encoding == STRING) {
+        // 被其他地方引用的值对象不移动它的 sds ，INT 编码的值没有 sds
+        sds s = sdsDefrag(val->ptr);
+
+        if (s) {
+            val->ptr = s;
+            (*hits)++;
+        } else {
+            (*misses)++;
+        }
+    }
+
+    if ((newde = zmalloc_defrag(de)) == NULL) {
+        (*misses)++;
+        return NULL;
+    }
+    (*hits)++;
+    newde->key = (char*)newde+keyoff;
+    if (valoff) {
+        robj *o = dbEntryEmbeddedVal(newde);
+
+        o->ptr = (char*)newde+valoff;
+        newde->val = o;
+    }
+    // 旧节点已经释放，过期字典中只按指针查找它
+    if (newde->expire) dictReplaceEntry(db->expires,de,newde);
+    return newde;
+}
+
 /*
  * 尝试将键值对 key 和 val 添加到数据库中。
- * 调用者负责对 key 和 val 的引用计数进行增加。
+ * 数据库接管调用者的一个 val 引用，键会被复制到节点中。
  * 程序在键已经存在时会停止。
  */
 void dbAdd(KVdataDb *db, robj *key, robj *val) {
-    // 复制键名
-    sds copy = sdsdup(key->ptr);
+    // 创建保存键和值的节点
+    dictEntry *de = dbCreateEntry(key->ptr, val);
     // 尝试添加键值对
-    int retval = dictAdd(db->DB, copy, val);
+    int retval = dictAddEntry(db->DB, de);
     // 确保键已经添加成功
     assert(retval == DICT_OK);
 
@@ -200,7 +290,7 @@ void dbAdd(KVdataDb *db, robj *key, robj *val) {
 
 /*
  * 为已存在的键关联一个新值。
- * 调用者负责对新值 val 的引用计数进行增加。
+ * 数据库接管调用者的一个 val 引用。
  * 这个函数不会修改键的过期时间。
  * 如果键不存在，那么函数停止。
  */
@@ -209,18 +299,38 @@ void dbOverwrite(KVdataDb *db, robj *key, robj *val) {
     // 节点必须存在，否则中止
     assert(de != NULL);
     // 覆写旧值
-    dictReplace(db->DB, key->ptr, val);
+    dbEntrySetVal(de, val);
+}
+
+/*
+ * 将数据库节点 de 从过期键索引中移除，清除它的过期时间
+ */
+static void dbEntryRemoveExpire(KVdataDb *db, dictEntry *de) {
+    dictDelete(db->expires,de->key);
+    de->expire = 0;
 }
 
 /*
  * 移除键 key 的过期时间
+ * 键带有过期时间并且被移除时返回 1 ，否则返回 0
  */
 int removeExpire(KVdataDb *db, robj *key) {
-    // 确保键带有过期时间
-    assert(dictFind(db->DB,key->ptr) != NULL);
+    dictEntry *de = dictFind(db->DB,key->ptr);
+
+    // 确保键存在
+    assert(de != NULL);
+    if (de->expire == 0) return 0;
+    dbEntryRemoveExpire(db,de);
+    return 1;
+}
 
-    // 删除过期时间，从数据库的过期字典中将键移除
-    return dictDelete(db->expires,key->ptr) == DICT_OK;
+/*
+ * 过期键索引的节点释放函数
+ * 索引中的节点就是数据库节点，由数据库字典释放，这里什么也不做
+ */
+void dbExpiresEntryDestructor(void *privdata, dictEntry *de) {
+    KVDATA_NOTUSED(privdata);
+    KVDATA_NOTUSED(de);
 }
 
 
@@ -229,7 +339,7 @@ int removeExpire(KVdataDb *db, robj *key) {
  *
  * 这个函数可以在不管键 key 是否存在的情况下，将它和 val 关联起来。
  *
- * 1) 值对象的引用计数会被增加
+ * 1) 值对象的引用计数会被增加（值较短时被复制到数据库中，引用随即释放）
  * 2) 监视键 key 的客户端会收到键已经被修改的通知
  * 3) 键的过期时间会被移除（键变为持久的）
  */
@@ -239,17 +349,21 @@ void setKey(KVdataDb *db, robj *key, robj *val) {
     list * watched;//监视键key的客户端链表
     listNode *cur;//链表节点
     KVClient *client;//监视键key的客户端
-    // 添加或覆写数据库中的键值对
-    if (lookupKey(db,key) == NULL) {
+    //为对象引用计数+1，这个引用交给数据库
+    incrRefCount(val);
+    // 添加或覆写数据库中的键值对，只查找一次数据库字典
+    dicNode = dictFind(db->DB,key->ptr);
+    if (dicNode == NULL) {
+        // 新节点没有过期时间
         dbAdd(db,key,val);
     } else {
-        //为数据库中已存在的键值进行更新
-        dbOverwrite(db,key,val);
+        //为数据库中已存在的键值进行更新，节点不会移动
+        dbEntrySetVal(dicNode,val);
+        // 覆写也是一次访问
+        if (server.rdb_child_pid == -1) objectTouch(dictGetVal(dicNode));
+        // 移除键的过期时间
+        if (dicNode->expire) dbEntryRemoveExpire(db,dicNode);
     }
-    //为对象引用计数+1
-    incrRefCount(val);
-    // 移除键的过期时间
-    removeExpire(db,key);
     // 检查当前键是否在数据库被监视的键中，
     // 如果是，则将监视该键的客户端加上KVDATA_DIRTY_CAS标识
     if((dicNode=dictFind(db->watched_keys, key))!=NULL)
@@ -264,7 +378,7 @@ void setKey(KVdataDb *db, robj *key, robj *val) {
             if(!(client->flags & KVDATA_DIRTY_CAS))
             {
                 client->flags |= KVDATA_DIRTY_CAS;
-                printf("The key monitored by the client[%d] has been modified, add KVDATA_DIRTY_CAS flag\n",client->fd);
+                serverLog(KVDATA_DEBUG, "The key monitored by the client[%d] has been modified, add KVDATA_DIRTY_CAS flag\n",client->fd);
             }
             cur = cur->next;
          }
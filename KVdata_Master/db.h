@@ -12,26 +12,33 @@ typedef struct KVdataDb {
     int id;       
     // 数据库键空间，保存着数据库中的所有键值对（数据库键空间就是一个字典结构）
     dict *DB;               
-    // 键的过期时间，字典的键为键，字典的值为过期事件 UNIX 时间戳
+    // 带有过期时间的键的索引，只用于定期删除过期键
+    // 索引中的节点就是数据库节点，过期时间保存在节点中，不需要额外的分配
     dict *expires;           
     // 正在被 WATCH 命令监视的键. 字典的键为键，字典的值为监视该键的客户端链表
     dict *watched_keys;    
+    // 定期删除抽样中已过期的键所占比例的移动平均，估计过期字典中尚未删除的过期键的比例
+    double avg_stale_perc;
 
 }KVdataDb;
 
 
+// 不超过这个长度的字符串值直接保存在数据库节点中，更长的值通过指针引用单独分配的对象
+#define KVDATA_DB_EMBED_VALUE_MAX 64
+
 long long mstime(void);
 robj *lookupKey(KVdataDb *db, robj *key);
 long long getExpire(KVdataDb *db, robj *key);
-void expireIfNeeded(KVdataDb *db, robj *key);
+int expireIfNeeded(KVdataDb *db, dictEntry *de);
 int dbDelete(KVdataDb *db, robj *key);
 void dbAdd(KVdataDb *db, robj *key, robj *val);
 void dbOverwrite(KVdataDb *db, robj *key, robj *val);
 int removeExpire(KVdataDb *db, robj *key);
 void setKey(KVdataDb *db, robj *key, robj *val);
+void dbEntryDestructor(void *privdata, dictEntry *de);
+dictEntry *dbDefragEntry(KVdataDb *db, dictEntry *de, long long *hits, long long *misses);
+void dbExpiresEntryDestructor(void *privdata, dictEntry *de);
 
 
 long long emptyDb();
-void dictEmpty(dict *d);
-int dictClear(dict *d, dictht *ht);
 #endif
\ No newline at end of file
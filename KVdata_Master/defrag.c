@@ -0,0 +1,140 @@
+#include "defrag.h"
+#include "server.h"
+#include "dict.h"
+#include "zmalloc.h"
+#include "util.h"
+
+/*
+ * 主动碎片整理
+ *
+ * 长时间运行之后，键被删除和覆写会在分配器中留下大量利用率很低的页面：
+ * 每个页面上只剩下少量正在使用的区块，页面无法归还系统，常驻内存远大于实际使用的内存。
+ * 主动碎片整理在 serverCron 中以受限的 CPU 时间逐步访问整个键空间，
+ * 把位于利用率低的位置的分配移动到新的区块中（由 zmalloc_defrag 判断），
+ * 腾空的页面由分配器归还系统。
+ *
+ * 主线程每秒根据分配器的统计数据计算碎片率，碎片的字节数和碎片率都超过阈值时开始整理，
+ * 整理占用的 CPU 时间随碎片率在 cycle-min 和 cycle-max 之间线性增长。
+ * 多 reactor 模式下每个 reactor 在自己的线程上整理自己的键空间分片。
+ */
+
+/*
+ * 整理一个数据库时传给字典回调的状态
+ */
+typedef struct defragCtx {
+    KVdataDb *db;
+    long long hits, misses, key_hits, key_misses;
+} defragCtx;
+
+/*
+ * 根据分配器的统计数据计算碎片率，更新整理占用的 CPU 时间百分比
+ * 由主线程中的 serverCron 每秒调用一次
+ */
+void computeDefragCycles(void) {
+    size_t allocated, active, resident, frag_bytes = 0;
+    int cpu_pct = 0, running = __atomic_load_n(&server.active_defrag_running,__ATOMIC_RELAXED);
+    double frag_pct = 0;
+
+    if (server.active_defrag_enabled &&
+        zmalloc_get_allocator_info(&allocated,&active,&resident) && allocated)
+    {
+        // glibc 的 active 包括已经被 malloc_trim 归还系统的空闲页面，用常驻内存限制它；
+        // jemalloc 的 resident 总是不小于 active
+        if (resident && resident < active) active = resident;
+        frag_bytes = active > allocated ? active-allocated : 0;
+        frag_pct = (double)frag_bytes*100/allocated;
+
+        if (frag_pct >= server.active_defrag_threshold_lower &&
+            frag_bytes >= server.active_defrag_ignore_bytes)
+        {
+            int lower = server.active_defrag_threshold_lower;
+            int upper = server.active_defrag_threshold_upper;
+            int min = server.active_defrag_cycle_min, max = server.active_defrag_cycle_max;
+
+            // 碎片率在下限和上限之间时，CPU 时间百分比在 min 和 max 之间线性插值
+            if (frag_pct >= upper || upper <= lower)
+                cpu_pct = max;
+            else
+                cpu_pct = min+(int)((frag_pct-lower)*(max-min)/(upper-lower));
+            if (cpu_pct < 1) cpu_pct = 1;
+        }
+    }
+
+    if (cpu_pct && !running)
+        serverLog(KVDATA_NOTICE,"Starting active defrag, frag=%.0f%%, frag_bytes=%zu, cpu=%d%%\n",
+            frag_pct,frag_bytes,cpu_pct);
+    else if (!cpu_pct && running)
+        serverLog(KVDATA_VERBOSE,"Active defrag stopped, frag=%.0f%%\n",frag_pct);
+    __atomic_store_n(&server.active_defrag_running,cpu_pct,__ATOMIC_RELAXED);
+}
+
+/*
+ * 整理一个数据库节点，作为 dictDefragGroups 的回调
+ */
+static dictEntry *activeDefragEntry(void *privdata, dictEntry *de) {
+    defragCtx *ctx = privdata;
+    long long hits = ctx->hits;
+    dictEntry *newde = dbDefragEntry(ctx->db,de,&ctx->hits,&ctx->misses);
+
+    if (ctx->hits > hits) ctx->key_hits++;
+    else ctx->key_misses++;
+    return newde;
+}
+
+/*
+ * 在时间预算内整理 dbnum 个数据库，每次时间事件中由 databasesCron 调用一次
+ * 整理在多次调用之间通过游标继续，整个分片访问一遍之后从头开始下一轮。
+ * 时间预算为每次时间事件间隔的 server.active_defrag_running% 。
+ *
+ * 多 reactor 模式下每个 reactor 在自己的线程上整理自己的键空间分片，
+ * 所以这里的状态都是线程局部的。
+ */
+void activeDefragCycle(KVdataDb *db) {
+    // 正在整理的数据库和哈希表中的游标
+    static __thread int current_db = 0;
+    static __thread unsigned long cursor = 0;
+    // 本轮已经移动的分配数量和访问的键数量
+    static __thread long long cycle_hits = 0, cycle_keys = 0;
+    // 上一轮几乎没有移动分配时，在这个时间之前不开始新的一轮
+    static __thread uint64_t idle_until = 0;
+    int cpu_pct = __atomic_load_n(&server.active_defrag_running,__ATOMIC_RELAXED);
+    defragCtx ctx = {NULL, 0, 0, 0, 0};
+    uint64_t start, timelimit;
+    int finished = 0;
+
+    // RDB 子进程存在时移动分配会让父进程写时复制大量内存页
+    if (cpu_pct == 0 || server.loading || server.rdb_child_pid != -1) return;
+
+    start = getMonotonicUs();
+    if (start < idle_until) return;
+    timelimit = 1000000ULL*cpu_pct/server.hz/100;
+    if (timelimit == 0) timelimit = 1;
+
+    while (1) {
+        ctx.db = db+current_db;
+        // 哈希表 rehash 期间节点在两个哈希表之间迁移，等 rehash 完成之后再继续
+        if (dictIsRehashing(ctx.db->DB)) break;
+        cursor = dictDefragGroups(ctx.db->DB,cursor,KVDATA_DEFRAG_GROUPS_PER_STEP,activeDefragEntry,&ctx);
+        if (cursor == 0 && ++current_db == server.dbnum) {
+            current_db = 0;
+            finished = 1;
+            break;
+        }
+        if (getMonotonicUs()-start >= timelimit) break;
+    }
+    cycle_hits += ctx.hits;
+    cycle_keys += ctx.key_hits+ctx.key_misses;
+    if (finished) {
+        // 一轮结束，把腾空的页面归还系统
+        if (cycle_hits) zmalloc_trim();
+        // 剩下的碎片已经无法通过移动分配减少，暂停一段时间，避免一直占用 CPU
+        if (cycle_hits*100 < cycle_keys*KVDATA_DEFRAG_MIN_HITS_PERC)
+            idle_until = getMonotonicUs()+KVDATA_DEFRAG_IDLE_TIME*1000000ULL;
+        cycle_hits = cycle_keys = 0;
+    }
+
+    __atomic_add_fetch(&server.stat_active_defrag_hits,ctx.hits,__ATOMIC_RELAXED);
+    __atomic_add_fetch(&server.stat_active_defrag_misses,ctx.misses,__ATOMIC_RELAXED);
+    __atomic_add_fetch(&server.stat_active_defrag_key_hits,ctx.key_hits,__ATOMIC_RELAXED);
+    __atomic_add_fetch(&server.stat_active_defrag_key_misses,ctx.key_misses,__ATOMIC_RELAXED);
+}
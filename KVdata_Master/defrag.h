@@ -0,0 +1,17 @@
+#ifndef KVDATA_DEFRAG_H
+#define KVDATA_DEFRAG_H
+#include "db.h"
+
+/* 主动碎片整理的默认配置 */
+#define KVDATA_DEFAULT_ACTIVE_DEFRAG_IGNORE_BYTES (100ULL<<20)  //碎片少于这么多字节时不整理
+#define KVDATA_DEFAULT_ACTIVE_DEFRAG_THRESHOLD_LOWER 10  //碎片率超过这个百分比时开始整理
+#define KVDATA_DEFAULT_ACTIVE_DEFRAG_THRESHOLD_UPPER 100 //碎片率达到这个百分比时以最大的力度整理
+#define KVDATA_DEFAULT_ACTIVE_DEFRAG_CYCLE_MIN 1   //整理最少占用的 CPU 时间百分比
+#define KVDATA_DEFAULT_ACTIVE_DEFRAG_CYCLE_MAX 25  //整理最多占用的 CPU 时间百分比
+#define KVDATA_DEFRAG_GROUPS_PER_STEP 16           //每步整理的哈希表组数，每步之后检查时间预算
+#define KVDATA_DEFRAG_MIN_HITS_PERC 1              //一轮中移动的分配少于键数量的这个百分比时暂停整理
+#define KVDATA_DEFRAG_IDLE_TIME 30                 //暂停整理的时间（秒）
+
+void computeDefragCycles(void);
+void activeDefragCycle(KVdataDb *db);
+#endif
@@ -1,8 +1,216 @@
 #include "dict.h"
 #include "server.h"
 #include "zmalloc.h"
+#include "slab.h"
+#include "util.h"
 #include <string.h>
+#include <stdlib.h>
 #include <ctype.h>
+#include <assert.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/* ----------------------------- 控制字节组 ---------------------------------- */
+
+// 哈希值的低 7 位保存在控制字节中，用于快速排除不相等的键
+#define dictHashTag(h) ((unsigned char)((h) & 0x7f))
+// 哈希值的其余位用于选择起始组
+#define dictHashGroup(h) ((unsigned long)((h) >> 7))
+// 槽位中缓存的哈希值：第 7 位到第 38 位，和控制字节中的低 7 位一起可以还原哈希表用到的所有位
+#define dictHashCached(h) ((uint32_t)((h) >> 7))
+// 由缓存还原 idx 槽位中节点的键的哈希值（低 39 位），rehash 时不需要重新计算
+#define dictSlotHash(ht, idx) ((((uint64_t)(ht)->hashes[idx]) << 7) | (ht)->ctrl[idx])
+// 槽位所在的组的第一个控制字节
+#define dictSlotGroup(ht, idx) ((ht)->ctrl + ((idx) & ~(unsigned long)(DICT_GROUP_WIDTH-1)))
+
+/*
+ * 返回组中控制字节等于 tag 的槽位的位图，第 i 位为 1 表示组中第 i 个槽位匹配
+ */
+static inline unsigned int dictGroupMatch(const unsigned char *ctrl, unsigned char tag)
+{
+#if defined(__SSE2__)
+    __m128i group = _mm_loadu_si128((const __m128i *)ctrl);
+    return (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char)tag)));
+#else
+    unsigned int mask = 0;
+    for (int i = 0; i < DICT_GROUP_WIDTH; i++)
+        if (ctrl[i] == tag) mask |= 1u << i;
+    return mask;
+#endif
+}
+
+/*
+ * 返回组中空闲槽位（空槽位或墓碑）的位图
+ * 空闲槽位的控制字节最高位为 1 ，满槽位的为 0
+ */
+static inline unsigned int dictGroupMatchFree(const unsigned char *ctrl)
+{
+#if defined(__SSE2__)
+    return (unsigned int)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)ctrl));
+#else
+    unsigned int mask = 0;
+    for (int i = 0; i < DICT_GROUP_WIDTH; i++)
+        if (ctrl[i] & 0x80) mask |= 1u << i;
+    return mask;
+#endif
+}
+
+/*
+ * 返回组中满槽位的位图
+ */
+static inline unsigned int dictGroupMatchFull(const unsigned char *ctrl)
+{
+    return ~dictGroupMatchFree(ctrl) & ((1u << DICT_GROUP_WIDTH)-1);
+}
+
+/*
+ * 重置哈希表的各项属性
+ */
+static void dictResetHt(dictht *ht)
+{
+    ht->table = NULL;   //哈希表数组
+    ht->hashes = NULL;  //缓存的哈希值数组
+    ht->ctrl = NULL;    //控制字节数组
+    ht->size = 0;       //哈希表大小（table数组的大小）
+    ht->sizemask = 0;   //哈希表大小掩码
+    ht->used = 0;       //该哈希表已有节点的数量
+    ht->deleted = 0;    //该哈希表中墓碑的数量
+}
+
+/*
+ * 哈希表再插入一个节点是否会超过最大装载因子
+ */
+static int dictHtNeedsGrow(dictht *ht)
+{
+    return (ht->used+ht->deleted+1)*DICT_MAX_LOAD_DEN > ht->size*DICT_MAX_LOAD_NUM;
+}
+
+/*
+ * 在哈希表 ht 中查找键 key ，h 为键的哈希值
+ * 找到返回节点所在的槽位，找不到返回 -1
+ *
+ * 组之间按照三角数序列探测（偏移 1, 3, 6, 10 ...），组的数量是 2 的幂时可以访问到所有组
+ */
+static long dictLookupSlot(dict *d, dictht *ht, const void *key, uint64_t h)
+{
+    unsigned long gmask = ht->sizemask/DICT_GROUP_WIDTH;
+    unsigned long g = dictHashGroup(h) & gmask;
+    unsigned char tag = dictHashTag(h);
+    uint32_t cached = dictHashCached(h);
+
+    for (unsigned long step = 1; ; step++) {
+        unsigned char *ctrl = ht->ctrl + g*DICT_GROUP_WIDTH;
+        unsigned int match = dictGroupMatch(ctrl, tag);
+
+        // 只比较控制字节和缓存的哈希值都相同的槽位
+        while (match) {
+            long idx = g*DICT_GROUP_WIDTH + __builtin_ctz(match);
+            if (ht->hashes[idx] == cached && dictCompareKeys(d, key, ht->table[idx]->key))
+                return idx;
+            match &= match-1;
+        }
+        // 组中有空槽位，说明插入时不会越过这个组，键不存在
+        if (dictGroupMatch(ctrl, DICT_CTRL_EMPTY)) return -1;
+        // 所有组都已经检查过
+        if (step > gmask) return -1;
+        g = (g + step) & gmask;
+    }
+}
+
+/*
+ * 返回哈希值为 h 的键在哈希表 ht 中的第一个空闲槽位
+ * 调用者需要保证哈希表没有超过最大装载因子，所以空闲槽位一定存在
+ */
+static long dictFindFreeSlot(dictht *ht, uint64_t h)
+{
+    unsigned long gmask = ht->sizemask/DICT_GROUP_WIDTH;
+    unsigned long g = dictHashGroup(h) & gmask;
+
+    for (unsigned long step = 1; ; step++) {
+        unsigned int match = dictGroupMatchFree(ht->ctrl + g*DICT_GROUP_WIDTH);
+
+        if (match) return g*DICT_GROUP_WIDTH + __builtin_ctz(match);
+        // 所有组都已经检查过，哈希表已满，说明装载因子的检查有错误
+        assert(step <= gmask);
+        g = (g + step) & gmask;
+    }
+}
+
+/*
+ * 将节点放入哈希表的 idx 槽位，h 为节点的键的哈希值
+ */
+static void dictInsertAt(dictht *ht, long idx, dictEntry *de, uint64_t h)
+{
+    if (ht->ctrl[idx] == DICT_CTRL_DELETED) ht->deleted--;
+    ht->ctrl[idx] = dictHashTag(h);
+    ht->hashes[idx] = dictHashCached(h);
+    ht->table[idx] = de;
+    ht->used++;
+}
+
+/*
+ * 清空哈希表的 idx 槽位，节点本身不会被释放
+ */
+static void dictRemoveAt(dictht *ht, long idx)
+{
+    // 组中还有空槽位时，没有任何键在插入时越过这个组，槽位可以直接置为空；
+    // 否则必须留下墓碑，让查找继续探测后面的组
+    if (dictGroupMatch(dictSlotGroup(ht, idx), DICT_CTRL_EMPTY)) {
+        ht->ctrl[idx] = DICT_CTRL_EMPTY;
+    } else {
+        ht->ctrl[idx] = DICT_CTRL_DELETED;
+        ht->deleted++;
+    }
+    ht->table[idx] = NULL;
+    ht->used--;
+}
+
+/*
+ * 返回不小于 size 的第一个 2 的幂，最小为 DICT_HT_INITIAL_SIZE
+ */
+static unsigned long dictNextPower(unsigned long size)
+{
+    unsigned long i = DICT_HT_INITIAL_SIZE;
+
+    while (i < size) i *= 2;
+    return i;
+}
+
+/*
+ * 为哈希表 ht 分配 size 个槽位，size 必须是 2 的幂
+ * 槽位数组、缓存的哈希值数组和控制字节数组在同一次分配中，依次排列，所有槽位都是空的
+ * T = O(N)
+ */
+static void dictHtAlloc(dictht *ht, unsigned long size)
+{
+    ht->size = size;
+    ht->sizemask = size-1;
+    ht->table = zmalloc(size*(sizeof(dictEntry*)+sizeof(uint32_t)+1));
+    ht->hashes = (uint32_t*)(ht->table+size);
+    ht->ctrl = (unsigned char*)(ht->hashes+size);
+    memset(ht->table, 0, size*sizeof(dictEntry*));
+    memset(ht->ctrl, DICT_CTRL_EMPTY, size);
+    ht->used = 0;
+    ht->deleted = 0;
+}
+
+/*
+ * 释放字典中的一个节点，以及节点的键和值
+ */
+static void dictFreeEntry(dict *d, dictEntry *he)
+{
+    if (d->type->entryDestructor) {
+        d->type->entryDestructor(NULL, he);
+        return;
+    }
+    dictFreeKey(d, he);
+    dictFreeVal(d, he);
+    slabFree(KVDATA_SLAB_DICTENTRY, he);
+}
+
+/* ------------------------------- 字典操作 ---------------------------------- */
+
 /*
  * 创建一个新的字典
  */
@@ -11,14 +219,8 @@ dict *dictCreate(dictType *type)
     dict *d = zmalloc(sizeof(*d));
     // 初始化两个哈希表的各项属性值
     // 但暂时还不分配内存给哈希表数组
-    for(int i=0;i<=1;i++)
-    {
-        //重置指定哈希表内的各项属性
-        d->ht[i].table = NULL;   //哈希表数组
-        d->ht[i].size = 0;       //哈希表大小（table数组的大小）
-        d->ht[i].sizemask = 0;   //哈希表大小掩码
-        d->ht[i].used = 0;       //该哈希表已有节点的数量
-    }
+    dictResetHt(&d->ht[0]);
+    dictResetHt(&d->ht[1]);
     // 设置类型特定函数
     d->type = type;
 
@@ -35,6 +237,7 @@ dict *dictCreate(dictType *type)
  * 2) 如果字典的 0 号哈希表非空，那么将新哈希表设置为 1 号哈希表，
  *    并打开字典的 rehash 标识，使得程序可以开始对字典进行 rehash
  *
+ * 新哈希表的大小为不小于 size 的 2 的幂。
  * size 参数不够大，或者 rehash 已经在进行时，返回 DICT_ERR 。
  * 成功创建 0 号哈希表，或者 1 号哈希表时，返回 DICT_OK 。
  *
@@ -44,18 +247,15 @@ int dictExpand(dict *d, unsigned long size)
 {
     // 新哈希表
     dictht n;
+    unsigned long realsize = dictNextPower(size);
 
     // 不能在字典正在 rehash 时进行
     // size 的值也不能小于 0 号哈希表的当前已使用节点
     if (dictIsRehashing(d) || d->ht[0].used > size)
         return DICT_ERR;
 
-    // 为哈希表分配空间，并将所有指针指向 NULL
-    n.size = size;
-    n.sizemask = size-1;
     // T = O(N)
-    n.table = zmalloc(size*sizeof(dictEntry*));
-    n.used = 0;
+    dictHtAlloc(&n, realsize);
 
     // 如果 0 号哈希表为空，那么这是一次初始化：
     // 程序将新哈希表赋给 0 号哈希表的指针，然后字典就可以开始处理键值对了。
@@ -72,6 +272,43 @@ int dictExpand(dict *d, unsigned long size)
     return DICT_OK;
 }
 
+/*
+ * rehash 进行中，1 号哈希表再插入一个节点之后，
+ * 是否放不下 0 号哈希表中还没有迁移的节点（它们最终都会迁移到 1 号哈希表）
+ */
+static int dictRehashTargetNeedsGrow(dict *d)
+{
+    dictht *ht = &d->ht[1];
+
+    return (d->ht[0].used+ht->used+ht->deleted+1)*DICT_MAX_LOAD_DEN > ht->size*DICT_MAX_LOAD_NUM;
+}
+
+/*
+ * rehash 进行中，把 1 号哈希表换成一个按两个哈希表的节点总数的两倍分配的新哈希表，
+ * 1 号哈希表中的节点搬到新哈希表，0 号哈希表的迁移继续进行。
+ * 只需要移动 1 号哈希表中的节点，0 号哈希表很大而且很稀疏（缩小之后）时也不需要一次性迁移它。
+ * T = O(N)
+ */
+static void dictGrowRehashTarget(dict *d)
+{
+    dictht *old = &d->ht[1], n;
+
+    dictHtAlloc(&n, dictNextPower((d->ht[0].used+old->used)*2));
+    for (unsigned long g = 0; g < old->size/DICT_GROUP_WIDTH; g++) {
+        unsigned int full = dictGroupMatchFull(old->ctrl + g*DICT_GROUP_WIDTH);
+
+        while (full) {
+            long idx = g*DICT_GROUP_WIDTH + __builtin_ctz(full);
+            uint64_t h = dictSlotHash(old, idx);
+
+            dictInsertAt(&n, dictFindFreeSlot(&n, h), old->table[idx], h);
+            full &= full-1;
+        }
+    }
+    zfree(old->table);
+    d->ht[1] = n;
+}
+
 /*
  * 根据需要，初始化字典（的哈希表），
  * 或者对字典（的现有哈希表）进行扩展
@@ -79,20 +316,20 @@ int dictExpand(dict *d, unsigned long size)
  */
 int dictExpandIfNeeded(dict *d)
 {
-    // 渐进式 rehash 已经在进行了，直接返回，对于正在进行rehash的，则不能进行扩展或初始化
-    if (dictIsRehashing(d)) return DICT_OK;
+    // 渐进式 rehash 正在进行时新键都插入 1 号哈希表，
+    // 1 号哈希表要能容纳两个哈希表中的所有节点，放不下时换成更大的 1 号哈希表
+    if (dictIsRehashing(d)) {
+        if (dictRehashTargetNeedsGrow(d)) dictGrowRehashTarget(d);
+        return DICT_OK;
+    }
 
     // 如果字典（的 0 号哈希表）为空，那么创建并返回初始化大小的 0 号哈希表
     if (d->ht[0].size == 0) return dictExpand(d, DICT_HT_INITIAL_SIZE);
 
-    // 以下两个条件之一为真时，对字典进行扩展
-    // 1）字典已使用节点数和字典大小之间的比率接近 1：1
-    // 2）已使用节点数和字典大小之间的比率超过 dict_force_resize_ratio
-    if (d->ht[0].used >= d->ht[0].size || (d->ht[0].used*10/d->ht[0].size >= dict_force_resize_ratio))
-    {
-        // 新哈希表的大小至少是目前已使用节点数的两倍
+    // 已使用节点和墓碑一起超过最大装载因子时，
+    // 按照已使用节点数量的两倍创建新哈希表，迁移的同时清除墓碑
+    if (dictHtNeedsGrow(&d->ht[0]))
         return dictExpand(d, d->ht[0].used*2);
-    }
 
     return DICT_OK;
 }
@@ -103,73 +340,97 @@ int dictExpandIfNeeded(dict *d)
  * 返回 1 表示仍有键需要从 0 号哈希表移动到 1 号哈希表，
  * 返回 0 则表示所有键都已经迁移完毕。
  *
- * 注意，每步 rehash 都是以一个哈希表索引（桶）作为单位的，
- * 一个桶里可能会有多个节点，
- * 被 rehash 的桶里的所有节点都会被移动到新哈希表。
+ * 注意，每步 rehash 都是以一个组作为单位的，
+ * 被 rehash 的组里的所有节点都会被移动到新哈希表。
+ * 为了限制单次调用的耗时，最多跳过 N*10 个空组。
  *
  * T = O(N)
  */
 int dictRehash(dict *d, int n) {
+    int empty_visits = n*10;
+
     // 只可以在 rehash 进行中时执行
     if (!dictIsRehashing(d)) return 0;
 
     // 进行 N 步迁移
     // T = O(N)
-    while(n--) {
-        dictEntry *de;
-
-        // 如果 0 号哈希表为空，那么表示 rehash 执行完毕
-        // T = O(1)
-        if (d->ht[0].used == 0) {
-            // 释放 0 号哈希表
-            zfree(d->ht[0].table);
-            // 将原来的 1 号哈希表设置为新的 0 号哈希表
-            d->ht[0] = d->ht[1];   
-            //重置指定哈希表内的各项属
-            d->ht[1].table = NULL;   //哈希表数组
-            d->ht[1].size = 0;       //哈希表大小（table数组的大小）
-            d->ht[1].sizemask = 0;   //哈希表大小掩码
-            d->ht[1].used = 0;       //该哈希表已有节点的数量
-            // 关闭 rehash 标识
-            d->rehashidx = -1;
-            // 返回 0 ，向调用者表示 rehash 已经完成
-            return 0;
+    while (n-- && d->ht[0].used != 0) {
+        dictht *ht0 = &d->ht[0];
+        unsigned int full;
+
+        // 略过没有节点的组，找到下一个非空的组
+        while ((full = dictGroupMatchFull(ht0->ctrl + d->rehashidx*DICT_GROUP_WIDTH)) == 0) {
+            d->rehashidx++;
+            if (--empty_visits == 0) return 1;
         }
 
-        // 略过数组中为空的索引，找到下一个非空索引
-        while(d->ht[0].table[d->rehashidx] == NULL) 
-        d->rehashidx++;
-
-        // 指向该索引的链表表头节点
-        de = d->ht[0].table[d->rehashidx];
-
-        // 将一个桶中的所有节点迁移到新哈希表
-        // T = O(1)
-        while(de) {
-            unsigned int h;
-            // 计算新哈希表的哈希值，以及节点插入的索引位置
-            h = dictHashKey(d, de->key) & d->ht[1].sizemask;
-
-            // 插入节点到新哈希表
-            //【键冲突时采用前插法，将本次的键next指针指向哈希表原来键的节点，再将本次节点替代原键节点位置】
-            de->next = d->ht[1].table[h];
-            d->ht[1].table[h] = de;
+        // 将一个组中的所有节点迁移到新哈希表
+        // 节点本身不需要移动，只需要移动槽位中的指针，哈希值从缓存中还原，不需要访问键
+        while (full) {
+            long idx = d->rehashidx*DICT_GROUP_WIDTH + __builtin_ctz(full);
+            uint64_t h = dictSlotHash(ht0, idx);
 
-            // 更新计数器
-            d->ht[0].used--;
-            d->ht[1].used++;
-
-            // 继续处理下个节点
-            de = de->next;
+            dictInsertAt(&d->ht[1], dictFindFreeSlot(&d->ht[1], h), ht0->table[idx], h);
+            dictRemoveAt(ht0, idx);
+            full &= full-1;
         }
-        // 将刚迁移完的哈希表索引的指针设为空
-        d->ht[0].table[d->rehashidx] = NULL;
         // 更新 rehash 索引
         d->rehashidx++;
     }
+
+    // 如果 0 号哈希表为空，那么表示 rehash 执行完毕
+    if (d->ht[0].used == 0) {
+        // 释放 0 号哈希表
+        zfree(d->ht[0].table);
+        // 将原来的 1 号哈希表设置为新的 0 号哈希表
+        d->ht[0] = d->ht[1];
+        dictResetHt(&d->ht[1]);
+        // 关闭 rehash 标识
+        d->rehashidx = -1;
+        // 返回 0 ，向调用者表示 rehash 已经完成
+        return 0;
+    }
     return 1;
 }
 
+/*
+ * 在 us 微秒的时间内，以 100 步为单位进行 rehash
+ * 返回执行的步数
+ */
+int dictRehashMicroseconds(dict *d, uint64_t us) {
+    uint64_t start = getMonotonicUs();
+    int rehashes = 0;
+
+    while (dictRehash(d, 100)) {
+        rehashes += 100;
+        if (getMonotonicUs()-start >= us) break;
+    }
+    return rehashes;
+}
+
+/*
+ * 字典是否因为填充率过低而需要缩小
+ * 哈希表大于初始大小，并且已使用节点低于 DICT_MIN_FILL_PERCENT 时返回 1
+ */
+int dictNeedsShrink(dict *d) {
+    unsigned long size = d->ht[0].size;
+
+    if (dictIsRehashing(d) || size <= DICT_HT_INITIAL_SIZE) return 0;
+    return d->ht[0].used*100/size < DICT_MIN_FILL_PERCENT;
+}
+
+/*
+ * 将字典缩小到已使用节点数量的两倍（向上取 2 的幂），缩小后的装载因子不超过 1/2 ，
+ * 和扩展时的策略相同。新哈希表通过渐进式 rehash 启用，同时清除墓碑。
+ * 字典正在 rehash ，或者缩小后大小不变时返回 DICT_ERR
+ */
+int dictResize(dict *d) {
+    unsigned long size = d->ht[0].used*2;
+
+    if (dictIsRehashing(d) || dictNextPower(size) >= d->ht[0].size) return DICT_ERR;
+    return dictExpand(d, size);
+}
+
 /*
  * 返回字典中包含键 key 的节点
  * 找到返回节点，找不到返回 NULL
@@ -178,30 +439,22 @@ int dictRehash(dict *d, int n) {
  */
 dictEntry *dictFind(dict *d, void *key)
 {
-    dictEntry *he;
-    unsigned int h, idx, table;
-    // 字典（的哈希表）为空
-    if (d->ht[0].size == 0) return NULL;
+    uint64_t h;
+    // 字典为空
+    if (dictSize(d) == 0) return NULL;
     // 如果正在进行rehash的话，进行单步 rehash
     if (dictIsRehashing(d)) dictRehash(d, 1);
     // 计算键的哈希值
     h = dictHashKey(d, key);
     // 在字典的哈希表中查找这个键
-    for (table = 0; table <= 1; table++) {
-        // 计算索引值
-        idx = h & d->ht[table].sizemask;
-        // 遍历给定索引上的链表的所有节点，查找 key
-        he = d->ht[table].table[idx];    
-        while(he) {
-            //比较键是否相等
-            if (dictSdsKeyCompare(key, he->key))//*(char*)key == *(char*)he->key
-            {
-                return he;
-            }    
-                
-            he = he->next;
+    for (int table = 0; table <= 1; table++) {
+        dictht *ht = &d->ht[table];
+
+        if (ht->used) {
+            long idx = dictLookupSlot(d, ht, key, h);
+            if (idx != -1) return ht->table[idx];
         }
-        // 如果程序遍历完 0 号哈希表，仍然没找到指定的键的节点
+        // 如果程序查找完 0 号哈希表，仍然没找到指定的键的节点
         // 那么程序会检查字典是否在进行 rehash ，
         // 然后才决定是直接返回 NULL ，还是继续查找 1 号哈希表
         if (!dictIsRehashing(d)) return NULL;
@@ -210,16 +463,6 @@ dictEntry *dictFind(dict *d, void *key)
     return NULL;
 }
 
-/*
- * 根据给定命令名字（SDS），查找命令
- */
-struct KVDataCommand *lookupCommand(sds name) {
-    dictEntry *dicNode;
-    dicNode = dictFind(server.commands,name);
-    return dicNode ? dictGetVal(dicNode) : NULL;
-}
-
-
 /*
  * 从字典中删除包含给定键的节点
  * 并且释放被删除的节点
@@ -228,12 +471,10 @@ struct KVDataCommand *lookupCommand(sds name) {
  */
 int dictDelete(dict *d, const void *key)
 {
-    unsigned int h, idx;
-    dictEntry *he, *prevHe;
-    int table;
-    
-    // 字典（的哈希表）为空
-    if (d->ht[0].size == 0) return DICT_ERR;
+    uint64_t h;
+
+    // 字典为空
+    if (dictSize(d) == 0) return DICT_ERR;
     //如果该字典正在Rehash，则使用单步Rehash
     if (dictIsRehashing(d)) dictRehash(d, 1);
 
@@ -241,35 +482,19 @@ int dictDelete(dict *d, const void *key)
     h = dictHashKey(d, key);
     // 遍历哈希表
     // T = O(1)
-    for (table = 0; table <= 1; table++) {
-        // 计算索引值 
-        idx = h & d->ht[table].sizemask;
-        // 指向该索引上桶的链表
-        he = d->ht[table].table[idx];
-        prevHe = NULL;
-        // 遍历桶链表上的所有节点
-        // T = O(1)
-        while(he) {
-            // 查找到目标节点
-            if (dictSdsKeyCompare(key, he->key)) {
-                // 从链表中删除，考虑了key是链表的头节点与不是头节点两种情况
-                //总之就是将目标节点从原来的节点中摘除出来
-                if (prevHe)
-                    prevHe->next = he->next;
-                else
-                    d->ht[table].table[idx] = he->next;
-                // 1.释放给定字典的键，和对应的值
-                sdsfree(he->key);
-                decrRefCount(he->val);
-                // 2.释放节点本身
-                zfree(he);
-                // 更新已使用节点数量
-                d->ht[table].used--;
-                // 返回已找到信号
-                return DICT_OK;
-            }
-            prevHe = he;
-            he = he->next;
+    for (int table = 0; table <= 1; table++) {
+        dictht *ht = &d->ht[table];
+        long idx;
+
+        if (ht->used && (idx = dictLookupSlot(d, ht, key, h)) != -1) {
+            dictEntry *he = ht->table[idx];
+
+            // 从哈希表中摘除节点
+            dictRemoveAt(ht, idx);
+            // 释放给定字典的键，对应的值，以及节点本身
+            dictFreeEntry(d, he);
+            // 返回已找到信号
+            return DICT_OK;
         }
         // 如果执行到这里，说明在 0 号哈希表中找不到给定键
         // 那么根据字典是否正在进行 rehash ，决定要不要查找 1 号哈希表
@@ -301,6 +526,32 @@ int dictAdd(dict *d, void *key, void *val)
     return DICT_OK;
 }
 
+/*
+ * 返回可以将哈希值为 h 的 key 插入到哈希表的槽位
+ * 如果 key 已经存在于哈希表，那么返回 -1
+ */
+static long dictKeyIndexWithHash(dict *d, const void *key, uint64_t h)
+{
+    //根据需要对字典进行初始化或扩展
+    if (dictExpandIfNeeded(d) == DICT_ERR)
+        return -1;
+
+    // 查找 key 是否存在
+    // T = O(1)
+    for (int table = 0; table <= 1; table++) {
+        dictht *ht = &d->ht[table];
+
+        if (ht->used && dictLookupSlot(d, ht, key, h) != -1)
+            return -1;
+        // 如果运行到这里时，说明 0 号哈希表中不包含 key
+        // 如果这时 rehash 正在进行，那么继续查找 1 号哈希表
+        if (!dictIsRehashing(d)) break;
+    }
+
+    // 返回插入哈希表中的第一个空闲槽位
+    return dictFindFreeSlot(dictIsRehashing(d) ? &d->ht[1] : &d->ht[0], h);
+}
+
 /*
  * 尝试将键插入到字典中
  *
@@ -313,74 +564,74 @@ int dictAdd(dict *d, void *key, void *val)
  */
 dictEntry *dictAddRaw(dict *d, void *key)
 {
-    int index;
+    long index;
+    uint64_t h;
     dictEntry *entry;
     dictht *ht;
 
     //如果该字典正在Rehash，则使用单步Rehash
     if (dictIsRehashing(d)) dictRehash(d, 1);
 
-    // 计算键在哈希表中的索引值
-    // dictKeyIndex函数返回可以插入键值的索引
+    // 计算键在哈希表中的槽位
     // 如果值为 -1 ，那么表示键已经存在
-    if ((index =  dictKeyIndex(d, key)) == -1)
+    h = dictHashKey(d, key);
+    if ((index = dictKeyIndexWithHash(d, key, h)) == -1)
         return NULL;
 
     // 如果字典正在 rehash ，那么将新键添加到 1 号哈希表
     // 否则，将新键添加到 0 号哈希表
     ht = dictIsRehashing(d) ? &d->ht[1] : &d->ht[0];
 
-    // 为新节点分配空间
-    entry = zmalloc(sizeof(*entry));
-    // 将新节点插入到桶链表表头
-    entry->next = ht->table[index];
-    ht->table[index] = entry;
-    // 更新哈希表已使用节点数量
-    ht->used++;
-    // 设置新节点的键
+    // 从对象池中为新节点分配空间，并设置新节点的键
+    entry = slabAlloc(KVDATA_SLAB_DICTENTRY);
     entry->key = key;
+    entry->val = NULL;
+    entry->expire = 0;
+    // 将新节点放入槽位
+    dictInsertAt(ht, index, entry, h);
 
     return entry;
 }
 
 /*
- * 返回可以将 key 插入到哈希表的索引位置
+ * 将调用者分配好的节点 entry 添加到字典中，节点的键为 entry->key
+ * 节点之后由字典的 entryDestructor 释放，
+ * 这样调用者可以把键和值放在和节点相同的一次分配中。
+ * 只有键不存在于字典时，添加操作才会成功
+ * 添加成功返回 DICT_OK ，失败返回 DICT_ERR
+ *
+ * T = O(N)
+ */
+int dictAddEntry(dict *d, dictEntry *entry)
+{
+    long index;
+    uint64_t h;
+
+    //如果该字典正在Rehash，则使用单步Rehash
+    if (dictIsRehashing(d)) dictRehash(d, 1);
+
+    // 计算键在哈希表中的槽位，键已经存在时添加失败
+    h = dictHashKey(d, entry->key);
+    if ((index = dictKeyIndexWithHash(d, entry->key, h)) == -1)
+        return DICT_ERR;
+
+    // 将节点放入正在使用的哈希表
+    dictInsertAt(dictIsRehashing(d) ? &d->ht[1] : &d->ht[0], index, entry, h);
+    return DICT_OK;
+}
+
+/*
+ * 返回可以将 key 插入到哈希表的槽位
  * 如果 key 已经存在于哈希表，那么返回 -1
  *
- * 注意，如果字典正在进行 rehash ，那么总是返回 1 号哈希表的索引。
+ * 注意，如果字典正在进行 rehash ，那么总是返回 1 号哈希表的槽位。
  * 因为在字典进行 rehash 时，新节点总是插入到 1 号哈希表。
  *
  * T = O(N)
  */
-int dictKeyIndex(dict *d, const void *key)
+long dictKeyIndex(dict *d, const void *key)
 {
-    unsigned int h, idx, table;
-    dictEntry *he;
-    //根据需要对字典进行初始化或扩展
-    if (dictExpandIfNeeded(d) == DICT_ERR)
-        return -1;
-
-    // 计算 key 的哈希值
-    h = dictHashKey(d, key);
-    // T = O(1)
-    for (table = 0; table <= 1; table++) {
-        // 计算索引值
-        idx = h & d->ht[table].sizemask;
-
-        // 查找 key 是否存在
-        he = d->ht[table].table[idx];
-        while(he) {
-            if (key == he->key)
-                return -1;
-            he = he->next;
-        }
-        // 如果运行到这里时，说明 0 号哈希表中所有节点都不包含 key
-        // 如果这时 rehash 正在进行，那么继续对 1 号哈希表进行 rehash
-        if (!dictIsRehashing(d)) break;
-    }
-    
-    // 返回索引值
-    return idx;
+    return dictKeyIndexWithHash(d, key, dictHashKey(d, key));
 }
 
 /*
@@ -392,8 +643,7 @@ int dictKeyIndex(dict *d, const void *key)
  */
 int dictReplace(dict *d, void *key, void *val)
 {
-    dictEntry *entry;
-    void *auxentry;
+    dictEntry *entry, auxentry;
     // 尝试直接将键值对添加到字典
     // 如果键 key 不存在的话，添加会成功
     // T = O(N)
@@ -402,14 +652,55 @@ int dictReplace(dict *d, void *key, void *val)
 
     // 运行到这里，说明键 key 已经存在，那么找出包含这个 key 的节点
     entry = dictFind(d, key);
-    // 先保存原有的值的指针
-    auxentry = entry->val;
+    // 先保存原有的节点
+    auxentry = *entry;
     // 然后设置新的值
     entry->val = val;
     // 然后释放旧值
-    decrRefCount(auxentry);
+    dictFreeVal(d, &auxentry);
     return 0;
 }
+
+/*
+ * 删除哈希表上的所有节点，并重置哈希表的各项属性
+ * T = O(N)
+ */
+int dictClear(dict *d, dictht *ht)
+{
+    // 遍历整个哈希表
+    for (unsigned long i = 0; i < ht->size && ht->used > 0; i++) {
+        dictEntry *he;
+
+        // 跳过空槽位和墓碑
+        if (ht->ctrl[i] & 0x80) continue;
+
+        he = ht->table[i];
+        // 删除键、值和节点
+        dictFreeEntry(d, he);
+        // 更新已使用节点计数
+        ht->used--;
+    }
+    // 释放哈希表结构，控制字节数组和槽位数组在同一次分配中
+    zfree(ht->table);
+    //重置指定哈希表内的各项属性
+    dictResetHt(ht);
+
+    return DICT_OK;
+}
+
+/*
+ * 清空字典上的所有哈希表节点，并重置字典属性
+ * T = O(N)
+ */
+void dictEmpty(dict *d)
+{
+    // 删除两个哈希表上的所有节点
+    dictClear(d,&d->ht[0]);
+    dictClear(d,&d->ht[1]);
+    // 重置属性 
+    d->rehashidx = -1;
+}
+
 /*
  * 比较字典两个键的是否相同
  */
@@ -424,6 +715,15 @@ int dictSdsKeyCompare(const void *key1, const void *key2)
     return memcmp(key1, key2, l1) == 0;
 }
 
+/*
+ * 比较两个字符串对象键是否相同
+ */
+int dictObjKeyCompare(const void *key1, const void *key2)
+{
+    const robj *o1 = key1, *o2 = key2;
+    return dictSdsKeyCompare(o1->ptr, o2->ptr);
+}
+
 
 /*
  * 创建并返回给定字典的不安全迭代器
@@ -438,7 +738,6 @@ dictIterator *dictGetIterator(dict *d)
     iter->table = 0;
     iter->index = -1;
     iter->entry = NULL;
-    iter->nextEntry = NULL;
     return iter;
 }
 
@@ -450,45 +749,30 @@ dictIterator *dictGetIterator(dict *d)
 dictEntry *dictNext(dictIterator *iter)
 {
     while (1) {
-
-        // 进入这个循环有两种可能：
-        // 1) 这是迭代器第一次运行
-        // 2) 当前索引链表中的节点已经迭代完（NULL 为链表的表尾）
-        if (iter->entry == NULL) {
-            // 指向被迭代的哈希表
-            dictht *ht = &iter->d->ht[iter->table];
-            // 更新迭代器迭代的哈希表索引
-            iter->index++;
-            // 如果迭代器的当前索引大于当前被迭代的哈希表的大小
-            // 那么说明这个哈希表已经迭代完毕
-            if (iter->index >= (signed) ht->size) {
-                // 如果正在 rehash 的话，那么说明 1 号哈希表也正在使用中
-                // 那么继续对 1 号哈希表进行迭代
-                if (dictIsRehashing(iter->d) && iter->table == 0) {
-                    iter->table++;
-                    iter->index = 0;
-                    ht = &iter->d->ht[1];
-                // 如果没有 rehash ，那么说明迭代已经完成
-                } else {
-                    break;
-                }
+        // 指向被迭代的哈希表
+        dictht *ht = &iter->d->ht[iter->table];
+        // 更新迭代器迭代的哈希表槽位
+        iter->index++;
+        // 如果迭代器的当前槽位大于当前被迭代的哈希表的大小
+        // 那么说明这个哈希表已经迭代完毕
+        if (iter->index >= (long)ht->size) {
+            // 如果正在 rehash 的话，那么说明 1 号哈希表也正在使用中
+            // 那么继续对 1 号哈希表进行迭代
+            if (dictIsRehashing(iter->d) && iter->table == 0) {
+                iter->table++;
+                iter->index = -1;
+                continue;
             }
-            // 如果进行到这里，说明这个哈希表并未迭代完
-            // 更新节点指针，指向下个桶链表的表头节点
-            iter->entry = ht->table[iter->index];
-        } else {
-            // 执行到这里，说明程序正在迭代某个链表
-            // 将节点指针指向链表的下个节点
-            iter->entry = iter->nextEntry;
-        }
-        // 如果当前节点不为空，那么也记录该节点的下个节点
-        // 因为安全迭代器有可能会将迭代器返回的当前节点删除
-        if (iter->entry) {
-            iter->nextEntry = iter->entry->next;
-            return iter->entry;
+            // 如果没有 rehash ，那么说明迭代已经完成
+            break;
         }
+        // 跳过空槽位和墓碑
+        if (ht->ctrl[iter->index] & 0x80) continue;
+        iter->entry = ht->table[iter->index];
+        return iter->entry;
     }
     // 迭代完毕
+    iter->entry = NULL;
     return NULL;
 }
 
@@ -501,6 +785,120 @@ void dictReleaseIterator(dictIterator *iter)
     zfree(iter);
 }
 
+/*
+ * 从字典中随机取出至多 count 个互不相同的节点，保存到 des 数组中，返回取出的节点数量
+ *
+ * 从随机选择的一个组开始，依次取出之后连续的组中的节点，正在 rehash 时两个哈希表都会被抽样。
+ * 取出的节点不是完全独立的，但是比逐个随机选择槽位快得多，适合抽样统计以及定期删除过期键。
+ * 每个哈希表最多访问 count*10 个组，哈希表很稀疏时取出的节点可能少于 count 个。
+ *
+ * T = O(N)
+ */
+unsigned int dictGetSomeKeys(dict *d, dictEntry **des, unsigned int count)
+{
+    unsigned long groups[2] = {0, 0}, maxgroups, maxsteps, start;
+    unsigned int stored = 0;
+    int tables = dictIsRehashing(d) ? 2 : 1;
+
+    if (dictSize(d) < count) count = dictSize(d);
+    if (count == 0) return 0;
+
+    // 哈希表的大小都是 2 的幂，组的数量也是
+    for (int table = 0; table < tables; table++)
+        groups[table] = d->ht[table].size / DICT_GROUP_WIDTH;
+    maxgroups = groups[0] > groups[1] ? groups[0] : groups[1];
+    start = (((unsigned long)random() << 31) ^ (unsigned long)random()) & (maxgroups-1);
+
+    maxsteps = (unsigned long)count*10;
+    for (unsigned long g = 0; g < maxsteps && g < maxgroups; g++) {
+        for (int table = 0; table < tables; table++) {
+            dictht *ht = &d->ht[table];
+            unsigned long group;
+            unsigned int full;
+
+            // 较小的哈希表已经全部访问过了
+            if (g >= groups[table]) continue;
+            group = (start+g) & (groups[table]-1);
+            full = dictGroupMatchFull(ht->ctrl + group*DICT_GROUP_WIDTH);
+            while (full) {
+                des[stored++] = ht->table[group*DICT_GROUP_WIDTH + __builtin_ctz(full)];
+                if (stored == count) return stored;
+                full &= full-1;
+            }
+        }
+    }
+    return stored;
+}
+
+/*
+ * 主动碎片整理：从 cursor 号组开始，依次把 0 号哈希表中 groups 个组的节点交给 fn ，
+ * fn 移动了节点时返回节点的新地址，由这里写回槽位；没有移动时返回 NULL 。
+ * 节点的键不变，所以控制字节和缓存的哈希值都不需要修改。
+ *
+ * 返回下一次调用使用的游标，整个哈希表都访问过之后返回 0 。
+ * 两次调用之间哈希表可能扩展或收缩，之后的调用可能重复访问或者漏掉一部分节点，
+ * 对碎片整理来说这是可以接受的；字典正在 rehash 时不做任何事情，直接返回 cursor 。
+ */
+unsigned long dictDefragGroups(dict *d, unsigned long cursor, unsigned long groups,
+                               dictDefragFunction *fn, void *privdata)
+{
+    dictht *ht = &d->ht[0];
+    unsigned long ngroups = ht->size / DICT_GROUP_WIDTH;
+
+    if (dictIsRehashing(d)) return cursor;
+    for (; groups > 0 && cursor < ngroups; groups--, cursor++) {
+        unsigned int full = dictGroupMatchFull(ht->ctrl + cursor*DICT_GROUP_WIDTH);
+
+        while (full) {
+            long idx = cursor*DICT_GROUP_WIDTH + __builtin_ctz(full);
+            dictEntry *newde = fn(privdata, ht->table[idx]);
+
+            if (newde) ht->table[idx] = newde;
+            full &= full-1;
+        }
+    }
+    return cursor < ngroups ? cursor : 0;
+}
+
+/*
+ * 节点 oldde 被移动到 newde 之后，把字典中指向 oldde 的槽位改为指向 newde
+ * oldde 可能已经被释放，这里只比较指针，不访问 oldde ；键的哈希值由 newde 的键计算
+ * 找到并替换返回 DICT_OK ，字典中没有指向 oldde 的槽位返回 DICT_ERR
+ */
+int dictReplaceEntry(dict *d, dictEntry *oldde, dictEntry *newde)
+{
+    uint64_t h = dictHashKey(d, newde->key);
+    unsigned char tag = dictHashTag(h);
+
+    for (int table = 0; table <= 1; table++) {
+        dictht *ht = &d->ht[table];
+        unsigned long gmask = ht->sizemask/DICT_GROUP_WIDTH;
+        unsigned long g = dictHashGroup(h) & gmask;
+
+        if (ht->used == 0) {
+            if (!dictIsRehashing(d)) break;
+            continue;
+        }
+        for (unsigned long step = 1; ; step++) {
+            unsigned char *ctrl = ht->ctrl + g*DICT_GROUP_WIDTH;
+            unsigned int match = dictGroupMatch(ctrl, tag);
+
+            while (match) {
+                long idx = g*DICT_GROUP_WIDTH + __builtin_ctz(match);
+                if (ht->table[idx] == oldde) {
+                    ht->table[idx] = newde;
+                    return DICT_OK;
+                }
+                match &= match-1;
+            }
+            if (dictGroupMatch(ctrl, DICT_CTRL_EMPTY) || step > gmask) break;
+            g = (g + step) & gmask;
+        }
+        if (!dictIsRehashing(d)) break;
+    }
+    return DICT_ERR;
+}
+
 
 
 
@@ -511,17 +909,17 @@ void dictReleaseIterator(dictIterator *iter)
 
 //需要反复研究！！！！！！！！！！！！！！！！！！
 
-unsigned int dictSdsHash(const void *key) {
+uint64_t dictSdsHash(const void *key) {
     return dictGenHashFunction((unsigned char*)key, sdslen((char*)key));
 }
 
-unsigned int dictObjHash(const void *key) {
+uint64_t dictObjHash(const void *key) {
     const robj *o = key;
     return dictGenHashFunction(o->ptr, sdslen((sds)o->ptr));
 }
 
-unsigned int dictSdsCaseHash(const  void *key) {
-    return dictGenCaseHashFunction((unsigned char*)key, strlen((char*)key));
+uint64_t dictSdsCaseHash(const  void *key) {
+    return dictGenCaseHashFunction((unsigned char*)key, sdslen((char*)key));
 }
 
 void dictListDestructor(void *privdata, void *val)
@@ -537,8 +935,30 @@ void dictKVDATAObjectDestructor(void *privdata, void *val)
     if (val == NULL) return; /* Values of swapped out keys as set to NULL */
     decrRefCount(val);
 }
+
+void dictSdsDestructor(void *privdata, void *val)
+{
+    KVDATA_NOTUSED(privdata);
+    sdsfree(val);
+}
 /* -------------------------- hash functions -------------------------------- */
-static uint32_t dict_hash_function_seed = 5381;
+// 哈希函数的种子，启动时由 dictSetHashFunctionSeed 设置为随机值，
+// 客户端无法预先构造出哈希值相同的键
+static uint64_t dict_hash_function_seed = 5381;
+
+/*
+ * 设置哈希函数的种子，必须在创建任何字典之前调用
+ */
+void dictSetHashFunctionSeed(uint64_t seed)
+{
+    dict_hash_function_seed = seed;
+}
+
+uint64_t dictGetHashFunctionSeed(void)
+{
+    return dict_hash_function_seed;
+}
+
 /* 
  * 托马斯的32位混合哈希值计算方法
  * 
@@ -555,65 +975,100 @@ unsigned int dictIntHashFunction(unsigned int key)
     return key;
 }
 
-/* MurmurHash2, by Austin Appleby
- * Note - This code makes a few assumptions about how your machine behaves -
- * 1. We can read a 4-byte value from any address without crashing
- * 2. sizeof(int) == 4
- *
- * And it has a few limitations -
- *
- * 1. It will not work incrementally.
- * 2. It will not produce the same results on little-endian and big-endian
- *    machines.
+/* wyhash (final version 4), by Wang Yi, released into the public domain.
+ * 64 位的乘法混合哈希，每次处理 16 或 48 字节，短键只需要一到两次 128 位乘法。
+ * 和 MurmurHash2 一样，大端和小端机器上的结果不同，哈希值只在进程内使用。
  */
-unsigned int dictGenHashFunction(const void *key, int len) {
-    /* 'm' and 'r' are mixing constants generated offline.
-     They're not really 'magic', they just happen to work well.  */
-    uint32_t seed = dict_hash_function_seed;
-    const uint32_t m = 0x5bd1e995;
-    const int r = 24;
-
-    /* Initialize the hash to a 'random' value */
-    uint32_t h = seed ^ len;
-
-    /* Mix 4 bytes at a time into the hash */
-    const unsigned char *data = (const unsigned char *)key;
-
-    while(len >= 4) {
-        uint32_t k = *(uint32_t*)data;
+static const uint64_t wyp[4] = {
+    0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull,
+    0x4b33a62ed433d4a3ull, 0x4d5a2da51de1aa47ull
+};
+
+// 128 位乘法，低 64 位和高 64 位分别写回 A 和 B
+static inline void wymum(uint64_t *A, uint64_t *B) {
+    __uint128_t r = *A;
+    r *= *B;
+    *A = (uint64_t)r;
+    *B = (uint64_t)(r >> 64);
+}
 
-        k *= m;
-        k ^= k >> r;
-        k *= m;
+static inline uint64_t wymix(uint64_t A, uint64_t B) {
+    wymum(&A, &B);
+    return A ^ B;
+}
 
-        h *= m;
-        h ^= k;
+static inline uint64_t wyr8(const uint8_t *p) { uint64_t v; memcpy(&v, p, 8); return v; }
+static inline uint64_t wyr4(const uint8_t *p) { uint32_t v; memcpy(&v, p, 4); return v; }
+static inline uint64_t wyr3(const uint8_t *p, size_t k) {
+    return (((uint64_t)p[0]) << 16) | (((uint64_t)p[k >> 1]) << 8) | p[k-1];
+}
 
-        data += 4;
-        len -= 4;
+static uint64_t wyhash(const void *key, size_t len, uint64_t seed) {
+    const uint8_t *p = key;
+    uint64_t a, b;
+
+    seed ^= wymix(seed ^ wyp[0], wyp[1]);
+    if (len <= 16) {
+        if (len >= 4) {
+            a = (wyr4(p) << 32) | wyr4(p+((len >> 3) << 2));
+            b = (wyr4(p+len-4) << 32) | wyr4(p+len-4-((len >> 3) << 2));
+        } else if (len > 0) {
+            a = wyr3(p, len);
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t i = len;
+        if (i > 48) {
+            uint64_t see1 = seed, see2 = seed;
+            do {
+                seed = wymix(wyr8(p) ^ wyp[1], wyr8(p+8) ^ seed);
+                see1 = wymix(wyr8(p+16) ^ wyp[2], wyr8(p+24) ^ see1);
+                see2 = wymix(wyr8(p+32) ^ wyp[3], wyr8(p+40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= see1 ^ see2;
+        }
+        while (i > 16) {
+            seed = wymix(wyr8(p) ^ wyp[1], wyr8(p+8) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+        a = wyr8(p+i-16);
+        b = wyr8(p+i-8);
     }
+    a ^= wyp[1];
+    b ^= seed;
+    wymum(&a, &b);
+    return wymix(a ^ wyp[0] ^ len, b ^ wyp[1]);
+}
 
-    /* Handle the last few bytes of the input array  */
-    switch(len) {
-    case 3: h ^= data[2] << 16;
-    case 2: h ^= data[1] << 8;
-    case 1: h ^= data[0]; h *= m;
-    };
-
-    /* Do a few final mixes of the hash to ensure the last few
-     * bytes are well-incorporated. */
-    h ^= h >> 13;
-    h *= m;
-    h ^= h >> 15;
-
-    return (unsigned int)h;
+/*
+ * 计算长度为 len 的 key 的 64 位哈希值
+ */
+uint64_t dictGenHashFunction(const void *key, size_t len) {
+    return wyhash(key, len, dict_hash_function_seed);
 }
 
-/* 字符串对应的哈希算法*/
-unsigned int dictGenCaseHashFunction(const unsigned char *buf, int len) {
-    unsigned int hash = (unsigned int)dict_hash_function_seed;//5381
-    while (len--)
-        hash = ((hash << 5) + hash) + (tolower(*buf++)); /* hash * 33 + c */
+/*
+ * 计算长度为 len 的 buf 忽略大小写的 64 位哈希值
+ * 每次把最多 64 字节转换为小写，再以上一段的哈希值为种子计算下一段
+ */
+uint64_t dictGenCaseHashFunction(const unsigned char *buf, size_t len) {
+    unsigned char lower[64];
+    uint64_t hash = dict_hash_function_seed;
+
+    // 空字符串不需要转换，也避免把未初始化的 lower 传给 wyhash
+    if (len == 0) return wyhash(buf, 0, hash);
+    do {
+        size_t n = len < sizeof(lower) ? len : sizeof(lower);
+        for (size_t j = 0; j < n; j++) lower[j] = tolower(buf[j]);
+        hash = wyhash(lower, n, hash);
+        buf += n;
+        len -= n;
+    } while (len);
     return hash;
 }
 
@@ -2,10 +2,19 @@
 #define KVDATA_DICT_H
 #include <stdint.h>
 #include "sds.h"
-// 强制 rehash 的比率
-#define dict_force_resize_ratio  5
-// 字典哈希表的初始大小
-#define DICT_HT_INITIAL_SIZE   40
+// 每个控制字节组包含的槽位数量，一次 SIMD 比较可以检查一整组槽位
+#define DICT_GROUP_WIDTH 16
+// 字典哈希表的初始大小，必须是 2 的幂，并且是 DICT_GROUP_WIDTH 的倍数
+#define DICT_HT_INITIAL_SIZE   16
+// 哈希表的最大装载因子为 DICT_MAX_LOAD_NUM/DICT_MAX_LOAD_DEN ，已删除的槽位也计算在内
+#define DICT_MAX_LOAD_NUM 7
+#define DICT_MAX_LOAD_DEN 8
+// 已使用节点占哈希表大小的百分比低于这个值时，后台任务会缩小哈希表
+#define DICT_MIN_FILL_PERCENT 10
+// 控制字节：空槽位
+#define DICT_CTRL_EMPTY 0x80
+// 控制字节：已删除的槽位（墓碑），查找时不能在这里停止
+#define DICT_CTRL_DELETED 0xfe
 // 字典的操作状态，操作成功
 #define DICT_OK 0
 // 字典的操作状态，操作失败（或出错）
@@ -17,16 +26,20 @@ typedef struct dictEntry {
     void *key;
     // 键值对的值
     void *val;
-    // 键的过期时间
+    // 键的过期时间，毫秒格式的 UNIX 时间戳，0 表示没有过期时间
     uint64_t expire;
-    // 指向下个哈希表节点，形成链表，解决键冲突
-    struct dictEntry *next;
 
 } dictEntry;
 
 /*
  * 哈希表
  * 每个字典都使用两个哈希表，从而实现渐进式 rehash 。
+ *
+ * 哈希表使用开放寻址法解决冲突：
+ * 槽位按 DICT_GROUP_WIDTH 个一组，每个槽位有一个控制字节，
+ * 满槽位的控制字节保存键的 64 位哈希值的低 7 位，空槽位和墓碑的最高位为 1 。
+ * 查找时用键的哈希值的其余位选择起始组，一次比较整组控制字节，
+ * 只有控制字节相同的槽位才需要比较键，遇到含有空槽位的组时停止。
  */
 typedef struct dictht {
     
@@ -35,6 +48,12 @@ typedef struct dictht {
     // 每个dictEntry结构保存着一个键值对。
     dictEntry **table;
 
+    // 每个槽位中节点的键的哈希值的第 7 位到第 38 位，rehash 时不需要重新计算哈希值
+    uint32_t *hashes;
+
+    // 控制字节数组，和 table 数组一一对应，和 table 在同一次分配中
+    unsigned char *ctrl;
+
     // 哈希表大小（table数组的大小）
     unsigned long size;
     
@@ -45,6 +64,9 @@ typedef struct dictht {
     // 该哈希表已有节点的数量
     unsigned long used;
 
+    // 该哈希表中墓碑的数量
+    unsigned long deleted;
+
 } dictht;
 
 /*
@@ -53,9 +75,16 @@ typedef struct dictht {
 typedef struct dictType {
 
     // 计算哈希值的函数
-    unsigned int (*hashFunction)(const void *key);
+    uint64_t (*hashFunction)(const void *key);
+    // 比较两个键是否相等的函数，为 NULL 时比较指针
+    int (*keyCompare)(const void *key1, const void *key2);
+    // 销毁键的函数
+    void (*keyDestructor)(void *privdata, void *key);
     // 销毁值的函数
     void (*valDestructor)(void *privdata, void *obj);
+    // 销毁节点的函数，节点由调用者分配（dictAddEntry）时使用，
+    // 为 NULL 时先销毁键和值，再释放节点本身
+    void (*entryDestructor)(void *privdata, dictEntry *de);
 
 } dictType;
 
@@ -65,9 +94,9 @@ typedef struct dict {
     // 哈希表
     dictht ht[2];
 
-    // rehash 索引
+    // rehash 索引，为 0 号哈希表中下一个要迁移的组
     // 当 rehash 不在进行时，值为 -1
-    int rehashidx;
+    long rehashidx;
 
     // 类型特定函数，每个字典结构保存了一簇用于操作特定类型键值对的函数
     // 监视键字典，过期键字典，数据库字典
@@ -75,6 +104,11 @@ typedef struct dict {
 
 } dict;
 
+/*
+ * 主动碎片整理回调，移动了节点时返回节点的新地址，否则返回 NULL
+ */
+typedef dictEntry *dictDefragFunction(void *privdata, dictEntry *de);
+
 /*
  * 字典迭代器
  */
@@ -84,12 +118,10 @@ typedef struct dictIterator {
     dict *d;
     //正在被迭代的哈希表号码，值可以是 0 或 1 。
     int table;
-    //迭代器当前所指向的哈希表索引位置。
-    int index;
+    //迭代器当前所指向的哈希表槽位。
+    long index;
     //当前迭代到的节点的指针
     dictEntry *entry;
-    //当前迭代节点的下一个节点
-    dictEntry *nextEntry;
     
 } dictIterator;
 
@@ -102,33 +134,57 @@ typedef struct dictIterator {
 #define dictSize(d) ((d)->ht[0].used+(d)->ht[1].used)
 // 计算给定键的哈希值
 #define dictHashKey(d, key) (d)->type->hashFunction(key)
+// 比较两个键是否相等
+#define dictCompareKeys(d, key1, key2) \
+    ((d)->type->keyCompare ? (d)->type->keyCompare(key1, key2) : (key1) == (key2))
+// 释放给定节点的键
+#define dictFreeKey(d, entry) do { \
+        if ((d)->type->keyDestructor) (d)->type->keyDestructor(NULL, (entry)->key); \
+    } while(0)
+// 释放给定节点的值
+#define dictFreeVal(d, entry) do { \
+        if ((d)->type->valDestructor) (d)->type->valDestructor(NULL, (entry)->val); \
+    } while(0)
 
 
 dict *dictCreate(dictType *type);
 int dictExpand(dict *d, unsigned long size);
 int dictExpandIfNeeded(dict *d);
 int dictRehash(dict *d, int n);
+int dictRehashMicroseconds(dict *d, uint64_t us);
+int dictNeedsShrink(dict *d);
+int dictResize(dict *d);
 dictEntry *dictFind(dict *d, void *key);
-struct KVDataCommand *lookupCommand(sds name);
 int dictDelete(dict *d, const void *key);
 int dictAdd(dict *d, void *key, void *val);
 dictEntry *dictAddRaw(dict *d, void *key);
-int dictKeyIndex(dict *d, const void *key);
+int dictAddEntry(dict *d, dictEntry *entry);
+long dictKeyIndex(dict *d, const void *key);
 int dictReplace(dict *d, void *key, void *val);
+void dictEmpty(dict *d);
+int dictClear(dict *d, dictht *ht);
 
 int dictSdsKeyCompare(const void *key1, const void *key2);
+int dictObjKeyCompare(const void *key1, const void *key2);
 
 dictIterator *dictGetIterator(dict *d);
 dictEntry *dictNext(dictIterator *iter);
 void dictReleaseIterator(dictIterator *iter);
+unsigned int dictGetSomeKeys(dict *d, dictEntry **des, unsigned int count);
+unsigned long dictDefragGroups(dict *d, unsigned long cursor, unsigned long groups,
+                               dictDefragFunction *fn, void *privdata);
+int dictReplaceEntry(dict *d, dictEntry *oldde, dictEntry *newde);
 //需要反复研究！！！！！！！！！！！！！！！！！！
 
-unsigned int dictSdsHash(const void *key);
-unsigned int dictObjHash(const void *key);
-unsigned int dictSdsCaseHash(const  void *key);
+uint64_t dictSdsHash(const void *key);
+uint64_t dictObjHash(const void *key);
+uint64_t dictSdsCaseHash(const  void *key);
 void dictListDestructor(void *privdata, void *val);
 void dictKVDATAObjectDestructor(void *privdata, void *val);
+void dictSdsDestructor(void *privdata, void *val);
 unsigned int dictIntHashFunction(unsigned int key);
-unsigned int dictGenHashFunction(const void *key, int len);
-unsigned int dictGenCaseHashFunction(const unsigned char *buf, int len);
+uint64_t dictGenHashFunction(const void *key, size_t len);
+uint64_t dictGenCaseHashFunction(const unsigned char *buf, size_t len);
+void dictSetHashFunctionSeed(uint64_t seed);
+uint64_t dictGetHashFunctionSeed(void);
 #endif
\ No newline at end of file
@@ -11,6 +11,8 @@
 #include "client.h"
 #include <string.h>
 #include "zmalloc.h"
+#include "clock.h"
+#include <unistd.h>
 /*
  * 初始化满足监听条件事件槽空间， 创建 epoll红黑树句柄，建议最大监听事件数为1024
  * 将事件状态（epoll红黑树句柄+满足监听条件事件槽）存入事件处理器的状态结构eventLoop
@@ -40,21 +42,42 @@ int aeApiCreate(aeEventLoop *eventLoop) {
 
 
 /*
- * 初始化服务监听文件描述符，设置为非阻塞状态，将其加入epoll句柄。
- * 并将其与服务器套接字绑定
-*/ 
-void init_ListenSocket(aeEventLoop *eventLoop, short port)
+ * 事件处理器扩容时，调整满足监听条件事件槽的大小
+ */
+int aeApiResize(aeEventLoop *eventLoop, int setsize) {
+    eventLoop_State *state = eventLoop->apidata;
+
+    state->events = zrealloc(state->events, sizeof(struct epoll_event)*setsize);
+    return 0;
+}
+
+/*
+ * 创建一个监听 port 端口的非阻塞 TCP 套接字
+ * backlog 为 listen 的待连接队列长度
+ * reuseport 为真时开启 SO_REUSEPORT ，多个 reactor 可以各自监听同一个端口，
+ * 由内核在这些监听套接字之间分配新连接
+ * 成功返回监听文件描述符，出错返回 -1
+ */
+int anetTcpServer(short port, int backlog, int reuseport)
 {
     //初始化服务器的监听文件描述符
     int lfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (lfd == -1) {
+        serverLog(KVDATA_WARNING, "socket error: %s\n", strerror(errno));
+        return -1;
+    }
 
     //将服务器监听文件描述符设置为非阻塞状态
     if(fcntl(lfd, F_SETFL, O_NONBLOCK)<0)
-    printf("fcntl error.\n");
-    
-    //-------------------------------------------------------------------------------------------------------
-    //将监听文件描述符加入到epoll红黑树句柄中进行监听，并设置回调函数为acceptTcpHandler函数
-    aeCreateFileEvent(eventLoop, lfd, AE_READABLE,acceptTcpHandler, NULL);
+    serverLog(KVDATA_WARNING, "fcntl error.\n");
+
+    //同一个端口上的所有监听套接字都必须在 bind 之前开启 SO_REUSEPORT
+    int yes = 1;
+    if (reuseport && setsockopt(lfd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes)) == -1) {
+        serverLog(KVDATA_WARNING, "setsockopt SO_REUSEPORT: %s\n", strerror(errno));
+        close(lfd);
+        return -1;
+    }
 
     //初始化服务器套接字
     struct sockaddr_in sin;
@@ -65,48 +88,96 @@ void init_ListenSocket(aeEventLoop *eventLoop, short port)
     
     //将服务器监听描述符与服务器套接字绑定
     if(bind(lfd, (struct sockaddr *)&sin, sizeof(sin))<0)
-    printf("bind error.\n");
+    serverLog(KVDATA_WARNING, "bind error.\n");
     
     //设置最大待连接客户端数
-    if(listen(lfd, 20)<0)
-    printf("listen error.\n");
+    if(listen(lfd, backlog)<0)
+    serverLog(KVDATA_WARNING, "listen error.\n");
+
+    return lfd;
+}
+
+/*
+ * 初始化服务监听文件描述符，设置为非阻塞状态，将其加入epoll句柄。
+ * 并将其与服务器套接字绑定
+*/ 
+void init_ListenSocket(aeEventLoop *eventLoop, short port)
+{
+    //多 reactor 模式下，各个 reactor 的监听套接字共享同一个端口
+    int lfd = anetTcpServer(port, server.tcp_backlog, server.reactors_num > 1);
+    if (lfd == -1) return;
+
+    //将监听文件描述符加入到epoll红黑树句柄中进行监听，并设置回调函数为acceptTcpHandler函数
+    aeCreateFileEvent(eventLoop, lfd, AE_READABLE,acceptTcpHandler, NULL);
     
     server.listenfd = lfd;
-    printf("Listening....\n");
+    serverLog(KVDATA_NOTICE, "Listening....\n");
     return;
 }
 
 
+/*
+ * 拒绝一个新连接：尽力告诉客户端原因，然后关闭套接字
+ */
+static void rejectTcpConnection(int cfd, char *err) {
+    // 套接字还是阻塞的，但是新连接的发送缓冲区是空的，写这么一点数据不会阻塞
+    if (write(cfd, err, strlen(err)) == -1) {
+        /* 客户端收不到也没有关系 */
+    }
+    close(cfd);
+    __atomic_add_fetch(&server.stat_rejected_conn, 1, __ATOMIC_RELAXED);
+}
+
 /*
  * 创建一个 TCP 连接处理器
  * 服务器使用
+ * 每次最多接受 MAX_ACCEPTS_PER_CALL 个连接，连接风暴时不用每个连接都回到事件循环一次，
+ * 也不会让事件循环长时间只处理新连接
  */
 void acceptTcpHandler(aeEventLoop *ae, int lfd, void *privdata, int mask) {
 
     char ip[20];
     int port;
+    int max = MAX_ACCEPTS_PER_CALL;
     struct sockaddr_in cin;//客户端套接字
-    socklen_t len = sizeof(cin);//客户端套接字长度
-    
-    //客户端与服务器建立连接
-    int cfd = accept(lfd, (struct sockaddr *)&cin, &len);
-    if ((cfd) == -1)
-    {
-        printf("accept: %s" , strerror(errno));
-        return ;
+    socklen_t len;//客户端套接字长度
+
+    while(max--) {
+        //客户端与服务器建立连接
+        len = sizeof(cin);
+        int cfd = accept(lfd, (struct sockaddr *)&cin, &len);
+        if ((cfd) == -1)
+        {
+            //已经没有待接受的连接了
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                serverLog(KVDATA_WARNING, "accept: %s\n" , strerror(errno));
+            return ;
+        }
+
+        //达到最大客户端数量，拒绝新连接
+        if (__atomic_load_n(&server.connected_clients, __ATOMIC_RELAXED) >= server.maxclients) {
+            rejectTcpConnection(cfd, "-ERR max number of clients reached\r\n");
+            continue;
+        }
+
+        //获取新连接客户端的ip地址：port端口号
+        inet_ntop(AF_INET, (void *)(&cin.sin_addr), ip, 16);
+        port = ntohs(cin.sin_port);
+
+        //根据已连接文件描述符创建新的客户端状态
+        KVClient *c = createClient(cfd);
+        if (c == NULL) {
+            serverLog(KVDATA_WARNING, "Error registering fd event for the new client: %s (fd=%d)\n", strerror(errno), cfd);
+            close(cfd);
+            continue;
+        }
+        memcpy(c->ip,ip,sizeof(ip));
+        c->port = port;
+
+        //打印建立连接的客户端相关信息
+        serverLog(KVDATA_VERBOSE, "new connect [%s:%d][time:%ld], cfd[%d], ip[%s], port[%d].\n",
+               inet_ntoa(cin.sin_addr), ntohs(cin.sin_port), ae->events[cfd].last_active,cfd,ip,port);
     }
-    //获取新连接客户端的ip地址：port端口号
-    inet_ntop(AF_INET, (void *)(&cin.sin_addr), ip, 16);
-    port = ntohs(cin.sin_port);
-
-    //根据已连接文件描述符创建新的客户端状态
-    KVClient *c = createClient(cfd);
-    c->ip = ip;
-    c->port = port;
-    
-    //打印建立连接的客户端相关信息
-    printf("new connect [%s:%d][time:%ld], cfd[%d], ip[%s], port[%d].\n",
-           inet_ntoa(cin.sin_addr), ntohs(cin.sin_port), ae->events[cfd].last_active,cfd,ip,port);
 }
 
 
@@ -145,10 +216,10 @@ int aeApiAddEvent(aeEventLoop *eventLoop, int fd, int mask)
     //注册事件到红黑树句柄epfd
     if (epoll_ctl(state->epfd, option, fd, &epv) < 0)   //实际添加/修改
     {
-         printf("epoll_ctl error.\n");
+         serverLog(KVDATA_WARNING, "epoll_ctl error.\n");
          return -1;
     }
-    eventLoop->events[fd].last_active = time(NULL);
+    eventLoop->events[fd].last_active = clockUnixSec();
     return 0;
 }
 
@@ -238,7 +309,7 @@ int anetTcpNonBlockConnect(char *err, char *addr, int port)
 
     //将服务器监听文件描述符设置为非阻塞状态
     if(fcntl(cfd, F_SETFL, O_NONBLOCK)<0)
-    printf("fcntl error.\n");
+    serverLog(KVDATA_WARNING, "fcntl error.\n");
 
     //初始化服务器的scokaddr_in结构体
     struct sockaddr_in sever_addr;
@@ -2,6 +2,7 @@
 #ifndef KVDATA_EVENTEPOLL_H
 #define KVDATA_EVENTEPOLL_H
 #define MAX_EVENTS 1024  //红黑树句柄最大监听事件数量
+#define MAX_ACCEPTS_PER_CALL 1000  //每次可读事件最多接受的新连接数量
 
 typedef struct eventLoop_State {
 
@@ -14,6 +15,8 @@ typedef struct eventLoop_State {
 
 
 int aeApiCreate(aeEventLoop *eventLoop);
+int aeApiResize(aeEventLoop *eventLoop, int setsize);
+int anetTcpServer(short port, int backlog, int reuseport);
 void init_ListenSocket(aeEventLoop *eventLoop, short port);
 void acceptTcpHandler(aeEventLoop *ae, int lfd, void *privdata, int mask);
 int aeApiAddEvent(aeEventLoop *eventLoop, int fd, int mask);
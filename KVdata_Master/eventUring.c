@@ -0,0 +1,426 @@
+#include "eventUring.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include "zmalloc.h"
+#include "server.h"
+
+/*
+ * io_uring 多路复用后端
+ *
+ * 直接使用 io_uring_setup/io_uring_enter 系统调用，不依赖 liburing 。
+ * 请求的 user_data 最高两位是请求类型：
+ * poll 请求的低 32 位是 fd ，中间是 poll 请求的代数；批量 I/O 请求的低 32 位是本批中的序号。
+ */
+#define URING_TAG_SHIFT 62
+#define URING_TAG_POLL 0ULL        // 文件事件监听
+#define URING_TAG_REMOVE 1ULL      // 取消文件事件监听，完成事件直接丢弃
+#define URING_TAG_IO 2ULL          // 批量 recv/send
+#define URING_GEN_MASK 0x3fffffffULL
+
+static int uringEnter(int ringfd, unsigned to_submit, unsigned min_complete,
+                      unsigned flags, void *arg, size_t argsz)
+{
+    return (int) syscall(__NR_io_uring_enter, ringfd, to_submit, min_complete, flags, arg, argsz);
+}
+
+static unsigned long long uringPollData(int fd, unsigned gen) {
+    return (URING_TAG_POLL << URING_TAG_SHIFT) | ((unsigned long long)gen << 32) | (unsigned)fd;
+}
+
+/*
+ * 释放 io_uring 后端状态，只在创建失败时使用
+ */
+static void uringFreeState(eventUring_State *state) {
+    if (state->sqes) munmap(state->sqes, state->sqes_len);
+    if (state->cq_ptr && state->cq_ptr != state->sq_ptr) munmap(state->cq_ptr, state->cq_len);
+    if (state->sq_ptr) munmap(state->sq_ptr, state->sq_len);
+    if (state->ringfd != -1) close(state->ringfd);
+    zfree(state->armed);
+    zfree(state->gen);
+    zfree(state->ready);
+    zfree(state->ready_mask);
+    zfree(state->io_privdata);
+    zfree(state->io_res);
+    zfree(state);
+}
+
+/*
+ * 创建 io_uring 实例，映射提交队列和完成队列，并将后端状态存入 eventLoop->apidata
+ * 成功返回 0 ，内核不支持或者出错时返回 -1
+ */
+int aeUringCreate(aeEventLoop *eventLoop) {
+    struct io_uring_params p;
+    unsigned entries = AE_URING_MIN_ENTRIES;
+    int setsize = eventLoop->setsize;
+
+    // 提交队列的长度和事件处理器的容量相当，满了的时候会提前提交
+    while (entries < (unsigned)setsize && entries < AE_URING_MAX_ENTRIES) entries <<= 1;
+
+    eventUring_State *state = zmalloc(sizeof(eventUring_State));
+    if (!state) return -1;
+    memset(state,0,sizeof(*state));
+    memset(&p,0,sizeof(p));
+
+    state->ringfd = (int) syscall(__NR_io_uring_setup, entries, &p);
+    if (state->ringfd == -1) {
+        serverLog(KVDATA_WARNING, "io_uring_setup: %s\n", strerror(errno));
+        goto err;
+    }
+    // 带超时的等待需要 IORING_FEAT_EXT_ARG （Linux 5.11），
+    // 完成队列不丢事件需要 IORING_FEAT_NODROP
+    if (!(p.features & IORING_FEAT_EXT_ARG) || !(p.features & IORING_FEAT_NODROP)) {
+        serverLog(KVDATA_WARNING, "io_uring: kernel is too old, Linux 5.11 or newer is required.\n");
+        goto err;
+    }
+
+    // 映射提交队列环、完成队列环以及请求数组
+    state->sq_len = p.sq_off.array + p.sq_entries*sizeof(unsigned);
+    state->cq_len = p.cq_off.cqes + p.cq_entries*sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (state->cq_len > state->sq_len) state->sq_len = state->cq_len;
+        state->cq_len = state->sq_len;
+    }
+    state->sq_ptr = mmap(NULL, state->sq_len, PROT_READ|PROT_WRITE,
+                         MAP_SHARED|MAP_POPULATE, state->ringfd, IORING_OFF_SQ_RING);
+    if (state->sq_ptr == MAP_FAILED) {
+        state->sq_ptr = NULL;
+        goto mmaperr;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        state->cq_ptr = state->sq_ptr;
+    } else {
+        state->cq_ptr = mmap(NULL, state->cq_len, PROT_READ|PROT_WRITE,
+                             MAP_SHARED|MAP_POPULATE, state->ringfd, IORING_OFF_CQ_RING);
+        if (state->cq_ptr == MAP_FAILED) {
+            state->cq_ptr = NULL;
+            goto mmaperr;
+        }
+    }
+    state->sqes_len = p.sq_entries*sizeof(struct io_uring_sqe);
+    state->sqes = mmap(NULL, state->sqes_len, PROT_READ|PROT_WRITE,
+                       MAP_SHARED|MAP_POPULATE, state->ringfd, IORING_OFF_SQES);
+    if (state->sqes == MAP_FAILED) {
+        state->sqes = NULL;
+        goto mmaperr;
+    }
+
+    char *sq = state->sq_ptr, *cq = state->cq_ptr;
+    state->sq_head = (unsigned*)(sq + p.sq_off.head);
+    state->sq_tail = (unsigned*)(sq + p.sq_off.tail);
+    state->sq_mask = (unsigned*)(sq + p.sq_off.ring_mask);
+    state->sq_entries = (unsigned*)(sq + p.sq_off.ring_entries);
+    state->sq_array = (unsigned*)(sq + p.sq_off.array);
+    state->sq_local_tail = *state->sq_tail;
+    state->cq_head = (unsigned*)(cq + p.cq_off.head);
+    state->cq_tail = (unsigned*)(cq + p.cq_off.tail);
+    state->cq_mask = (unsigned*)(cq + p.cq_off.ring_mask);
+    state->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+
+    // 每个 fd 的监听状态，以及暂存就绪事件和批量 I/O 结果的数组
+    state->armed = zmalloc(sizeof(int)*setsize);
+    state->gen = zmalloc(sizeof(unsigned)*setsize);
+    state->ready = zmalloc(sizeof(int)*setsize);
+    state->ready_mask = zmalloc(sizeof(int)*setsize);
+    state->io_privdata = zmalloc(sizeof(void*)*setsize);
+    state->io_res = zmalloc(sizeof(int)*setsize);
+    if (!state->armed || !state->gen || !state->ready || !state->ready_mask ||
+        !state->io_privdata || !state->io_res) goto err;
+    memset(state->armed,0,sizeof(int)*setsize);
+    memset(state->gen,0,sizeof(unsigned)*setsize);
+    memset(state->ready_mask,0,sizeof(int)*setsize);
+
+    eventLoop->apidata = state;
+    return 0;
+
+mmaperr:
+    serverLog(KVDATA_WARNING, "io_uring mmap error: %s\n", strerror(errno));
+err:
+    uringFreeState(state);
+    return -1;
+}
+
+/*
+ * 事件处理器扩容时，调整每个 fd 的监听状态数组以及暂存数组的大小
+ */
+int aeUringResize(aeEventLoop *eventLoop, int setsize) {
+    eventUring_State *state = eventLoop->apidata;
+    int oldsize = eventLoop->setsize;
+
+    state->armed = zrealloc(state->armed, sizeof(int)*setsize);
+    state->gen = zrealloc(state->gen, sizeof(unsigned)*setsize);
+    state->ready = zrealloc(state->ready, sizeof(int)*setsize);
+    state->ready_mask = zrealloc(state->ready_mask, sizeof(int)*setsize);
+    state->io_privdata = zrealloc(state->io_privdata, sizeof(void*)*setsize);
+    state->io_res = zrealloc(state->io_res, sizeof(int)*setsize);
+    if (setsize > oldsize) {
+        memset(state->armed+oldsize, 0, sizeof(int)*(setsize-oldsize));
+        memset(state->gen+oldsize, 0, sizeof(unsigned)*(setsize-oldsize));
+        memset(state->ready_mask+oldsize, 0, sizeof(int)*(setsize-oldsize));
+    }
+    return 0;
+}
+
+/*
+ * 收割完成队列中的所有完成事件
+ * poll 请求的完成事件暂存到 state->ready 中，批量 I/O 的结果保存到 state->io_res 中
+ */
+static void uringReap(aeEventLoop *eventLoop) {
+    eventUring_State *state = eventLoop->apidata;
+    unsigned head = *state->cq_head;
+    unsigned tail = __atomic_load_n(state->cq_tail, __ATOMIC_ACQUIRE);
+
+    while (head != tail) {
+        struct io_uring_cqe *cqe = &state->cqes[head & *state->cq_mask];
+        unsigned long long data = cqe->user_data;
+        unsigned long long tag = data >> URING_TAG_SHIFT;
+
+        if (tag == URING_TAG_IO) {
+            state->io_res[data & 0xffffffff] = cqe->res;
+            state->io_done++;
+        } else if (tag == URING_TAG_POLL) {
+            int fd = data & 0xffffffff;
+            unsigned gen = (data >> 32) & URING_GEN_MASK;
+
+            // 代数不一致说明这个 poll 请求已经被取消或者替换，丢弃
+            if (fd < eventLoop->setsize && gen == state->gen[fd] && state->armed[fd] != AE_NONE) {
+                int armed = state->armed[fd], mask = 0;
+
+                // 一次性 poll 请求触发之后就失效了
+                state->armed[fd] = AE_NONE;
+                // 出错时和 epoll 的 EPOLLERR 一样，交给读写处理器去发现错误
+                if (cqe->res < 0 || (cqe->res & (POLLERR|POLLHUP))) {
+                    mask = armed;
+                } else {
+                    if (cqe->res & POLLIN) mask |= AE_READABLE;
+                    if (cqe->res & POLLOUT) mask |= AE_WRITABLE;
+                    mask &= armed;
+                }
+                if (mask) {
+                    if (state->ready_mask[fd] == AE_NONE)
+                        state->ready[state->ready_count++] = fd;
+                    state->ready_mask[fd] |= mask;
+                }
+            }
+        }
+        head++;
+    }
+    __atomic_store_n(state->cq_head, head, __ATOMIC_RELEASE);
+}
+
+/*
+ * 将已经填好的请求提交给内核，min_complete 不为 0 时等待至少这么多个完成事件，
+ * ts 为等待的超时时间，NULL 表示一直等待。
+ * 返回提交的请求数量，超时或者被信号中断不算错误，出错时返回 -1
+ */
+static int uringSubmit(aeEventLoop *eventLoop, unsigned min_complete, struct __kernel_timespec *ts) {
+    eventUring_State *state = eventLoop->apidata;
+    struct io_uring_getevents_arg arg;
+    int ret;
+
+    if (state->to_submit == 0 && min_complete == 0) return 0;
+
+    // 发布本地的提交队列尾部，内核会读取到这个位置为止的请求
+    __atomic_store_n(state->sq_tail, state->sq_local_tail, __ATOMIC_RELEASE);
+
+    memset(&arg,0,sizeof(arg));
+    arg.ts = (unsigned long long)(uintptr_t)ts;
+    while(1) {
+        if (min_complete)
+            ret = uringEnter(state->ringfd, state->to_submit, min_complete,
+                             IORING_ENTER_GETEVENTS|IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+        else
+            ret = uringEnter(state->ringfd, state->to_submit, 0, 0, NULL, 0);
+        if (ret >= 0) break;
+
+        if (errno == ETIME || errno == EINTR) return 0;
+        // 完成队列溢出，收割之后重试
+        if (errno == EBUSY) {
+            uringReap(eventLoop);
+            continue;
+        }
+        serverLog(KVDATA_WARNING, "io_uring_enter: %s\n", strerror(errno));
+        return -1;
+    }
+    state->to_submit -= ret;
+    return ret;
+}
+
+/*
+ * 取得一个空闲的请求槽，提交队列满时先把积累的请求提交给内核
+ */
+static struct io_uring_sqe *uringGetSqe(aeEventLoop *eventLoop) {
+    eventUring_State *state = eventLoop->apidata;
+    unsigned head = __atomic_load_n(state->sq_head, __ATOMIC_ACQUIRE);
+
+    if (state->sq_local_tail - head == *state->sq_entries) {
+        uringSubmit(eventLoop, 0, NULL);
+        head = __atomic_load_n(state->sq_head, __ATOMIC_ACQUIRE);
+        if (state->sq_local_tail - head == *state->sq_entries) return NULL;
+    }
+
+    unsigned idx = state->sq_local_tail & *state->sq_mask;
+    struct io_uring_sqe *sqe = &state->sqes[idx];
+    memset(sqe,0,sizeof(*sqe));
+    state->sq_array[idx] = idx;
+    state->sq_local_tail++;
+    state->to_submit++;
+    return sqe;
+}
+
+/*
+ * 按照 mask 重新提交 fd 的 poll 请求
+ * 已经提交过的 poll 请求先被取消，mask 为 AE_NONE 时只取消不提交
+ */
+static int uringArm(aeEventLoop *eventLoop, int fd, int mask) {
+    eventUring_State *state = eventLoop->apidata;
+    struct io_uring_sqe *sqe;
+
+    if (state->armed[fd] != AE_NONE) {
+        if ((sqe = uringGetSqe(eventLoop)) == NULL) return -1;
+        sqe->opcode = IORING_OP_POLL_REMOVE;
+        sqe->fd = -1;
+        sqe->addr = uringPollData(fd, state->gen[fd]);
+        sqe->user_data = URING_TAG_REMOVE << URING_TAG_SHIFT;
+        state->armed[fd] = AE_NONE;
+    }
+    // 旧请求的完成事件（包括被取消时的 -ECANCELED）都会因为代数不一致而被丢弃
+    state->gen[fd] = (state->gen[fd]+1) & URING_GEN_MASK;
+    if (mask == AE_NONE) return 0;
+
+    if ((sqe = uringGetSqe(eventLoop)) == NULL) return -1;
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    if (mask & AE_READABLE) sqe->poll32_events |= POLLIN;
+    if (mask & AE_WRITABLE) sqe->poll32_events |= POLLOUT;
+    sqe->user_data = uringPollData(fd, state->gen[fd]);
+    state->armed[fd] = mask;
+    return 0;
+}
+
+/*
+ * 监听 fd 的 mask 事件（和原有的事件合并），请求在下一次等待时才提交给内核
+ */
+int aeUringAddEvent(aeEventLoop *eventLoop, int fd, int mask) {
+    eventUring_State *state = eventLoop->apidata;
+
+    mask |= eventLoop->events[fd].mask;
+    if (state->armed[fd] == mask) return 0;
+    if (uringArm(eventLoop, fd, mask) == -1) {
+        serverLog(KVDATA_WARNING, "io_uring: submission queue is full.\n");
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * 取消对 fd 的 delmask 事件的监听
+ * 还在等待重新提交的 fd 不需要做任何事，重新提交时会使用新的掩码
+ */
+void aeUringDelEvent(aeEventLoop *eventLoop, int fd, int delmask) {
+    eventUring_State *state = eventLoop->apidata;
+    int mask = eventLoop->events[fd].mask & (~delmask);
+
+    if (state->armed[fd] == AE_NONE || state->armed[fd] == mask) return;
+    uringArm(eventLoop, fd, mask);
+}
+
+/*
+ * 重新提交上一轮触发过的 poll 请求，然后在一次 io_uring_enter 中提交所有积累的请求，
+ * 并等待至少一个完成事件或者超时，将就绪事件放入 eventLoop->fired 数组中。
+ * 返回就绪事件个数
+ */
+int aeUring_wait(aeEventLoop *eventLoop, struct timeval *tvp) {
+    eventUring_State *state = eventLoop->apidata;
+    struct __kernel_timespec ts, *tsp = NULL;
+    int j, numevents;
+
+    // fired 数组中还保存着上一轮的就绪事件，这些 fd 的 poll 请求已经失效
+    for (j = 0; j < state->last_fired; j++) {
+        int fd = eventLoop->fired[j].fd;
+        int mask = eventLoop->events[fd].mask;
+        if (mask != AE_NONE && state->armed[fd] == AE_NONE)
+            uringArm(eventLoop, fd, mask);
+    }
+
+    // 已经有暂存的就绪事件（在批量 I/O 期间收到的）时不阻塞
+    if (state->ready_count) {
+        ts.tv_sec = ts.tv_nsec = 0;
+        tsp = &ts;
+    } else if (tvp) {
+        ts.tv_sec = tvp->tv_sec;
+        ts.tv_nsec = tvp->tv_usec*1000;
+        tsp = &ts;
+    }
+    uringSubmit(eventLoop, 1, tsp);
+    uringReap(eventLoop);
+
+    numevents = state->ready_count;
+    for (j = 0; j < numevents; j++) {
+        int fd = state->ready[j];
+        eventLoop->fired[j].fd = fd;
+        eventLoop->fired[j].mask = state->ready_mask[fd];
+        state->ready_mask[fd] = AE_NONE;
+    }
+    state->ready_count = 0;
+    state->last_fired = numevents;
+    return numevents;
+}
+
+/*
+ * 将一个 recv 或 send 操作加入本批 I/O ，在 aeUringSubmitIO 时统一提交
+ * 同一批中每个 fd 最多只能有一个操作，buf 在本批完成之前必须保持有效
+ * 成功返回 AE_OK ，本批已满时返回 AE_ERR ，由调用者自己完成这个操作
+ */
+int aeUringQueueIO(aeEventLoop *eventLoop, int op, int fd, void *buf, size_t len, void *privdata) {
+    eventUring_State *state = eventLoop->apidata;
+    struct io_uring_sqe *sqe;
+
+    if (state->io_count == eventLoop->setsize) return AE_ERR;
+    if ((sqe = uringGetSqe(eventLoop)) == NULL) return AE_ERR;
+
+    sqe->opcode = (op == AE_URING_RECV) ? IORING_OP_RECV : IORING_OP_SEND;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long)buf;
+    sqe->len = len;
+    // 和非阻塞的 read/write 一样，套接字暂时不可读写时立即返回 -EAGAIN
+    sqe->msg_flags = MSG_DONTWAIT;
+    if (op == AE_URING_SEND) sqe->msg_flags |= MSG_NOSIGNAL;
+    sqe->user_data = (URING_TAG_IO << URING_TAG_SHIFT) | (unsigned)state->io_count;
+    state->io_privdata[state->io_count++] = privdata;
+    return AE_OK;
+}
+
+/*
+ * 在一次 io_uring_enter 中提交本批所有 I/O 操作（以及积累的 poll 请求），
+ * 等待它们全部完成之后，依次对每个操作调用 proc 。
+ * proc 中不能再向本批加入新的操作。
+ * 返回本批的操作数量
+ */
+int aeUringSubmitIO(aeEventLoop *eventLoop, aeUringIOProc *proc) {
+    eventUring_State *state = eventLoop->apidata;
+    int count = state->io_count;
+
+    if (count == 0) return 0;
+    while (state->io_done < count) {
+        // 提交失败时 buf 可能已经交给了内核，无法安全地继续运行
+        if (uringSubmit(eventLoop, count - state->io_done, NULL) == -1) {
+            serverLog(KVDATA_WARNING, "Fatal: can't submit I/O to io_uring.\n");
+            exit(1);
+        }
+        uringReap(eventLoop);
+    }
+
+    for (int j = 0; j < count; j++)
+        proc(eventLoop, state->io_privdata[j], state->io_res[j]);
+    state->io_count = 0;
+    state->io_done = 0;
+    return count;
+}
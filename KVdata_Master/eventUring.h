@@ -0,0 +1,80 @@
+#ifndef KVDATA_EVENTURING_H
+#define KVDATA_EVENTURING_H
+#include <stddef.h>
+#include <linux/io_uring.h>
+#include "events.h"
+
+#define AE_URING_MIN_ENTRIES 64       //提交队列的最小长度
+#define AE_URING_MAX_ENTRIES 32768    //提交队列的最大长度，内核的上限
+
+/*批量 I/O 操作类型*/
+#define AE_URING_RECV 0
+#define AE_URING_SEND 1
+
+//批量 I/O 完成后对每个操作调用的函数，res 为 recv/send 的返回值，出错时为 -errno
+typedef void aeUringIOProc(aeEventLoop *eventLoop, void *privdata, int res);
+
+/*
+ * io_uring 后端状态
+ *
+ * 文件事件通过一次性的 IORING_OP_POLL_ADD 监听，事件触发后在下一次等待之前重新提交，
+ * 所以和 epoll 后端一样是水平触发的语义。
+ * 添加、修改、删除监听产生的请求先积累在提交队列中，和等待一起在一次 io_uring_enter 中提交。
+ */
+typedef struct eventUring_State {
+
+    // io_uring 实例的文件描述符
+    int ringfd;
+
+    // 提交队列（SQ）环，以下指针都指向和内核共享的内存
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_entries;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    // 本地的提交队列尾部，提交时才写回 *sq_tail
+    unsigned sq_local_tail;
+    // 已经填好但还没有提交给内核的请求数量
+    unsigned to_submit;
+
+    // 完成队列（CQ）环
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    // 映射的共享内存，释放时使用
+    void *sq_ptr, *cq_ptr;
+    size_t sq_len, cq_len, sqes_len;
+
+    // armed[fd] 为 fd 当前已经提交的 poll 请求监听的事件掩码，AE_NONE 表示没有
+    int *armed;
+    // gen[fd] 为 fd 的 poll 请求代数，每次重新提交时增加，用于丢弃过期的完成事件
+    unsigned *gen;
+
+    // 已经收到、还没有交给事件处理器的就绪事件
+    // 批量 I/O 等待完成期间收到的 poll 完成事件也暂存在这里
+    int *ready;
+    int *ready_mask;
+    int ready_count;
+
+    // 上一次返回给事件处理器的就绪事件数量，这些 fd 的 poll 请求需要重新提交
+    int last_fired;
+
+    // 本批 I/O 操作的私有数据和结果
+    void **io_privdata;
+    int *io_res;
+    int io_count;
+    int io_done;
+
+} eventUring_State;
+
+int aeUringCreate(aeEventLoop *eventLoop);
+int aeUringResize(aeEventLoop *eventLoop, int setsize);
+int aeUringAddEvent(aeEventLoop *eventLoop, int fd, int mask);
+void aeUringDelEvent(aeEventLoop *eventLoop, int fd, int delmask);
+int aeUring_wait(aeEventLoop *eventLoop, struct timeval *tvp);
+int aeUringQueueIO(aeEventLoop *eventLoop, int op, int fd, void *buf, size_t len, void *privdata);
+int aeUringSubmitIO(aeEventLoop *eventLoop, aeUringIOProc *proc);
+#endif
@@ -1,28 +1,30 @@
 #include <stdio.h>
 #include "eventEpoll.h"
+#include "eventUring.h"
 #include <time.h>
 #include "zmalloc.h"
 #include "client.h"
 #include "errno.h"
 #include <string.h>
 #include <unistd.h>
+#include "ioThreads.h"
+#include "reactor.h"
+#include "clock.h"
 
 /*
  * 初始化事件处理器eventLoop
  */
 aeEventLoop *aeCreateEventLoop(int setsize)
 {
-    aeEventLoop *eventLoop = zmalloc(sizeof(aeEventLoop));
-    if(eventLoop == NULL)
-        return NULL;
+    aeEventLoop *eventLoop;
+
+    // 为事件处理器分配空间
+    if ((eventLoop = zmalloc(sizeof(*eventLoop))) == NULL) return NULL;
     // 初始化事件处理器的开关
     eventLoop->stop = 0;
     // 初始化目前已注册的最大文件事件描述符
     eventLoop->maxfd = -1;
 
-    // 为事件处理器分配空间
-    if ((eventLoop = zmalloc(sizeof(*eventLoop))) == NULL) goto err;
-
     // 为已注册文件事件结构和已就绪文件事件结构数组分配空间
     eventLoop->events = zmalloc(sizeof(aeFileEvent)*setsize);
     eventLoop->fired = zmalloc(sizeof(aeFiredEvent)*setsize);
@@ -31,20 +33,37 @@ aeEventLoop *aeCreateEventLoop(int setsize)
     // 设置事件处理器的容量，即文件事件数组的大小
     eventLoop->setsize = setsize;
 
-    // 初始化执行最近一次执行时间事件的时间
-    eventLoop->lastTime = time(NULL);
+    // 时间事件的到达时间由缓存的时钟计算，保证创建事件处理器的线程的时钟已经初始化
+    updateCachedClock();
 
-    // 初始化时间事件链表，以及时间事件id
-    eventLoop->timeEventHead = NULL;
+    // 初始化时间事件最小堆和槽位表，以及时间事件id
+    eventLoop->timeEventHeap = NULL;
+    eventLoop->timeEventHeapSize = 0;
+    eventLoop->timeEventSlots = NULL;
+    eventLoop->timeEventFreeSlots = NULL;
+    eventLoop->timeEventFreeCount = 0;
+    eventLoop->timeEventCap = 0;
     eventLoop->timeEventNextId = 0;
 
+    // 默认没有阻塞前需要执行的函数
+    eventLoop->beforesleep = NULL;
+
+    //按照配置选择多路复用后端，io_uring 不可用时退回到 epoll
+    eventLoop->backend = server.event_backend;
+    if (eventLoop->backend == AE_BACKEND_URING && aeUringCreate(eventLoop) == -1) {
+        serverLog(KVDATA_WARNING, "io_uring is not available, falling back to epoll.\n");
+        eventLoop->backend = AE_BACKEND_EPOLL;
+    }
+
     //初始化满足监听条件事件槽空间， 创建 epoll红黑树句柄，建议最大监听事件数为1024
     //将事件状态（epoll红黑树句柄+满足监听条件事件槽）存入事件处理器的状态结构eventLoop
-    if (aeApiCreate(eventLoop) == -1) goto err;
+    if (eventLoop->backend == AE_BACKEND_EPOLL && aeApiCreate(eventLoop) == -1) goto err;
 
-    // 初始化已注册文件事件监听事件为空
-    for (int i = 0; i < setsize; i++)
+    // 初始化已注册文件事件监听事件为空，且都不在红黑树上
+    for (int i = 0; i < setsize; i++) {
         eventLoop->events[i].mask = AE_NONE;//无设置
+        eventLoop->events[i].status = 0;
+    }
 
     // 返回事件处理器
     return eventLoop;
@@ -53,7 +72,7 @@ aeEventLoop *aeCreateEventLoop(int setsize)
     //释放所有已分配空间
     err:
     if (eventLoop) {
-        printf("aeCreateEventLoop error.\n");
+        serverLog(KVDATA_WARNING, "aeCreateEventLoop error.\n");
         zfree(eventLoop->events);
         zfree(eventLoop->fired);
         zfree(eventLoop);
@@ -63,6 +82,36 @@ aeEventLoop *aeCreateEventLoop(int setsize)
 }
 
 
+/*
+ * 将事件处理器的容量调整为 setsize ，已注册文件事件和已就绪文件事件数组随之扩大或缩小
+ * 如果已经注册的最大文件描述符不小于 setsize ，或者分配内存失败，返回 AE_ERR ，否则返回 AE_OK
+ */
+int aeResizeSetSize(aeEventLoop *eventLoop, int setsize)
+{
+    int i;
+
+    if (setsize == eventLoop->setsize) return AE_OK;
+    if (eventLoop->maxfd >= setsize) return AE_ERR;
+
+    // 先调整多路复用后端的状态
+    if (eventLoop->backend == AE_BACKEND_URING) {
+        if (aeUringResize(eventLoop, setsize) == -1) return AE_ERR;
+    } else {
+        if (aeApiResize(eventLoop, setsize) == -1) return AE_ERR;
+    }
+
+    eventLoop->events = zrealloc(eventLoop->events, sizeof(aeFileEvent)*setsize);
+    eventLoop->fired = zrealloc(eventLoop->fired, sizeof(aeFiredEvent)*setsize);
+    eventLoop->setsize = setsize;
+
+    // 新的槽位没有监听任何事件
+    for (i = eventLoop->maxfd+1; i < setsize; i++) {
+        eventLoop->events[i].mask = AE_NONE;
+        eventLoop->events[i].status = 0;
+    }
+    return AE_OK;
+}
+
 /*
  * 事件监听类型mask，事件处理函数proc，文件描述符fd、事件私有数据clientData
  * （1）将文件描述符fd对应的事件信息添加到已注册文件事件数组eventLoop->events[fd]中.
@@ -70,17 +119,22 @@ aeEventLoop *aeCreateEventLoop(int setsize)
  */
 int aeCreateFileEvent(aeEventLoop *eventLoop, int fd, int mask, aeFileProc *proc, void *clientData)
 {
-    //文件描述符fd超出槽大小，返回错误，并设置errno
+    //文件描述符fd超出事件处理器的容量，按倍数扩大容量
     if (fd >= eventLoop->setsize) {
-        return AE_ERR;
+        int setsize = eventLoop->setsize*2;
+        while (setsize <= fd) setsize *= 2;
+        if (aeResizeSetSize(eventLoop, setsize) == AE_ERR) return AE_ERR;
     }
     // 取出已注册文件事件数组eventLoop->events中文件描述fd对应下标的元素指针
     aeFileEvent *fe = &eventLoop->events[fd];
 
     //监听指定 fd 的指定事件
     //将文件描述符fd以及其对应的事件结构加入到epoll句柄中
-    if (aeApiAddEvent(eventLoop, fd, mask) == -1)
-        return AE_ERR;
+    if (eventLoop->backend == AE_BACKEND_URING) {
+        if (aeUringAddEvent(eventLoop, fd, mask) == -1) return AE_ERR;
+    } else {
+        if (aeApiAddEvent(eventLoop, fd, mask) == -1) return AE_ERR;
+    }
     
     // 设置fd监听的事件类型，以及事件的处理器的回调函数
     fe->mask |= mask;
@@ -92,7 +146,7 @@ int aeCreateFileEvent(aeEventLoop *eventLoop, int fd, int mask, aeFileProc *proc
     fe->clientData = clientData;
 
     //更新每次将文件描述符加入/修改到红黑树柄中的时间
-    fe->last_active = time(NULL);
+    fe->last_active = clockUnixSec();
     // 如果有需要，更新事件处理器的最大fd
     
     if (fd > eventLoop->maxfd)
@@ -134,64 +188,176 @@ void aeDeleteFileEvent(aeEventLoop *eventLoop, int fd, int mask)
     }
 
     // 取消红黑树句柄epfd对给定文件描述符fd的mask事件类型的监视
-    aeApiDelEvent(eventLoop, fd, mask);
+    if (eventLoop->backend == AE_BACKEND_URING)
+        aeUringDelEvent(eventLoop, fd, mask);
+    else
+        aeApiDelEvent(eventLoop, fd, mask);
 }
 
 /*
- * 从客户端中读取输入命令，并将其保存在查询缓冲区中
+ * 返回文件描述符 fd 正在被监听的事件类型
+ */
+int aeGetFileEvents(aeEventLoop *eventLoop, int fd) {
+    if (fd >= eventLoop->setsize) return 0;
+    return eventLoop->events[fd].mask;
+}
+
+/*
+ * 客户端套接字的读事件处理器
+ * 从客户端中读取输入命令，并将其保存在查询缓冲区中，然后解析执行命令
+ * 如果开启了 I/O 线程读，那么只将客户端加入待读链表，由 I/O 线程统一读取和解析
  */
 void recvData(struct aeEventLoop *eventLoop, int fd, void *clientData, int mask)
 {
     KVClient *c = (KVClient*) clientData;
-
-    int nread, readlen;
-    size_t qblen;
-    KVDATA_NOTUSED(eventLoop);
     KVDATA_NOTUSED(mask);
 
+    // 命令正在其他 reactor 中执行，暂停读事件，等命令返回之后再恢复
+    if (c->flags & KVDATA_FORWARDED) {
+        aeDeleteFileEvent(eventLoop, fd, AE_READABLE);
+        return;
+    }
+
+    // 推迟到 beforeSleep 中由 I/O 线程读取
+    if (postponeClientRead(c)) return;
+
+    // io_uring 后端下推迟到 beforeSleep 中，和其他客户端一起批量读取
+    // 主服务器和从服务器对应的客户端仍然立即读取
+    if (eventLoop->backend == AE_BACKEND_URING && !(c->flags & (KVDATA_MASTER|KVDATA_SLAVE))) {
+        if (!(c->flags & KVDATA_PENDING_READ)) {
+            c->flags |= KVDATA_PENDING_READ;
+            listAddNodeHead(c->reactor->clients_pending_read,c);
+        }
+        return;
+    }
+
+    // 读入出错或者遇到 EOF，释放客户端
+    if (readQueryFromClient(c) == AE_ERR) {
+        freeClient(c);
+        return;
+    }
+    // 函数会执行到缓存中的所有内容都被处理完为止
+    processInputBuffer(c);
+}
+
+/*
+ * 从客户端中读取输入命令，并将其保存在查询缓冲区中
+ * 读入成功（包括暂时不可读）返回 AE_OK ，读入出错或者客户端关闭连接返回 AE_ERR 。
+ *
+ * 这个函数可能在 I/O 线程中执行，所以不能在这里释放客户端，由调用者负责。
+ */
+int readQueryFromClient(KVClient *c)
+{
+    // 读入命令内容到查询缓存
+    size_t readlen;
+    char *buf = prepareQueryBuffer(c, &readlen);
+    int nread = read(c->fd, buf, readlen);
+    return readQueryFromClientDone(c, nread);
+}
+
+/*
+ * 为查询缓冲区分配空间，返回本次读入内容的写入位置，本次最多读入的长度保存在 readlen 中
+ *
+ * 一般每次读入 KVDATA_IOBUF_LEN 字节；
+ * 正在读入大参数时只读入参数剩余的部分，让查询缓冲区恰好是这个参数，解析时可以直接作为参数对象
+ */
+char *prepareQueryBuffer(KVClient *c, size_t *readlen)
+{
     // 获取查询缓冲区当前内容的长度
     // 如果读取出现 short read ，那么可能会有内容滞留在读取缓冲区里面,这些滞留内容也许不能完整构成一个符合协议的命令，
-    qblen = sdslen(c->querybuf);
+    size_t qblen = sdslen(c->querybuf);
+
+    *readlen = KVDATA_IOBUF_LEN;
+    if (c->multibulklen && c->bulklen != -1 && c->bulklen >= KVDATA_MBULK_BIG_ARG) {
+        // 参数（包括结尾的 "\r\n"）还没有读入的部分
+        long long remaining = (long long)(c->bulklen+2)-qblen;
+
+        if (remaining > 0 && remaining < (long long)*readlen) *readlen = remaining;
+    }
    
     // 为查询缓冲区分配空间，确保至少会有readlen+1的空闲空间
-    c->querybuf = sdsMakeRoomFor(c->querybuf, KVDATA_IOBUF_LEN);
+    c->querybuf = sdsMakeRoomFor(c->querybuf, *readlen);
+    return c->querybuf+qblen;
+}
 
-    // 读入命令内容到查询缓存
-    nread = read(fd, c->querybuf+qblen, KVDATA_IOBUF_LEN);
+/*
+ * 根据读入结果 nread 更新查询缓冲区，nread 为 -1 时错误码保存在 errno 中
+ * 返回值和 readQueryFromClient 相同
+ */
+int readQueryFromClientDone(KVClient *c, int nread)
+{
     // 读入出错
     if (nread == -1) {
         if (errno == EAGAIN) {
             //errno == EAGAIN当前不可读写，需要继续重试
-            printf("Reading from client error: %s\n",strerror(errno));
-            nread = 0;
+            return AE_OK;
         } else {
-            printf("Reading from client error: %s\n",strerror(errno));
-            //读入出错，释放客户端
-            freeClient(c);
-            return;
+            serverLog(KVDATA_VERBOSE, "Reading from client error: %s\n",strerror(errno));
+            return AE_ERR;
         }
-    // 遇到 EOF，读取结束，释放客户端
+    // 遇到 EOF，读取结束
     } else if (nread == 0) {
-        printf("Client closed connection, read 0 word.\n");
-        freeClient(c);
-        return;
+        serverLog(KVDATA_VERBOSE, "Client closed connection, read 0 word.\n");
+        return AE_ERR;
     }
 
-    if (nread) {
-        // 根据内容，更新查询缓冲区（SDS） free 和 len 属性
-        // 并将 '\0' 正确地放到内容的最后
-        sdsIncrLen(c->querybuf,nread);
-        // 记录服务器和客户端最后一次互动的时间
-        c->lastinteraction = server.unixtime;
-        // 如果客户端是主服务器 master 的话，更新它的复制偏移量
-        if (c->flags & KVDATA_MASTER) c->reploff += nread;
+    // 根据内容，更新查询缓冲区（SDS） free 和 len 属性
+    // 并将 '\0' 正确地放到内容的最后
+    sdsIncrLen(c->querybuf,nread);
+    // 记录服务器和客户端最后一次互动的时间
+    c->lastinteraction = server.unixtime;
+    // 如果客户端是主服务器 master 的话，更新它的复制偏移量
+    if (c->flags & KVDATA_MASTER) c->reploff += nread;
+    return AE_OK;
+}
 
-    } 
-    // 函数会执行到缓存中的所有内容都被处理完为止
-    processInputBuffer(c);
+/*
+ * 批量读取的完成回调，res 为 recv 的返回值，出错时为 -errno
+ */
+static void readQueryFromClientUsingUringDone(aeEventLoop *eventLoop, void *privdata, int res)
+{
+    KVClient *c = privdata;
+    KVDATA_NOTUSED(eventLoop);
 
+    if (res < 0) {
+        errno = -res;
+        res = -1;
+    }
+    // 读入出错或者遇到 EOF，释放客户端
+    if (readQueryFromClientDone(c, res) == AE_ERR) {
+        freeClient(c);
+        return;
+    }
+    processInputBuffer(c);
 }
 
+/*
+ * io_uring 后端下，为待读链表中的每个客户端发起一个 recv ，
+ * 在一次 io_uring_enter 中全部提交并等待完成，然后依次解析执行读入的命令。
+ * 返回处理的客户端数量
+ */
+int handleClientsWithPendingReadsUsingUring(aeEventLoop *eventLoop)
+{
+    list *pending = currentReactor->clients_pending_read;
+    int processed = listLength(pending);
+
+    while(listLength(pending)) {
+        listNode *ln = listFirst(pending);
+        KVClient *c = listNodeValue(ln);
+        c->flags &= ~KVDATA_PENDING_READ;
+        listUnlinkNode(pending,ln);
+
+        size_t readlen;
+        char *buf = prepareQueryBuffer(c, &readlen);
+        // 本批已满，直接读取
+        if (aeUringQueueIO(eventLoop, AE_URING_RECV, c->fd, buf, readlen, c) == AE_ERR) {
+            int nread = read(c->fd, buf, readlen);
+            readQueryFromClientUsingUringDone(eventLoop, c, nread == -1 ? -errno : nread);
+        }
+    }
+    aeUringSubmitIO(eventLoop, readQueryFromClientUsingUringDone);
+    return processed;
+}
 
 /*
  * 开启事件处理器的主循环，开始处理事件
@@ -202,11 +368,21 @@ void aeMain(aeEventLoop *eventLoop) {
     eventLoop->stop = 0;
 
     while (!eventLoop->stop) {
+        // 如果有需要在事件处理前执行的函数，那么运行它
+        if (eventLoop->beforesleep != NULL)
+            eventLoop->beforesleep(eventLoop);
         // 开始处理事件
         aeProcessEvents(eventLoop, AE_ALL_EVENTS);
     }
 }
 
+/*
+ * 设置处理事件前需要被执行的函数
+ */
+void aeSetBeforeSleepProc(aeEventLoop *eventLoop, aeBeforeSleepProc *beforesleep) {
+    eventLoop->beforesleep = beforesleep;
+}
+
 
 /*
  * 处理所有已到达的时间事件，以及所有已就绪的文件事件。
@@ -248,6 +424,9 @@ int aeProcessEvents(aeEventLoop *eventLoop, int flags)
             // 计算距今最近的时间事件还要多久才能达到
             // 并将该时间距保存在 tv 结构中
             long now_sec, now_ms;
+            // 上一次刷新时钟之后执行了文件事件和 beforeSleep ，重新读取时钟，
+            // 否则时间事件会晚到达这段时间
+            updateCachedClock();
             aeGetTime(&now_sec, &now_ms);//取出当前时间的秒和毫秒，
 
             tvp = &tv;
@@ -279,7 +458,13 @@ int aeProcessEvents(aeEventLoop *eventLoop, int flags)
         }
        
         // 处理文件事件，阻塞时间由 tvp 决定
-        numevents = aeEpoll_wait(eventLoop, tvp);
+        if (eventLoop->backend == AE_BACKEND_URING)
+            numevents = aeUring_wait(eventLoop, tvp);
+        else
+            numevents = aeEpoll_wait(eventLoop, tvp);
+
+        // 等待可能阻塞了很久，刷新缓存的时钟，本次迭代中的事件处理器都读取这个时间
+        updateCachedClock();
 
         for (j = 0; j < numevents; j++) {
             
@@ -301,6 +486,8 @@ int aeProcessEvents(aeEventLoop *eventLoop, int flags)
                 rfired = 1;
                 fe->rfileProc(eventLoop,fd,fe->clientData,mask);
             }
+            // 读事件处理器可能让事件处理器扩容，重新获取事件结构
+            fe = &eventLoop->events[fd];
             // 写事件
             if (fe->mask & mask & AE_WRITABLE) {
                 if (!rfired || fe->wfileProc != fe->rfileProc)
@@ -319,36 +506,122 @@ int aeProcessEvents(aeEventLoop *eventLoop, int flags)
 }
 
 
+/*
+ * 比较两个时间事件的到达时间，a 比 b 早到达时返回 1
+ */
+static int aeTimeEventBefore(aeTimeEvent *a, aeTimeEvent *b)
+{
+    return a->when_sec < b->when_sec ||
+           (a->when_sec == b->when_sec && a->when_ms < b->when_ms);
+}
+
+/*
+ * 将时间事件 te 放到堆的 idx 位置，并记录它在堆中的下标
+ */
+static void aeTimeHeapSet(aeEventLoop *eventLoop, int idx, aeTimeEvent *te)
+{
+    eventLoop->timeEventHeap[idx] = te;
+    te->heap_index = idx;
+}
+
+/*
+ * 将堆中 idx 位置的时间事件向上调整，直到它不比父节点早到达
+ */
+static void aeTimeHeapSiftUp(aeEventLoop *eventLoop, int idx)
+{
+    aeTimeEvent *te = eventLoop->timeEventHeap[idx];
+
+    while (idx > 0) {
+        int parent = (idx-1)/2;
+        if (!aeTimeEventBefore(te, eventLoop->timeEventHeap[parent])) break;
+        aeTimeHeapSet(eventLoop, idx, eventLoop->timeEventHeap[parent]);
+        idx = parent;
+    }
+    aeTimeHeapSet(eventLoop, idx, te);
+}
+
+/*
+ * 将堆中 idx 位置的时间事件向下调整，直到它不比子节点晚到达
+ */
+static void aeTimeHeapSiftDown(aeEventLoop *eventLoop, int idx)
+{
+    aeTimeEvent *te = eventLoop->timeEventHeap[idx];
+    int size = eventLoop->timeEventHeapSize;
+
+    while (1) {
+        int child = idx*2+1;
+        if (child >= size) break;
+        // 选择两个子节点中更早到达的那个
+        if (child+1 < size &&
+            aeTimeEventBefore(eventLoop->timeEventHeap[child+1], eventLoop->timeEventHeap[child]))
+            child++;
+        if (!aeTimeEventBefore(eventLoop->timeEventHeap[child], te)) break;
+        aeTimeHeapSet(eventLoop, idx, eventLoop->timeEventHeap[child]);
+        idx = child;
+    }
+    aeTimeHeapSet(eventLoop, idx, te);
+}
+
+/*
+ * 将时间事件加入堆中
+ */
+static void aeTimeHeapPush(aeEventLoop *eventLoop, aeTimeEvent *te)
+{
+    int idx = eventLoop->timeEventHeapSize++;
+    aeTimeHeapSet(eventLoop, idx, te);
+    aeTimeHeapSiftUp(eventLoop, idx);
+}
+
+/*
+ * 将时间事件从堆中移除，时间事件本身不会被释放
+ */
+static void aeTimeHeapRemove(aeEventLoop *eventLoop, aeTimeEvent *te)
+{
+    int idx = te->heap_index;
+    int last = --eventLoop->timeEventHeapSize;
+
+    te->heap_index = -1;
+    if (idx == last) return;
+
+    // 用堆的最后一个元素填补空位，然后根据它和新位置的关系向上或向下调整
+    aeTimeHeapSet(eventLoop, idx, eventLoop->timeEventHeap[last]);
+    if (idx > 0 && aeTimeEventBefore(eventLoop->timeEventHeap[idx], eventLoop->timeEventHeap[(idx-1)/2]))
+        aeTimeHeapSiftUp(eventLoop, idx);
+    else
+        aeTimeHeapSiftDown(eventLoop, idx);
+}
+
+/*
+ * 释放时间事件，并归还它占用的槽位
+ */
+static void aeFreeTimeEvent(aeEventLoop *eventLoop, aeTimeEvent *te, int slot)
+{
+    eventLoop->timeEventSlots[slot] = NULL;
+    eventLoop->timeEventFreeSlots[eventLoop->timeEventFreeCount++] = slot;
+    zfree(te);
+}
+
 /*
  * 寻找里目前时间最近的时间事件
- * 因为链表是乱序的，所以查找复杂度为 O（N）
+ * 时间事件保存在最小堆中，堆顶就是最近的时间事件，复杂度为 O(1)
 */
 aeTimeEvent *aeSearchNearestTimer(aeEventLoop *eventLoop)
 {
-    aeTimeEvent *te = eventLoop->timeEventHead;
-    aeTimeEvent *nearest = NULL;
-    //遍历时间事件链表，寻找下一个即将执行的时间事件（最近的时间事件）
-    while(te) {
-        if (!nearest || te->when_sec < nearest->when_sec ||
-            (te->when_sec == nearest->when_sec &&
-             te->when_ms < nearest->when_ms))
-            nearest = te;
-        te = te->next;
-    }
-    return nearest;
+    if (eventLoop->timeEventHeapSize == 0) return NULL;
+    return eventLoop->timeEventHeap[0];
 }
 
 /*
  * 取出当前时间的秒和毫秒，
  * 并分别将它们保存到 seconds 和 milliseconds 参数中
+ * 时间事件使用缓存的单调时钟，不受系统时间调整的影响，也不需要系统调用
  */
 void aeGetTime(long *seconds, long *milliseconds)
 {
-    struct timeval tv;
-    //gettimeofday函数会将当时的时间转换成s和ms的形式放到timeval结构中
-    gettimeofday(&tv, NULL);
-    *seconds = tv.tv_sec;
-    *milliseconds = tv.tv_usec/1000;
+    uint64_t now = clockMonotonicUs();
+
+    *seconds = now/1000000;
+    *milliseconds = (now/1000)%1000;
 }
 
 /*
@@ -357,57 +630,43 @@ void aeGetTime(long *seconds, long *milliseconds)
  */
 int processTimeEvents(aeEventLoop *eventLoop) {
     int processed = 0;
+    int budget;
     aeTimeEvent *te;
-    long long maxId;
-    time_t now = time(NULL);
-
-    // 当上一次执行时间事件的时间>now，则将所有时间事件的执行事件设置为now
-    // 通过重置事件的运行时间，
-    // 防止因时间穿插（skew）而造成的事件处理混乱
-    if (now < eventLoop->lastTime) {
-        te = eventLoop->timeEventHead;
-        while(te) {
-            te->when_sec = 0;
-            te = te->next;
-        }
-    }
-
-    // 更新最后一次处理时间事件的时间
-    eventLoop->lastTime = now;
-
-    // 遍历链表
-    // 执行那些已经到达的事件
-    te = eventLoop->timeEventHead;
-
-    while(te) {
-        long now_sec, now_ms;
+    long now_sec, now_ms;
 
-        // 获取当前时间
-        aeGetTime(&now_sec, &now_ms);
-
-        // 如果当前时间等于或等于事件的执行时间，那么说明事件已到达，执行这个事件
-        if (now_sec > te->when_sec ||
-            (now_sec == te->when_sec && now_ms >= te->when_ms))
-        {
-            int retval;
-            // 执行事件处理器，并获取返回值
-            retval = te->timeProc(eventLoop, te->clientData);
-            processed++;
-
-            // 记录是否有需要循环执行这个事件时间
-            if (retval != AE_TIMECIRCLE) {
-                // 是的， retval 毫秒之后继续执行这个时间事件
-                aeAddMillisecondsToNow(retval,&te->when_sec,&te->when_ms);
-            } else {
-                // 不，将这个事件删除
-                aeDeleteTimeEvent(eventLoop, te->id);
-            }
-
-            // 因为执行事件之后，事件列表可能已经被改变了
-            // 因此需要将 te 放回表头，继续开始执行事件
-            te = eventLoop->timeEventHead;
+    // 获取当前时间
+    // 到达时间由单调时钟计算，系统时间被调回时不会出现时间穿插（skew）
+    aeGetTime(&now_sec, &now_ms);
+
+    // 依次取出堆顶已经到达的事件执行
+    // 本轮最多执行开始时堆中事件数量那么多次，
+    // 避免在处理器中创建的 0 毫秒事件或者总是返回 0 的事件让本轮无法结束
+    budget = eventLoop->timeEventHeapSize;
+    while (budget-- > 0 && eventLoop->timeEventHeapSize) {
+        te = eventLoop->timeEventHeap[0];
+
+        // 堆顶都还没有到达，其余的事件更不会到达
+        if (now_sec < te->when_sec ||
+            (now_sec == te->when_sec && now_ms < te->when_ms))
+            break;
+
+        int retval;
+        long long id = te->id;
+        int slot = (int)(id & 0xffffffff);
+
+        // 执行期间事件不在堆中，处理器中删除它只会将 id 标记为 AE_DELETED_EVENT_ID
+        aeTimeHeapRemove(eventLoop, te);
+        // 执行事件处理器，并获取返回值
+        retval = te->timeProc(eventLoop, te->clientData);
+        processed++;
+
+        if (te->id == AE_DELETED_EVENT_ID || retval == AE_TIMECIRCLE) {
+            // 事件在执行时被删除，或者不需要再次执行，释放这个事件
+            aeFreeTimeEvent(eventLoop, te, slot);
         } else {
-            te = te->next;
+            // retval 毫秒之后继续执行这个时间事件
+            aeAddMillisecondsToNow(retval,&te->when_sec,&te->when_ms);
+            aeTimeHeapPush(eventLoop, te);
         }
     }
     return processed;
@@ -442,52 +701,70 @@ void aeAddMillisecondsToNow(long long milliseconds, long *sec, long *ms) {
 
 /*
  * 删除给定 id 的时间事件
+ * 通过 id 的低 32 位找到槽位，复杂度为 O(logN)
  * 成功返回AE_OK，失败返回AE_ERR
  */
 int aeDeleteTimeEvent(aeEventLoop *eventLoop, long long id)
 {
-    aeTimeEvent *te, *prev = NULL;
+    aeTimeEvent *te;
+    int slot = (int)(id & 0xffffffff);
 
-    // 遍历时间事件链表
-    te = eventLoop->timeEventHead;
-    while(te) {
+    if (id < 0 || slot >= eventLoop->timeEventCap) return AE_ERR;
+    te = eventLoop->timeEventSlots[slot];
+    // 槽位为空，或者已经被其他事件复用
+    if (te == NULL || te->id != id) return AE_ERR; /* 没有找到具有指定ID的时间事件 */
+
+    // 事件正在执行，只做标记，由 processTimeEvents 在执行完之后释放
+    if (te->heap_index == -1) {
+        te->id = AE_DELETED_EVENT_ID;
+        return AE_OK;
+    }
 
-        // 发现目标事件，删除
-        if (te->id == id) {
+    // 从堆中移除并释放时间事件
+    aeTimeHeapRemove(eventLoop, te);
+    aeFreeTimeEvent(eventLoop, te, slot);
+    return AE_OK;
+}
 
-            //如果目标事件是表头位置，更新表头
-            if (prev == NULL)
-                eventLoop->timeEventHead = te->next;
-                //如果目标事件不是表头，连接该节点前后
-            else
-                prev->next = te->next;
+/*
+ * 扩大时间事件最小堆、槽位表和空闲槽位栈的容量，新的槽位都是空闲的
+ */
+static void aeExpandTimeEvents(aeEventLoop *eventLoop)
+{
+    int oldcap = eventLoop->timeEventCap;
+    int newcap = oldcap ? oldcap*2 : AE_TIME_EVENTS_INIT_SIZE;
 
-            // 释放时间事件
-            zfree(te);
+    eventLoop->timeEventHeap = zrealloc(eventLoop->timeEventHeap, sizeof(aeTimeEvent*)*newcap);
+    eventLoop->timeEventSlots = zrealloc(eventLoop->timeEventSlots, sizeof(aeTimeEvent*)*newcap);
+    eventLoop->timeEventFreeSlots = zrealloc(eventLoop->timeEventFreeSlots, sizeof(int)*newcap);
 
-            return AE_OK;
-        }
-        prev = te;
-        te = te->next;
+    // 从大到小压栈，先分配编号小的槽位
+    for (int j = newcap-1; j >= oldcap; j--) {
+        eventLoop->timeEventSlots[j] = NULL;
+        eventLoop->timeEventFreeSlots[eventLoop->timeEventFreeCount++] = j;
     }
-    return AE_ERR; /* 没有找到具有指定ID的时间事件 */
+    eventLoop->timeEventCap = newcap;
 }
 
 /*
  * 创建时间事件，并设置事件启动事件，回调函数等
+ * 时间事件 id 的高位是递增的序号，低 32 位是事件所在的槽位
  * 返回时间事件id
  */
 long long aeCreateTimeEvent(aeEventLoop *eventLoop, long long milliseconds,
                             aeTimeProc *proc, void *clientData)
 {
-    // 更新时间计数器
-    long long id = eventLoop->timeEventNextId++;
-
     // 创建时间事件结构
     aeTimeEvent *te = zmalloc(sizeof(aeTimeEvent));
     if (te == NULL)
         return AE_ERR;
-    // 设置时间事件 ID
+
+    // 分配一个空闲槽位，没有时扩容
+    if (eventLoop->timeEventFreeCount == 0) aeExpandTimeEvents(eventLoop);
+    int slot = eventLoop->timeEventFreeSlots[--eventLoop->timeEventFreeCount];
+
+    // 更新时间计数器，并设置时间事件 ID
+    long long id = (eventLoop->timeEventNextId++ << AE_TIME_EVENT_SLOT_BITS) | slot;
     te->id = id;
 
     // 设定处理事件的时间
@@ -496,9 +773,9 @@ long long aeCreateTimeEvent(aeEventLoop *eventLoop, long long milliseconds,
     te->timeProc = proc;
     // 设置私有数据
     te->clientData = clientData;
-    // 将新事件放入时间事件表头【头插法】
-    te->next = eventLoop->timeEventHead;
-    eventLoop->timeEventHead = te;
+    // 将新事件放入槽位表和最小堆中
+    eventLoop->timeEventSlots[slot] = te;
+    aeTimeHeapPush(eventLoop, te);
 
     //返回时间事件id
     return id;
@@ -20,6 +20,17 @@
 /*决定时间事件是否要持续执行的 flag */
 #define AE_TIMECIRCLE -1
 
+/*时间事件最小堆和槽位表的初始容量*/
+#define AE_TIME_EVENTS_INIT_SIZE 16
+/*时间事件 id 的低 32 位是它在槽位表中的下标*/
+#define AE_TIME_EVENT_SLOT_BITS 32
+/*正在执行的时间事件被删除时，先将 id 设置为这个值，执行完之后再释放*/
+#define AE_DELETED_EVENT_ID -1
+
+/*多路复用后端*/
+#define AE_BACKEND_EPOLL 0 // epoll ，默认
+#define AE_BACKEND_URING 1 // io_uring
+
 #define KVDATA_IOBUF_LEN  (1024*16)  //默认命令读入长度
 
 struct aeEventLoop;//【此处要声明一下结构体，因为是在后面才定义的，定义之前要使用便需要声明】
@@ -29,6 +40,8 @@ struct aeEventLoop;//【此处要声明一下结构体，因为是在后面才
 typedef void aeFileProc(struct aeEventLoop *eventLoop, int fd, void *clientData, int mask);
 //时间事件处理函数
 typedef int aeTimeProc(struct aeEventLoop *eventLoop, void *clientData);
+//事件处理器每次进入阻塞等待之前执行的函数
+typedef void aeBeforeSleepProc(struct aeEventLoop *eventLoop);
 
 /*
  * 已注册文件事件结构
@@ -85,8 +98,8 @@ typedef struct aeTimeEvent {
     // 事件处理函数
     aeTimeProc *timeProc;
 
-    // 指向下个时间事件结构，形成链表
-    struct aeTimeEvent *next;
+    // 在时间事件最小堆中的下标，正在执行时不在堆中，为 -1
+    int heap_index;
 
     // 多路复用库的私有数据
     void *clientData;
@@ -97,37 +110,54 @@ typedef struct aeEventLoop{
     // 目前已注册的最大描述符
     int maxfd;   
 
-    // 事件处理器当前容量
+    // 事件处理器当前容量，注册的文件描述符超出容量时自动扩大
     int setsize;
 
     // 用于生成时间事件 id
     long long timeEventNextId;
 
-    // 最近一次执行时间事件的时间（已执行）
-    time_t lastTime;    
-
     // 已注册的文件事件
     aeFileEvent *events; 
 
     // 已就绪的文件事件
     aeFiredEvent *fired;
 
-    // 时间事件链表（时间事件采用头插法）
-    aeTimeEvent *timeEventHead;
+    // 时间事件最小堆，按到达时间排序，堆顶就是最近的时间事件
+    // 插入和删除的复杂度为 O(logN) ，查找最近的时间事件为 O(1)
+    aeTimeEvent **timeEventHeap;
+    int timeEventHeapSize;
+
+    // 时间事件槽位表，通过时间事件 id 的低 32 位在 O(1) 内找到时间事件
+    aeTimeEvent **timeEventSlots;
+    // 空闲槽位栈
+    int *timeEventFreeSlots;
+    int timeEventFreeCount;
+
+    // 堆、槽位表和空闲槽位栈的容量
+    int timeEventCap;
 
     // 事件处理器的开关
     int stop;
 
+    // 每次进入阻塞等待文件事件之前执行的函数
+    aeBeforeSleepProc *beforesleep;
+
+    // 使用的多路复用后端，AE_BACKEND_EPOLL 或 AE_BACKEND_URING
+    int backend;
+
     // 多路复用的私有数据（存储监听事件状态结构：红黑树句柄epfd+满足监听条件文件事件数组）
     void *apidata;
 
 } aeEventLoop;
 
 aeEventLoop *aeCreateEventLoop(int setsize);
+int aeResizeSetSize(aeEventLoop *eventLoop, int setsize);
 int aeCreateFileEvent(aeEventLoop *eventLoop, int fd, int mask, aeFileProc *proc, void *clientData);
 void aeDeleteFileEvent(aeEventLoop *eventLoop, int fd, int mask);
+int aeGetFileEvents(aeEventLoop *eventLoop, int fd);
 void recvData(struct aeEventLoop *eventLoop, int fd, void *clientData, int mask);
 void aeMain(aeEventLoop *eventLoop);
+void aeSetBeforeSleepProc(aeEventLoop *eventLoop, aeBeforeSleepProc *beforesleep);
 int aeProcessEvents(aeEventLoop *eventLoop, int flags);
 aeTimeEvent *aeSearchNearestTimer(aeEventLoop *eventLoop);
 void aeGetTime(long *seconds, long *milliseconds);
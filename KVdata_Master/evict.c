@@ -0,0 +1,329 @@
+#include "evict.h"
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <limits.h>
+#include "server.h"
+#include "reactor.h"
+#include "zmalloc.h"
+#include "clock.h"
+#include "slab.h"
+extern struct sharedObjectsStruct shared;
+
+/*
+ * 内存淘汰
+ *
+ * 设置了 maxmemory 之后，执行命令之前检查已分配的内存，超出上限时按照淘汰策略删除键。
+ * 精确的 LRU 需要把所有键串在一个链表中，每个键多两个指针，每次访问都要移动节点；
+ * 这里采用近似的做法：每个对象只用 24 位记录访问信息，淘汰时从字典中随机抽样，
+ * 把抽样中最空闲的键放入一个按照空闲程度排序的淘汰池，再淘汰淘汰池中最空闲的键。
+ * 淘汰池在多轮之间保留，候选键越积越好，效果接近精确的 LRU 。
+ *
+ * 多 reactor 模式下每个 reactor 只从自己的键空间分片中淘汰键，淘汰池也是每个线程一个，
+ * 键按照哈希均匀地分布在各个分片中，各个分片的淘汰是均衡的。
+ */
+
+/*
+ * 淘汰池中的候选键，按照 idle 从小到大排列，越靠后越先被淘汰
+ */
+typedef struct evictionPoolEntry {
+    // 空闲程度，LRU 为空闲时间，LFU 为 255 减去访问计数器，TTL 为越早过期越大
+    unsigned long long idle;
+    // 候选键，较短的键使用 cached 缓冲区
+    sds key;
+    // 预先分配的键缓冲区，避免每次放入候选键都要分配内存
+    sds cached;
+    // 键所在的数据库
+    int dbid;
+} evictionPoolEntry;
+
+// 当前线程的淘汰池，第一次淘汰时创建
+static __thread evictionPoolEntry *evictionPool;
+
+static const struct {
+    const char *name;
+    int policy;
+} maxmemoryPolicyTable[] = {
+    {"volatile-lru", KVDATA_MAXMEMORY_VOLATILE_LRU},
+    {"volatile-ttl", KVDATA_MAXMEMORY_VOLATILE_TTL},
+    {"allkeys-lru", KVDATA_MAXMEMORY_ALLKEYS_LRU},
+    {"allkeys-lfu", KVDATA_MAXMEMORY_ALLKEYS_LFU},
+    {"noeviction", KVDATA_MAXMEMORY_NO_EVICTION},
+    {NULL, 0}
+};
+
+/*
+ * 根据名字返回淘汰策略，无法识别时返回 -1
+ */
+int maxmemoryPolicyFromName(const char *name) {
+    for (int j = 0; maxmemoryPolicyTable[j].name; j++) {
+        if (!strcasecmp(name,maxmemoryPolicyTable[j].name))
+            return maxmemoryPolicyTable[j].policy;
+    }
+    return -1;
+}
+
+/*
+ * 返回淘汰策略的名字
+ */
+const char *maxmemoryPolicyName(int policy) {
+    for (int j = 0; maxmemoryPolicyTable[j].name; j++) {
+        if (maxmemoryPolicyTable[j].policy == policy)
+            return maxmemoryPolicyTable[j].name;
+    }
+    return "unknown";
+}
+
+/*
+ * 返回当前的 LRU 时钟，精度为 KVDATA_LRU_CLOCK_RESOLUTION 毫秒
+ * 由当前线程的缓存时钟换算，不需要系统调用
+ */
+unsigned int getLRUClock(void) {
+    return (clockUnixMs()/KVDATA_LRU_CLOCK_RESOLUTION) & KVDATA_LRU_CLOCK_MAX;
+}
+
+/*
+ * 估计对象 o 的空闲时间（毫秒），LRU 时钟回绕之后仍然正确（只回绕一次的话）
+ */
+unsigned long long estimateObjectIdleTime(robj *o) {
+    unsigned long long lruclock = getLRUClock();
+
+    if (lruclock >= o->lru) {
+        return (lruclock - o->lru) * KVDATA_LRU_CLOCK_RESOLUTION;
+    } else {
+        return (lruclock + (KVDATA_LRU_CLOCK_MAX - o->lru)) * KVDATA_LRU_CLOCK_RESOLUTION;
+    }
+}
+
+/*
+ * 返回当前的分钟数，只保留低 16 位，用作 LFU 数据中的衰减时间
+ */
+static unsigned long LFUGetTimeInMinutes(void) {
+    return (clockUnixMs()/60000) & 65535;
+}
+
+/*
+ * 返回从衰减时间 ldt 到现在经过的分钟数，16 位的分钟数回绕之后仍然正确
+ */
+static unsigned long LFUTimeElapsed(unsigned long ldt) {
+    unsigned long now = LFUGetTimeInMinutes();
+    if (now >= ldt) return now-ldt;
+    return 65535-ldt+now;
+}
+
+/*
+ * 以对数的概率增加访问计数器，计数器越大越难增加，8 位可以表示上百万次访问
+ */
+static uint8_t LFULogIncr(uint8_t counter) {
+    double r, baseval, p;
+
+    if (counter == 255) return 255;
+    r = (double)rand()/RAND_MAX;
+    baseval = counter - KVDATA_LFU_INIT_VAL;
+    if (baseval < 0) baseval = 0;
+    p = 1.0/(baseval*KVDATA_LFU_LOG_FACTOR+1);
+    if (r < p) counter++;
+    return counter;
+}
+
+/*
+ * 返回对象 o 按照空闲时间衰减之后的访问计数器，对象本身不会被修改
+ */
+static unsigned long LFUDecrAndReturn(robj *o) {
+    unsigned long ldt = o->lru >> 8;
+    unsigned long counter = o->lru & 255;
+    unsigned long num_periods = LFUTimeElapsed(ldt) / KVDATA_LFU_DECAY_TIME;
+
+    if (num_periods)
+        counter = (num_periods > counter) ? 0 : counter - num_periods;
+    return counter;
+}
+
+/*
+ * 返回新保存到数据库中的对象的访问信息
+ */
+unsigned int objectInitialLRU(void) {
+    if (server.maxmemory_policy & KVDATA_MAXMEMORY_FLAG_LFU)
+        return (LFUGetTimeInMinutes()<<8) | KVDATA_LFU_INIT_VAL;
+    return getLRUClock();
+}
+
+/*
+ * 对象 o 被访问，更新它的访问信息
+ * LRU 策略下记录访问时间，LFU 策略下先衰减再以对数的概率增加计数器
+ * 共享对象被多个键引用，不记录访问信息
+ */
+void objectTouch(robj *o) {
+    if (o->refcount == KVDATA_SHARED_REFCOUNT) return;
+    if (server.maxmemory_policy & KVDATA_MAXMEMORY_FLAG_LFU) {
+        unsigned long counter = LFUDecrAndReturn(o);
+        counter = LFULogIncr(counter);
+        o->lru = (LFUGetTimeInMinutes()<<8) | counter;
+    } else {
+        o->lru = getLRUClock();
+    }
+}
+
+/*
+ * 创建淘汰池
+ */
+static evictionPoolEntry *evictionPoolAlloc(void) {
+    evictionPoolEntry *ep = zmalloc(sizeof(*ep)*KVDATA_EVPOOL_SIZE);
+
+    for (int j = 0; j < KVDATA_EVPOOL_SIZE; j++) {
+        ep[j].idle = 0;
+        ep[j].key = NULL;
+        ep[j].cached = sdsMakeRoomFor(sdsnewlen("",0),KVDATA_EVPOOL_CACHED_SDS_SIZE);
+        ep[j].dbid = 0;
+    }
+    return ep;
+}
+
+/*
+ * 从字典 sampledict 中抽样，把比淘汰池中已有的候选键更空闲的键放入淘汰池
+ * 淘汰池已满时挤掉最不空闲的候选键
+ * sampledict 是数据库字典或者过期键索引，两者的节点都是数据库节点
+ */
+static void evictionPoolPopulate(int dbid, dict *sampledict, evictionPoolEntry *pool) {
+    dictEntry *samples[KVDATA_MAXMEMORY_SAMPLES_MAX];
+    unsigned int count;
+
+    count = dictGetSomeKeys(sampledict,samples,server.maxmemory_samples);
+    for (unsigned int j = 0; j < count; j++) {
+        dictEntry *de = samples[j];
+        unsigned long long idle;
+        sds cached;
+        int k = 0;
+
+        // 计算键的空闲程度
+        if (server.maxmemory_policy & KVDATA_MAXMEMORY_FLAG_LRU) {
+            idle = estimateObjectIdleTime(dictGetVal(de));
+        } else if (server.maxmemory_policy & KVDATA_MAXMEMORY_FLAG_LFU) {
+            idle = 255-LFUDecrAndReturn(dictGetVal(de));
+        } else {
+            // 越早过期的键越先被淘汰
+            idle = ULLONG_MAX - de->expire;
+        }
+
+        // 找到第一个空位，或者第一个不比它更不空闲的候选键
+        while (k < KVDATA_EVPOOL_SIZE && pool[k].key && pool[k].idle < idle) k++;
+        if (k == 0 && pool[KVDATA_EVPOOL_SIZE-1].key != NULL) {
+            // 淘汰池已满，并且这个键比所有候选键都不空闲
+            continue;
+        } else if (k < KVDATA_EVPOOL_SIZE && pool[k].key == NULL) {
+            // 放入空位
+        } else {
+            if (pool[KVDATA_EVPOOL_SIZE-1].key == NULL) {
+                // 右边还有空位，把 k 及之后的候选键右移一位
+                cached = pool[KVDATA_EVPOOL_SIZE-1].cached;
+                memmove(pool+k+1,pool+k,sizeof(pool[0])*(KVDATA_EVPOOL_SIZE-k-1));
+                pool[k].cached = cached;
+            } else {
+                // 没有空位，挤掉最左边（最不空闲）的候选键，k 之前的候选键左移一位
+                k--;
+                cached = pool[0].cached;
+                if (pool[0].key != pool[0].cached) sdsfree(pool[0].key);
+                memmove(pool,pool+1,sizeof(pool[0])*k);
+                pool[k].cached = cached;
+            }
+        }
+
+        // 复制键，节点可能在下一次淘汰之前被删除
+        if (sdslen(de->key) > KVDATA_EVPOOL_CACHED_SDS_SIZE) {
+            pool[k].key = sdsdup(de->key);
+        } else {
+            pool[k].cached = sdscpylen(pool[k].cached,de->key,sdslen(de->key));
+            pool[k].key = pool[k].cached;
+        }
+        pool[k].idle = idle;
+        pool[k].dbid = dbid;
+    }
+}
+
+/*
+ * 返回和 maxmemory 比较的内存用量
+ * 对象池中空闲的对象已经计入 used_memory ，但是会被之后分配的对象复用，不算作数据占用的内存，
+ * 否则删除键释放的 robj 留在对象池中，内存用量不会下降，淘汰会一直进行下去
+ */
+static size_t evictionUsedMemory(void) {
+    size_t used = zmalloc_used_memory(), poolfree = slabFreeMemory();
+    return used > poolfree ? used-poolfree : 0;
+}
+
+/*
+ * 已分配的内存超过 maxmemory 时，按照淘汰策略从数据库数组 dbs 中删除键，直到内存不超过上限
+ * 内存不超过上限时返回 AE_OK ，
+ * 淘汰策略为 noeviction 或者没有可以淘汰的键时返回 AE_ERR
+ */
+int freeMemoryIfNeeded(KVdataDb *dbs) {
+    int policy = server.maxmemory_policy;
+    long long evicted = 0;
+
+    if (server.maxmemory == 0 || evictionUsedMemory() <= server.maxmemory) return AE_OK;
+    if (policy == KVDATA_MAXMEMORY_NO_EVICTION) return AE_ERR;
+    if (evictionPool == NULL) evictionPool = evictionPoolAlloc();
+
+    while (evictionUsedMemory() > server.maxmemory) {
+        sds bestkey = NULL;
+        int bestdbid = 0;
+
+        while (bestkey == NULL) {
+            unsigned long total_keys = 0;
+            int k;
+
+            // 从每个数据库中抽样，补充淘汰池
+            for (int j = 0; j < server.dbnum; j++) {
+                dict *d = (policy & KVDATA_MAXMEMORY_FLAG_ALLKEYS) ? dbs[j].DB : dbs[j].expires;
+                if (dictSize(d) == 0) continue;
+                evictionPoolPopulate(j,d,evictionPool);
+                total_keys += dictSize(d);
+            }
+            // 没有可以淘汰的键
+            if (total_keys == 0) break;
+
+            // 从最空闲的一端取出候选键，候选键可能已经被删除或者不再带有过期时间
+            for (k = KVDATA_EVPOOL_SIZE-1; k >= 0; k--) {
+                dictEntry *de;
+
+                if (evictionPool[k].key == NULL) continue;
+                bestdbid = evictionPool[k].dbid;
+                de = dictFind((policy & KVDATA_MAXMEMORY_FLAG_ALLKEYS) ?
+                              dbs[bestdbid].DB : dbs[bestdbid].expires,
+                              evictionPool[k].key);
+                if (evictionPool[k].key != evictionPool[k].cached)
+                    sdsfree(evictionPool[k].key);
+                evictionPool[k].key = NULL;
+                evictionPool[k].idle = 0;
+                if (de) {
+                    bestkey = de->key;
+                    break;
+                }
+            }
+        }
+        if (bestkey == NULL) break;
+
+        // 删除键，bestkey 是节点中的键，在节点被释放之前一直有效
+        robj key = {.encoding = STRING, .refcount = 1, .ptr = bestkey};
+        dbDelete(&dbs[bestdbid],&key);
+        evicted++;
+    }
+    if (evicted) __atomic_add_fetch(&server.stat_evictedkeys,evicted,__ATOMIC_RELAXED);
+    return evictionUsedMemory() <= server.maxmemory ? AE_OK : AE_ERR;
+}
+
+/*
+ * 设置了 maxmemory 时，在执行客户端 c 的命令之前调用
+ * 需要时从当前线程的键空间分片中淘汰键；仍然超过上限时拒绝执行写命令，
+ * 回复 OOM 错误并返回 AE_ERR ，其他命令照常执行，返回 AE_OK
+ */
+int checkMaxmemory(KVClient *c) {
+    if (server.maxmemory == 0) return AE_OK;
+    if (freeMemoryIfNeeded(currentReactor->db) == AE_OK) return AE_OK;
+    if (!(c->cmd->flags & KVDATA_CMD_WRITE)) return AE_OK;
+
+    // 如果客户端正在执行事务，则事务执行将失败
+    flagTransaction(c);
+    __atomic_add_fetch(&c->cmd->rejected_calls,1,__ATOMIC_RELAXED);
+    addReply(c,shared.oomerr);
+    return AE_ERR;
+}
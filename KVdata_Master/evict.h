@@ -0,0 +1,38 @@
+#ifndef KVDATA_EVICT_H
+#define KVDATA_EVICT_H
+#include "object.h"
+#include "db.h"
+#include "client.h"
+
+/* 内存淘汰策略，低位的标志表示如何计算键的空闲程度，以及从哪个字典中抽样 */
+#define KVDATA_MAXMEMORY_FLAG_LRU (1<<0)
+#define KVDATA_MAXMEMORY_FLAG_LFU (1<<1)
+#define KVDATA_MAXMEMORY_FLAG_ALLKEYS (1<<2)
+#define KVDATA_MAXMEMORY_VOLATILE_LRU ((0<<8)|KVDATA_MAXMEMORY_FLAG_LRU)
+#define KVDATA_MAXMEMORY_VOLATILE_TTL (1<<8)
+#define KVDATA_MAXMEMORY_ALLKEYS_LRU ((2<<8)|KVDATA_MAXMEMORY_FLAG_LRU|KVDATA_MAXMEMORY_FLAG_ALLKEYS)
+#define KVDATA_MAXMEMORY_ALLKEYS_LFU ((3<<8)|KVDATA_MAXMEMORY_FLAG_LFU|KVDATA_MAXMEMORY_FLAG_ALLKEYS)
+#define KVDATA_MAXMEMORY_NO_EVICTION (4<<8)
+#define KVDATA_DEFAULT_MAXMEMORY_POLICY KVDATA_MAXMEMORY_NO_EVICTION
+#define KVDATA_DEFAULT_MAXMEMORY_SAMPLES 5  //每个数据库每轮抽样的键数量
+#define KVDATA_MAXMEMORY_SAMPLES_MAX 64
+#define KVDATA_EVPOOL_SIZE 16               //淘汰池中候选键的数量
+#define KVDATA_EVPOOL_CACHED_SDS_SIZE 255   //淘汰池中预先分配的键缓冲区大小，更长的键单独分配
+
+/* LRU 时钟 */
+#define KVDATA_LRU_CLOCK_MAX ((1<<KVDATA_LRU_BITS)-1)  //LRU 时钟的最大值，之后回绕
+#define KVDATA_LRU_CLOCK_RESOLUTION 1000                //LRU 时钟的精度（毫秒）
+/* LFU 对数计数器 */
+#define KVDATA_LFU_INIT_VAL 5     //新键的计数器初始值，避免刚写入的键马上被淘汰
+#define KVDATA_LFU_LOG_FACTOR 10  //计数器增长的对数因子，越大计数器增长越慢
+#define KVDATA_LFU_DECAY_TIME 1   //键每空闲这么多分钟，计数器减一
+
+unsigned int getLRUClock(void);
+unsigned long long estimateObjectIdleTime(robj *o);
+unsigned int objectInitialLRU(void);
+void objectTouch(robj *o);
+int maxmemoryPolicyFromName(const char *name);
+const char *maxmemoryPolicyName(int policy);
+int freeMemoryIfNeeded(KVdataDb *dbs);
+int checkMaxmemory(KVClient *c);
+#endif
@@ -0,0 +1,333 @@
+#include "ioThreads.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "server.h"
+#include "assert.h"
+
+/*
+ * I/O 线程
+ *
+ * 命令的执行始终在主线程中进行，I/O 线程只负责：
+ * (1)从套接字读取数据到查询缓冲区，并将其解析为 c->argv
+ * (2)将 c->buf 和 c->reply 中的回复写出到套接字
+ *
+ * 主线程在 beforeSleep 中把待处理的客户端平均分配给各个线程（0 号线程就是主线程自己），
+ * 然后等待所有线程处理完毕，所以同一时刻一个客户端只会被一个线程访问，键空间也只有主线程访问。
+ */
+
+// I/O 线程
+static pthread_t io_threads[IO_THREADS_MAX_NUM];
+// 用于让空闲的 I/O 线程休眠：主线程持有锁时，线程会阻塞在锁上
+static pthread_mutex_t io_threads_mutex[IO_THREADS_MAX_NUM];
+// 每个线程待处理的客户端数量，由主线程设置，线程处理完后清零
+static unsigned long io_threads_pending[IO_THREADS_MAX_NUM];
+// I/O 线程当前执行的操作，IO_THREADS_OP_READ 或 IO_THREADS_OP_WRITE
+static int io_threads_op;
+// 每个线程需要处理的客户端链表
+static list *io_threads_list[IO_THREADS_MAX_NUM];
+
+static unsigned long getIOPendingCount(int i) {
+    return __atomic_load_n(&io_threads_pending[i], __ATOMIC_ACQUIRE);
+}
+
+static void setIOPendingCount(int i, unsigned long count) {
+    __atomic_store_n(&io_threads_pending[i], count, __ATOMIC_RELEASE);
+}
+
+/*
+ * I/O 线程在 I/O 线程中处理单个客户端的读操作
+ */
+static void threadedReadFromClient(KVClient *c) {
+    // 读入出错或者客户端关闭连接，交给主线程释放
+    if (readQueryFromClient(c) == AE_ERR) {
+        c->flags |= KVDATA_CLOSE_ASAP;
+        return;
+    }
+    // 只解析出一条命令，命令由主线程执行
+    processInputBuffer(c);
+}
+
+/*
+ * I/O 线程的主函数
+ * 先忙等一段时间检查是否有任务，没有任务时阻塞在自己的锁上，直到主线程释放锁
+ */
+static void *IOThreadMain(void *myid) {
+    long id = (long)myid;
+
+    while(1) {
+        // 忙等待有任务到来
+        for (int j = 0; j < 1000000; j++) {
+            if (getIOPendingCount(id) != 0) break;
+        }
+
+        // 仍然没有任务，给主线程一个停止本线程的机会
+        if (getIOPendingCount(id) == 0) {
+            pthread_mutex_lock(&io_threads_mutex[id]);
+            pthread_mutex_unlock(&io_threads_mutex[id]);
+            continue;
+        }
+
+        // 处理分配给本线程的客户端
+        listNode *ln = listFirst(io_threads_list[id]);
+        while(ln != NULL) {
+            KVClient *c = listNodeValue(ln);
+            if (io_threads_op == IO_THREADS_OP_WRITE) {
+                if (writeToClient(c,0) == AE_ERR) c->flags |= KVDATA_CLOSE_ASAP;
+            } else if (io_threads_op == IO_THREADS_OP_READ) {
+                threadedReadFromClient(c);
+            } else {
+                serverLog(KVDATA_WARNING, "io_threads_op value is unknown\n");
+                abort();
+            }
+            ln = ln->next;
+        }
+        // 清空任务链表，通知主线程本线程已经处理完毕
+        while(listLength(io_threads_list[id]))
+            listUnlinkNode(io_threads_list[id],listFirst(io_threads_list[id]));
+        setIOPendingCount(id, 0);
+    }
+}
+
+/*
+ * 根据 server.io_threads_num 创建 I/O 线程
+ * 线程创建后处于停止状态，等到有足够多的客户端需要处理时才被启动
+ */
+void initThreadedIO(void) {
+    // I/O 线程默认处于非活跃状态
+    server.io_threads_active = 0;
+
+    // 只有主线程，不需要创建 I/O 线程
+    if (server.io_threads_num == 1) return;
+
+    if (server.io_threads_num > IO_THREADS_MAX_NUM) {
+        serverLog(KVDATA_WARNING, "Fatal: too many I/O threads configured. The maximum number is %d.\n", IO_THREADS_MAX_NUM);
+        exit(1);
+    }
+
+    for (int i = 0; i < server.io_threads_num; i++) {
+        io_threads_list[i] = listCreate();
+        // 0 号线程就是主线程
+        if (i == 0) continue;
+
+        pthread_t tid;
+        pthread_mutex_init(&io_threads_mutex[i],NULL);
+        setIOPendingCount(i, 0);
+        // 线程被创建后就阻塞在锁上，直到 startThreadedIO
+        pthread_mutex_lock(&io_threads_mutex[i]);
+        if (pthread_create(&tid,NULL,IOThreadMain,(void*)(long)i) != 0) {
+            serverLog(KVDATA_WARNING, "Fatal: Can't initialize IO thread.\n");
+            exit(1);
+        }
+        io_threads[i] = tid;
+    }
+    serverLog(KVDATA_NOTICE, "Threaded I/O initialized, %d I/O threads.\n", server.io_threads_num);
+}
+
+/*
+ * 启动所有 I/O 线程
+ */
+void startThreadedIO(void) {
+    assert(server.io_threads_active == 0);
+    for (int j = 1; j < server.io_threads_num; j++)
+        pthread_mutex_unlock(&io_threads_mutex[j]);
+    server.io_threads_active = 1;
+}
+
+/*
+ * 停止所有 I/O 线程，让它们阻塞在锁上，不再占用 CPU
+ */
+void stopThreadedIO(void) {
+    // 停止之前先处理完已经交给 I/O 线程读取的客户端
+    handleClientsWithPendingReadsUsingThreads();
+    assert(server.io_threads_active == 1);
+    for (int j = 1; j < server.io_threads_num; j++)
+        pthread_mutex_lock(&io_threads_mutex[j]);
+    server.io_threads_active = 0;
+}
+
+/*
+ * 待写的客户端很少时，使用 I/O 线程的同步开销比收益还大，
+ * 这时停止 I/O 线程，由主线程自己完成读写。
+ *
+ * 返回 1 表示 I/O 线程处于停止状态，返回 0 表示 I/O 线程应该被使用。
+ */
+int stopThreadedIOIfNeeded(void) {
+    int pending = listLength(server.clients_pending_write);
+
+    // 没有开启 I/O 线程
+    if (server.io_threads_num == 1) return 1;
+
+    if (pending < (server.io_threads_num*2)) {
+        if (server.io_threads_active) stopThreadedIO();
+        return 1;
+    } else {
+        return 0;
+    }
+}
+
+/*
+ * 如果 I/O 线程处于活跃状态，并且开启了 I/O 线程读，
+ * 那么将客户端加入待读链表，推迟到 beforeSleep 中由 I/O 线程读取，并返回 1 。
+ * 否则返回 0 ，由调用者立即读取。
+ *
+ * 主服务器和从服务器对应的客户端总是由主线程读取。
+ */
+int postponeClientRead(KVClient *c) {
+    if (server.io_threads_active &&
+        server.io_threads_do_reads &&
+        !(c->flags & (KVDATA_MASTER|KVDATA_SLAVE|KVDATA_PENDING_READ)))
+    {
+        c->flags |= KVDATA_PENDING_READ;
+        listAddNodeHead(server.clients_pending_read,c);
+        return 1;
+    } else {
+        return 0;
+    }
+}
+
+/*
+ * 将待读链表中的客户端分配给各个 I/O 线程读取并解析，
+ * 然后在主线程中依次执行解析出来的命令。
+ * 返回处理的客户端数量
+ */
+int handleClientsWithPendingReadsUsingThreads(void) {
+    if (!server.io_threads_active || !server.io_threads_do_reads) return 0;
+    int processed = listLength(server.clients_pending_read);
+    if (processed == 0) return 0;
+
+    // 将客户端平均分配给各个线程
+    listNode *ln = listFirst(server.clients_pending_read);
+    int item_id = 0;
+    while(ln != NULL) {
+        KVClient *c = listNodeValue(ln);
+        int target_id = item_id % server.io_threads_num;
+        listAddNodeTail(io_threads_list[target_id],c);
+        item_id++;
+        ln = ln->next;
+    }
+
+    // 通知 I/O 线程开始读取
+    io_threads_op = IO_THREADS_OP_READ;
+    for (int j = 1; j < server.io_threads_num; j++) {
+        int count = listLength(io_threads_list[j]);
+        setIOPendingCount(j, count);
+    }
+
+    // 主线程也负责处理一部分客户端
+    ln = listFirst(io_threads_list[0]);
+    while(ln != NULL) {
+        threadedReadFromClient(listNodeValue(ln));
+        ln = ln->next;
+    }
+    while(listLength(io_threads_list[0]))
+        listUnlinkNode(io_threads_list[0],listFirst(io_threads_list[0]));
+
+    // 等待所有 I/O 线程处理完毕
+    while(1) {
+        unsigned long pending = 0;
+        for (int j = 1; j < server.io_threads_num; j++)
+            pending += getIOPendingCount(j);
+        if (pending == 0) break;
+    }
+
+    // 在主线程中执行解析出来的命令
+    while(listLength(server.clients_pending_read)) {
+        ln = listFirst(server.clients_pending_read);
+        KVClient *c = listNodeValue(ln);
+        c->flags &= ~KVDATA_PENDING_READ;
+        listUnlinkNode(server.clients_pending_read,ln);
+
+        // 读入出错或者客户端关闭了连接
+        if (c->flags & KVDATA_CLOSE_ASAP) {
+            freeClient(c);
+            continue;
+        }
+
+        // 查询缓冲区中有协议错误，I/O 线程已经写好了错误回复
+        if ((c->flags & KVDATA_CLOSE_AFTER_REPLY) && clientHasPendingReplies(c)) {
+            putClientInPendingWriteQueue(c);
+            continue;
+        }
+
+        // 执行 I/O 线程已经解析出来的命令
+        if (c->flags & KVDATA_PENDING_COMMAND) {
+            c->flags &= ~KVDATA_PENDING_COMMAND;
+            if (processCommand(c) == AE_OK)
+                resetClient(c);
+        }
+        // 继续处理查询缓冲区中剩余的命令
+        processInputBuffer(c);
+    }
+    return processed;
+}
+
+/*
+ * 将待写链表中的客户端分配给各个 I/O 线程写出回复，
+ * 如果待写客户端很少，那么直接在主线程中写出。
+ * 返回处理的客户端数量
+ */
+int handleClientsWithPendingWritesUsingThreads(void) {
+    // 没有开启 I/O 线程，或者待写客户端很少，在当前线程中写出
+    // 多 reactor 模式下总是走这个分支，各个 reactor 写出自己的客户端
+    if (server.io_threads_num == 1 || stopThreadedIOIfNeeded())
+        return handleClientsWithPendingWrites();
+
+    int processed = listLength(server.clients_pending_write);
+
+    // 启动 I/O 线程
+    if (!server.io_threads_active) startThreadedIO();
+
+    // 将客户端平均分配给各个线程
+    listNode *ln = listFirst(server.clients_pending_write);
+    int item_id = 0;
+    while(ln != NULL) {
+        KVClient *c = listNodeValue(ln);
+        c->flags &= ~KVDATA_PENDING_WRITE;
+        int target_id = item_id % server.io_threads_num;
+        listAddNodeTail(io_threads_list[target_id],c);
+        item_id++;
+        ln = ln->next;
+    }
+
+    // 通知 I/O 线程开始写出
+    io_threads_op = IO_THREADS_OP_WRITE;
+    for (int j = 1; j < server.io_threads_num; j++) {
+        int count = listLength(io_threads_list[j]);
+        setIOPendingCount(j, count);
+    }
+
+    // 主线程也负责处理一部分客户端
+    ln = listFirst(io_threads_list[0]);
+    while(ln != NULL) {
+        KVClient *c = listNodeValue(ln);
+        if (writeToClient(c,0) == AE_ERR) c->flags |= KVDATA_CLOSE_ASAP;
+        ln = ln->next;
+    }
+    while(listLength(io_threads_list[0]))
+        listUnlinkNode(io_threads_list[0],listFirst(io_threads_list[0]));
+
+    // 等待所有 I/O 线程处理完毕
+    while(1) {
+        unsigned long pending = 0;
+        for (int j = 1; j < server.io_threads_num; j++)
+            pending += getIOPendingCount(j);
+        if (pending == 0) break;
+    }
+
+    // 释放出错的客户端，为一次没写完的客户端安装写事件处理器
+    while(listLength(server.clients_pending_write)) {
+        ln = listFirst(server.clients_pending_write);
+        KVClient *c = listNodeValue(ln);
+        listDetachNode(server.clients_pending_write,ln);
+
+        if (c->flags & KVDATA_CLOSE_ASAP) {
+            freeClient(c);
+            continue;
+        }
+        if (clientHasPendingReplies(c) &&
+            aeCreateFileEvent(server.eventsLoop, c->fd, AE_WRITABLE, sendReplyToClient, c) == AE_ERR)
+            freeClient(c);
+    }
+    return processed;
+}
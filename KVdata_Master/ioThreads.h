@@ -0,0 +1,18 @@
+#ifndef KVDATA_IOTHREADS_H
+#define KVDATA_IOTHREADS_H
+#include "client.h"
+
+#define IO_THREADS_MAX_NUM 128  //I/O 线程数量上限（包括主线程）
+
+/* I/O 线程当前执行的操作 */
+#define IO_THREADS_OP_READ 0   //读取并解析查询缓冲区
+#define IO_THREADS_OP_WRITE 1  //写出回复缓冲区
+
+void initThreadedIO(void);
+void startThreadedIO(void);
+void stopThreadedIO(void);
+int stopThreadedIOIfNeeded(void);
+int postponeClientRead(KVClient *c);
+int handleClientsWithPendingReadsUsingThreads(void);
+int handleClientsWithPendingWritesUsingThreads(void);
+#endif
@@ -1,6 +1,7 @@
 #include "list.h"
 #include <stdio.h>
 #include "zmalloc.h"
+#include "slab.h"
 /*
  * 创建一个新的链表
  * 创建成功返回链表，失败返回 NULL 。
@@ -33,8 +34,8 @@ list *listCreate(void)
 list *listAddNodeTail(list *list, void *value)
 {
     listNode *node;
-    // 为新节点分配内存
-    if ((node = zmalloc(sizeof(*node))) == NULL)
+    // 从对象池中为新节点分配内存
+    if ((node = slabAlloc(KVDATA_SLAB_LISTNODE)) == NULL)
         return NULL;
     // 保存值指针
     node->value = value;
@@ -64,13 +65,23 @@ list *listAddNodeHead(list *list, void *value)
 {
     listNode *node;
 
-    // 为节点分配内存
-    if ((node = zmalloc(sizeof(*node))) == NULL)
+    // 从对象池中为节点分配内存
+    if ((node = slabAlloc(KVDATA_SLAB_LISTNODE)) == NULL)
         return NULL;
 
     // 保存值指针
     node->value = value;
+    listLinkNodeHead(list,node);
+    return list;
+}
 
+/*
+ * 将调用者提供的节点 node 添加到链表的表头，不分配内存
+ * 节点可以嵌在其他结构中，从链表中摘除时应该使用 listDetachNode
+ * T = O(1)
+ */
+void listLinkNodeHead(list *list, listNode *node)
+{
     // 添加节点到空链表
     if (list->len == 0) {
         list->head = list->tail = node;
@@ -85,7 +96,6 @@ list *listAddNodeHead(list *list, void *value)
 
     // 更新链表节点数
     list->len++;
-    return list;
 }
 
 
@@ -104,12 +114,13 @@ void listRelease(list *list)
     len = list->len;
     while(len--) {
         next = current->next;
-        // 释放节点的值
-        if(current->value != NULL)
+        // 释放节点的值，设置了释放函数时使用释放函数
+        if (list->free) list->free(current->value);
+        else if(current->value != NULL)
         zfree(current->value);
          // 释放节点的结构    
         if(current != NULL)   
-        zfree(current);
+        slabFree(KVDATA_SLAB_LISTNODE,current);
 
         current = next;
     }
@@ -136,10 +147,46 @@ void listDelNode(list *list, listNode *node)
         node->next->prev = node->prev;
     else
         list->tail = node->prev;
-    // 释放值
-    zfree(node->value);
+    // 释放值，设置了释放函数时使用释放函数
+    if (list->free) list->free(node->value);
+    else zfree(node->value);
     // 释放节点
-    zfree(node);
+    slabFree(KVDATA_SLAB_LISTNODE,node);
+    // 链表数减一
+    list->len--;
+}
+
+/*
+ * 将给定节点 node 从链表 list 中摘除，并释放节点本身
+ * 与 listDelNode 不同，节点的值不会被释放，由调用者负责
+ * 主要用于保存客户端指针这类不归链表所有的值的链表
+ * T = O(1)
+ */
+void listUnlinkNode(list *list, listNode *node)
+{
+    listDetachNode(list,node);
+    // 只释放节点，不释放值
+    slabFree(KVDATA_SLAB_LISTNODE,node);
+}
+
+/*
+ * 将给定节点 node 从链表 list 中摘除，节点本身和节点的值都不会被释放
+ * 和 listLinkNodeHead 配合使用
+ * T = O(1)
+ */
+void listDetachNode(list *list, listNode *node)
+{
+    // 调整前置节点的指针
+    if (node->prev)
+        node->prev->next = node->next;
+    else
+        list->head = node->next;
+    // 调整后置节点的指针
+    if (node->next)
+        node->next->prev = node->prev;
+    else
+        list->tail = node->prev;
+    node->prev = node->next = NULL;
     // 链表数减一
     list->len--;
 }
@@ -149,11 +196,7 @@ void listDelNode(list *list, listNode *node)
  */
 listNode *listNext(listNode *node)
 {
-    listNode *next;
-    if((next = zmalloc(sizeof(*next)))==NULL)
-        return NULL;
-    next = node->next;
-    return next;
+    return node->next;
 }
 
 
@@ -189,6 +232,9 @@ listNode *listSearchKey(list *list, void *key)
  * 复制整个链表。
  * 复制成功返回输入链表的副本，
  * 如果因为内存不足而造成复制失败，返回 NULL 。
+ *
+ * 如果链表设置了值复制函数 dup ，那么使用它复制节点的值，
+ * 否则新节点和原节点共享同一个值。
  * 
  * 主要用于多个从节点复制同一主节点时，通过共享回复缓冲区中的内容来减少SAVE的次数
  * T = O(N)
@@ -201,11 +247,16 @@ list *listDup(list *orig)
     // 创建新链表
     if ((copy = listCreate()) == NULL)
         return NULL;
+    // 设置值处理函数
+    copy->dup = orig->dup;
+    copy->free = orig->free;
+    copy->match = orig->match;
     // 迭代整个输入链表
     node = orig->head;
     while(node != NULL) {
+        void *value = copy->dup ? copy->dup(node->value) : node->value;
          // 将节点添加到链表
-        if (listAddNodeTail(copy, node->value) == NULL) {
+        if (listAddNodeTail(copy, value) == NULL) {
             listRelease(copy);
             return NULL;
         }
@@ -39,11 +39,18 @@ typedef struct list {
 #define listLast(l) ((l)->tail)
 // 返回给定链表的表头节点
 #define listFirst(l) ((l)->head)
+// 设置链表的节点值复制函数
+#define listSetDupMethod(l,m) ((l)->dup = (m))
+// 设置链表的节点值释放函数
+#define listSetFreeMethod(l,m) ((l)->free = (m))
 list *listCreate(void);
 list *listAddNodeTail(list *list, void *value);
 list *listAddNodeHead(list *list, void *value);
 void listRelease(list *list);
 void listDelNode(list *list, listNode *node);
+void listUnlinkNode(list *list, listNode *node);
+void listLinkNodeHead(list *list, listNode *node);
+void listDetachNode(list *list, listNode *node);
 listNode *listSearchKey(list *list, void *key);
 list *listDup(list *orig);
 #endif
\ No newline at end of file
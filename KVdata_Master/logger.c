@@ -0,0 +1,247 @@
+#include "logger.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include "server.h"
+
+/*
+ * 异步日志
+ *
+ * 各个线程（主线程、I/O 线程、reactor）把格式化好的日志放入一个有界的无锁环形缓冲区，
+ * 由后台日志线程取出并写入日志文件，事件循环不会因为写日志而阻塞。
+ * 缓冲区满时直接丢弃日志并计数，下一次写出时报告丢弃的数量。
+ *
+ * 环形缓冲区是多生产者单消费者的：
+ * 每个槽位有一个序号，序号等于 pos 表示槽位空闲、可以被第 pos 条日志占用，
+ * 等于 pos+1 表示第 pos 条日志已经写好、可以被消费者取出。
+ */
+typedef struct logSlot {
+    // 槽位序号
+    unsigned long seq;
+    // 日志级别
+    int level;
+    // 日志内容的长度
+    int len;
+    // 日志产生的时间，由日志线程格式化
+    struct timeval tv;
+    // 日志内容，不包括结尾的换行
+    char msg[KVDATA_LOG_MAX_LEN];
+} logSlot;
+
+static logSlot log_ring[KVDATA_LOG_RING_SIZE];
+// 下一条日志占用的位置，由生产者原子地增加
+static unsigned long log_head;
+// 下一条要写出的日志的位置，只由消费者修改
+static unsigned long log_tail;
+// 缓冲区满而被丢弃的日志数量
+static unsigned long log_dropped;
+// 日志文件描述符，没有配置日志文件时写到标准输出
+static int log_fd = STDOUT_FILENO;
+// 后台日志线程是否在运行，没有运行时日志直接同步写出
+static int log_async = 0;
+// 保证同一时刻只有一个消费者（日志线程或者退出时的 flushServerLog）
+static pthread_mutex_t log_consumer_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * 将一条日志按照 "pid 时间 级别 内容" 的格式写入 buf ，返回写入的长度
+ */
+static int formatLogLine(char *buf, size_t size, int level, struct timeval *tv,
+                         const char *msg, int len)
+{
+    const char *c = ".-*#";
+    char tbuf[64];
+    struct tm tm;
+    int off;
+
+    localtime_r(&tv->tv_sec, &tm);
+    off = strftime(tbuf, sizeof(tbuf), "%d %b %H:%M:%S.", &tm);
+    snprintf(tbuf+off, sizeof(tbuf)-off, "%03d", (int)(tv->tv_usec/1000));
+    return snprintf(buf, size, "%d %s %c %.*s\n", (int)getpid(), tbuf, c[level], len, msg);
+}
+
+/*
+ * 把 buf 中的内容全部写入日志文件
+ */
+static void writeLogBuffer(const char *buf, size_t len) {
+    while (len) {
+        ssize_t nwritten = write(log_fd, buf, len);
+        if (nwritten == -1) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        buf += nwritten;
+        len -= nwritten;
+    }
+}
+
+/*
+ * 取出环形缓冲区中所有已经写好的日志，合并成尽量少的 write 写入日志文件
+ * 返回写出的日志条数
+ */
+static int drainLogRing(void) {
+    static char out[KVDATA_LOG_MAX_LEN*16];
+    size_t outlen = 0;
+    int drained = 0;
+    unsigned long dropped;
+
+    pthread_mutex_lock(&log_consumer_mutex);
+    // 先报告被丢弃的日志
+    dropped = __atomic_exchange_n(&log_dropped, 0, __ATOMIC_RELAXED);
+    if (dropped) {
+        char msg[128];
+        struct timeval tv;
+        int len = snprintf(msg, sizeof(msg), "%lu log lines dropped because the log buffer was full", dropped);
+
+        gettimeofday(&tv, NULL);
+        outlen += formatLogLine(out+outlen, sizeof(out)-outlen, KVDATA_WARNING, &tv, msg, len);
+    }
+
+    while (1) {
+        logSlot *slot = &log_ring[log_tail & (KVDATA_LOG_RING_SIZE-1)];
+
+        // 槽位还没有被写好，后面的日志下一次再取
+        if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != log_tail+1) break;
+
+        // 输出缓冲区放不下一条完整的日志，先写出
+        if (sizeof(out)-outlen < KVDATA_LOG_MAX_LEN+128) {
+            writeLogBuffer(out, outlen);
+            outlen = 0;
+        }
+        outlen += formatLogLine(out+outlen, sizeof(out)-outlen, slot->level, &slot->tv,
+                                slot->msg, slot->len);
+
+        // 归还槽位，下一轮的生产者可以使用
+        __atomic_store_n(&slot->seq, log_tail+KVDATA_LOG_RING_SIZE, __ATOMIC_RELEASE);
+        log_tail++;
+        drained++;
+    }
+    if (outlen) writeLogBuffer(out, outlen);
+    pthread_mutex_unlock(&log_consumer_mutex);
+    return drained;
+}
+
+/*
+ * 后台日志线程的主函数
+ * 缓冲区为空时休眠一小段时间，避免生产者每写一条日志都要唤醒线程
+ */
+static void *logThreadMain(void *arg) {
+    KVDATA_NOTUSED(arg);
+    while (1) {
+        if (drainLogRing() == 0) usleep(KVDATA_LOG_FLUSH_US);
+    }
+    return NULL;
+}
+
+/*
+ * 记录一条日志，应该通过 serverLog 宏调用
+ * 日志线程运行时只把日志放入环形缓冲区，否则直接写出
+ */
+void serverLogRaw(int level, const char *fmt, ...) {
+    va_list ap;
+    struct timeval tv;
+    int len;
+
+    gettimeofday(&tv, NULL);
+
+    // 日志线程还没有启动（或者在子进程中），同步写出
+    if (!log_async) {
+        char msg[KVDATA_LOG_MAX_LEN], line[KVDATA_LOG_MAX_LEN+128];
+
+        va_start(ap, fmt);
+        len = vsnprintf(msg, sizeof(msg), fmt, ap);
+        va_end(ap);
+        if (len < 0) return;
+        if (len >= (int)sizeof(msg)) len = sizeof(msg)-1;
+        // 日志末尾的换行由格式化函数统一添加
+        if (len && msg[len-1] == '\n') len--;
+        len = formatLogLine(line, sizeof(line), level, &tv, msg, len);
+        writeLogBuffer(line, len);
+        return;
+    }
+
+    // 占用一个槽位，缓冲区满时丢弃日志
+    unsigned long pos = __atomic_load_n(&log_head, __ATOMIC_RELAXED);
+    logSlot *slot;
+    while (1) {
+        slot = &log_ring[pos & (KVDATA_LOG_RING_SIZE-1)];
+        unsigned long seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        long diff = (long)(seq - pos);
+
+        if (diff == 0) {
+            // 槽位空闲，尝试占用，失败时 pos 会被更新为最新的值
+            if (__atomic_compare_exchange_n(&log_head, &pos, pos+1, 0,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if (diff < 0) {
+            // 槽位中还是上一轮的日志，缓冲区已满
+            __atomic_add_fetch(&log_dropped, 1, __ATOMIC_RELAXED);
+            return;
+        } else {
+            // 槽位已经被其他生产者占用
+            pos = __atomic_load_n(&log_head, __ATOMIC_RELAXED);
+        }
+    }
+
+    // 在槽位中格式化日志，然后发布给消费者
+    va_start(ap, fmt);
+    len = vsnprintf(slot->msg, sizeof(slot->msg), fmt, ap);
+    va_end(ap);
+    if (len < 0) len = 0;
+    if (len >= (int)sizeof(slot->msg)) len = sizeof(slot->msg)-1;
+    if (len && slot->msg[len-1] == '\n') len--;
+    slot->len = len;
+    slot->level = level;
+    slot->tv = tv;
+    __atomic_store_n(&slot->seq, pos+1, __ATOMIC_RELEASE);
+}
+
+/*
+ * 写出环形缓冲区中剩余的日志，进程退出时调用
+ */
+void flushServerLog(void) {
+    if (log_async) drainLogRing();
+}
+
+/*
+ * 在 fork 出来的子进程中调用
+ * 子进程中没有日志线程，之后的日志同步写出；
+ * 缓冲区中从父进程继承来的日志由父进程负责写出，这里直接丢弃
+ */
+void serverLogAfterFork(void) {
+    log_async = 0;
+}
+
+/*
+ * 打开日志文件，并启动后台日志线程
+ * 在载入配置之后、启动其他线程之前调用
+ */
+void initServerLog(void) {
+    pthread_t tid;
+
+    if (server.logfile[0] != '\0') {
+        log_fd = open(server.logfile, O_WRONLY|O_APPEND|O_CREAT, 0644);
+        if (log_fd == -1) {
+            printf("Can't open the log file %s: %s\n", server.logfile, strerror(errno));
+            exit(1);
+        }
+    }
+
+    for (int j = 0; j < KVDATA_LOG_RING_SIZE; j++) log_ring[j].seq = j;
+    log_head = log_tail = 0;
+
+    if (pthread_create(&tid, NULL, logThreadMain, NULL) != 0) {
+        // 没有日志线程时仍然可以同步写日志
+        serverLog(KVDATA_WARNING, "Can't create the log thread, logging synchronously.");
+        return;
+    }
+    log_async = 1;
+    // 进程正常退出时写出剩余的日志
+    atexit(flushServerLog);
+}
@@ -0,0 +1,29 @@
+#ifndef KVDATA_LOGGER_H
+#define KVDATA_LOGGER_H
+
+/* 日志级别，只有不低于 server.verbosity 的日志才会被记录 */
+#define KVDATA_DEBUG 0     //调试信息，比如每条命令的参数
+#define KVDATA_VERBOSE 1   //详细信息，比如客户端的连接和断开
+#define KVDATA_NOTICE 2    //运行中的重要信息，默认级别
+#define KVDATA_WARNING 3   //警告和错误
+#define KVDATA_DEFAULT_VERBOSITY KVDATA_NOTICE
+
+#define KVDATA_LOG_MAX_LEN 1024     //单条日志的最大长度，超出部分被截断
+#define KVDATA_LOG_RING_SIZE 4096   //日志环形缓冲区可容纳的日志条数，必须是 2 的幂
+#define KVDATA_LOG_FLUSH_US 10000   //日志环形缓冲区为空时，后台线程的休眠时间（微秒）
+
+/*
+ * 记录一条日志
+ * 级别低于 server.verbosity 时只有一次比较，不会格式化参数
+ */
+#define serverLog(level, ...) do {                  \
+        if ((level) < server.verbosity) break;      \
+        serverLogRaw(level, __VA_ARGS__);           \
+    } while(0)
+
+void serverLogRaw(int level, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+void initServerLog(void);
+void flushServerLog(void);
+void serverLogAfterFork(void);
+#endif
@@ -1,36 +1,58 @@
-#include <stdio.h>
-#include <stdlib.h>
-#include "eventEpoll.h"
-#define EVENTS_NUM  100     //事件处理器事件槽总数
-#define SERV_PORT   6668    //服务器默认端口号
-
-
-KVServer server;//全局服务器变量
-
-int main(int argc, char *argv[])
-{
-    //初始化服务器
-    initServer(&server);
-
-    //使用用户指定端口.如未指定,用默认端口
-    short port = SERV_PORT;
-    if (argc == 2)
-        port = atoi(argv[1]);
-    //打印服务器的端口号
-    printf("server running:port[%d]\n", port);
-    
-    //初始化事件处理器，并创建epoll句柄,设置事件处理器的最大容量为EVENTS_NUM
-    server.eventsLoop = aeCreateEventLoop(EVENTS_NUM);
-    //初始化服务监听文件描述符，设置为非阻塞状态，将其加入epoll句柄，并将其与服务器套接字绑定。
-    init_ListenSocket(server.eventsLoop, port);
-    printf("Start the main loop of the event handler to start processing events... ...\n");
-    //创建时间事件到事件处理器中
-    aeCreateTimeEvent(server.eventsLoop, 5000, serverCron, NULL);
-
-    while(1)
-    {
-        aeMain(server.eventsLoop);
-    }
-
- return 0;
-}
+#include <stdio.h>
+#include <stdlib.h>
+#include "eventEpoll.h"
+#include "config.h"
+#include "ioThreads.h"
+#include "reactor.h"
+#include "slowlog.h"
+#define EVENTS_NUM  1024    //事件处理器事件槽的初始数量，连接增多时按需扩容
+#define SERV_PORT   6668    //服务器默认端口号
+
+
+KVServer server;//全局服务器变量
+
+int main(int argc, char *argv[])
+{
+    //初始化服务器
+    initServer(&server);
+
+    //使用用户指定端口.如未指定,用默认端口
+    //端口之后可以跟随 --<选项名> <值> 形式的配置项
+    short port = SERV_PORT;
+    if (argc >= 2)
+        port = atoi(argv[1]);
+    if (argc > 2)
+        loadServerConfigFromArgv(argc-2, argv+2);
+    //记录监听端口，INFO server 中的 tcp_port 使用它
+    server.port = port;
+    //打开日志文件，启动后台日志线程
+    initServerLog();
+    //根据配置创建慢查询日志的环形缓冲区
+    slowlogInit();
+    //打印服务器的端口号
+    serverLog(KVDATA_NOTICE, "server running:port[%d]\n", port);
+    //根据最大客户端数量提升打开文件数量的限制，并检查内核的待连接队列上限
+    adjustOpenFilesLimit();
+    checkTcpBacklogSettings();
+    
+    //初始化事件处理器，并创建epoll句柄,设置事件处理器的初始容量为EVENTS_NUM
+    server.eventsLoop = aeCreateEventLoop(EVENTS_NUM);
+    //初始化服务监听文件描述符，设置为非阻塞状态，将其加入epoll句柄，并将其与服务器套接字绑定。
+    init_ListenSocket(server.eventsLoop, port);
+    serverLog(KVDATA_NOTICE, "Start the main loop of the event handler to start processing events... ...\n");
+    //创建时间事件到事件处理器中
+    aeCreateTimeEvent(server.eventsLoop, 1, serverCron, NULL);
+    //设置每次进入阻塞等待前执行的函数
+    aeSetBeforeSleepProc(server.eventsLoop, beforeSleep);
+    //根据配置创建 I/O 线程
+    initThreadedIO();
+    //创建 reactor ，配置了多个 reactor 时启动其余 reactor 的线程
+    initReactors(port);
+
+    while(1)
+    {
+        aeMain(server.eventsLoop);
+    }
+
+ return 0;
+}
@@ -15,13 +15,14 @@ void initClientMultiState(KVClient *c) {
 
     // 命令计数
     c->mstate.count = 0;
+    c->mstate.capacity = 0;
 }
 
 void execCommand(KVClient *c)
 {
     // 客户端没有可执行的事务
     if (!(c->flags & KVDATA_MULTI)) {
-        printf("EXEC without MULTI\n");
+        serverLog(KVDATA_DEBUG, "EXEC without MULTI\n");
         return;
     }
     /* 检查是否需要阻止事务执行，因为：
@@ -36,6 +37,10 @@ void execCommand(KVClient *c)
     }
     // 已经可以保证安全性了，取消客户端对所有键的监视
     unwatchAllKeysCommand(c); 
+    // 保存 EXEC 命令自己的参数，执行完事务之后恢复，由 resetClient 释放
+    int orig_argc = c->argc;
+    robj **orig_argv = c->argv;
+    struct KVDataCommand *orig_cmd = c->cmd;
     addReplyLongLongWithPrefix(c,c->mstate.count,'*');
     // 执行事务中的命令
     for (int j = 0; j < c->mstate.count; j++) {
@@ -48,6 +53,10 @@ void execCommand(KVClient *c)
         // 执行命令
         call(c,0);
     }
+    // 恢复 EXEC 命令的参数，事务队列中的参数由 discardTransaction 释放
+    c->argc = orig_argc;
+    c->argv = orig_argv;
+    c->cmd = orig_cmd;
     // 清理事务状态
     discardTransaction(c);
 }
@@ -57,7 +66,7 @@ void discardCommand(KVClient *c)
 
     // 不能在客户端未进行事务状态之前使用
     if (!(c->flags & KVDATA_MULTI)) {
-        printf("DISCARD without MULTI\n");
+        serverLog(KVDATA_DEBUG, "DISCARD without MULTI\n");
         return;
     }
     discardTransaction(c);
@@ -72,7 +81,7 @@ void multiCommand(KVClient *c) {
 
     // 不能在事务中嵌套事务
     if (c->flags & KVDATA_MULTI) {
-        printf("MULTI calls can not be nested\n");
+        serverLog(KVDATA_DEBUG, "MULTI calls can not be nested\n");
         return;
     }
     // 打开事务 FLAG
@@ -126,7 +135,7 @@ void watchCommand(KVClient *c)
 {
     // 不能在事务开始后执行
     if (c->flags & KVDATA_MULTI) {
-        printf("WATCH inside MULTI is not allowed\n");
+        serverLog(KVDATA_DEBUG, "WATCH inside MULTI is not allowed\n");
         return;
     }
     // 监视输入的任意个键
@@ -176,9 +185,12 @@ void queueMultiCommand(KVClient *c)
     multiCmd *mc;
     int j;
     
-    // 为新数组元素分配空间
-    c->mstate.commands = zrealloc(c->mstate.commands,
-            sizeof(multiCmd)*(c->mstate.count+1));
+    // 队列已满时容量翻倍，入队 N 条命令只需要 O(logN) 次重新分配
+    if (c->mstate.count == c->mstate.capacity) {
+        c->mstate.capacity = c->mstate.capacity ? c->mstate.capacity*2 : KVDATA_MULTI_INIT_CAPACITY;
+        c->mstate.commands = zrealloc(c->mstate.commands,
+                sizeof(multiCmd)*c->mstate.capacity);
+    }
 
     // 指向新元素
     mc = c->mstate.commands+c->mstate.count;
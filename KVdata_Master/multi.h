@@ -4,6 +4,8 @@
 #include "db.h"
 
 
+#define KVDATA_MULTI_INIT_CAPACITY 4  //事务队列的初始容量
+
 /* 事务命令 */
 typedef struct multiCmd {
     // 参数
@@ -21,6 +23,8 @@ typedef struct multiState {
     multiCmd *commands;  
     // 已入队命令计数
     int count;         
+    // 事务队列的容量，按倍数增长，入队时不需要每次都重新分配
+    int capacity;
 
 } multiState;
 
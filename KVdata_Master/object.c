@@ -8,6 +8,10 @@
 #include <ctype.h>
 #include "list.h"
 #include "assert.h"
+#include "server.h"
+#include "evict.h"
+#include "slab.h"
+#include "util.h"
 
 struct sharedObjectsStruct shared;
 /*
@@ -30,6 +34,8 @@ void createSharedObjects(void) {
         "-WRONGTYPE Operation against a key holding the wrong kind of value\r\n"));
     shared.execaborterr = createObject(STRING,sdsnew(
         "-EXECABORT Transaction discarded because of previous errors.\r\n"));
+    shared.oomerr = createObject(STRING,sdsnew(
+        "-OOM command not allowed when used memory > 'maxmemory'.\r\n"));
     // 常用长度 bulk 或者 multi bulk 回复
     for (j = 0; j < KVDATA_SHARED_BULKHDR_LEN; j++) {
         shared.mbulkhdr[j] = createObject(STRING,
@@ -37,6 +43,11 @@ void createSharedObjects(void) {
         shared.bulkhdr[j] = createObject(STRING,
             sdscatprintf(sdsnewlen("",0),"$%d\r\n",j));
     }
+    // 共享整数对象，由值为小整数的键引用
+    for (j = 0; j < KVDATA_SHARED_INTEGERS; j++) {
+        shared.integers[j] = createObject(INT,(void*)(long)j);
+        shared.integers[j]->refcount = KVDATA_SHARED_REFCOUNT;
+    }
 }
 
 
@@ -44,7 +55,7 @@ void createSharedObjects(void) {
  * 为对象的引用计数增一
  */
 void incrRefCount(robj *o) {
-    o->refcount++;
+    if (o->refcount != KVDATA_SHARED_REFCOUNT) o->refcount++;
 }
 
 /*
@@ -53,17 +64,22 @@ void incrRefCount(robj *o) {
  */
 void decrRefCount(robj *o) {
     if (o->refcount <= 0) 
-    printf("decrRefCount against refcount <= 0.");
+    serverLog(KVDATA_WARNING, "decrRefCount against refcount <= 0.");
+
+    // 共享对象不会被释放
+    if (o->refcount == KVDATA_SHARED_REFCOUNT) return;
 
     // 释放对象
     if (o->refcount == 1) {
         switch(o->encoding) {
         case STRING: freeStringObject(o); break;
         case INT: freeIntObject(o); break;
+        // sds 和对象在同一次分配中，对象不是从对象池中分配的
+        case EMBSTR: zfree(o); return;
         default:  
-        printf("Unknown object type.\n"); break;
+        serverLog(KVDATA_WARNING, "Unknown object type.\n"); break;
         }
-        zfree(o);
+        slabFree(KVDATA_SLAB_ROBJ,o);
     // 减少计数
     } else {
         o->refcount--;
@@ -71,51 +87,150 @@ void decrRefCount(robj *o) {
 }
 
 
+/*
+ * 作用于特定数据结构的释放函数包装，用作链表的值释放函数
+ */
+void decrRefCountVoid(void *o) {
+    decrRefCount(o);
+}
+
 /*
  * 创建一个新 robj 对象
  */
 robj *createObject(int encoding, void *ptr) {
 
-    robj *o = zmalloc(sizeof(*o));
+    // robj 从对象池中分配
+    robj *o = slabAlloc(KVDATA_SLAB_ROBJ);
     //创建对象时，对象的引用计数+1
     //编码类型设置为简单的字符串STRING
     o->encoding = encoding;
     o->ptr = ptr;
     o->refcount = 1;
+    // 对象保存到数据库中时会重新设置访问信息
+    o->lru = objectInitialLRU();
 
     return o;
 }
 
-/* 
- * 当可变输出缓冲区最后一个节点对象的是一个共享对象
- * 创建该对象的一个复制品，用复制品替换该对象，原对象引用计数-1
- * 防止修改共享对象，影响其它进程使用
+/*
+ * 创建一个 STRING 编码的字符串对象
+ * 对象的 sds 可以被修改和扩展，用于参数对象和回复缓冲块
+ * 返回值：被创建的对象
  */
-robj *dupLastObject(list *reply) {
-    robj *new, *cur;
-    listNode *ln;
-    assert(listLength(reply) > 0);
-    ln = listLast(reply);
-    cur = listNodeValue(ln);
-    if (cur->refcount > 1) {
-        //创建一个新的对象
-        new = createObject(STRING, cur->ptr);
-        //原来对象引用计数-1
-        decrRefCount(cur);
-        listNodeValue(ln) = new;
-    }
-    return listNodeValue(ln);
+robj *createRawStringObject(char *ptr, size_t len) {
+    //sdsnewlen(ptr,len)根据字符串指针ptr以及指定字节长度len，初始化一个sdshdr结构变量
+    return createObject(STRING,sdsnewlen(ptr,len));
 }
 
+/*
+ * 创建一个 EMBSTR 编码的字符串对象
+ * 对象和 sds 在同一次分配中，少一次分配和一次指针跳转，sds 不能被扩展
+ */
+robj *createEmbeddedStringObject(char *ptr, size_t len) {
+    size_t size = sdsEmbedSize(len);
+    robj *o = zmalloc(sizeof(robj)+size);
 
+    o->encoding = EMBSTR;
+    o->refcount = 1;
+    o->lru = objectInitialLRU();
+    o->ptr = sdsEmbed(o+1,size,ptr,len);
+    return o;
+}
 
 /*
- * 创建一个 STRING 编码的字符串对象
- * 返回值：被创建的对象
+ * 创建一个内容不再修改的字符串对象
+ * 较短的字符串使用 EMBSTR 编码，否则使用 STRING 编码
  */
 robj *createStringObject(char *ptr, size_t len) {
-    //sdsnewlen(ptr,len)根据字符串指针ptr以及指定字节长度len，初始化一个sdshdr结构变量
-    return createObject(STRING,sdsnewlen(ptr,len));
+    if (len <= KVDATA_ENCODING_EMBSTR_SIZE_LIMIT)
+        return createEmbeddedStringObject(ptr,len);
+    return createRawStringObject(ptr,len);
+}
+
+/*
+ * 创建值为 value 的整数对象
+ * 值在共享整数的范围内，并且对象不需要单独的访问信息时返回共享对象
+ */
+robj *createStringObjectFromLongLong(long long value) {
+    if (value >= 0 && value < KVDATA_SHARED_INTEGERS &&
+        !(server.maxmemory &&
+          (server.maxmemory_policy & (KVDATA_MAXMEMORY_FLAG_LRU|KVDATA_MAXMEMORY_FLAG_LFU))))
+        return shared.integers[value];
+    if (value < LONG_MIN || value > LONG_MAX) {
+        char buf[32];
+        int len = ll2string(buf,sizeof(buf),value);
+
+        return createStringObject(buf,len);
+    }
+    return createObject(INT,(void*)(long)value);
+}
+
+/*
+ * 尝试以更节省内存的编码保存字符串对象 o ，返回编码后的对象
+ * 内容是 long long 范围内的十进制整数（没有前导零和空白）时使用 INT 编码，
+ * 小整数直接使用共享整数对象。
+ * 只有没有被其他地方引用的对象会被编码，o 的引用被转交给返回的对象。
+ */
+robj *tryObjectEncoding(robj *o) {
+    long long value;
+    sds s = o->ptr;
+    size_t len;
+
+    if (!sdsEncodedObject(o) || o->refcount != 1) return o;
+
+    // 超过 20 个字符的字符串不可能是 long long
+    len = sdslen(s);
+    if (len > 20 || !string2ll(s,len,&value)) return o;
+
+    // 共享整数
+    if (value >= 0 && value < KVDATA_SHARED_INTEGERS) {
+        robj *shobj = createStringObjectFromLongLong(value);
+
+        if (shobj->refcount == KVDATA_SHARED_REFCOUNT) {
+            decrRefCount(o);
+            return shobj;
+        }
+        decrRefCount(shobj);
+    }
+    if (value < LONG_MIN || value > LONG_MAX) return o;
+
+    // STRING 编码的对象原地转换，EMBSTR 的对象不是从对象池分配的，需要创建新的对象
+    if (o->encoding == STRING) {
+        sdsfree(s);
+        o->encoding = INT;
+        o->ptr = (void*)(long)value;
+        return o;
+    }
+    decrRefCount(o);
+    return createObject(INT,(void*)(long)value);
+}
+
+/*
+ * 返回字符串对象 o 的 sds 形式
+ * 值是 sds 时增加 o 的引用计数并返回 o ，INT 编码时创建新的字符串对象
+ * 调用者用完后需要对返回的对象调用 decrRefCount
+ */
+robj *getDecodedObject(robj *o) {
+    if (o->encoding == INT) {
+        char buf[32];
+        int len = ll2string(buf,sizeof(buf),(long)o->ptr);
+
+        return createStringObject(buf,len);
+    }
+    incrRefCount(o);
+    return o;
+}
+
+/*
+ * 返回字符串对象 o 的值的长度，INT 编码时为十进制表示的长度
+ */
+size_t stringObjectLen(robj *o) {
+    if (o->encoding == INT) {
+        char buf[32];
+
+        return ll2string(buf,sizeof(buf),(long)o->ptr);
+    }
+    return sdslen(o->ptr);
 }
 
 void freeStringObject(robj *o)
@@ -149,7 +264,7 @@ int getLongLongFromObject(robj *o, long long *target) {
         value = 0;
     } else {
 
-        if (o->encoding == STRING) {
+        if (sdsEncodedObject(o)) {
             //strtoll函数
             //String是要转化的字符串。endptr Endptr保存函数结束前的那个非合法字符的地址。Radix说明nptr的进制。
             //eg:ret=strtoll("123abc", &eptr, 10);   ret=123  eptr=abc
@@ -161,7 +276,8 @@ int getLongLongFromObject(robj *o, long long *target) {
             // 直接将它的值保存到 value 中
             value = (long)o->ptr;
         } else {
-            printf("Unknown string encoding.\n");
+            serverLog(KVDATA_WARNING, "Unknown string encoding.\n");
+            return AE_ERR;
         }
     }
 
@@ -2,16 +2,33 @@
 #define KVDATA_OBJECT_H
 #include <stdio.h>
 #include "list.h"
-#define STRING 1   //字符串类型的对象编码
-#define INT    2   //整数类型的对象编码
+#include <limits.h>
+#define STRING 1   //字符串类型的对象编码，ptr 指向单独分配的 sds
+#define INT    2   //整数类型的对象编码，整数值直接保存在 ptr 中
+#define EMBSTR 3   //嵌入式字符串编码，robj 和 sds 在同一次分配中，sds 不能被扩展
+
+//长度不超过这个值的字符串由 createStringObject 创建为 EMBSTR 编码
+#define KVDATA_ENCODING_EMBSTR_SIZE_LIMIT 44
+//共享整数对象的数量，值为 0 到 KVDATA_SHARED_INTEGERS-1
+#define KVDATA_SHARED_INTEGERS 10000
+//共享整数对象的引用计数，incrRefCount/decrRefCount 不修改它，多个线程可以同时引用
+#define KVDATA_SHARED_REFCOUNT INT_MAX
+//对象的值是否是 sds
+#define sdsEncodedObject(o) ((o)->encoding == STRING || (o)->encoding == EMBSTR)
 
 //共享参数长度的对象，长度限制
 #define KVDATA_SHARED_BULKHDR_LEN 32  
+//对象中 LRU 时钟（或者 LFU 数据）所占的位数
+#define KVDATA_LRU_BITS 24
 //unsigned类型本身是4字节
-//此处在定义变量后加上：4,说明限制该变量只占4个bit位
+//此处在定义变量后加上：8,说明限制该变量只占8个bit位
 typedef struct KVDATAObject {
     // 编码
-    int encoding;
+    unsigned encoding:8;
+    // 内存淘汰使用的访问信息，和编码共用 4 个字节，不增加对象的大小
+    // LRU 策略下为最近一次被访问时的 LRU 时钟，
+    // LFU 策略下高 16 位为最近一次衰减的时间（分钟），低 8 位为对数访问计数器
+    unsigned lru:KVDATA_LRU_BITS;
     // 引用计数
     int refcount;
     // 指向实际值的指针
@@ -22,17 +39,24 @@ typedef struct KVDATAObject {
 // 通过复用来减少内存碎片，以及减少操作耗时的共享对象
 struct sharedObjectsStruct {
     robj *crlf, *ok, *err, *pong, *queued, *syntaxerr, *nullbulk, *wrongtypeerr,
-    *execaborterr,
+    *execaborterr, *oomerr,
     *mbulkhdr[KVDATA_SHARED_BULKHDR_LEN], /* "*<value>\r\n" */
-    *bulkhdr[KVDATA_SHARED_BULKHDR_LEN];  /* "$<value>\r\n" */
+    *bulkhdr[KVDATA_SHARED_BULKHDR_LEN],  /* "$<value>\r\n" */
+    *integers[KVDATA_SHARED_INTEGERS];
 };
 
 void incrRefCount(robj *o);
 void decrRefCount(robj *o);
+void decrRefCountVoid(void *o);
 void createSharedObjects(void);
 robj *createObject(int encoding, void *ptr);
-robj *dupLastObject(list *reply);
 robj *createStringObject(char *ptr, size_t len);
+robj *createRawStringObject(char *ptr, size_t len);
+robj *createEmbeddedStringObject(char *ptr, size_t len);
+robj *createStringObjectFromLongLong(long long value);
+robj *tryObjectEncoding(robj *o);
+robj *getDecodedObject(robj *o);
+size_t stringObjectLen(robj *o);
 void freeStringObject(robj *o);
 void freeIntObject(robj *o);
 int getLongLongFromObject(robj *o, long long *target);
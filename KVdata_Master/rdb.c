@@ -9,6 +9,7 @@
 #include "server.h"
 #include <stdlib.h>
 #include "slave.h"
+#include "util.h"
 extern struct sharedObjectsStruct shared;//共享对象
 extern KVServer server;//全局服务器变量
 
@@ -45,7 +46,7 @@ int rdbSave(char *filename) {
     fp = fopen(tmpfile,"w");
     if (!fp) {
         //文件开启失败写入日志
-        printf("Failed opening .rdb for saving: %s\n", strerror(errno));
+        serverLog(KVDATA_WARNING, "Failed opening .rdb for saving: %s\n", strerror(errno));
         return RDB_ERR;
     }
 
@@ -88,15 +89,14 @@ int rdbSave(char *filename) {
 
         //遍历数据库，并写入每个键值对的数据
         while((de = dictNext(di)) != NULL) {
-            //获取键
-            sds keystr = de->key;
-            robj *key=createStringObject(keystr,strlen(keystr));
+            //获取键，键的 sds 在数据库节点中，不需要复制
+            robj key = {.encoding = STRING, .refcount = 1, .ptr = de->key};
             //获取值
             robj *o = dictGetVal(de);
-            // 获取键key的过期时间
-            long long expire = getExpire(db,key);
+            // 获取键key的过期时间，过期时间保存在数据库节点中
+            long long expire = de->expire ? (long long)de->expire : -1;
             // 保存键值对数据
-            if (rdbSaveKeyValuePair(&rdb,key,o,expire,now) == -1) goto werr;
+            if (rdbSaveKeyValuePair(&rdb,&key,o,expire,now) == -1) goto werr;
         }
         //当前数据库遍历完毕，释放字典迭代器，移动到下一数据库
         dictReleaseIterator(di);
@@ -119,18 +119,22 @@ int rdbSave(char *filename) {
     //确保流fp的所有内存都写入了磁盘.
     if (fsync(fileno(fp)) == -1) goto werr;
     //关闭流 stream。刷新所有的缓冲区。
-    if (fclose(fp) == EOF) goto werr;
+    // fclose 失败时流已经被释放，不能再次关闭
+    if (fclose(fp) == EOF) {
+        fp = NULL;
+        goto werr;
+    }
 
     //把 old_filename 所指向的文件名改为 new_filename。错误返回-1
     if (rename(tmpfile,filename) == -1) {
-        printf("Error moving temp DB file on the final destination: %s\n", strerror(errno));
+        serverLog(KVDATA_WARNING, "Error moving temp DB file on the final destination: %s\n", strerror(errno));
         //对文件的连接计数-1，为0时才会删除该文件
         unlink(tmpfile);
         return RDB_ERR;
     }
 
     // 写入完成，打印日志
-    printf("DB saved on disk.\n");
+    serverLog(KVDATA_NOTICE, "DB saved on disk.\n");
 
     //情况一：同步运行，生成RDB文件时服务器不响应命令
     //情况二：后台运行，则此处修改的子进程中的server.dirty，不会影响主进程在backgroundSaveDoneHandler函数中对server.dirty的计算
@@ -143,10 +147,10 @@ int rdbSave(char *filename) {
 
     werr:
     // 关闭文件
-    fclose(fp);
+    if (fp) fclose(fp);
     // 删除文件
     unlink(tmpfile);
-    printf("Write error saving DB on disk: %s\n", strerror(errno));
+    serverLog(KVDATA_WARNING, "Write error saving DB on disk: %s\n", strerror(errno));
     //如果有需要，释放字典迭代器
     if (di) dictReleaseIterator(di);
 
@@ -202,12 +206,37 @@ int rdbSaveMillisecondTime(saveStream *rdb, long long t) {
 }
 
 /* 
- * 将长度为 1 字节的数据库编号len写入到 rdb 中。
- * 写入成功返回1，写入失败返回-1。
+ * 将长度（或数据库编号）len 写入到 rdb 中，按照大小使用不同的编码：
+ *
+ *   00xxxxxx                    6 位长度
+ *   01xxxxxx xxxxxxxx           14 位长度
+ *   10000000 [4 字节，大端序]   32 位长度
+ *   10000001 [8 字节，大端序]   64 位长度
+ *
+ * 小于 64 的长度和旧的单字节格式相同。
+ * 写入成功返回写入的字节数，写入失败返回-1。
  */
-int rdbSaveLen(saveStream *rdb, unsigned char len) {
-    unsigned char buf = len;
-    return rdbWriteRaw(rdb,&buf,1);
+int rdbSaveLen(saveStream *rdb, uint64_t len) {
+    unsigned char buf[9];
+    int n;
+
+    if (len < (1<<6)) {
+        buf[0] = (len&0xFF)|(RDB_6BITLEN<<6);
+        n = 1;
+    } else if (len < (1<<14)) {
+        buf[0] = ((len>>8)&0xFF)|(RDB_14BITLEN<<6);
+        buf[1] = len&0xFF;
+        n = 2;
+    } else if (len <= UINT32_MAX) {
+        buf[0] = RDB_32BITLEN;
+        for (int j = 0; j < 4; j++) buf[1+j] = (len>>(24-j*8))&0xFF;
+        n = 5;
+    } else {
+        buf[0] = RDB_64BITLEN;
+        for (int j = 0; j < 8; j++) buf[1+j] = (len>>(56-j*8))&0xFF;
+        n = 9;
+    }
+    return rdbWriteRaw(rdb,buf,n);
 }
 
 /*
@@ -223,12 +252,18 @@ int rdbSaveType(saveStream *rdb, unsigned char type) {
  * 函数返回 rdb 保存字符串对象所需的字节数。
  */
 int rdbSaveStringObject(saveStream *rdb, robj *obj) {
-    int n;
+    int n = -1;
     // 保存字符串对象
-    if (obj->encoding == STRING) {
+    if (sdsEncodedObject(obj)) {
         n = rdbSaveRawString(rdb,obj->ptr,sdslen(obj->ptr));
+    // 整数对象以十进制字符串的形式保存，载入时重新编码
+    } else if (obj->encoding == INT) {
+        char buf[32];
+        int len = ll2string(buf,sizeof(buf),(long)obj->ptr);
+
+        n = rdbSaveRawString(rdb,(unsigned char*)buf,len);
     } else {
-        printf("Unknown object encoding.\n");
+        serverLog(KVDATA_WARNING, "Unknown object encoding.\n");
     }
     return n;
 }
@@ -278,6 +313,8 @@ int rdbSaveBackground(char *filename) {
     //开辟子进程
     if ((childpid = fork()) == 0) {
         /* Child */
+        // 子进程中没有日志线程，日志改为同步写出
+        serverLogAfterFork();
         // 子进程关闭监听套接字
         close(server.listenfd);
 
@@ -287,11 +324,11 @@ int rdbSaveBackground(char *filename) {
         // 打印 copy-on-write（写时复制） 时使用的内存数
         if (retval == AE_OK) {
             // 向父进程发送信号，退出子进程
-            printf("BGSAVE successfully!\n");
+            serverLog(KVDATA_NOTICE, "BGSAVE successfully!\n");
             exit(0);
         }else{
             // 向父进程发送信号，退出子进程
-            printf("BGSAVE failed!\n");
+            serverLog(KVDATA_WARNING, "BGSAVE failed!\n");
             exit(1);
         }
     } else {
@@ -299,11 +336,11 @@ int rdbSaveBackground(char *filename) {
         // 如果 fork() 出错，那么报告错误
         if (childpid == -1) {
             //写入错误日志
-            printf("Can't save in background: fork: %s\n", strerror(errno));
+            serverLog(KVDATA_WARNING, "Can't save in background: fork: %s\n", strerror(errno));
             return AE_ERR;
         }
         // 打印 BGSAVE 开始的日志
-        printf("Background saving started by pid %d\n",childpid);
+        serverLog(KVDATA_NOTICE, "Background saving started by pid %d\n",childpid);
         // 记录负责执行 BGSAVE 的子进程 ID
         server.rdb_child_pid = childpid;
         return AE_OK;
@@ -316,7 +353,7 @@ int rdbSaveBackground(char *filename) {
  * 将给定 rdb 中保存的数据载入到数据库中。
  */
 int rdbLoad(char *filename) {
-    uint32_t dbid;
+    uint64_t dbid;
     int type, rdbver;
     KVdataDb *db = server.db+0;
     char buf[1024];
@@ -326,7 +363,7 @@ int rdbLoad(char *filename) {
 
     // 打开 rdb 文件（该文件必须存在）
     if ((fp = fopen(filename,"r")) == NULL) {
-    printf("open fail errno reason = %s \n", strerror(errno));
+    serverLog(KVDATA_WARNING, "open fail errno reason = %s \n", strerror(errno));
     return RDB_ERR;
     }
     // 初始化写入流
@@ -339,7 +376,7 @@ int rdbLoad(char *filename) {
     // 检查buf的前3个字节是否为"RDB"，不是则关闭流fp，报错直接退出
     if (memcmp(buf,"RDB",3) != 0) {
         fclose(fp);
-        printf("Wrong signature trying to load DB from file\n");
+        serverLog(KVDATA_WARNING, "Wrong signature trying to load DB from file\n");
         return RDB_ERR;
     }
     /*将服务器状态调整到开始载入状态*/ 
@@ -375,7 +412,7 @@ int rdbLoad(char *filename) {
                 goto rdberr;
             // 检查数据库号码的正确性
             if (dbid >= (unsigned)server.dbnum) {
-                printf("FATAL: Data file was created with a KVDATA server configured to handle more than %d databases. Exiting.\n", server.dbnum);
+                serverLog(KVDATA_WARNING, "FATAL: Data file was created with a KVDATA server configured to handle more than %d databases. Exiting.\n", server.dbnum);
                 return RDB_ERR;
             }
             // 在程序内容切换数据库
@@ -387,6 +424,7 @@ int rdbLoad(char *filename) {
         if ((key = rdbGenericLoadStringObject(&rdb)) == NULL) goto rdberr;
         //读入type类型对象的键的值
         if ((val = rdbLoadObject(type,&rdb)) == NULL) goto rdberr;
+        val = tryObjectEncoding(val);
 
         //那么在键已经过期的时候，不再将它们关联到数据库中去
         if (expiretime != -1 && expiretime < now) {
@@ -414,9 +452,9 @@ int rdbLoad(char *filename) {
 
         // 比对校验和，将rdb中的校验和cksum与通过
         if (cksum == 0) {
-            printf("RDB file was saved with checksum disabled: no check performed.\n");
+            serverLog(KVDATA_NOTICE, "RDB file was saved with checksum disabled: no check performed.\n");
         } else if (cksum != expected) {
-            printf("Wrong RDB checksum. Aborting now.\n");
+            serverLog(KVDATA_WARNING, "Wrong RDB checksum. Aborting now.\n");
             return RDB_ERR;
         }
     }
@@ -424,11 +462,11 @@ int rdbLoad(char *filename) {
     fclose(fp);
     // 服务器从载入状态中退出
     server.loading = 0;
-    printf("RDB restores the database successfully for the first time.\n");
+    serverLog(KVDATA_NOTICE, "RDB restores the database successfully for the first time.\n");
     return RDB_OK;
     /* 在这里处理文件的意外结束，使用一个致命的退出 */
     rdberr: 
-    printf("Short read or OOM loading DB. Unrecoverable error, aborting now.\n");
+    serverLog(KVDATA_WARNING, "Short read or OOM loading DB. Unrecoverable error, aborting now.\n");
     return RDB_ERR; 
 }
 
@@ -454,16 +492,33 @@ long long rdbLoadMillisecondTime(saveStream *rdb) {
 }
 
 /*
- * 从rdb中载出一个单字节的长度值
- * 载出成功返回一个整数，载出失败返回KVDATA_RDB_LENERR
+ * 从rdb中载出一个由 rdbSaveLen 编码的长度值
+ * 载出成功返回长度，载出失败返回 RDB_LENERR
  */
-int rdbLoadLen(saveStream *rdb) {
-    unsigned char buf;
-    
-    // 读入被编码的长度值保存在buf ，这个值可能已经是“编码类型”，也可能是一个被编码的长度
-    if (saveStreamRead(rdb,&buf,1) == 0) return RDB_LENERR;
-    return buf&0x3F;
-   
+uint64_t rdbLoadLen(saveStream *rdb) {
+    unsigned char buf[8];
+    uint64_t len = 0;
+    int type, n;
+
+    if (saveStreamRead(rdb,buf,1) == 0) return RDB_LENERR;
+    type = (buf[0]&0xC0)>>6;
+    if (type == RDB_6BITLEN) {
+        return buf[0]&0x3F;
+    } else if (type == RDB_14BITLEN) {
+        len = buf[0]&0x3F;
+        if (saveStreamRead(rdb,buf,1) == 0) return RDB_LENERR;
+        return (len<<8)|buf[0];
+    } else if (buf[0] == RDB_32BITLEN) {
+        n = 4;
+    } else if (buf[0] == RDB_64BITLEN) {
+        n = 8;
+    } else {
+        serverLog(KVDATA_WARNING, "Unknown length encoding %d in rdbLoadLen()\n", buf[0]);
+        return RDB_LENERR;
+    }
+    if (saveStreamRead(rdb,buf,n) == 0) return RDB_LENERR;
+    for (int j = 0; j < n; j++) len = (len<<8)|buf[j];
+    return len;
 }
 
 /*
@@ -478,7 +533,7 @@ robj *rdbLoadObject(int rdbtype, saveStream *rdb) {
         if ((o = rdbGenericLoadStringObject(rdb)) == NULL) return NULL;
     } 
     else {
-        printf("Unknown object type.\n");
+        serverLog(KVDATA_WARNING, "Unknown object type.\n");
     }
     return o;
 }
@@ -488,12 +543,11 @@ robj *rdbLoadObject(int rdbtype, saveStream *rdb) {
  * 返回该字符串对象
  */
 robj *rdbGenericLoadStringObject(saveStream *rdb) {
-    int isencoded;
-    uint32_t len;
+    uint64_t len;
     sds val;
 
     // 读出字符串对象的长度
-    len = rdbLoadLen(rdb);
+    if ((len = rdbLoadLen(rdb)) == RDB_LENERR) return NULL;
     // 直接从 rdb 中读出它
     val = sdsnewlen(NULL,len);
     if (len && saveStreamRead(rdb,val,len) == 0) {
@@ -502,6 +556,11 @@ robj *rdbGenericLoadStringObject(saveStream *rdb) {
         return NULL;
     }
     //返回从rdb读入的字符串对象val
+    if (len <= KVDATA_ENCODING_EMBSTR_SIZE_LIMIT) {
+        robj *o = createEmbeddedStringObject(val,len);
+        sdsfree(val);
+        return o;
+    }
     return createObject(STRING,val);
 }
 
@@ -510,6 +569,8 @@ robj *rdbGenericLoadStringObject(saveStream *rdb) {
  * 执行手动LOAD
  */
 void loadCommand(KVClient *c) {
+    // 先清空旧数据库，RDB 中的键不能和已有的键重复
+    emptyDb();
     // 执行
     if (rdbLoad(server.rdb_filename) == RDB_OK) {
         addReply(c,shared.ok);
@@ -525,13 +586,13 @@ void loadCommand(KVClient *c) {
 void backgroundSaveDoneHandler(int exitcode, int bysignal) {
     // BGSAVE 成功
     if (!bysignal && exitcode == 0) {
-        printf("Background saving terminated with success.\n");
+        serverLog(KVDATA_NOTICE, "Background saving terminated with success.\n");
     // BGSAVE 出错
     } else if (!bysignal && exitcode != 0) {
-        printf("Background saving error.");
+        serverLog(KVDATA_WARNING, "Background saving error.");
     // BGSAVE 被中断
     } else {
-        printf("Background saving terminated by signal %d.\n", bysignal);
+        serverLog(KVDATA_NOTICE, "Background saving terminated by signal %d.\n", bysignal);
         // 移除临时文件
         char tmpfile[256];
         snprintf(tmpfile,256,"temp-%d.rdb\n", (int) server.rdb_child_pid);
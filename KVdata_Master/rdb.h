@@ -1,6 +1,7 @@
 #ifndef KVDATA_RDB_H
 #define KVDATA_RDB_H
 
+#include <stdint.h>
 #include "saveStream.h"
 
 #define RDB_OK 0
@@ -12,8 +13,14 @@
  */
 // 字符串类型的对象
 #define RDB_TYPE_STRING 0
-// 表示读取/写入错误
-#define RDB_LENERR 252
+// 长度的编码，保存在长度第一个字节的高 2 位中
+#define RDB_6BITLEN 0
+#define RDB_14BITLEN 1
+// 第一个字节为这两个值时，后面跟着 4 或者 8 字节的长度
+#define RDB_32BITLEN 0x80
+#define RDB_64BITLEN 0x81
+// rdbLoadLen 读取错误时的返回值
+#define RDB_LENERR UINT64_MAX
 // 以毫秒计算的过期时间
 #define RDB_OPCODE_EXPIRETIME_MS 253
 // 选择数据库
@@ -28,7 +35,7 @@ int rdbSave(char *filename);
 int rdbSaveKeyValuePair(saveStream *rdb, robj *key, robj *val, long long expiretime, long long now);
 int rdbWriteRaw(saveStream *rdb, void *p, size_t len);
 int rdbSaveMillisecondTime(saveStream *rdb, long long t);
-int rdbSaveLen(saveStream *rdb, unsigned char len);
+int rdbSaveLen(saveStream *rdb, uint64_t len);
 int rdbSaveType(saveStream *rdb, unsigned char type);
 int rdbSaveStringObject(saveStream *rdb, robj *obj);
 int rdbSaveRawString(saveStream *rdb, unsigned char *s, size_t len);
@@ -37,7 +44,7 @@ int rdbSaveBackground(char *filename);
 int rdbLoad(char *filename);
 int rdbLoadType(saveStream *rdb);
 long long rdbLoadMillisecondTime(saveStream *rdb);
-int rdbLoadLen(saveStream *rdb);
+uint64_t rdbLoadLen(saveStream *rdb);
 robj *rdbLoadObject(int rdbtype, saveStream *rdb);
 robj *rdbGenericLoadStringObject(saveStream *rdb);
 void backgroundSaveDoneHandler(int exitcode, int bysignal);
@@ -0,0 +1,360 @@
+#define _GNU_SOURCE
+#include "reactor.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+#include "server.h"
+#include "eventEpoll.h"
+#include "zmalloc.h"
+#include "clock.h"
+#include "evict.h"
+
+/*
+ * 多 reactor 模式
+ *
+ * 启动 N 个 reactor ，每个 reactor 在自己的线程上运行一个事件处理器，
+ * 通过开启了 SO_REUSEPORT 的监听套接字各自接受连接，并且拥有一个键空间分片。
+ * 键由哈希值决定属于哪个 reactor ，只有键的拥有者可以访问它所在的数据库，所以数据库不需要加锁。
+ *
+ * 客户端的命令如果访问的是其他 reactor 的键，那么客户端会连同命令一起通过无锁信箱
+ * 交给键的拥有者执行，回复写入客户端的输出缓冲区后再把客户端发回它所属的 reactor ，
+ * 由后者负责写出回复、继续处理查询缓冲区中的后续命令。
+ * 命令在其他 reactor 中执行期间，客户端所属的 reactor 不会读写这个客户端。
+ *
+ * 目前只支持单键命令（SET、GET、TSET）以及不访问键的 PING ，
+ * 事务、持久化以及主从复制相关的命令在这个模式下会被拒绝。
+ */
+
+// 当前线程所运行的 reactor
+__thread kvReactor *currentReactor = NULL;
+
+/*----------------------------------------信箱----------------------------------------*/
+
+/*
+ * 创建一个空信箱
+ */
+static kvMailbox *mailboxCreate(void) {
+    kvMailbox *mb = zmalloc(sizeof(*mb));
+    mb->head = 0;
+    mb->tail = 0;
+    return mb;
+}
+
+/*
+ * 向信箱中投递一条消息，只能由生产者调用
+ * 成功返回 AE_OK ，信箱已满时返回 AE_ERR
+ */
+static int mailboxPush(kvMailbox *mb, void *msg) {
+    unsigned long head = mb->head;
+    unsigned long tail = __atomic_load_n(&mb->tail, __ATOMIC_ACQUIRE);
+
+    if (head - tail == KVDATA_MAILBOX_SIZE) return AE_ERR;
+    mb->slots[head & (KVDATA_MAILBOX_SIZE-1)] = msg;
+    // 消息写入之后才更新 head ，消费者看到新的 head 时一定能看到消息本身
+    __atomic_store_n(&mb->head, head+1, __ATOMIC_RELEASE);
+    return AE_OK;
+}
+
+/*
+ * 从信箱中取出一条消息，只能由消费者调用
+ * 信箱为空时返回 NULL
+ */
+static void *mailboxPop(kvMailbox *mb) {
+    unsigned long tail = mb->tail;
+    unsigned long head = __atomic_load_n(&mb->head, __ATOMIC_ACQUIRE);
+
+    if (tail == head) return NULL;
+    void *msg = mb->slots[tail & (KVDATA_MAILBOX_SIZE-1)];
+    __atomic_store_n(&mb->tail, tail+1, __ATOMIC_RELEASE);
+    return msg;
+}
+
+/*----------------------------------------reactor----------------------------------------*/
+
+/*
+ * 将客户端从 src 发送给 dst
+ * 信箱已满时先暂存在 src 的 outbox 中，在 beforeSleep 中重新投递
+ */
+static void reactorSend(kvReactor *src, kvReactor *dst, KVClient *c) {
+    // outbox 中还有消息时直接排在后面，保证投递的顺序
+    if (listLength(src->outbox[dst->id]) ||
+        mailboxPush(dst->inbox[src->id], c) == AE_ERR)
+        listAddNodeTail(src->outbox[dst->id], c);
+    src->wakeup[dst->id] = 1;
+}
+
+/*
+ * 返回拥有键 key 的 reactor
+ */
+kvReactor *reactorForKey(robj *key) {
+    uint64_t h = dictGenHashFunction(key->ptr, sdslen(key->ptr));
+    return &server.reactors[h % server.reactors_num];
+}
+
+/*
+ * 返回命令的键参数在 argv 中的位置
+ * 命令不访问键时返回 0 ，命令不能在多 reactor 模式下执行时返回 -1
+ */
+static int reactorCommandKeyIndex(struct KVDataCommand *cmd) {
+    // 管理命令和事务需要访问所有 reactor 的数据
+    if (cmd->flags & (KVDATA_CMD_ADMIN|KVDATA_CMD_TRANSACTION)) return -1;
+    // 访问多个键的命令，键可能属于不同的 reactor
+    if (cmd->firstkey && cmd->lastkey != cmd->firstkey) return -1;
+    return cmd->firstkey;
+}
+
+/*
+ * 多 reactor 模式下执行客户端的命令，由 processCommand 调用
+ * 键属于当前 reactor 时直接执行并返回 AE_OK ，
+ * 否则将客户端转发给键的拥有者并返回 AE_ERR ，此时调用者不能重置客户端，
+ * 命令执行完毕之后由 reactorCommandDone 负责。
+ */
+int reactorDispatchCommand(KVClient *c) {
+    int keyindex = reactorCommandKeyIndex(c->cmd);
+
+    if (keyindex == -1) {
+        __atomic_add_fetch(&c->cmd->rejected_calls,1,__ATOMIC_RELAXED);
+        addReplySds(c,sdsnew("-ERR command not supported with multiple reactors\r\n"));
+        return AE_OK;
+    }
+    // 不访问键的命令直接执行
+    if (keyindex == 0) {
+        if (checkMaxmemory(c) == AE_OK) call(c,0);
+        return AE_OK;
+    }
+
+    // 切换到拥有键的 reactor 中对应的数据库
+    kvReactor *owner = reactorForKey(c->argv[keyindex]);
+    c->db = &owner->db[c->db->id];
+    if (owner == c->reactor) {
+        if (checkMaxmemory(c) == AE_OK) call(c,0);
+        return AE_OK;
+    }
+
+    // 转发期间不能再写这个客户端，先移出待写链表并移除写事件处理器，
+    // 命令返回之后如果还有未写完的回复会重新加入待写链表
+    if (c->flags & KVDATA_PENDING_WRITE) removeClientFromPendingWriteQueue(c);
+    if (aeGetFileEvents(c->reactor->el,c->fd) & AE_WRITABLE)
+        aeDeleteFileEvent(c->reactor->el,c->fd,AE_WRITABLE);
+    c->flags |= KVDATA_FORWARDED;
+    reactorSend(c->reactor,owner,c);
+    return AE_ERR;
+}
+
+/*
+ * 转发的命令已经执行完毕，客户端回到了它所属的 reactor
+ */
+static void reactorCommandDone(KVClient *c) {
+    c->flags &= ~KVDATA_FORWARDED;
+    resetClient(c);
+
+    // 回复已经写入输出缓冲区，加入待写链表
+    if (clientHasPendingReplies(c)) putClientInPendingWriteQueue(c);
+    // 转发期间套接字可读时读事件会被暂停，这里恢复
+    if (!(aeGetFileEvents(c->reactor->el,c->fd) & AE_READABLE) &&
+        aeCreateFileEvent(c->reactor->el,c->fd,AE_READABLE,recvData,c) == AE_ERR)
+    {
+        freeClient(c);
+        return;
+    }
+    // 继续处理查询缓冲区中剩余的命令
+    processInputBuffer(c);
+}
+
+/*
+ * 处理其他 reactor 发给 r 的所有消息
+ * 客户端属于 r 时表示命令执行完毕，否则表示需要在 r 中执行客户端的命令
+ */
+static void reactorProcessInbox(kvReactor *r) {
+    for (int j = 0; j < server.reactors_num; j++) {
+        KVClient *c;
+
+        if (j == r->id) continue;
+        while ((c = mailboxPop(r->inbox[j])) != NULL) {
+            if (c->reactor == r) {
+                reactorCommandDone(c);
+            } else {
+                // 执行命令，然后把客户端发回它所属的 reactor
+                // 内存超过上限时在本 reactor 的分片中淘汰键，或者拒绝执行写命令
+                if (checkMaxmemory(c) == AE_OK) call(c,0);
+                reactorSend(r,c->reactor,c);
+            }
+        }
+    }
+}
+
+/*
+ * 在进入阻塞等待之前调用
+ * (1)处理其他 reactor 发来的消息
+ * (2)重新投递之前因为信箱已满没能投递的消息
+ * (3)唤醒本轮投递了消息的 reactor ，每个 reactor 最多只写一次 eventfd
+ */
+void reactorBeforeSleep(void) {
+    kvReactor *r = currentReactor;
+
+    reactorProcessInbox(r);
+
+    for (int j = 0; j < server.reactors_num; j++) {
+        list *outbox = r->outbox[j];
+
+        while (listLength(outbox)) {
+            KVClient *c = listNodeValue(listFirst(outbox));
+            if (mailboxPush(server.reactors[j].inbox[r->id],c) == AE_ERR) break;
+            listUnlinkNode(outbox,listFirst(outbox));
+        }
+        if (r->wakeup[j]) {
+            uint64_t one = 1;
+            r->wakeup[j] = 0;
+            if (write(server.reactors[j].wakefd,&one,sizeof(one)) == -1 && errno != EAGAIN)
+                serverLog(KVDATA_WARNING, "Error waking up reactor %d: %s\n", j, strerror(errno));
+        }
+    }
+}
+
+/*
+ * eventfd 的读事件处理器，被其他 reactor 唤醒时调用
+ */
+static void reactorWakeupHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
+    KVDATA_NOTUSED(el);
+    KVDATA_NOTUSED(privdata);
+    KVDATA_NOTUSED(mask);
+    uint64_t count;
+
+    // 清空 eventfd 的计数器，然后处理信箱中的消息
+    if (read(fd,&count,sizeof(count)) == -1 && errno != EAGAIN)
+        serverLog(KVDATA_WARNING, "Error reading reactor wakeup fd: %s\n", strerror(errno));
+    reactorProcessInbox(currentReactor);
+}
+
+/*
+ * 将当前线程绑定到 reactor 编号对应的 CPU 上
+ */
+static void reactorSetAffinity(kvReactor *r) {
+#ifdef __linux__
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    cpu_set_t set;
+
+    if (ncpu <= 0) return;
+    CPU_ZERO(&set);
+    CPU_SET(r->id % ncpu, &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+        serverLog(KVDATA_WARNING, "Warning: can't pin reactor %d to CPU %ld.\n", r->id, r->id % ncpu);
+#endif
+}
+
+/*
+ * reactor 线程的主函数
+ */
+static void *reactorMain(void *arg) {
+    kvReactor *r = arg;
+
+    currentReactor = r;
+    reactorSetAffinity(r);
+    // 每个 reactor 线程有自己的缓存时钟
+    updateCachedClock();
+    while(1) aeMain(r->el);
+    return NULL;
+}
+
+/*
+ * 其余 reactor 的时间事件，维护本 reactor 拥有的键空间分片
+ * 0 号 reactor 的键空间由 serverCron 维护
+ */
+static int reactorCron(struct aeEventLoop *eventLoop, void *clientData) {
+    kvReactor *r = clientData;
+
+    KVDATA_NOTUSED(eventLoop);
+    databasesCron(r->db);
+    return 1000/server.hz;
+}
+
+/*
+ * 初始化 reactor 共用的部分：信箱、 outbox 以及 eventfd
+ */
+static void reactorInitCommon(kvReactor *r) {
+    for (int j = 0; j < server.reactors_num; j++) {
+        r->inbox[j] = (j == r->id) ? NULL : mailboxCreate();
+        r->outbox[j] = listCreate();
+        r->wakeup[j] = 0;
+    }
+    r->wakefd = eventfd(0, EFD_NONBLOCK);
+    if (r->wakefd == -1) {
+        serverLog(KVDATA_WARNING, "Fatal: can't create eventfd for reactor %d: %s\n", r->id, strerror(errno));
+        exit(1);
+    }
+    if (aeCreateFileEvent(r->el, r->wakefd, AE_READABLE, reactorWakeupHandler, NULL) == AE_ERR) {
+        serverLog(KVDATA_WARNING, "Fatal: can't listen on eventfd of reactor %d.\n", r->id);
+        exit(1);
+    }
+}
+
+/*
+ * 创建 reactor ，必须在主线程的事件处理器和监听套接字创建之后调用
+ *
+ * 0 号 reactor 总是存在，它就是主线程，直接使用 server 中的事件处理器、客户端链表和数据库。
+ * 配置了多个 reactor 时，其余每个 reactor 创建自己的事件处理器、键空间分片
+ * 以及监听 port 端口的 SO_REUSEPORT 套接字，然后在各自的线程上开始运行。
+ */
+void initReactors(int port) {
+    server.reactors = zmalloc(sizeof(kvReactor)*server.reactors_num);
+
+    // 0 号 reactor 运行在主线程上
+    kvReactor *r0 = &server.reactors[0];
+    r0->id = 0;
+    r0->thread = pthread_self();
+    r0->el = server.eventsLoop;
+    r0->listenfd = server.listenfd;
+    r0->db = server.db;
+    r0->clients = server.clients;
+    r0->clients_pending_write = server.clients_pending_write;
+    r0->clients_pending_read = server.clients_pending_read;
+    r0->wakefd = -1;
+    currentReactor = r0;
+
+    // 只有一个 reactor ，不需要信箱
+    if (server.reactors_num == 1) return;
+
+    reactorInitCommon(r0);
+    reactorSetAffinity(r0);
+
+    for (int j = 1; j < server.reactors_num; j++) {
+        kvReactor *r = &server.reactors[j];
+
+        r->id = j;
+        r->el = aeCreateEventLoop(server.eventsLoop->setsize);
+        if (r->el == NULL) {
+            serverLog(KVDATA_WARNING, "Fatal: can't create event loop for reactor %d.\n", j);
+            exit(1);
+        }
+        aeSetBeforeSleepProc(r->el, beforeSleep);
+        r->db = createDatabases(server.dbnum);
+        aeCreateTimeEvent(r->el, 1, reactorCron, r);
+        r->clients = listCreate();
+        r->clients_pending_write = listCreate();
+        r->clients_pending_read = listCreate();
+        reactorInitCommon(r);
+
+        r->listenfd = anetTcpServer(port, server.tcp_backlog, 1);
+        if (r->listenfd == -1 ||
+            aeCreateFileEvent(r->el, r->listenfd, AE_READABLE, acceptTcpHandler, NULL) == AE_ERR)
+        {
+            serverLog(KVDATA_WARNING, "Fatal: can't listen on port %d for reactor %d.\n", port, j);
+            exit(1);
+        }
+    }
+
+    // 所有 reactor 都初始化完毕之后才启动线程，因为信箱是在各个 reactor 之间共享的
+    for (int j = 1; j < server.reactors_num; j++) {
+        kvReactor *r = &server.reactors[j];
+        if (pthread_create(&r->thread, NULL, reactorMain, r) != 0) {
+            serverLog(KVDATA_WARNING, "Fatal: can't start reactor %d.\n", j);
+            exit(1);
+        }
+    }
+    serverLog(KVDATA_NOTICE, "Multi-reactor mode, %d reactors.\n", server.reactors_num);
+}
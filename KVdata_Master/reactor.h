@@ -0,0 +1,65 @@
+#ifndef KVDATA_REACTOR_H
+#define KVDATA_REACTOR_H
+#include <pthread.h>
+#include "events.h"
+#include "client.h"
+
+#define KVDATA_REACTORS_MAX 64          //reactor 数量上限
+#define KVDATA_DEFAULT_REACTORS 1       //默认只有一个 reactor ，即只有主线程的事件处理器
+#define KVDATA_MAILBOX_SIZE 256         //每个信箱可容纳的消息数量，必须是 2 的幂
+
+/*
+ * 单生产者单消费者的无锁信箱
+ * 每对 reactor 之间各有一个，只由源 reactor 写入，目标 reactor 读取。
+ * 信箱中传递的是客户端指针：
+ * 发给键的拥有者时表示请求执行命令，发回客户端所属 reactor 时表示命令已执行完毕。
+ */
+typedef struct kvMailbox {
+    // 下一个要写入的位置，只由生产者修改
+    unsigned long head;
+    // 下一个要读取的位置，只由消费者修改
+    unsigned long tail;
+    // 消息槽
+    void *slots[KVDATA_MAILBOX_SIZE];
+} kvMailbox;
+
+/*
+ * reactor 状态
+ * 每个 reactor 运行在一个线程上，拥有自己的事件处理器、监听套接字以及一个键空间分片，
+ * 0 号 reactor 运行在主线程上，直接使用 server 中的事件处理器、客户端链表和数据库。
+ */
+typedef struct kvReactor {
+    // reactor 编号
+    int id;
+    // 运行 reactor 的线程
+    pthread_t thread;
+    // 事件处理器
+    aeEventLoop *el;
+    // 开启了 SO_REUSEPORT 的监听套接字
+    int listenfd;
+    // 本 reactor 拥有的键空间分片（dbnum 个数据库）
+    KVdataDb *db;
+    // 连接到本 reactor 的客户端
+    list *clients;
+    // 等待在 beforeSleep 中写出回复的客户端
+    list *clients_pending_write;
+    // io_uring 后端下等待在 beforeSleep 中批量读取的客户端
+    list *clients_pending_read;
+    // 用于被其他 reactor 唤醒的 eventfd
+    int wakefd;
+    // inbox[j] 保存 j 号 reactor 发给本 reactor 的消息
+    kvMailbox *inbox[KVDATA_REACTORS_MAX];
+    // outbox[j] 保存发往 j 号 reactor 但是信箱已满、暂时没能投递的客户端
+    list *outbox[KVDATA_REACTORS_MAX];
+    // wakeup[j] 为真表示本轮向 j 号 reactor 投递了消息，需要在 beforeSleep 中唤醒它
+    char wakeup[KVDATA_REACTORS_MAX];
+} kvReactor;
+
+// 当前线程所运行的 reactor
+extern __thread kvReactor *currentReactor;
+
+void initReactors(int port);
+kvReactor *reactorForKey(robj *key);
+int reactorDispatchCommand(KVClient *c);
+void reactorBeforeSleep(void);
+#endif
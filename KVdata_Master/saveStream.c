@@ -265,6 +265,12 @@ size_t saveStreamWriteBulkCount(saveStream *r, char prefix, int count) {
  * 将 obj 所指向的整数对象或字符串对象的值写入到 r 当中。
  */
 int saveStreamWriteBulkObject(saveStream *r, robj *obj) {
+    if (obj->encoding == INT) {
+        char buf[32];
+        int len = ll2string(buf,sizeof(buf),(long)obj->ptr);
+
+        return saveStreamWriteBulkString(r,buf,len);
+    }
     return saveStreamWriteBulkString(r,obj->ptr,sdslen(obj->ptr));
 
 }
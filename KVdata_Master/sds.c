@@ -5,37 +5,153 @@
 #include "client.h"
 #include "server.h"
 #include "util.h"
+#include "clock.h"
 extern struct sharedObjectsStruct shared;
+/*
+ * 返回 type 类型的头部大小
+ */
+static inline size_t sdsHdrSize(char type) {
+    switch (type & SDS_TYPE_MASK) {
+    case SDS_TYPE_8: return sizeof(struct sdshdr8);
+    case SDS_TYPE_16: return sizeof(struct sdshdr16);
+    case SDS_TYPE_32: return sizeof(struct sdshdr32);
+    case SDS_TYPE_64: return sizeof(struct sdshdr64);
+    }
+    return 0;
+}
+
+/*
+ * 返回可以保存容量为 size 的字符串的最小头部类型
+ */
+static inline char sdsReqType(size_t size) {
+    if (size <= UINT8_MAX) return SDS_TYPE_8;
+    if (size <= UINT16_MAX) return SDS_TYPE_16;
+#if SIZE_MAX > UINT32_MAX
+    if (size <= UINT32_MAX) return SDS_TYPE_32;
+    return SDS_TYPE_64;
+#else
+    return SDS_TYPE_32;
+#endif
+}
+
+/*
+ * 返回 type 类型的头部可以记录的最大容量
+ */
+static inline size_t sdsTypeMaxSize(char type) {
+    switch (type) {
+    case SDS_TYPE_8: return UINT8_MAX;
+    case SDS_TYPE_16: return UINT16_MAX;
+    case SDS_TYPE_32: return UINT32_MAX;
+    }
+    return SIZE_MAX;
+}
+
+/*
+ * 设置 sds 的长度，不检查容量
+ */
+static inline void sdssetlen(sds s, size_t newlen) {
+    switch (s[-1] & SDS_TYPE_MASK) {
+    case SDS_TYPE_8: SDS_HDR(8,s)->len = newlen; break;
+    case SDS_TYPE_16: SDS_HDR(16,s)->len = newlen; break;
+    case SDS_TYPE_32: SDS_HDR(32,s)->len = newlen; break;
+    case SDS_TYPE_64: SDS_HDR(64,s)->len = newlen; break;
+    }
+}
+
+/*
+ * 返回 sds 的容量，不包括头部和结尾的 \0
+ */
+static inline size_t sdsalloc(const sds s) {
+    switch (s[-1] & SDS_TYPE_MASK) {
+    case SDS_TYPE_8: return SDS_HDR(8,s)->alloc;
+    case SDS_TYPE_16: return SDS_HDR(16,s)->alloc;
+    case SDS_TYPE_32: return SDS_HDR(32,s)->alloc;
+    case SDS_TYPE_64: return SDS_HDR(64,s)->alloc;
+    }
+    return 0;
+}
+
+/*
+ * 设置 sds 的容量，调用者保证容量不超过头部类型的上限
+ */
+static inline void sdssetalloc(sds s, size_t newalloc) {
+    switch (s[-1] & SDS_TYPE_MASK) {
+    case SDS_TYPE_8: SDS_HDR(8,s)->alloc = newalloc; break;
+    case SDS_TYPE_16: SDS_HDR(16,s)->alloc = newalloc; break;
+    case SDS_TYPE_32: SDS_HDR(32,s)->alloc = newalloc; break;
+    case SDS_TYPE_64: SDS_HDR(64,s)->alloc = newalloc; break;
+    }
+}
+
+/*
+ * 在 sh 处写入 type 类型的头部，返回对应的 sds
+ * 调用者负责写入字符串的内容和结尾的 \0
+ */
+static sds sdsInitHdr(void *sh, char type, size_t len, size_t alloc) {
+    sds s = (char*)sh+sdsHdrSize(type);
+
+    s[-1] = type;
+    sdssetlen(s, len);
+    sdssetalloc(s, alloc);
+    return s;
+}
+
 /*
  * 根据给定的初始化字符串 init 和字符串长度 initlen
- * 创建一个新的 sds
+ * 创建一个新的 sds ，头部类型由 initlen 决定
  * 返回值
  *        创建成功返回 sdshdr 相对应的 sds
  *        创建失败返回 NULL
  *  T = O(1)
  */
 sds sdsnewlen(const void *init, size_t initlen) {
+    char type = sdsReqType(initlen);
+    void *sh;
+    sds s;
 
-    struct sdshdr *sh;
     // zmalloc 不初始化所分配的内存
-    sh = zmalloc(sizeof(struct sdshdr)+initlen+1);
+    sh = zmalloc(sdsHdrSize(type)+initlen+1);
     // 内存分配失败，返回
     if (sh == NULL) return NULL;
 
-    // 设置初始化长度
-    sh->len = initlen;
-
     // 新 sds 不预留任何空间
-    sh->free = 0;
+    s = sdsInitHdr(sh, type, initlen, initlen);
 
-    // 如果有指定初始化内容，将它们复制到 sdshdr 的 buf 中
+    // 如果有指定初始化内容，将它们复制到 buf 中
     if (initlen && init)
-        memcpy(sh->buf, init, initlen);
+        memcpy(s, init, initlen);
     // 以 \0 结尾
-    sh->buf[initlen] = '\0';
+    s[initlen] = '\0';
 
     // 返回 buf 部分，而不是整个 sdshdr
-    return (char*)sh->buf;
+    return s;
+}
+
+/*
+ * 返回在调用者提供的内存中创建长度为 initlen 的 sds 至少需要的字节数
+ */
+size_t sdsEmbedSize(size_t initlen) {
+    return sdsHdrSize(sdsReqType(initlen))+initlen+1;
+}
+
+/*
+ * 在调用者提供的 size 字节内存 buf 中创建内容为 init 的 sds ，
+ * size 中多出来的部分作为 sds 的空闲空间（不超过头部类型可以记录的容量）。
+ * 这样创建的 sds 和调用者的结构在同一次分配中，
+ * 不能用 sdsfree 释放，内容也不能超过 buf 的大小（sdscpylen 在空间足够时原地复制）
+ * T = O(N)
+ */
+sds sdsEmbed(void *buf, size_t size, const void *init, size_t initlen) {
+    char type = sdsReqType(initlen);
+    size_t alloc = size-sdsHdrSize(type)-1;
+    sds s;
+
+    if (alloc > sdsTypeMaxSize(type)) alloc = sdsTypeMaxSize(type);
+    s = sdsInitHdr(buf, type, initlen, alloc);
+    if (initlen && init)
+        memcpy(s, init, initlen);
+    s[initlen] = '\0';
+    return s;
 }
 
 /*
@@ -60,89 +176,91 @@ sds sdsdup(const sds s) {
 }
 
 /*
- * 释放给定的 sds
- *  T = O(N)
- */
-void sdsfree(sds s) {
-    if (s == NULL) return;
-    zfree(s-sizeof(struct sdshdr));
-}
-
-/*
- * 返回 sds 实际保存的字符串的长度
- * T = O(1)
+ * 返回 sds 所在区块的起始地址，也就是头部的地址
  */
-size_t sdslen(const sds s) {
-    struct sdshdr *sh = (void*)(s-(sizeof(struct sdshdr)));
-    return sh->len;
+void *sdsAllocPtr(const sds s) {
+    return s-sdsHdrSize(s[-1]);
 }
 
 /*
- * 返回 sds 对应结构剩余可用空闲空间
- * T = O(1)
+ * 释放给定的 sds
+ *  T = O(N)
  */
-size_t sdsavail(const sds s) {
-    struct sdshdr *sh = (void*)(s-(sizeof(struct sdshdr)));
-    return sh->free;
+void sdsfree(sds s) {
+    if (s == NULL) return;
+    zfree(sdsAllocPtr(s));
 }
 
 /*
  * 对 sds 中 buf 的长度进行扩展，确保在函数执行之后，
  * buf 至少会有 addlen + 1 长度的空余空间（额外的 1 字节是为 \0 准备的）
+ * 扩展后的容量超过原来头部类型的上限时，换成更宽的头部
  * 返回值
  *        扩展成功返回扩展后的 sds
  *        扩展失败返回 NULL
  *  T = O(N)
  */
 sds sdsMakeRoomFor(sds s, size_t addlen) {
-
-    struct sdshdr *sh, *newsh;
-
-    // 获取 s 目前的空余空间长度
-    size_t free = sdsavail(s);
-
-    size_t len, newlen;
+    char oldtype = s[-1] & SDS_TYPE_MASK, type;
+    void *sh, *newsh;
+    size_t len, newlen, hdrlen;
 
     // s 目前的空余空间已经足够，无须再进行扩展，直接返回
-    if (free >= addlen) return s;
+    if (sdsavail(s) >= addlen) return s;
 
     // 获取 s 目前已占用空间的长度
     len = sdslen(s);
-    sh = (void*) (s-(sizeof(struct sdshdr)));
+    sh = (char*)s-sdsHdrSize(oldtype);
 
     // s 最少需要的长度*2,一次多分配一些空间，避免频繁分配内存
+    assert(len+addlen > len);
     newlen = 2*(len+addlen);
+    if (newlen < len+addlen) newlen = len+addlen;
+
+    type = sdsReqType(newlen);
+    hdrlen = sdsHdrSize(type);
+    if (type == oldtype) {
+        // 头部不变，可以直接扩展原来的区块
+        if ((newsh = zrealloc(sh, hdrlen+newlen+1)) == NULL)
+            return NULL;
+        s = (char*)newsh+hdrlen;
+    } else {
+        // 头部变宽，字符串的位置改变，不能使用 realloc
+        if ((newsh = zmalloc(hdrlen+newlen+1)) == NULL)
+            return NULL;
+        memcpy((char*)newsh+hdrlen, s, len+1);
+        zfree(sh);
+        s = sdsInitHdr(newsh, type, len, newlen);
+    }
 
-    //ptr -- 指针指向一个要重新分配内存的内存块，该内存块之前是通过调用 malloc、calloc 或 realloc 进行分配内存的。如果为空指针，则会分配一个新的内存块，且函数返回一个指向它的指针。
-    //size -- 内存块的新的大小，以字节为单位。如果大小为 0，且 ptr 指向一个已存在的内存块，则 ptr 所指向的内存块会被释放，并返回一个空指针。
-    if((newsh = zrealloc(sh, sizeof(struct sdshdr)+newlen+1)) == NULL)
-        return NULL;
-
-    // 更新 sds 的空余长度
-    newsh->free = newlen - len;
+    // 更新 sds 的容量
+    sdssetalloc(s, newlen);
 
     // 返回 sds
-    return newsh->buf;
+    return s;
 }
 
 /*
- * 根据sds字符串长度增加incr
- * 更新free和len的长度
+ * 根据sds字符串长度增加incr ，incr 可以是负数
+ * 用于调用者直接向 sdsMakeRoomFor 预留的空间写入内容之后更新长度
  * 复杂度
  *  T = O(1)
  */
-void sdsIncrLen(sds s, int incr) {
-    struct sdshdr *sh = (void*) (s-(sizeof(struct sdshdr)));
+void sdsIncrLen(sds s, ssize_t incr) {
+    size_t len = sdslen(s);
 
     // 确保 sds 空间足够
-    assert(sh->free >= incr);
+    if (incr >= 0)
+        assert(sdsavail(s) >= (size_t)incr);
+    else
+        assert(len >= (size_t)(-incr));
 
     // 更新属性
-    sh->len += incr;
-    sh->free -= incr;
+    len += incr;
+    sdssetlen(s, len);
 
     // 放置新的结尾符号
-    s[sh->len] = '\0';
+    s[len] = '\0';
 }
 
 /*
@@ -155,8 +273,7 @@ void sdsIncrLen(sds s, int incr) {
  * 复杂度
  *  T = O(N)
  */
-void sdsrange(sds s, int start, int end) {
-    struct sdshdr *sh = (void*) (s-(sizeof(struct sdshdr)));
+void sdsrange(sds s, ssize_t start, ssize_t end) {
     size_t newlen, len = sdslen(s);
     
     //如果给定的字符串长度为0，直接退出
@@ -176,9 +293,9 @@ void sdsrange(sds s, int start, int end) {
     newlen = (start > end) ? 0 : (end-start)+1;
     
     if (newlen != 0) {
-        if (start >= (signed)len) {
+        if (start >= (ssize_t)len) {
             newlen = 0;
-        } else if (end >= (signed)len) {
+        } else if (end >= (ssize_t)len) {
             end = len-1;
             newlen = (start > end) ? 0 : (end-start)+1;
         }
@@ -188,12 +305,11 @@ void sdsrange(sds s, int start, int end) {
 
     // 如果有需要，对字符串进行移动
     // T = O(N)
-    if (start && newlen) memmove(sh->buf, sh->buf+start, newlen);
+    if (start && newlen) memmove(s, s+start, newlen);
     // 添加终结符
-    sh->buf[newlen] = '\0';
-    // 更新属性
-    sh->free = sh->free+(sh->len-newlen);
-    sh->len = newlen;
+    s[newlen] = '\0';
+    // 更新属性，容量不变
+    sdssetlen(s, newlen);
 }
 
 
@@ -204,9 +320,6 @@ void sdsrange(sds s, int start, int end) {
  *  T = O(N)
  */
 sds sdscatlen(sds s, const void *t, size_t len) {
-    
-    struct sdshdr *sh;
-    
     // 原有字符串长度
     size_t curlen = sdslen(s);
     // 扩展 sds 空间
@@ -215,12 +328,10 @@ sds sdscatlen(sds s, const void *t, size_t len) {
     if (s == NULL) return NULL;
 
     // 复制 t 中的内容到字符串后部
-    sh = (void*) (s-(sizeof(struct sdshdr)));
     memcpy(s+curlen, t, len);
 
     // 更新属性
-    sh->len = curlen+len;
-    sh->free = sh->free-len;
+    sdssetlen(s, curlen+len);
 
     // 添加新结尾符号
     s[curlen+len] = '\0';
@@ -229,13 +340,49 @@ sds sdscatlen(sds s, const void *t, size_t len) {
     return s;
 }
 
+/*
+ * 将长度为 len 的字符串 t 复制到 sds 中，覆盖原有的内容
+ * 原有空间足够时不会分配内存
+ * 返回值
+ *       复制成功返回新 sds ，失败返回 NULL
+ *  T = O(N)
+ */
+sds sdscpylen(sds s, const char *t, size_t len) {
+    // 如果 s 的 buf 长度不满足 len ，那么扩展它
+    if (sdsalloc(s) < len) {
+        s = sdsMakeRoomFor(s,len-sdslen(s));
+        if (s == NULL) return NULL;
+    }
+
+    // 复制内容
+    memcpy(s, t, len);
+    s[len] = '\0';
+
+    // 更新属性
+    sdssetlen(s, len);
+
+    // 返回新的 sds
+    return s;
+}
+
 /* 
  * 为了计算客户端的输出缓冲区大小，我们需要获取已分配对象的大小，
  * 但是我们不能直接在sds字符串上使用zmalloc_size()，
  * 因为它们使用的是一种技巧(头在返回的指针之前)，所以我们使用这个助手函数
  */
 size_t zmalloc_size_sds(sds s) {
-    return zmalloc_size(s-sizeof(struct sdshdr));
+    return zmalloc_size(sdsAllocPtr(s));
+}
+
+/*
+ * 主动碎片整理时移动单独分配的 sds
+ * 返回移动后的 sds ，调用者负责修正指向 s 的指针；不需要移动时返回 NULL
+ */
+sds sdsDefrag(sds s) {
+    size_t hdrlen = sdsHdrSize(s[-1]);
+    char *sh = zmalloc_defrag(s-hdrlen);
+
+    return sh ? sh+hdrlen : NULL;
 }
 
 /*------------------------------------command---------------------------------------------------------------*/
@@ -253,26 +400,30 @@ void setGenericCommand(KVClient *c, robj *key, robj *val, robj *expire, int unit
         // expire 参数的值不正确时报错
         if (milliseconds <= 0) {
             //执行遇到错误，返回客户端一个错误；
-            printf("invalid expire time\n");
+            serverLog(KVDATA_VERBOSE, "invalid expire time\n");
             return;
         }
         // 不论输入的过期时间是秒还是毫秒,实际都以毫秒的形式保存过期时间
         // 如果输入的过期时间为秒UNIT_SECONDS，那么将它转换为毫秒
         if (unit == UNIT_SECONDS) milliseconds *= 1000;
     }
+    // 值是整数时以 INT 编码保存，小整数直接引用共享对象
+    // 参数数组中的对象被替换为编码后的对象，参数数组仍然持有它的一个引用
+    if (val == c->argv[2]) val = c->argv[2] = tryObjectEncoding(val);
     // 将键值关联到数据库（添加不存在的键，或者更新已存在的键），并且将键的过期时间移除
     setKey(c->db,key,val);
     // 将数据库设为脏
     //服务器每次修改一个键之后，都会对脏键计数器+1，这个计数会触发服务器的持久化以及复制操作
-    server.dirty++;
+    // 多 reactor 模式下多个线程会同时修改这个计数器
+    __atomic_add_fetch(&server.dirty,1,__ATOMIC_RELAXED);
 
     // 为键设置过期时间
-    if (expire) setExpire(c->db,key,mstime()+milliseconds);
+    if (expire) setExpire(c->db,key,commandTimeMs()+milliseconds);
 
 
     // 设置成功，向客户端发送回复
     addReply(c,shared.ok);
-    printf("The key is succesfully seted\n");
+    serverLog(KVDATA_DEBUG, "The key is succesfully seted\n");
 }
 
 /* SET key value*/
@@ -297,7 +448,7 @@ void setCommand(KVClient *c) {
             expire = next;
             j++;
         } else {
-            printf( "-ERR syntax error\n");
+            serverLog(KVDATA_VERBOSE,  "-ERR syntax error\n");
             return;
         }
     }
@@ -306,11 +457,11 @@ void setCommand(KVClient *c) {
 
 /*
  * 将键 key 的过期时间设为 when
+ * 过期时间直接保存在数据库节点中，第一次设置时把节点加入过期键索引
  */
 void setExpire(KVdataDb *db, robj *key, long long when) 
 {
-    char buf[20];
-    dictEntry *kde, *de;
+    dictEntry *kde;
 
     // 取出键对应的字典节点
     kde = dictFind(db->DB,key->ptr);
@@ -318,18 +469,16 @@ void setExpire(KVdataDb *db, robj *key, long long when)
     //确定该节点不为空
     assert(kde != NULL);
 
-    // 根据键取出键的过期时间
-    // 如果在过期字典存在该键，则取出该键
-    // 如果过期字典中不存在键，则在过期字典中添加一个该键
-    if((de = dictFind(db->expires,key->ptr)) == NULL)
-       de = dictAddRaw(db->expires,key->ptr);
+    // 键还没有过期时间，将数据库节点本身加入过期键索引，
+    // 索引和数据库字典共享节点，不需要额外的分配
+    if (kde->expire == 0) {
+        int retval = dictAddEntry(db->expires,kde);
+        assert(retval == DICT_OK);
+    }
 
     // 设置键的过期时间
-    // 这里是直接使用整数值来保存过期时间，不是用 INT 编码的 String 对象
-    de->expire = when;
-    int len = ll2string(buf,sizeof(buf)-1,when);
-    de->val = createStringObject(buf,len);
-    printf("The key %s expire set successfully\n",(char*)key->ptr);
+    kde->expire = when;
+    serverLog(KVDATA_DEBUG, "The key %s expire set successfully\n",(char*)key->ptr);
 }
 
 //尝试从数据库中取出键 c->argv[1] 对应的值对象
@@ -346,10 +495,10 @@ int getGenericCommand(KVClient *c) {
         return AE_OK;
     }
 
-    printf("getKey  succeseful.\n");
+    serverLog(KVDATA_DEBUG, "getKey  succeseful.\n");
 
     // 值对象存在，检查它的类型
-    if ((o->encoding != STRING) && (o->encoding != INT)) {
+    if (!sdsEncodedObject(o) && (o->encoding != INT)) {
         // 类型错误
         addReply(c,shared.wrongtypeerr);
         return AE_ERR;
@@ -7,31 +7,97 @@
 
 #include <stdio.h>
 #include <stdarg.h>
+#include <stdint.h>
+#include <sys/types.h>
 /*类型别名，用于指向 sdshdr 的 buf 属性*/
 typedef char *sds;
 
-/* 保存字符串对象的结构*/
-struct sdshdr {
-    
+/*
+ * 保存字符串对象的结构
+ * 根据字符串的长度选择不同宽度的头部，短字符串的头部只有 3 个字节。
+ * 头部是紧凑排列的（不对齐），buf 前面的一个字节 flags 的低 3 位保存头部的类型，
+ * 通过 s[-1] 就可以知道头部的大小。
+ */
+struct __attribute__ ((__packed__)) sdshdr8 {
     // buf 中已占用空间的长度
-    int len;
-    // buf 中剩余可用空间的长度
-    int free;
+    uint8_t len;
+    // buf 的容量，不包括头部和结尾的 \0
+    uint8_t alloc;
+    // 低 3 位为头部类型，高 5 位未使用
+    unsigned char flags;
     // 数据空间
     char buf[];
 };
+struct __attribute__ ((__packed__)) sdshdr16 {
+    uint16_t len;
+    uint16_t alloc;
+    unsigned char flags;
+    char buf[];
+};
+struct __attribute__ ((__packed__)) sdshdr32 {
+    uint32_t len;
+    uint32_t alloc;
+    unsigned char flags;
+    char buf[];
+};
+struct __attribute__ ((__packed__)) sdshdr64 {
+    uint64_t len;
+    uint64_t alloc;
+    unsigned char flags;
+    char buf[];
+};
+
+/* 头部类型 */
+#define SDS_TYPE_8  1
+#define SDS_TYPE_16 2
+#define SDS_TYPE_32 3
+#define SDS_TYPE_64 4
+#define SDS_TYPE_MASK 7
+// 由 sds 得到 T 类型的头部
+#define SDS_HDR(T,s) ((struct sdshdr##T *)((s)-(sizeof(struct sdshdr##T))))
+
+/*
+ * 返回 sds 实际保存的字符串的长度
+ * T = O(1)
+ */
+static inline size_t sdslen(const sds s) {
+    switch (s[-1] & SDS_TYPE_MASK) {
+    case SDS_TYPE_8: return SDS_HDR(8,s)->len;
+    case SDS_TYPE_16: return SDS_HDR(16,s)->len;
+    case SDS_TYPE_32: return SDS_HDR(32,s)->len;
+    case SDS_TYPE_64: return SDS_HDR(64,s)->len;
+    }
+    return 0;
+}
+
+/*
+ * 返回 sds 对应结构剩余可用空闲空间
+ * T = O(1)
+ */
+static inline size_t sdsavail(const sds s) {
+    switch (s[-1] & SDS_TYPE_MASK) {
+    case SDS_TYPE_8: return SDS_HDR(8,s)->alloc-SDS_HDR(8,s)->len;
+    case SDS_TYPE_16: return SDS_HDR(16,s)->alloc-SDS_HDR(16,s)->len;
+    case SDS_TYPE_32: return SDS_HDR(32,s)->alloc-SDS_HDR(32,s)->len;
+    case SDS_TYPE_64: return SDS_HDR(64,s)->alloc-SDS_HDR(64,s)->len;
+    }
+    return 0;
+}
 
 sds sdsnewlen(const void *init, size_t initlen);
+size_t sdsEmbedSize(size_t initlen);
+sds sdsEmbed(void *buf, size_t size, const void *init, size_t initlen);
 sds sdsdup(const sds s);
 void sdsfree(sds s);
-size_t sdslen(const sds s);
 sds sdsnew(const char *init);
-size_t sdsavail(const sds s);
 sds sdsMakeRoomFor(sds s, size_t addlen);
-void sdsIncrLen(sds s, int incr);
-void sdsrange(sds s, int start, int end);
+void sdsIncrLen(sds s, ssize_t incr);
+void sdsrange(sds s, ssize_t start, ssize_t end);
 sds sdscatlen(sds s, const void *t, size_t len);
+sds sdscpylen(sds s, const char *t, size_t len);
+void *sdsAllocPtr(const sds s);
 size_t zmalloc_size_sds(sds s);
+sds sdsDefrag(sds s);
 
 
 sds sdscatprintf(sds s, const char *fmt, ...);
@@ -1,6 +1,8 @@
 #include "server.h"
+#include "eventUring.h"
 #include "util.h"
 #include <string.h>
+#include <stdlib.h>
 #include <time.h>
 #include "assert.h"
 #include "zmalloc.h"
@@ -8,32 +10,47 @@
 #include "multi.h"
 #include <errno.h>
 #include <unistd.h> 
+#include <sys/uio.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
 #include "multi.h"
 #include "slave.h"
 #include "rdb.h"
+#include "ioThreads.h"
+#include "reactor.h"
+#include "slowlog.h"
+#include "clock.h"
+#include "evict.h"
+#include "slab.h"
+#include "defrag.h"
 extern struct sharedObjectsStruct shared;
 
 /*------------------------不同类型字典对应的键值释放函数以及哈希函数算法-----------------------------------------*/
-//命令字典，哈希函数以及值释放函数
-dictType commandTableDictType = {
-    dictSdsCaseHash,           /* 哈希函数 */
-    NULL                       /* 值释放函数 */
-};
 //正常数据库键值对字典，哈希函数以及值释放函数
+//节点由 dbAdd 分配，键和较短的值保存在节点中，由节点释放函数一起释放
 dictType dbDictType = {
     dictSdsHash,                /* 哈希函数 */
-    dictKVDATAObjectDestructor   /* 值释放函数 */
+    dictSdsKeyCompare,          /* 键比较函数 */
+    NULL,                       /* 键释放函数 */
+    NULL,                       /* 值释放函数 */
+    dbEntryDestructor           /* 节点释放函数 */
 };
-//过期键字典，哈希函数以及值释放函数
+//过期键索引，哈希函数以及值释放函数
+//节点就是数据库节点，由数据库字典释放
 dictType expiresDictType = {
-    dictSdsHash,               /* 哈希函数 */
-    NULL                       /* 值释放函数 */
+    dictSdsHash,                /* 哈希函数 */
+    dictSdsKeyCompare,          /* 键比较函数 */
+    NULL,                       /* 键释放函数 */
+    NULL,                       /* 值释放函数 */
+    dbExpiresEntryDestructor    /* 节点释放函数 */
 };
 //被监视的键字典，哈希函数以及值释放函数
 dictType clientDictType = {
     dictObjHash,                /* 哈希函数 */
-    dictListDestructor          /* 值释放函数 */
+    dictObjKeyCompare,          /* 键比较函数 */
+    dictKVDATAObjectDestructor, /* 键释放函数 */
+    dictListDestructor,         /* 值释放函数 */
+    NULL                        /* 节点释放函数 */
 };
 
 
@@ -44,64 +61,178 @@ dictType clientDictType = {
  * proc: 一个指向命令的实现函数的指针
  * counts: 参数的数量。可以用 -N 表示 >= N 
  * len: 命令名字的长度
+ * flags: 命令的属性，见 server.h 中的 KVDATA_CMD_* ，
+ *        复制、事务、多 reactor 等模块根据这些属性区分命令，不需要比较命令的实现函数
+ * firstkey: 第一个键参数的位置，0 表示命令不访问键
+ * lastkey: 最后一个键参数的位置，负数表示从最后一个参数倒数
+ * keystep: 相邻两个键参数之间的距离
+ * calls, microseconds, rejected_calls, latency_max, latency: 执行统计，初始为 0
  */
 struct KVDataCommand KVDATACommandTable[] = {
-    {"set",setCommand,3,3}, //SET KEY VALUE
-    {"get",getCommand,2,3}, //get KEY
-    {"tset",setCommand,5,4}, //TSET KEY VALUE [ss/ms] [expire]
-    {"multi",multiCommand,1,5},  //MULTI
-    {"exec",execCommand,1,4},    //EXEC
-    {"watch",watchCommand,1,5},  //WATCH KEY1
-    {"unwatchkeys",unwatchAllKeysCommand,1,11},//UNWATCHKEYS
-    {"discard",unwatchAllKeysCommand,1,7},//UNWATCHKEYS
-    {"save",saveCommand,1,4},//SAVE
-    {"load",loadCommand,1,4},//LOAD
-    {"slaveof",slaveofCommand,3,7},//SLAVEOF ip port
-    {"psync",syncCommand,3,5},//PSYNC runid offset
-    {"ping",pingCommand,1,4}//PING
+    {"set",setCommand,3,3,KVDATA_CMD_WRITE,1,1,1,0,0,0,0,{0}}, //SET KEY VALUE
+    {"get",getCommand,2,3,KVDATA_CMD_READONLY|KVDATA_CMD_FAST,1,1,1,0,0,0,0,{0}}, //get KEY
+    {"tset",setCommand,5,4,KVDATA_CMD_WRITE,1,1,1,0,0,0,0,{0}}, //TSET KEY VALUE [ss/ms] [expire]
+    {"multi",multiCommand,1,5,KVDATA_CMD_TRANSACTION|KVDATA_CMD_FAST,0,0,0,0,0,0,0,{0}},  //MULTI
+    {"exec",execCommand,1,4,KVDATA_CMD_TRANSACTION,0,0,0,0,0,0,0,{0}},    //EXEC
+    {"watch",watchCommand,-2,5,KVDATA_CMD_TRANSACTION|KVDATA_CMD_FAST,1,-1,1,0,0,0,0,{0}},  //WATCH KEY1 [KEY2 ...]
+    {"unwatchkeys",unwatchAllKeysCommand,1,11,KVDATA_CMD_FAST,0,0,0,0,0,0,0,{0}},//UNWATCHKEYS
+    {"discard",discardCommand,1,7,KVDATA_CMD_TRANSACTION|KVDATA_CMD_FAST,0,0,0,0,0,0,0,{0}},//DISCARD
+    {"save",saveCommand,1,4,KVDATA_CMD_ADMIN,0,0,0,0,0,0,0,{0}},//SAVE
+    {"load",loadCommand,1,4,KVDATA_CMD_WRITE|KVDATA_CMD_ADMIN,0,0,0,0,0,0,0,{0}},//LOAD
+    {"slaveof",slaveofCommand,3,7,KVDATA_CMD_ADMIN,0,0,0,0,0,0,0,{0}},//SLAVEOF ip port
+    {"psync",syncCommand,3,5,KVDATA_CMD_ADMIN,0,0,0,0,0,0,0,{0}},//PSYNC runid offset
+    {"ping",pingCommand,1,4,KVDATA_CMD_FAST,0,0,0,0,0,0,0,{0}},//PING
+    {"info",infoCommand,-1,4,0,0,0,0,0,0,0,0,{0}},//INFO [section]
+    {"slowlog",slowlogCommand,-2,7,0,0,0,0,0,0,0,0,{0}}//SLOWLOG GET [count] | LEN | RESET
 };
 
-void initCommand(dict*command)
+#define KVDATA_COMMAND_NUM (sizeof(KVDATACommandTable)/sizeof(struct KVDataCommand))
+
+/*
+ * 命令的完美哈希表
+ * commandSlots[h & (KVDATA_COMMAND_SLOTS-1)] 保存命令在命令表中的下标加 1 ，0 表示空槽位。
+ * initCommand 为命令表找到一个哈希种子，使得所有命令名字都落在不同的槽位上，
+ * 这样查找命令时只需要计算一次哈希、比较一次名字，不需要处理冲突。
+ */
+static unsigned char commandSlots[KVDATA_COMMAND_SLOTS];
+static uint32_t commandHashSeed;
+
+/*
+ * 计算命令名字的哈希值，忽略大小写
+ * FNV-1a ，每个字节在参与计算之前和 0x20 按位或，把大写字母转为小写
+ */
+static uint32_t commandHash(const char *name, size_t len, uint32_t seed) {
+    uint32_t h = 2166136261u ^ seed;
+
+    while (len--) {
+        h ^= (unsigned char)(*name++ | 0x20);
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/*
+ * 为命令表生成完美哈希表
+ * 依次尝试哈希种子，直到所有命令名字都没有冲突
+ */
+void initCommand(void)
 {
-    for(int i=0;i<13;i++)
-    { 
-        sds name = sdsnewlen((KVDATACommandTable+i)->name, (KVDATACommandTable+i)->len);      
-        if(dictAdd(command, name, KVDATACommandTable+i)==DICT_ERR)
-        printf("initCommand ERR\n");
-        //printf("Command name %s\n",name);
+    uint32_t seed;
+
+    // 命令名字的下标保存在 unsigned char 中，并且槽位数量至少是命令数量的两倍，
+    // 这样很快就能找到没有冲突的种子
+    assert(KVDATA_COMMAND_NUM < 255 && KVDATA_COMMAND_NUM*2 <= KVDATA_COMMAND_SLOTS);
+
+    for (seed = 0; seed < 1000000; seed++) {
+        unsigned int j;
+
+        memset(commandSlots,0,sizeof(commandSlots));
+        for (j = 0; j < KVDATA_COMMAND_NUM; j++) {
+            struct KVDataCommand *cmd = KVDATACommandTable+j;
+            uint32_t slot = commandHash(cmd->name,cmd->len,seed) & (KVDATA_COMMAND_SLOTS-1);
+
+            if (commandSlots[slot]) break;
+            commandSlots[slot] = j+1;
+        }
+        // 所有命令都没有冲突
+        if (j == KVDATA_COMMAND_NUM) {
+            commandHashSeed = seed;
+            return;
+        }
     }
+    serverLog(KVDATA_WARNING, "Can't build the command table, increase KVDATA_COMMAND_SLOTS.");
+    exit(1);
+}
+
+/*
+ * 根据命令名字查找命令，忽略大小写
+ * 直接在参数的缓冲区上查找，不分配内存
+ * 没有找到时返回 NULL
+ */
+struct KVDataCommand *lookupCommand(const char *name, size_t len) {
+    uint32_t slot = commandHash(name,len,commandHashSeed) & (KVDATA_COMMAND_SLOTS-1);
+    struct KVDataCommand *cmd;
+
+    if (commandSlots[slot] == 0) return NULL;
+    cmd = KVDATACommandTable+commandSlots[slot]-1;
+    if ((size_t)cmd->len != len || strncasecmp(cmd->name,name,len) != 0) return NULL;
+    return cmd;
 }
 
 void initServer(KVServer *server)
 {
     // 设置服务器的运行 ID
     getRandomHexChars(server->serverid,KVDATA_RUN_ID_SIZE);
+    // 每个进程使用随机的哈希函数种子，客户端无法构造大量哈希值相同的键
+    uint64_t seed;
+    getRandomBytes((unsigned char*)&seed,sizeof(seed));
+    dictSetHashFunctionSeed(seed);
     //设置默认服务器频率,触发时间事件用的
-    server->hz = 10;
+    server->hz = KVDATA_DEFAULT_HZ;
+    server->cronloops = 0;
+    //注册对象池的 fork 处理函数，之后才能创建其他线程
+    slabInit();
     //初始化共享对象
     createSharedObjects();
     //创建客户端链表
     server->clients=listCreate();
-    //更新服务器全局状态下的unix时间的缓存值
+    //创建等待写出回复以及等待 I/O 线程读取的客户端链表
+    server->clients_pending_write = listCreate();
+    server->clients_pending_read = listCreate();
+    //默认不开启 I/O 线程，所有读写都在主线程中完成
+    server->io_threads_num = KVDATA_DEFAULT_IO_THREADS;
+    server->io_threads_do_reads = 1;
+    server->io_threads_active = 0;
+    //默认使用 epoll 后端
+    server->event_backend = AE_BACKEND_EPOLL;
+    //默认只有主线程一个 reactor
+    server->reactors_num = KVDATA_DEFAULT_REACTORS;
+    server->reactors = NULL;
+    //连接数量相关的默认配置
+    server->maxclients = KVDATA_DEFAULT_MAXCLIENTS;
+    server->tcp_backlog = KVDATA_DEFAULT_TCP_BACKLOG;
+    server->connected_clients = 0;
+    server->stat_rejected_conn = 0;
+    server->stat_starttime = time(NULL);
+    server->stat_expiredkeys = 0;
+    server->stat_expired_time_cap_reached_count = 0;
+    server->stat_evictedkeys = 0;
+    //默认不限制内存
+    server->maxmemory = 0;
+    server->maxmemory_policy = KVDATA_DEFAULT_MAXMEMORY_POLICY;
+    server->maxmemory_samples = KVDATA_DEFAULT_MAXMEMORY_SAMPLES;
+    //默认不开启主动碎片整理
+    server->active_defrag_enabled = 0;
+    server->active_defrag_ignore_bytes = KVDATA_DEFAULT_ACTIVE_DEFRAG_IGNORE_BYTES;
+    server->active_defrag_threshold_lower = KVDATA_DEFAULT_ACTIVE_DEFRAG_THRESHOLD_LOWER;
+    server->active_defrag_threshold_upper = KVDATA_DEFAULT_ACTIVE_DEFRAG_THRESHOLD_UPPER;
+    server->active_defrag_cycle_min = KVDATA_DEFAULT_ACTIVE_DEFRAG_CYCLE_MIN;
+    server->active_defrag_cycle_max = KVDATA_DEFAULT_ACTIVE_DEFRAG_CYCLE_MAX;
+    server->active_defrag_running = 0;
+    server->stat_active_defrag_hits = 0;
+    server->stat_active_defrag_misses = 0;
+    server->stat_active_defrag_key_hits = 0;
+    server->stat_active_defrag_key_misses = 0;
+    memset(server->inst_metric,0,sizeof(server->inst_metric));
+    //慢查询日志
+    server->slowlog_log_slower_than = KVDATA_SLOWLOG_LOG_SLOWER_THAN;
+    server->slowlog_max_len = KVDATA_SLOWLOG_MAX_LEN;
+    //默认只记录 NOTICE 及以上级别的日志，写到标准输出
+    server->verbosity = KVDATA_DEFAULT_VERBOSITY;
+    server->logfile = "";
+    //初始化主线程的缓存时钟，更新服务器全局状态下的unix时间的缓存值
+    updateCachedClock();
     updateCachedTime();
-    //创建命令字典
-    server->commands = dictCreate(&commandTableDictType);
-    initCommand(server->commands);
+    //生成命令表的完美哈希表
+    initCommand();
     /*--------------------------------持久化相关参数初始化--------------------------------*/
     //初始化RDB默认文件名
     server->rdb_filename = "dump.rdb";
     /*--------------------------------数据库初始化--------------------------------*/
     //初始化数据库数量
     server->dbnum = DB_NUM;
-    //为数据库分配空间
-    server->db = zmalloc(sizeof(KVdataDb)*server->dbnum);
-    // 创建并初始化数据库结构
-    for (int j = 0; j < server->dbnum; j++) {
-        server->db[j].DB = dictCreate(&dbDictType);
-        server->db[j].expires = dictCreate(&expiresDictType);
-        server->db[j].watched_keys = dictCreate(&clientDictType);
-        server->db[j].id = j;
-    } 
+    //创建并初始化数据库结构
+    server->db = createDatabases(server->dbnum);
     /*--------------------------------主从复制初始化--------------------------------*/
     server->rdb_child_pid = -1;
     //创建从服务器链表
@@ -109,11 +240,121 @@ void initServer(KVServer *server)
     return ;
 }
 
+/*
+ * 为 dbnum 个数据库分配空间，并创建各个数据库的字典
+ * 多 reactor 模式下每个 reactor 都会调用一次，创建自己的键空间分片
+ */
+KVdataDb *createDatabases(int dbnum) {
+    KVdataDb *db = zmalloc(sizeof(KVdataDb)*dbnum);
+
+    for (int j = 0; j < dbnum; j++) {
+        db[j].DB = dictCreate(&dbDictType);
+        db[j].expires = dictCreate(&expiresDictType);
+        db[j].watched_keys = dictCreate(&clientDictType);
+        db[j].id = j;
+        db[j].avg_stale_perc = 0;
+    }
+    return db;
+}
+
 /* 我们使用全局状态下的unix时间的缓存值，
  * 因为有了虚拟内存和老化，在每次对象访问时都将当前时间存储在对象中，
- * 不需要准确性。访问全局变量要比调用时间(NULL)快得多*/
+ * 不需要准确性。访问全局变量要比调用时间(NULL)快得多
+ * 由主线程在每次事件循环迭代的 beforeSleep 中从缓存的时钟更新，
+ * I/O 线程和其他 reactor 更新客户端的最近互动时间时读取这个值 */
 void updateCachedTime(void) {
-    server.unixtime = time(NULL);
+    server.unixtime = clockUnixSec();
+}
+
+/*
+ * 根据 server.maxclients 调整进程能够打开的最大文件描述符数量
+ * 每个客户端需要一个文件描述符，另外保留 KVDATA_MIN_RESERVED_FDS 个给服务器自己使用。
+ *
+ * 如果无法提升到需要的数量，那么以 16 为步长逐渐降低目标，
+ * 最后根据实际能够得到的数量调小 server.maxclients 。
+ */
+void adjustOpenFilesLimit(void) {
+    rlim_t maxfiles = server.maxclients+KVDATA_MIN_RESERVED_FDS;
+    struct rlimit limit;
+
+    if (getrlimit(RLIMIT_NOFILE,&limit) == -1) {
+        serverLog(KVDATA_WARNING, "Unable to obtain the current NOFILE limit (%s), assuming 1024 and setting the max clients configuration accordingly.\n",
+            strerror(errno));
+        server.maxclients = 1024-KVDATA_MIN_RESERVED_FDS;
+        return;
+    }
+
+    rlim_t oldlimit = limit.rlim_cur;
+
+    // 当前的限制已经足够
+    if (oldlimit >= maxfiles) return;
+
+    rlim_t bestlimit;
+    int setrlimit_error = 0;
+
+    // 逐渐降低目标，直到 setrlimit 成功或者低于当前的限制
+    bestlimit = maxfiles;
+    while(bestlimit > oldlimit) {
+        rlim_t decr_step = 16;
+
+        limit.rlim_cur = bestlimit;
+        // 硬限制不能被降低，没有权限时也不能超过原来的硬限制
+        if (limit.rlim_max < bestlimit) limit.rlim_max = bestlimit;
+        if (setrlimit(RLIMIT_NOFILE,&limit) != -1) break;
+        setrlimit_error = errno;
+
+        // 没有权限提升硬限制时，先尝试直接提升到硬限制
+        if (getrlimit(RLIMIT_NOFILE,&limit) != -1 && limit.rlim_max < bestlimit &&
+            limit.rlim_max > oldlimit) {
+            bestlimit = limit.rlim_max;
+            continue;
+        }
+        if (bestlimit < decr_step) break;
+        bestlimit -= decr_step;
+    }
+
+    // 一点都没有提升，假定当前的限制就是能得到的最大值
+    if (bestlimit < oldlimit) bestlimit = oldlimit;
+
+    if (bestlimit < maxfiles) {
+        int old_maxclients = server.maxclients;
+
+        // 保留的文件描述符都不够，无法运行
+        if (bestlimit <= KVDATA_MIN_RESERVED_FDS) {
+            serverLog(KVDATA_WARNING, "Your current 'ulimit -n' of %llu is not enough for the server to start. Please increase your open file limit to at least %llu. Exiting.\n",
+                (unsigned long long) oldlimit, (unsigned long long) maxfiles);
+            exit(1);
+        }
+        server.maxclients = bestlimit-KVDATA_MIN_RESERVED_FDS;
+        serverLog(KVDATA_WARNING, "You requested maxclients of %d requiring at least %llu max file descriptors.\n",
+            old_maxclients, (unsigned long long) maxfiles);
+        serverLog(KVDATA_WARNING, "Server can't set maximum open files to %llu because of OS error: %s.\n",
+            (unsigned long long) maxfiles, strerror(setrlimit_error));
+        serverLog(KVDATA_WARNING, "Current maximum open files is %llu. maxclients has been reduced to %d to compensate for low ulimit. "
+               "If you need higher maxclients increase 'ulimit -n'.\n",
+            (unsigned long long) bestlimit, server.maxclients);
+    } else {
+        serverLog(KVDATA_NOTICE, "Increased maximum number of open files to %llu (it was originally set to %llu).\n",
+            (unsigned long long) maxfiles, (unsigned long long) oldlimit);
+    }
+}
+
+/*
+ * 检查内核的 somaxconn ，它比 server.tcp_backlog 小时 listen 的队列长度会被内核截断
+ */
+void checkTcpBacklogSettings(void) {
+    FILE *fp = fopen("/proc/sys/net/core/somaxconn","r");
+    char buf[1024];
+
+    if (!fp) return;
+    if (fgets(buf,sizeof(buf),fp) != NULL) {
+        int somaxconn = atoi(buf);
+        if (somaxconn > 0 && somaxconn < server.tcp_backlog) {
+            serverLog(KVDATA_WARNING, "WARNING: The TCP backlog setting of %d cannot be enforced because /proc/sys/net/core/somaxconn is set to the lower value of %d.\n",
+                server.tcp_backlog, somaxconn);
+        }
+    }
+    fclose(fp);
 }
 
 /*
@@ -138,18 +379,193 @@ int serverCron(struct aeEventLoop *eventLoop, void *clientData)
             //后台RDB结束
             if(pid==server.rdb_child_pid){
                 backgroundSaveDoneHandler(exitcode,signal);
-                printf("Successfully RDB bgsave.\n");
+                serverLog(KVDATA_NOTICE, "Successfully RDB bgsave.\n");
 
             //结束进程id与RDB子进程不一致
             }else{
-            printf(" Warning, detected child with unmatched pid: %ld.\n",(long)pid);
+            serverLog(KVDATA_WARNING, " Warning, detected child with unmatched pid: %ld.\n",(long)pid);
             }
             pid = 0;
         }  
     }
+    // 采样瞬时指标
+    run_with_period(100) {
+        trackInstantaneousMetric(KVDATA_METRIC_EXPIRED,
+            __atomic_load_n(&server.stat_expiredkeys,__ATOMIC_RELAXED));
+    }
+
+    // 根据碎片率决定是否进行主动碎片整理
+    run_with_period(1000) computeDefragCycles();
+
+    // 定期删除过期键，缩小填充率过低的哈希表，推进渐进式 rehash
+    databasesCron(server.db);
+
     // 重连接主服务器
-    replicationCron();
-    return 5000;
+    run_with_period(5000) replicationCron();
+
+    server.cronloops++;
+    return 1000/server.hz;
+}
+
+/*
+ * 记录一次瞬时指标的采样，current_reading 为计数器的当前值
+ * 由 serverCron 每 100 毫秒调用一次
+ */
+void trackInstantaneousMetric(int metric, long long current_reading) {
+    long long now = clockMonotonicUs()/1000;
+    long long t = now-server.inst_metric[metric].last_sample_time;
+    long long ops = current_reading-server.inst_metric[metric].last_sample_count;
+    long long ops_sec = t > 0 ? (ops*1000/t) : 0;
+
+    server.inst_metric[metric].samples[server.inst_metric[metric].idx] = ops_sec;
+    server.inst_metric[metric].idx++;
+    server.inst_metric[metric].idx %= KVDATA_METRIC_SAMPLES;
+    server.inst_metric[metric].last_sample_time = now;
+    server.inst_metric[metric].last_sample_count = current_reading;
+}
+
+/*
+ * 返回瞬时指标最近几次采样的平均值（每秒）
+ */
+long long getInstantaneousMetric(int metric) {
+    long long sum = 0;
+
+    for (int j = 0; j < KVDATA_METRIC_SAMPLES; j++)
+        sum += server.inst_metric[metric].samples[j];
+    return sum / KVDATA_METRIC_SAMPLES;
+}
+
+/*
+ * 定期删除过期键
+ *
+ * 惰性删除只在键被访问时检查过期时间，写入之后不再被访问的过期键会一直占用内存。
+ * 这里从每个数据库的过期字典中随机抽样 KVDATA_ACTIVE_EXPIRE_KEYS_PER_LOOP 个键，删除其中已经过期的，
+ * 只要抽样中已过期的键超过 KVDATA_ACTIVE_EXPIRE_ACCEPTABLE_STALE% 就继续抽样，
+ * 直到过期键的比例降下来，或者用完本次的时间预算。
+ *
+ * type 为 KVDATA_ACTIVE_EXPIRE_CYCLE_SLOW 时由时间事件调用，
+ * 时间预算为每次时间事件间隔的 KVDATA_ACTIVE_EXPIRE_SLOW_TIME_PERC% 。
+ * type 为 KVDATA_ACTIVE_EXPIRE_CYCLE_FAST 时由 beforeSleep 调用，
+ * 只在上一次定期删除用完了时间预算，或者估计的过期键比例仍然过高时执行，
+ * 时间预算为 KVDATA_ACTIVE_EXPIRE_FAST_DURATION 微秒，并且两次之间至少间隔两倍的预算。
+ *
+ * 多 reactor 模式下每个 reactor 在自己的线程上处理自己的键空间分片，
+ * 所以这里的状态都是线程局部的。
+ */
+void activeExpireCycle(KVdataDb *db, int type) {
+    // 上一次定期删除是否因为用完时间预算而结束
+    static __thread int timelimit_exit = 0;
+    // 上一次快速定期删除开始的时间
+    static __thread uint64_t last_fast_cycle = 0;
+    uint64_t start = getMonotonicUs(), timelimit;
+    int iteration = 0;
+
+    if (server.loading) return;
+
+    if (type == KVDATA_ACTIVE_EXPIRE_CYCLE_FAST) {
+        int stale = timelimit_exit;
+
+        for (int j = 0; j < server.dbnum && !stale; j++)
+            stale = db[j].avg_stale_perc*100 > KVDATA_ACTIVE_EXPIRE_ACCEPTABLE_STALE;
+        if (!stale) return;
+        if (start < last_fast_cycle+KVDATA_ACTIVE_EXPIRE_FAST_DURATION*2) return;
+        last_fast_cycle = start;
+        timelimit = KVDATA_ACTIVE_EXPIRE_FAST_DURATION;
+    } else {
+        timelimit = 1000000*KVDATA_ACTIVE_EXPIRE_SLOW_TIME_PERC/server.hz/100;
+        if (timelimit == 0) timelimit = 1;
+    }
+    timelimit_exit = 0;
+
+    for (int j = 0; j < server.dbnum && !timelimit_exit; j++) {
+        KVdataDb *d = db+j;
+        long long sampled = 0, expired = 0;
+        unsigned int num, n, loop_expired;
+
+        do {
+            dictEntry *des[KVDATA_ACTIVE_EXPIRE_KEYS_PER_LOOP];
+            long long now;
+
+            loop_expired = 0;
+
+            // 没有带过期时间的键
+            if ((num = dictSize(d->expires)) == 0) {
+                double zero = 0;
+                __atomic_store(&d->avg_stale_perc, &zero, __ATOMIC_RELAXED);
+                break;
+            }
+            if (num > KVDATA_ACTIVE_EXPIRE_KEYS_PER_LOOP) num = KVDATA_ACTIVE_EXPIRE_KEYS_PER_LOOP;
+
+            // 删除一个键不会移动其他节点，抽样得到的节点指针在删除过程中一直有效
+            n = dictGetSomeKeys(d->expires, des, num);
+            now = mstime();
+            for (unsigned int k = 0; k < n; k++) {
+                if ((long long)des[k]->expire < now) {
+                    robj key = {.encoding = STRING, .refcount = 1, .ptr = des[k]->key};
+
+                    dbDelete(d, &key);
+                    loop_expired++;
+                }
+            }
+            sampled += n;
+            expired += loop_expired;
+            if (loop_expired) __atomic_add_fetch(&server.stat_expiredkeys, loop_expired, __ATOMIC_RELAXED);
+
+            // 每 16 轮检查一次是否用完了时间预算
+            if ((++iteration & 0xf) == 0 && getMonotonicUs()-start > timelimit) {
+                timelimit_exit = 1;
+                __atomic_add_fetch(&server.stat_expired_time_cap_reached_count, 1, __ATOMIC_RELAXED);
+                break;
+            }
+            // 本轮抽样中过期键的比例不高，剩下的过期键留到下一次
+        } while (loop_expired*100 > n*KVDATA_ACTIVE_EXPIRE_ACCEPTABLE_STALE);
+
+        // 更新过期键比例的移动平均， INFO 可能在其他线程中读取
+        if (sampled) {
+            double perc = (double)expired/sampled*0.05 + d->avg_stale_perc*0.95;
+            __atomic_store(&d->avg_stale_perc, &perc, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/*
+ * 对 dbnum 个数据库执行后台维护，每次时间事件中调用一次
+ * 多 reactor 模式下每个 reactor 在自己的线程上处理自己的键空间分片
+ *
+ * (1) 定期删除过期键
+ * (2) 填充率低于 DICT_MIN_FILL_PERCENT 的哈希表会被缩小
+ * (3) 正在 rehash 的字典在 KVDATA_REHASH_BUDGET_US 微秒的总预算内推进 rehash ，
+ *     这样不再被访问的字典也能完成 rehash ，释放旧的哈希表
+ * (4) 碎片率过高时进行主动碎片整理
+ *
+ * RDB 子进程存在时跳过后三项，移动槽位和分配会让父进程写时复制大量内存页。
+ * 插入时的扩展和访问时的单步 rehash 不受影响，开放寻址的哈希表装满之前必须扩展。
+ */
+void databasesCron(KVdataDb *db) {
+    uint64_t start, elapsed;
+
+    activeExpireCycle(db, KVDATA_ACTIVE_EXPIRE_CYCLE_SLOW);
+
+    if (server.rdb_child_pid != -1) return;
+
+    for (int j = 0; j < server.dbnum; j++) {
+        dict *dicts[3] = {db[j].DB, db[j].expires, db[j].watched_keys};
+        for (int k = 0; k < 3; k++)
+            if (dictNeedsShrink(dicts[k])) dictResize(dicts[k]);
+    }
+
+    activeDefragCycle(db);
+
+    start = getMonotonicUs();
+    for (int j = 0; j < server.dbnum; j++) {
+        dict *dicts[3] = {db[j].DB, db[j].expires, db[j].watched_keys};
+        for (int k = 0; k < 3; k++) {
+            if (!dictIsRehashing(dicts[k])) continue;
+            elapsed = getMonotonicUs()-start;
+            if (elapsed >= KVDATA_REHASH_BUDGET_US) return;
+            dictRehashMicroseconds(dicts[k], KVDATA_REHASH_BUDGET_US-elapsed);
+        }
+    }
 }
 
 
@@ -159,16 +575,50 @@ int serverCron(struct aeEventLoop *eventLoop, void *clientData)
  */
 void setProtocolError(KVClient *c, int pos) {
 
-    printf("Protocol error from client: %d\n",c->fd);
+    serverLog(KVDATA_VERBOSE, "Protocol error from client: %d\n",c->fd);
     //KVDATA_CLOSE_AFTER_REPLY表示有用户对这个客户端执行了CLIENT KILL命令，
     // 或者客户端发送给服务器的命令请求中包含了错误的协议内容。
     // 服务器会将客户端积存在输出缓冲区中的所有内容发送给客户端，然后关闭客户端。
+    // 先回复一条错误，写出回复之后客户端就会被关闭
+    // I/O 线程中只写入固定回复缓冲区，由主线程把客户端加入待写链表
+    if (c->flags & KVDATA_PENDING_READ)
+        addReplyToBuffer(c,"-ERR Protocol error\r\n",21);
+    else
+        addReplySds(c,sdsnew("-ERR Protocol error\r\n"));
     c->flags |= KVDATA_CLOSE_AFTER_REPLY;
     //删除输入缓冲区中区间之外的内容
     sdsrange(c->querybuf,pos,-1);
 }
 
 
+/*
+ * 事件处理器每次进入阻塞等待之前调用
+ * (1)由 I/O 线程读取并解析待读客户端的查询缓冲区，然后在主线程中执行命令
+ * (2)将本轮产生的回复直接写出（或交给 I/O 线程写出），写不完的才安装写事件处理器
+ * (3)多 reactor 模式下，处理其他 reactor 发来的消息，并唤醒本轮投递了消息的 reactor
+ *
+ * 多 reactor 模式下每个 reactor 的事件处理器都使用这个函数
+ */
+void beforeSleep(struct aeEventLoop *eventLoop) {
+    // 主线程每次迭代更新一次 server.unixtime
+    if (currentReactor->id == 0) updateCachedTime();
+
+    // 处理由 I/O 线程读取的客户端
+    handleClientsWithPendingReadsUsingThreads();
+
+    // io_uring 后端下批量读取本轮可读的客户端
+    if (eventLoop->backend == AE_BACKEND_URING) handleClientsWithPendingReadsUsingUring(eventLoop);
+
+    // 处理 reactor 之间转发的命令
+    if (server.reactors_num > 1) reactorBeforeSleep();
+
+    // 上一次定期删除没有删完过期键时，快速地再删除一些
+    activeExpireCycle(currentReactor->db, KVDATA_ACTIVE_EXPIRE_CYCLE_FAST);
+
+    // 写出所有客户端的回复
+    handleClientsWithPendingWritesUsingThreads();
+}
+
 /* 
  * 处理客户端输入的命令内容，将其解析后执行命令
  */
@@ -177,20 +627,31 @@ void processInputBuffer(KVClient *c) {
     // 如果读取出现 short read ，那么可能会有内容滞留在读取缓冲区里面
     // 这些滞留内容也许不能完整构成一个符合协议的命令，
     // 需要等待下次读事件的就绪
-    while(sdslen(c->querybuf)>2) {
+    while(sdslen(c->querybuf)>0) {
         // 表示有用户对这个客户端执行了CLIENT KILL命令，
         // 或者客户端发送给服务器的命令请求中包含了错误的协议内容，没有必要处理命令了
         if (c->flags & KVDATA_CLOSE_AFTER_REPLY) return;
+        // 命令已转发给其他 reactor 执行，等执行完毕之后再继续处理
+        if (c->flags & KVDATA_FORWARDED) break;
         // 将client的querybuf中的协议内容转换为client的参数列表中的对象
-        processMultibulkBuffer(c);
+        // 命令还不完整时，等待下次读事件
+        if (processMultibulkBuffer(c) != AE_OK) break;
         
-        for(int i=0;i<c->argc;i++)
-        printf("NO.[%d]: %s  \n",i,(char *)c->argv[i]->ptr);
+        // 只有调试级别才打印命令参数，其他级别下连循环都不用执行
+        if (server.verbosity <= KVDATA_DEBUG) {
+            for(int i=0;i<c->argc;i++)
+                serverLog(KVDATA_DEBUG, "NO.[%d]: %s  \n",i,(char *)c->argv[i]->ptr);
+        }
         //多条查询可以看到参数长度<=0的情况
         //当参数个数为0，直接重置客户端，无需执行命令
         if (c->argc == 0) {
             resetClient(c);
         } else {
+            // 在 I/O 线程中只负责解析，命令交由主线程执行
+            if (c->flags & KVDATA_PENDING_READ) {
+                c->flags |= KVDATA_PENDING_COMMAND;
+                break;
+            }
             // 执行命令，并重置客户端
             if (processCommand(c) == AE_OK)
                 resetClient(c);
@@ -199,6 +660,22 @@ void processInputBuffer(KVClient *c) {
 }
 
 
+/*
+ * 创建一个内容为 ptr 、长度为 len 的参数对象
+ * 客户端缓存了参数对象时，将内容复制到缓存对象的 SDS 中，空间足够时不需要分配内存
+ */
+static robj *createClientArgObject(KVClient *c, char *ptr, size_t len) {
+    robj *o;
+
+    // 参数对象的 sds 需要能够被复用和原地修改，总是使用 STRING 编码
+    if (c->argv_pool_len == 0 || len > KVDATA_ARGV_POOL_MAX_LEN)
+        return createRawStringObject(ptr,len);
+
+    o = c->argv_pool[--c->argv_pool_len];
+    o->ptr = sdscpylen(o->ptr,ptr,len);
+    return o;
+}
+
 /* 
  * 将客户端命令输入缓冲区 c->querybuf 中的协议内容转换成 c->argv 中的参数对象
  *
@@ -207,6 +684,13 @@ void processInputBuffer(KVClient *c) {
  * argv[0] = SET
  * argv[1] = MSG
  * argv[2] = HELLO
+ *
+ * 命令可能分多次读入，解析是可以中断和恢复的：
+ * 还需读入的参数个数保存在 c->multibulklen ，当前参数的长度保存在 c->bulklen ，
+ * 已经解析出的参数保存在 c->argv 中并从查询缓冲区中删除，内容不完整时返回 AE_ERR 等待下次读入。
+ *
+ * 命令已经完整读入时返回 AE_OK ；
+ * 内容还不完整，或者内容不符合协议时返回 AE_ERR ，后者会为客户端设置 KVDATA_CLOSE_AFTER_REPLY 。
  */
 int processMultibulkBuffer(KVClient *c) {
     char *newline = NULL;
@@ -228,43 +712,64 @@ int processMultibulkBuffer(KVClient *c) {
         //         newline
         //如果找不到第一个 "\r\n"
         if (newline == NULL) {
-            //报告错误，内容不符合协议
-            printf("Protocol error: too big mbulk count string\n");
-            //如果在读入协议内容时，发现内容不符合协议，那么异步地关闭这个客户端。
-            setProtocolError(c,0);
+            // 这么长都没有 "\r" ，内容不符合协议
+            if (sdslen(c->querybuf) > KVDATA_INLINE_MAX_SIZE) {
+                serverLog(KVDATA_VERBOSE, "Protocol error: too big mbulk count string\n");
+                setProtocolError(c,0);
+            }
+            // 否则等待更多内容
             return AE_ERR;
         }
 
+        // "\r" 之后的 "\n" 还没有读入
+        if (newline-(c->querybuf) > ((signed)sdslen(c->querybuf)-2))
+            return AE_ERR;
+
         // 协议的第一个字符必须是 '*'
-        assert(c->querybuf[0] == '*');
+        if (c->querybuf[0] != '*') {
+            serverLog(KVDATA_VERBOSE, "Protocol error: expected '*', got '%c'\n", c->querybuf[0]);
+            setProtocolError(c,0);
+            return AE_ERR;
+        }
 
         // 将参数个数，也即是 * 之后， \r\n 之前的数字取出并保存到 ll 中
         // 比如对于 *3\r\n ，那么 ll 将等于 3
         ok = string2ll(c->querybuf+1,newline-(c->querybuf+1),&ll);
 
         // 参数个数转换失败，或参数的数量超出限制
-        if (!ok) {
+        if (!ok || ll > KVDATA_PROTO_MAX_MULTIBULK_LEN) {
             //报告错误，内容不符合协议
-            printf("Protocol error: invalid multibulk length.\n");
+            serverLog(KVDATA_VERBOSE, "Protocol error: invalid multibulk length.\n");
             //如果在读入协议内容时，发现内容不符合协议，那么异步地关闭这个客户端。
             setProtocolError(c,pos);
             return AE_ERR;
         }
 
-        // 设置该条命令的参数数量
-        c->multibulklen = ll;
-        
-        // 根据参数数量，为各个参数对象分配空间
-        if (c->argv) zfree(c->argv);
-        c->argv = zmalloc(sizeof(robj*)*c->multibulklen);
-
         // 参数数量之后的位置
         // 比如对于 *3\r\n$3\r\n$SET\r\n... 来说，
         // pos 指向 *3\r\n$3\r\n$SET\r\n...
         //                ^
         //                |
         //               pos
-        pos = (newline-c->querybuf)+2;  
+        pos = (newline-c->querybuf)+2;
+
+        // 空命令，比如 *0\r\n ，直接跳过
+        if (ll <= 0) {
+            sdsrange(c->querybuf,pos,-1);
+            return AE_OK;
+        }
+
+        // 设置该条命令的参数数量
+        c->multibulklen = ll;
+        
+        // 根据参数数量，为各个参数对象分配空间
+        // 上一条命令的参数数组足够大时直接复用，
+        // 参数数组最多先分配 1024 个，避免一个很大的参数个数就占用大量内存，不够时再扩大
+        if (c->argv_len < c->multibulklen) {
+            zfree(c->argv);
+            c->argv_len = c->multibulklen < 1024 ? c->multibulklen : 1024;
+            c->argv = zmalloc(sizeof(robj*)*c->argv_len);
+        }
     }
    //确定当前命令的参数数量>0
     assert(c->multibulklen > 0);
@@ -279,18 +784,25 @@ int processMultibulkBuffer(KVClient *c) {
         //                   |
         //                newline
             newline = strchr(c->querybuf+pos,'\r');
-            // 确保 "\r\n" 存在
+            // 参数长度还没有完整读入
             if (newline == NULL) {
-                //报告错误，内容不符合协议
-                printf("Protocol error: invalid bulklen length.\n");
-                //如果在读入协议内容时，发现内容不符合协议，那么异步地关闭这个客户端。
-                setProtocolError(c,pos);
-                return AE_ERR;
+                // 这么长都没有 "\r" ，内容不符合协议
+                if (sdslen(c->querybuf)-pos > KVDATA_INLINE_MAX_SIZE) {
+                    serverLog(KVDATA_VERBOSE, "Protocol error: too big bulk count string\n");
+                    setProtocolError(c,0);
+                    return AE_ERR;
+                }
+                break;
             }
+
+            // "\r" 之后的 "\n" 还没有读入
+            if (newline-(c->querybuf) > ((signed)sdslen(c->querybuf)-2))
+                break;
+
             // 确保协议符合参数格式，检查其中的 $...
             // 比如 $3\r\nSET\r\n
             if (c->querybuf[pos] != '$') {
-                printf("Protocol error: expected '$', got '%c'\n", c->querybuf[pos]);
+                serverLog(KVDATA_VERBOSE, "Protocol error: expected '$', got '%c'\n", c->querybuf[pos]);
                 setProtocolError(c,pos);
                 return AE_ERR;
             }
@@ -298,8 +810,8 @@ int processMultibulkBuffer(KVClient *c) {
             // 读取长度
             // 比如 $3\r\nSET\r\n 将会让 ll 的值设置 3
             ok = string2ll(c->querybuf+pos+1,newline-(c->querybuf+pos+1),&ll);
-            if (!ok) {
-                printf("Protocol error: invalid bulk length\n");
+            if (!ok || ll < 0 || ll > KVDATA_PROTO_MAX_BULK_LEN) {
+                serverLog(KVDATA_VERBOSE, "Protocol error: invalid bulk length\n");
                 setProtocolError(c,pos);
                 return AE_ERR;
             }
@@ -310,19 +822,53 @@ int processMultibulkBuffer(KVClient *c) {
             //       |
             //      pos
             pos += newline-(c->querybuf+pos)+2;
+
+            // 大参数：删除参数之前已经处理的内容，并为整个参数预留空间，
+            // 这样参数会被直接读入查询缓冲区的开头，读完之后整个查询缓冲区就是参数对象，
+            // 不需要复制，也不需要每次读入都移动缓冲区中的内容
+            if (ll >= KVDATA_MBULK_BIG_ARG) {
+                size_t qblen;
+
+                sdsrange(c->querybuf,pos,-1);
+                pos = 0;
+                qblen = sdslen(c->querybuf);
+                // 为参数以及结尾的 "\r\n" 预留空间
+                if (qblen < (size_t)ll+2)
+                    c->querybuf = sdsMakeRoomFor(c->querybuf,ll+2-qblen);
+            }
             
             // 参数的长度
             c->bulklen = ll;
+        }
 
-            if(c->execlen == 0)
-            c->execlen = c->bulklen;
+        // 参数内容（包括结尾的 "\r\n"）还没有完整读入
+        if (sdslen(c->querybuf)-pos < (size_t)(c->bulklen+2))
+            break;
+
+        // 参数数组已满，扩大参数数组
+        if (c->argc == c->argv_len) {
+            c->argv_len = c->argv_len*2 < c->argc+c->multibulklen ?
+                          c->argv_len*2 : c->argc+c->multibulklen;
+            c->argv = zrealloc(c->argv,sizeof(robj*)*c->argv_len);
         }
-       
+
         // 读入参数
-        // 为参数创建字符串对象      
-        c->argv[c->argc++] = createStringObject(c->querybuf+pos,c->bulklen);
-        //将游标后移
-        pos += c->bulklen+2;
+        // 查询缓冲区恰好是一个完整的大参数，直接将它作为参数对象，并为后续内容新建查询缓冲区
+        if (pos == 0 &&
+            c->bulklen >= KVDATA_MBULK_BIG_ARG &&
+            (signed) sdslen(c->querybuf) == c->bulklen+2)
+        {
+            // 去掉结尾的 "\r\n"
+            sdsIncrLen(c->querybuf,-2);
+            c->argv[c->argc++] = createObject(STRING,c->querybuf);
+            c->querybuf = sdsnewlen("",0);
+            pos = 0;
+        } else {
+            // 为参数创建字符串对象，优先复用缓存的参数对象
+            c->argv[c->argc++] = createClientArgObject(c,c->querybuf+pos,c->bulklen);
+            //将游标后移
+            pos += c->bulklen+2;
+        }
         
         // 清空参数长度
         c->bulklen = -1;
@@ -336,7 +882,7 @@ int processMultibulkBuffer(KVClient *c) {
     // 如果本条命令的所有参数都已读取完，那么返回
     if (c->multibulklen == 0) return AE_OK;
       
-    // 如果还有参数未读取完，那么就协议内容有错
+    // 还有参数没有读入，等待下次读事件
     return AE_ERR;
 }
 
@@ -351,46 +897,51 @@ int processMultibulkBuffer(KVClient *c) {
  * 否则，如果这个函数返回 0 ，那么表示客户端已经被销毁。
  */
 int processCommand(KVClient *c) {
-    // 如果执行命令伪quit命令，特别处理 quit 命令
-    // strcasecmp进行字符串比较时会自动忽略大小写
-    if (!strcasecmp(c->argv[0]->ptr,"quit")) {
-        printf("QUIT\n");
-
-        //表示有用户对这个客户端执行了CLIENT KILL命令
-        c->flags |= KVDATA_CLOSE_AFTER_REPLY;
-        return AE_ERR;
-    }
-    sds name = sdsnewlen((char*)c->argv[0]->ptr, c->execlen);
-    c->execlen = 0;
     // 查找命令，并进行命令合法性检查，以及命令参数个数检查
-    c->cmd = c->lastcmd = lookupCommand(name);
+    c->cmd = c->lastcmd = lookupCommand(c->argv[0]->ptr,sdslen(c->argv[0]->ptr));
     //查找命令出错
     if (!c->cmd) {
+        // quit 是伪命令，不在命令表中，只在查找失败时才比较，
+        // 其他命令不需要多一次字符串比较
+        // strcasecmp进行字符串比较时会自动忽略大小写
+        if (!strcasecmp(c->argv[0]->ptr,"quit")) {
+            serverLog(KVDATA_DEBUG, "QUIT\n");
+
+            //表示有用户对这个客户端执行了CLIENT KILL命令
+            c->flags |= KVDATA_CLOSE_AFTER_REPLY;
+            return AE_ERR;
+        }
         // 没找到指定的命令，如果客户端正在执行事务，则事务执行将失败
         flagTransaction(c);
-        printf("unknown command '%s'\n", name);
+        serverLog(KVDATA_DEBUG, "unknown command '%s'\n", (char*)c->argv[0]->ptr);
         addReply(c,shared.syntaxerr);
         return AE_OK;
 
     //参数个数错误
     } else if ((c->cmd->counts > 0 && c->cmd->counts != c->argc) ||
-               (c->argc < c->cmd->counts)) {
+               (c->argc < -c->cmd->counts)) {
         // 参数个数错误，如果客户端正在执行事务，则事务执行将失败
         flagTransaction(c);
-        printf("wrong number of arguments for '%s' command", c->cmd->name);
+        serverLog(KVDATA_DEBUG, "wrong number of arguments for '%s' command", c->cmd->name);
+        __atomic_add_fetch(&c->cmd->rejected_calls,1,__ATOMIC_RELAXED);
+        addReplySds(c,sdscatprintf(sdsnewlen("",0),
+            "-ERR wrong number of arguments for '%s' command\r\n",c->cmd->name));
         return AE_OK;
     }
+    // 多 reactor 模式下，命令需要交给拥有键的 reactor 执行，
+    // 由拥有键的 reactor 在执行之前检查内存上限
+    if (server.reactors_num > 1) return reactorDispatchCommand(c);
+    // 设置了内存上限时，需要的话先淘汰键，仍然超过上限时拒绝执行写命令
+    if (server.maxmemory && checkMaxmemory(c) == AE_ERR) return AE_OK;
     /* 避开事务状态下需要立即执行的命令 */
-    if (c->flags & KVDATA_MULTI &&
-        c->cmd->proc != execCommand && c->cmd->proc != discardCommand &&
-        c->cmd->proc != multiCommand && c->cmd->proc != watchCommand)
+    if (c->flags & KVDATA_MULTI && !(c->cmd->flags & KVDATA_CMD_TRANSACTION))
     {
         // 在事务上下文中
         // 除 EXEC 、 DISCARD 、 MULTI 和 WATCH 命令之外
         // 其他所有命令都会被入队到事务队列中   
         queueMultiCommand(c);
         addReply(c,shared.queued);
-        printf("QUEUE\n");
+        serverLog(KVDATA_DEBUG, "QUEUE\n");
     } else {
         // 执行命令
         call(c,0);
@@ -402,10 +953,376 @@ int processCommand(KVClient *c) {
  * 调用命令的实现函数，执行命令
  */ 
 void call(KVClient *c, int flags) {
+    struct KVDataCommand *cmd = c->cmd;
     // start 记录命令开始执行的时间
-    long long dirty, start, duration;
+    uint64_t start, duration;
+
+    KVDATA_NOTUSED(flags);
+    start = getMonotonicUs();
+    // 由 start 换算出命令时间，命令中判断过期时不需要再读取系统时间
+    clockEnterCommand(start);
     // 执行实现函数
-    c->cmd->proc(c);
+    cmd->proc(c);
+    clockLeaveCommand();
+    duration = getMonotonicUs()-start;
+
+    // 更新命令的统计信息
+    // EXEC 执行事务中的命令时会修改 c->cmd ，所以使用执行前保存的 cmd
+    recordCommandLatency(cmd,duration);
+    // 执行时间超过阈值时记录慢查询日志
+    slowlogPushEntryIfNeeded(c,c->argv,c->argc,duration);
+}
+
+/*
+ * 返回耗时 us 微秒在延迟直方图中所在的桶
+ * 小于 2^KVDATA_LATENCY_SUB_BITS 的值每个值一个桶，
+ * 之后每个 2 的幂区间按照最高位之后的 KVDATA_LATENCY_SUB_BITS 位分为若干个桶
+ */
+static int latencyBucket(uint64_t us) {
+    int e;
+
+    if (us < (1<<KVDATA_LATENCY_SUB_BITS)) return (int)us;
+    // 最高位的位置
+    e = 63-__builtin_clzll(us);
+    if (e > KVDATA_LATENCY_MAX_EXP) return KVDATA_LATENCY_BUCKETS-1;
+    return ((e-KVDATA_LATENCY_SUB_BITS+1)<<KVDATA_LATENCY_SUB_BITS) +
+           (int)((us>>(e-KVDATA_LATENCY_SUB_BITS)) & ((1<<KVDATA_LATENCY_SUB_BITS)-1));
+}
+
+/*
+ * 返回延迟直方图中第 bucket 个桶可以表示的最大耗时
+ */
+static uint64_t latencyBucketMax(int bucket) {
+    int e, sub;
+
+    if (bucket < (1<<KVDATA_LATENCY_SUB_BITS)) return bucket;
+    e = (bucket>>KVDATA_LATENCY_SUB_BITS)+KVDATA_LATENCY_SUB_BITS-1;
+    sub = bucket & ((1<<KVDATA_LATENCY_SUB_BITS)-1);
+    return ((((uint64_t)1<<KVDATA_LATENCY_SUB_BITS)+sub+1)<<(e-KVDATA_LATENCY_SUB_BITS))-1;
+}
+
+/*
+ * 记录命令的一次执行，耗时为 duration 微秒
+ * 多 reactor 模式下多个线程会同时执行同一个命令，所有计数器都原子地更新
+ */
+void recordCommandLatency(struct KVDataCommand *cmd, uint64_t duration) {
+    long long max = __atomic_load_n(&cmd->latency_max,__ATOMIC_RELAXED);
+
+    __atomic_add_fetch(&cmd->calls,1,__ATOMIC_RELAXED);
+    __atomic_add_fetch(&cmd->microseconds,(long long)duration,__ATOMIC_RELAXED);
+    __atomic_add_fetch(&cmd->latency[latencyBucket(duration)],1,__ATOMIC_RELAXED);
+    // 失败时 max 会被更新为最新的值
+    while ((long long)duration > max &&
+           !__atomic_compare_exchange_n(&cmd->latency_max,&max,(long long)duration,0,
+                                        __ATOMIC_RELAXED,__ATOMIC_RELAXED));
+}
+
+/*
+ * 根据命令的延迟直方图计算百分位数 p （0 到 100），没有执行记录时返回 0
+ * 返回值是百分位数所在桶能表示的最大耗时，不会超过记录到的最长耗时
+ */
+static uint64_t commandLatencyPercentile(struct KVDataCommand *cmd, double p) {
+    long long total = 0, seen = 0, rank;
+    long long max = __atomic_load_n(&cmd->latency_max,__ATOMIC_RELAXED);
+    int j;
+
+    for (j = 0; j < KVDATA_LATENCY_BUCKETS; j++)
+        total += __atomic_load_n(&cmd->latency[j],__ATOMIC_RELAXED);
+    if (total == 0) return 0;
+
+    // 第 rank 次（从 1 开始）执行所在的桶就是百分位数所在的桶
+    rank = (long long)(total*p/100.0+0.5);
+    if (rank < 1) rank = 1;
+    for (j = 0; j < KVDATA_LATENCY_BUCKETS; j++) {
+        seen += __atomic_load_n(&cmd->latency[j],__ATOMIC_RELAXED);
+        if (seen >= rank) break;
+    }
+    if (j == KVDATA_LATENCY_BUCKETS) j--;
+    return latencyBucketMax(j) < (uint64_t)max ? latencyBucketMax(j) : (uint64_t)max;
+}
+
+/*
+ * 将以字节为单位的 n 转换为易读的格式，比如 1.50M
+ */
+static void bytesToHuman(char *s, size_t size, unsigned long long n) {
+    double d;
+
+    if (n < 1024) {
+        snprintf(s,size,"%lluB",n);
+    } else if (n < (1024*1024)) {
+        d = (double)n/(1024);
+        snprintf(s,size,"%.2fK",d);
+    } else if (n < (1024LL*1024*1024)) {
+        d = (double)n/(1024*1024);
+        snprintf(s,size,"%.2fM",d);
+    } else {
+        d = (double)n/(1024LL*1024*1024);
+        snprintf(s,size,"%.2fG",d);
+    }
+}
+
+/*
+ * 生成 INFO 命令的回复内容
+ * section 为 "all" 或者 "default" 时生成所有部分，否则只生成指定的部分
+ */
+sds genInfoString(char *section) {
+    sds info = sdsnewlen("",0);
+    time_t uptime = server.unixtime-server.stat_starttime;
+    int allsections = 0, defsections = 0;
+    int sections = 0;
+    unsigned int j;
+
+    allsections = strcasecmp(section,"all") == 0;
+    defsections = strcasecmp(section,"default") == 0;
+
+    // 服务器信息
+    if (allsections || defsections || !strcasecmp(section,"server")) {
+        if (sections++) info = sdscatprintf(info,"\r\n");
+        info = sdscatprintf(info,
+            "# Server\r\n"
+            "process_id:%ld\r\n"
+            "run_id:%s\r\n"
+            "tcp_port:%d\r\n"
+            "uptime_in_seconds:%ld\r\n"
+            "uptime_in_days:%ld\r\n"
+            "hz:%d\r\n"
+            "event_backend:%s\r\n"
+            "io_threads:%d\r\n"
+            "reactors:%d\r\n",
+            (long) getpid(),
+            server.serverid,
+            server.port,
+            (long) uptime,
+            (long) (uptime/(3600*24)),
+            server.hz,
+            server.event_backend == AE_BACKEND_URING ? "io_uring" : "epoll",
+            server.io_threads_num,
+            server.reactors_num);
+    }
+
+    // 客户端信息
+    if (allsections || defsections || !strcasecmp(section,"clients")) {
+        if (sections++) info = sdscatprintf(info,"\r\n");
+        info = sdscatprintf(info,
+            "# Clients\r\n"
+            "connected_clients:%ld\r\n"
+            "maxclients:%d\r\n",
+            __atomic_load_n(&server.connected_clients,__ATOMIC_RELAXED),
+            server.maxclients);
+    }
+
+    // 内存信息
+    if (allsections || defsections || !strcasecmp(section,"memory")) {
+        char hmem[64], rss_hmem[64], maxmem_hmem[64];
+        size_t used = zmalloc_used_memory();
+        size_t rss = zmalloc_get_rss();
+        size_t allocated, active, resident;
+
+        zmalloc_get_allocator_info(&allocated,&active,&resident);
+        bytesToHuman(hmem,sizeof(hmem),used);
+        bytesToHuman(rss_hmem,sizeof(rss_hmem),rss);
+        bytesToHuman(maxmem_hmem,sizeof(maxmem_hmem),server.maxmemory);
+        if (sections++) info = sdscatprintf(info,"\r\n");
+        info = sdscatprintf(info,
+            "# Memory\r\n"
+            "used_memory:%zu\r\n"
+            "used_memory_human:%s\r\n"
+            "used_memory_rss:%zu\r\n"
+            "used_memory_rss_human:%s\r\n"
+            "maxmemory:%llu\r\n"
+            "maxmemory_human:%s\r\n"
+            "maxmemory_policy:%s\r\n"
+            "allocator_allocated:%zu\r\n"
+            "allocator_active:%zu\r\n"
+            "allocator_resident:%zu\r\n"
+            "allocator_frag_ratio:%.2f\r\n"
+            "allocator_rss_ratio:%.2f\r\n"
+            "mem_fragmentation_ratio:%.2f\r\n"
+            "mem_allocator:%s\r\n"
+            "active_defrag_running:%d\r\n",
+            used,
+            hmem,
+            rss,
+            rss_hmem,
+            server.maxmemory,
+            maxmem_hmem,
+            maxmemoryPolicyName(server.maxmemory_policy),
+            allocated,
+            active,
+            resident,
+            allocated ? (double)active/allocated : 0,
+            active ? (double)resident/active : 0,
+            used ? (double)rss/used : 0,
+            ZMALLOC_LIB,
+            __atomic_load_n(&server.active_defrag_running,__ATOMIC_RELAXED));
+        // 对象池的使用情况
+        info = slabInfo(info);
+    }
+
+    // 持久化信息
+    if (allsections || defsections || !strcasecmp(section,"persistence")) {
+        if (sections++) info = sdscatprintf(info,"\r\n");
+        info = sdscatprintf(info,
+            "# Persistence\r\n"
+            "loading:%d\r\n"
+            "rdb_changes_since_last_save:%lld\r\n"
+            "rdb_bgsave_in_progress:%d\r\n"
+            "rdb_child_pid:%d\r\n"
+            "rdb_last_save_time:%ld\r\n",
+            server.loading,
+            __atomic_load_n(&server.dirty,__ATOMIC_RELAXED),
+            server.rdb_child_pid != -1,
+            server.rdb_child_pid,
+            (long) server.lastsave);
+    }
+
+    // 统计信息
+    if (allsections || defsections || !strcasecmp(section,"stats")) {
+        long long numcommands = 0;
+        double stale_perc = 0;
+
+        for (j = 0; j < KVDATA_COMMAND_NUM; j++)
+            numcommands += __atomic_load_n(&KVDATACommandTable[j].calls,__ATOMIC_RELAXED);
+        // 所有键空间分片中过期键比例的估计值的平均
+        for (int r = 0; r < server.reactors_num; r++) {
+            for (int k = 0; k < server.dbnum; k++) {
+                double perc;
+                __atomic_load(&server.reactors[r].db[k].avg_stale_perc,&perc,__ATOMIC_RELAXED);
+                stale_perc += perc;
+            }
+        }
+        stale_perc /= server.reactors_num*server.dbnum;
+        if (sections++) info = sdscatprintf(info,"\r\n");
+        info = sdscatprintf(info,
+            "# Stats\r\n"
+            "total_commands_processed:%lld\r\n"
+            "rejected_connections:%lld\r\n"
+            "expired_keys:%lld\r\n"
+            "instantaneous_expired_keys_per_sec:%lld\r\n"
+            "expired_stale_perc:%.2f\r\n"
+            "expired_time_cap_reached_count:%lld\r\n"
+            "evicted_keys:%lld\r\n"
+            "active_defrag_hits:%lld\r\n"
+            "active_defrag_misses:%lld\r\n"
+            "active_defrag_key_hits:%lld\r\n"
+            "active_defrag_key_misses:%lld\r\n",
+            numcommands,
+            server.stat_rejected_conn,
+            __atomic_load_n(&server.stat_expiredkeys,__ATOMIC_RELAXED),
+            getInstantaneousMetric(KVDATA_METRIC_EXPIRED),
+            stale_perc*100,
+            __atomic_load_n(&server.stat_expired_time_cap_reached_count,__ATOMIC_RELAXED),
+            __atomic_load_n(&server.stat_evictedkeys,__ATOMIC_RELAXED),
+            __atomic_load_n(&server.stat_active_defrag_hits,__ATOMIC_RELAXED),
+            __atomic_load_n(&server.stat_active_defrag_misses,__ATOMIC_RELAXED),
+            __atomic_load_n(&server.stat_active_defrag_key_hits,__ATOMIC_RELAXED),
+            __atomic_load_n(&server.stat_active_defrag_key_misses,__ATOMIC_RELAXED));
+    }
+
+    // 复制信息
+    if (allsections || defsections || !strcasecmp(section,"replication")) {
+        if (sections++) info = sdscatprintf(info,"\r\n");
+        info = sdscatprintf(info,
+            "# Replication\r\n"
+            "role:%s\r\n",
+            server.masterhost == NULL ? "master" : "slave");
+        if (server.masterhost) {
+            info = sdscatprintf(info,
+                "master_host:%s\r\n"
+                "master_port:%d\r\n"
+                "master_link_status:%s\r\n"
+                "slave_repl_offset:%lld\r\n",
+                server.masterhost,
+                server.masterport,
+                server.repl_state == KVDATA_REPL_CONNECTED ? "up" : "down",
+                server.master ? server.master->reploff : -1);
+        }
+        info = sdscatprintf(info,
+            "connected_slaves:%lu\r\n",
+            listLength(server.slaves));
+        // 每个从服务器的状态和已经确认的复制偏移量
+        if (listLength(server.slaves)) {
+            int slaveid = 0;
+            listNode *ln = listFirst(server.slaves);
+
+            while (ln) {
+                KVClient *slave = listNodeValue(ln);
+                char *state = NULL;
+
+                switch(slave->replstate) {
+                case KVDATA_REPL_WAIT_BGSAVE_START:
+                case KVDATA_REPL_WAIT_BGSAVE_END:
+                    state = "wait_bgsave";
+                    break;
+                case KVDATA_REPL_SEND_BULK:
+                    state = "send_bulk";
+                    break;
+                case KVDATA_REPL_ONLINE:
+                    state = "online";
+                    break;
+                }
+                if (state) {
+                    info = sdscatprintf(info,
+                        "slave%d:ip=%s,port=%d,state=%s,offset=%lld\r\n",
+                        slaveid,slave->ip,slave->port,state,slave->repl_ack_off);
+                    slaveid++;
+                }
+                ln = ln->next;
+            }
+        }
+        info = sdscatprintf(info,
+            "master_repl_offset:%lld\r\n"
+            "repl_backlog_active:%d\r\n"
+            "repl_backlog_size:%lld\r\n"
+            "repl_backlog_first_byte_offset:%lld\r\n"
+            "repl_backlog_histlen:%lld\r\n",
+            server.master_reploff,
+            server.repl_backlog != NULL,
+            server.repl_backlog_size,
+            server.repl_backlog_off,
+            server.repl_backlog_histlen);
+    }
+
+    // 命令的调用次数、耗时和延迟分布，只有 "all" 或者指定时才生成
+    if (allsections || !strcasecmp(section,"commandstats")) {
+        if (sections++) info = sdscatprintf(info,"\r\n");
+        info = sdscatprintf(info, "# Commandstats\r\n");
+        for (j = 0; j < KVDATA_COMMAND_NUM; j++) {
+            struct KVDataCommand *c = KVDATACommandTable+j;
+            long long calls = __atomic_load_n(&c->calls,__ATOMIC_RELAXED);
+            long long usec = __atomic_load_n(&c->microseconds,__ATOMIC_RELAXED);
+            long long rejected = __atomic_load_n(&c->rejected_calls,__ATOMIC_RELAXED);
+
+            if (!calls && !rejected) continue;
+            info = sdscatprintf(info,
+                "cmdstat_%s:calls=%lld,usec=%lld,usec_per_call=%.2f,rejected_calls=%lld,"
+                "p50=%llu,p99=%llu,p99.9=%llu,max=%lld\r\n",
+                c->name, calls, usec, calls ? (double)usec/calls : 0, rejected,
+                (unsigned long long)commandLatencyPercentile(c,50),
+                (unsigned long long)commandLatencyPercentile(c,99),
+                (unsigned long long)commandLatencyPercentile(c,99.9),
+                __atomic_load_n(&c->latency_max,__ATOMIC_RELAXED));
+        }
+    }
+    return info;
+}
+
+/*
+ * INFO [section]
+ * 以 bulk 回复返回服务器的状态信息
+ */
+void infoCommand(KVClient *c) {
+    char *section = c->argc == 2 ? c->argv[1]->ptr : "default";
+    sds info;
+
+    if (c->argc > 2) {
+        addReply(c,shared.syntaxerr);
+        return;
+    }
+    info = genInfoString(section);
+    addReplySds(c,sdscatprintf(sdsnewlen("",0),"$%lu\r\n",(unsigned long)sdslen(info)));
+    addReplySds(c,info);
+    addReply(c,shared.crlf);
 }
 
 
@@ -437,13 +1354,38 @@ int prepareClientToWrite(KVClient *c) {
     // 无连接的伪客户端总是不可写的
     if (c->fd <= 0) return AE_ERR;
 
-    // 一般情况，为客户端套接字安装写处理器到事件循环
     // 注意：在从节点的复制状态变为KVDATA_REPL_ONLINE之前，是不能将命令流发送给从节点的
-    if (aeCreateFileEvent(server.eventsLoop, c->fd, AE_WRITABLE, sendReplyToClient, c) == AE_ERR) 
-        return AE_ERR;
+    // 回复只会被累积在输出缓冲区中，等 RDB 文件发送完毕后由 sendBulkToSlave 安装写处理器
+    if ((c->flags & KVDATA_SLAVE) && c->replstate != KVDATA_REPL_ONLINE)
+        return AE_OK;
+
+    // 命令正在其他 reactor 中执行，回复只会被累积在输出缓冲区中，
+    // 等命令返回客户端所属的 reactor 之后再加入待写链表
+    if (c->flags & KVDATA_FORWARDED) return AE_OK;
+
+    // 一般情况，将客户端加入待写链表，在 beforeSleep 中直接写出回复，
+    // 只有一次写不完时才为客户端套接字安装写处理器到事件循环
+    if (!clientHasPendingReplies(c)) putClientInPendingWriteQueue(c);
     return AE_OK;
 }
 
+/*
+ * 将客户端加入所属 reactor 的待写链表，已经在链表中时不做任何动作
+ */
+void putClientInPendingWriteQueue(KVClient *c) {
+    if (c->flags & KVDATA_PENDING_WRITE) return;
+    c->flags |= KVDATA_PENDING_WRITE;
+    listLinkNodeHead(c->reactor->clients_pending_write,&c->pending_write_node);
+}
+
+/*
+ * 将客户端移出所属 reactor 的待写链表，调用者确保客户端在链表中
+ */
+void removeClientFromPendingWriteQueue(KVClient *c) {
+    listDetachNode(c->reactor->clients_pending_write,&c->pending_write_node);
+    c->flags &= ~KVDATA_PENDING_WRITE;
+}
+
 /*
  * 为客户端安装写处理器到事件循环
  * 将对象obj根据编码类型加入到回复缓冲区中
@@ -453,15 +1395,24 @@ void addReply(KVClient *c, robj *obj) {
     // 为客户端安装写处理器到事件循环
     if (prepareClientToWrite(c) != AE_OK) return;
     //如果对象obj为字符串编码
-    if (obj->encoding == STRING || obj->encoding == INT) {
+    if (sdsEncodedObject(obj)) {
         // 首先尝试复制内容到固定回复缓冲区 c->buf 中，这样可以避免内存分配
         if (addReplyToBuffer(c,obj->ptr,sdslen(obj->ptr)) != AE_OK)
             // 如果 c->buf 中的空间不够，就复制到 c->reply 链表中
             // 可能会引起内存分配
             addReplyObjectToList(c,obj);
-    //如果对象为整数编码
+    //如果对象为整数编码，先转换为十进制字符串
+    } else if (obj->encoding == INT) {
+        char buf[32];
+        int len = ll2string(buf,sizeof(buf),(long)obj->ptr);
+
+        if (addReplyToBuffer(c,buf,len) != AE_OK) {
+            robj *o = createStringObject(buf,len);
+            addReplyObjectToList(c,o);
+            decrRefCount(o);
+        }
     } else {
-        printf("Wrong obj->encoding in addReply().\n");
+        serverLog(KVDATA_WARNING, "Wrong obj->encoding in addReply().\n");
     }
 }
 
@@ -483,6 +1434,8 @@ void addReplySds(KVClient *c, sds s) {
        // 将回复对象（一个 SDS ）添加到 c->reply 回复链表中
         robj *o = createObject(STRING, s);
         addReplyObjectToList(c,o);
+        // 回复链表复制了对象的内容
+        decrRefCount(o);
     }
 }
 
@@ -509,50 +1462,39 @@ int addReplyToBuffer(KVClient *c, char *s, size_t len) {
 }
 
 /*
- * 将回复对象（一个 SDS ）添加到 c->reply 回复链表中 
+ * 将回复对象（一个 SDS ）的内容添加到 c->reply 回复链表中
+ *
+ * 回复链表中的对象总是客户端私有的，o 的内容会被复制到链表的缓冲块中，
+ * 这样 o 可以是共享对象，也可以是其他 reactor 数据库中的值，不需要修改它的引用计数。
  */
 void addReplyObjectToList(KVClient *c, robj *o) {
-    robj *tail;
+    robj *tail = NULL;
 
     // 客户端即将被关闭，无须再发送回复
     if (c->flags & KVDATA_CLOSE_AFTER_REPLY) return;
 
-    // 链表中无缓冲块，直接将对象追加到链表中
-    if (listLength(c->reply) == 0) {
-        incrRefCount(o);
-        listAddNodeTail(c->reply,o);
-        c->reply_bytes += zmalloc_size_sds(o->ptr);
-
-    // 链表中已有缓冲块，尝试将回复添加到块内
-    // 如果当前的块不能容纳回复的话，那么新建一个块
-    } else {
-        // 取出表尾的 SDS
-        tail = listNodeValue(listLast(c->reply));
-
-        // 如果表尾 SDS 的已用空间加上对象的长度，小于 KVDATA_REPLY_CHUNK_BYTES
-        // 那么将新对象的内容拼接到表尾 SDS 的末尾
-        if (tail->ptr != NULL && sdslen(tail->ptr)+sdslen(o->ptr) <= KVDATA_REPLY_CHUNK_BYTES)
-        {
-            //先减去计算表尾缓冲块已用缓冲区
-            c->reply_bytes -= zmalloc_size_sds(tail->ptr);
-
-            //将表尾缓冲块复制一块新的引用计数为1的对象替代原来缓冲块
-            //因为当该回复内容发送给客户端以后，该缓冲需要被释放，如果共享原来的对象，会影响其它客户端的使用
-            tail = dupLastObject(c->reply);
+    // 取出表尾的缓冲块
+    if (listLength(c->reply) > 0) tail = listNodeValue(listLast(c->reply));
 
-            // 将对象o中的内容拼接到新的表尾缓存块中
-            tail->ptr = sdscatlen(tail->ptr,o->ptr,sdslen(o->ptr));
-
-            //重新计算可变回复缓冲区的大小
-            c->reply_bytes += zmalloc_size_sds(tail->ptr);
+    // 如果表尾 SDS 的已用空间加上对象的长度，小于 KVDATA_REPLY_CHUNK_BYTES
+    // 那么将新对象的内容拼接到表尾 SDS 的末尾
+    if (tail != NULL && tail->ptr != NULL &&
+        sdslen(tail->ptr)+sdslen(o->ptr) <= KVDATA_REPLY_CHUNK_BYTES)
+    {
+        //先减去计算表尾缓冲块已用缓冲区
+        c->reply_bytes -= zmalloc_size_sds(tail->ptr);
+        // 将对象o中的内容拼接到表尾缓存块中
+        tail->ptr = sdscatlen(tail->ptr,o->ptr,sdslen(o->ptr));
+        //重新计算可变回复缓冲区的大小
+        c->reply_bytes += zmalloc_size_sds(tail->ptr);
 
-        // 如果新对象的长度比原表尾缓冲块空用空闲空间大
-        // 直接将对象追加到末尾
-        } else {
-            incrRefCount(o);
-            listAddNodeTail(c->reply,o);
-            c->reply_bytes += zmalloc_size_sds(o->ptr);
-        }
+    // 链表中无缓冲块，或者表尾缓冲块放不下新对象的内容
+    // 复制对象的内容作为新的缓冲块追加到链表末尾
+    } else {
+        // 缓冲块之后还会被追加内容，需要可扩展的 sds
+        tail = createRawStringObject(o->ptr,sdslen(o->ptr));
+        listAddNodeTail(c->reply,tail);
+        c->reply_bytes += zmalloc_size_sds(tail->ptr);
     }
 }
 
@@ -562,7 +1504,7 @@ void addReplyObjectToList(KVClient *c, robj *o) {
 void addReplyBulkLen(KVClient *c, robj *obj) {
     size_t len;
     //计算对象的长度
-    len = sdslen(obj->ptr);
+    len = stringObjectLen(obj);
    //判断对象的长度是否符合共享对象，符合则直接将对应的共享对象填入回复缓冲区中
    //否则编码成协议格式后再存入回复缓冲区
     if (len < KVDATA_SHARED_BULKHDR_LEN)
@@ -598,8 +1540,31 @@ void addReplyLongLongWithPrefix(KVClient *c, long long ll, char prefix) {
     buf[len+1] = '\r';
     buf[len+2] = '\n';
     //将编码后的ll存入回复缓冲中
-    robj *o = createObject(STRING,sdsnewlen(buf,len+3));
-    addReply(c,o);
+    addReplyString(c,buf,len+3);
+}
+
+/*
+ * 将长度为 len 的内容 p 作为 bulk 回复添加到回复缓冲区
+ */
+void addReplyBulkCBuffer(KVClient *c, char *p, size_t len) {
+    addReplyLongLongWithPrefix(c,len,'$');
+    addReplyString(c,p,len);
+    addReply(c,shared.crlf);
+}
+
+/*
+ * 将长度为 len 的内容 s 添加到回复缓冲区
+ * 固定回复缓冲区放得下时不需要分配内存
+ */
+void addReplyString(KVClient *c, char *s, size_t len) {
+    // 为客户端安装写处理器到事件循环
+    if (prepareClientToWrite(c) != AE_OK) return;
+    if (addReplyToBuffer(c,s,len) != AE_OK) {
+        // 回复链表会复制对象的内容
+        robj *o = createStringObject(s,len);
+        addReplyObjectToList(c,o);
+        decrRefCount(o);
+    }
 }
 
 /*
@@ -614,69 +1579,115 @@ void addReplyBulk(KVClient *c, robj *obj) {
 }
 
 /*
- * 负责传送命令回复的写处理器
+ * 客户端的回复缓冲区或回复链表中是否还有未发送的内容
+ */
+int clientHasPendingReplies(KVClient *c) {
+    return c->bufpos || listLength(c->reply);
+}
+
+/*
+ * 复制回复链表中的缓冲块，用作回复链表的值复制函数
+ * 缓冲块会被原地追加内容，所以不能通过引用计数共享
+ */
+void *dupClientReplyValue(void *o) {
+    return createRawStringObject(((robj*)o)->ptr,sdslen(((robj*)o)->ptr));
+}
+
+/*
+ * 将客户端未写出的回复依次填入 iov 数组：先是固定缓冲区，然后是回复链表中的缓冲块，
+ * c->sentlen 只作用于第一个缓冲区。
+ * 最多填入 iovmax 项，并且在总长度超过 KVDATA_MAX_WRITE_PER_EVENT 之后停止。
+ * 返回填入的项数，总长度保存在 *bytes 中
+ */
+int prepareClientReplyIov(KVClient *c, struct iovec *iov, int iovmax, size_t *bytes) {
+    int iovcnt = 0;
+    size_t offset = c->sentlen;
+
+    *bytes = 0;
+    // 固定缓冲区中的内容总是排在回复链表之前
+    if (c->bufpos > 0) {
+        iov[iovcnt].iov_base = c->buf+offset;
+        iov[iovcnt].iov_len = c->bufpos-offset;
+        *bytes += iov[iovcnt].iov_len;
+        iovcnt++;
+        offset = 0;
+    }
+    for (listNode *ln = listFirst(c->reply); ln != NULL; ln = ln->next) {
+        if (iovcnt == iovmax || *bytes >= KVDATA_MAX_WRITE_PER_EVENT) break;
+        robj *o = listNodeValue(ln);
+        iov[iovcnt].iov_base = ((char*)o->ptr)+offset;
+        iov[iovcnt].iov_len = sdslen(o->ptr)-offset;
+        *bytes += iov[iovcnt].iov_len;
+        iovcnt++;
+        offset = 0;
+    }
+    return iovcnt;
+}
+
+/*
+ * 客户端的回复已经写出了 nwritten 字节，推进 c->sentlen ，
+ * 并清空已经全部写出的固定缓冲区、删除已经全部写出的缓冲块（包括空的缓冲块）
+ */
+void advanceClientReply(KVClient *c, size_t nwritten) {
+    if (c->bufpos > 0) {
+        size_t remaining = c->bufpos-c->sentlen;
+        if (nwritten < remaining) {
+            c->sentlen += nwritten;
+            return;
+        }
+        // 固定缓冲区中的内容已经全部写入完毕，清空两个计数器变量
+        nwritten -= remaining;
+        c->bufpos = 0;
+        c->sentlen = 0;
+    }
+    while(listLength(c->reply)) {
+        robj *o = listNodeValue(listFirst(c->reply));
+        size_t remaining = sdslen(o->ptr)-c->sentlen;
+        if (nwritten < remaining) {
+            c->sentlen += nwritten;
+            return;
+        }
+        // 缓冲块中的内容全部写入完毕，删除这个节点
+        nwritten -= remaining;
+        c->reply_bytes -= zmalloc_size_sds(o->ptr);
+        listDelNode(c->reply,listFirst(c->reply));
+        c->sentlen = 0;
+    }
+}
+
+/*
  * 将客户端对应的回复缓冲区中内容和回复缓冲链表中的内容发送给对应客户端
+ * handler_installed 表示是否在写事件处理器中被调用，是的话在写完之后删除写事件处理器
+ *
+ * 客户端仍然有效时返回 AE_OK ，客户端需要被释放（写入出错或者已经回复完需要关闭）时返回 AE_ERR 。
+ * 这个函数可能在 I/O 线程中执行，所以不能在这里释放客户端，由调用者负责。
  */
-void sendReplyToClient(aeEventLoop *el, int fd, void *privdata, int mask) {
-    KVClient *c = privdata;
-    int nwritten = 10, totwritten = 0, objlen;
-    size_t objmem; 
-    robj *o;
-    //无用参数避免警告
-    KVDATA_NOTUSED(el);
-    KVDATA_NOTUSED(mask);
+int writeToClient(KVClient *c, int handler_installed) {
+    struct iovec iov[KVDATA_IOV_MAX];
+    ssize_t nwritten = 0;
+    int totwritten = 0;
+
     // 一直循环，直到回复缓冲区为空
     // 或者指定条件满足为止
-    while(c->bufpos > 0 || listLength(c->reply)) {
-        //固定缓冲区buf
-        if (c->bufpos > 0) {
-            // 将固定回复缓冲区的内容写入到套接字
-            // c->sentlen 是用来处理短写的
-            // 当出现短写，导致写入未能一次完成时，下次触发写函数
-            // c->buf+c->sentlen 就会偏移到正确（未写入）内容的位置上。
-            nwritten = write(fd,c->buf+c->sentlen,c->bufpos-c->sentlen);
-            // 出错则跳出
-            if (nwritten <= 0) break;
-            // 成功写入则更新已写入计数器变量
-            c->sentlen += nwritten;
-            totwritten += nwritten;
-            // 如果缓冲区中的内容已经全部写入完毕
-            // 那么清空客户端的两个计数器变量
-            if (c->sentlen == c->bufpos) {
-                c->bufpos = 0;
-                c->sentlen = 0;
-            }
-        //可变缓冲区链表
-        } else {
-            // 取出位于链表最前面的对象
-            o = listNodeValue(listFirst(c->reply));
-            //链表节点对象的长度
-            objlen = sdslen(o->ptr);
-            objmem = zmalloc_size_sds(o->ptr);
-
-            // 略过空对象
-            if (objlen == 0) {
-                listDelNode(c->reply,listFirst(c->reply));
-                c->reply_bytes -= objmem;
-                continue;
-            }
-            // 将固定回复缓冲区的内容写入到套接字
-            // c->sentlen 是用来处理短写的
-            // 当出现短写，导致写入未能一次完成时，下次触发写函数
-            // c->buf+c->sentlen 就会偏移到正确（未写入）内容的位置上。
-            nwritten = write(fd, ((char*)o->ptr)+c->sentlen,objlen-c->sentlen);
-            // 写入出错则跳出
-            if (nwritten <= 0) break;
-            // 成功写入则更新写入计数器变量
-            c->sentlen += nwritten;
-            totwritten += nwritten;
-            // 如果缓冲区内容全部写入完毕，那么删除已写入完毕的节点
-            if (c->sentlen == objlen) {
-                listDelNode(c->reply,listFirst(c->reply));
-                c->sentlen = 0;
-                c->reply_bytes -= objmem;
-            }
+    while(clientHasPendingReplies(c)) {
+        // 把固定缓冲区和回复链表中的缓冲块收集到 iov 中，用一次 writev 写出
+        size_t iovbytes;
+        int iovcnt = prepareClientReplyIov(c, iov, KVDATA_IOV_MAX, &iovbytes);
+
+        // 剩下的都是空的缓冲块，直接释放
+        if (iovbytes == 0) {
+            advanceClientReply(c, 0);
+            continue;
         }
+        nwritten = writev(c->fd, iov, iovcnt);
+        // 写入出错则跳出
+        if (nwritten <= 0) break;
+        // 推进 c->sentlen ，并释放已经全部写出的缓冲区
+        advanceClientReply(c, nwritten);
+        totwritten += nwritten;
+
+        // 发生短写，说明套接字的发送缓冲区已满，等下次写入就绪再继续写入
+        if ((size_t)nwritten < iovbytes) break;
         /*
          * 为了避免一个非常大的回复独占服务器，
          * 当写入的总数量大于 KVDATA_MAX_WRITE_PER_EVENT ，
@@ -690,9 +1701,8 @@ void sendReplyToClient(aeEventLoop *el, int fd, void *privdata, int mask) {
         if (errno == EAGAIN) {
             nwritten = 0;
         } else {
-            printf("Error writing to client: %s\n", strerror(errno));
-            freeClient(c);
-            return;
+            serverLog(KVDATA_VERBOSE, "Error writing to client: %s\n", strerror(errno));
+            return AE_ERR;
         }
     }
     //更新最近一次客户端服务器的互动时间
@@ -702,14 +1712,127 @@ void sendReplyToClient(aeEventLoop *el, int fd, void *privdata, int mask) {
 
     //当客户端回复缓冲区中没有内容，则将该客户写事件从epoll红黑树中移除，
     //并从已注册事件数组中移除
-    if (c->bufpos == 0 && listLength(c->reply) == 0) {
+    if (!clientHasPendingReplies(c)) {
         c->sentlen = 0;
         // 删除 write handler
-        //aeDeleteFileEvent(server.eventsLoop,c->fd,AE_WRITABLE);
+        if (handler_installed) aeDeleteFileEvent(c->reactor->el,c->fd,AE_WRITABLE);
         // 如果指定了写入之后关闭客户端 FLAG ，那么关闭客户端
-        if (c->flags & KVDATA_CLOSE_AFTER_REPLY) 
+        if (c->flags & KVDATA_CLOSE_AFTER_REPLY) return AE_ERR;
+    }
+    return AE_OK;
+}
+
+/*
+ * 负责传送命令回复的写处理器
+ * 将客户端对应的回复缓冲区中内容和回复缓冲链表中的内容发送给对应客户端
+ */
+void sendReplyToClient(aeEventLoop *el, int fd, void *privdata, int mask) {
+    //无用参数避免警告
+    KVDATA_NOTUSED(el);
+    KVDATA_NOTUSED(fd);
+    KVDATA_NOTUSED(mask);
+    KVClient *c = privdata;
+    if (writeToClient(c,1) == AE_ERR) freeClient(c);
+}
+
+/*
+ * 写出当前 reactor 待写链表中所有客户端的回复，在进入阻塞等待之前调用
+ * 这样绝大多数回复都可以直接写出，不需要为每个客户端安装写事件处理器
+ * 返回处理的客户端数量
+ */
+int handleClientsWithPendingWrites(void) {
+    list *pending = currentReactor->clients_pending_write;
+    int processed = listLength(pending);
+
+    // io_uring 后端下批量写出
+    if (currentReactor->el->backend == AE_BACKEND_URING)
+        return handleClientsWithPendingWritesUsingUring();
+
+    while(listLength(pending)) {
+        KVClient *c = listNodeValue(listFirst(pending));
+        removeClientFromPendingWriteQueue(c);
+
+        // 尝试直接写出回复
+        if (writeToClient(c,0) == AE_ERR) {
+            freeClient(c);
+            continue;
+        }
+        // 一次写不完，安装写事件处理器，等套接字可写时继续写
+        if (clientHasPendingReplies(c) &&
+            aeCreateFileEvent(c->reactor->el, c->fd, AE_WRITABLE, sendReplyToClient, c) == AE_ERR)
+            freeClient(c);
+    }
+    return processed;
+}
+
+/*
+ * io_uring 批量写出的完成回调，res 为 send 的返回值，出错时为 -errno
+ */
+static void writeToClientUsingUringDone(aeEventLoop *el, void *privdata, int res) {
+    KVClient *c = privdata;
+    int drained;
+    KVDATA_NOTUSED(el);
+
+    // 写入出错
+    if (res < 0 && res != -EAGAIN) {
+        serverLog(KVDATA_VERBOSE, "Error writing to client: %s\n", strerror(-res));
         freeClient(c);
+        return;
+    }
+    if (res > 0 && !(c->flags & KVDATA_MASTER)) c->lastinteraction = server.unixtime;
+
+    // 和 writeToClient 一样，推进 c->sentlen 并释放已经全部写出的缓冲区
+    // 本次发送的缓冲区全部写出时 c->sentlen 会被清零
+    if (res >= 0) advanceClientReply(c, res);
+    drained = (res >= 0 && c->sentlen == 0);
+
+    // 本次发送的缓冲区写完了，回复链表中剩下的内容由 writeToClient 继续写出，
+    // 没有剩余内容时由它处理 KVDATA_CLOSE_AFTER_REPLY
+    if (drained && writeToClient(c,0) == AE_ERR) {
+        freeClient(c);
+        return;
     }
+    // 套接字暂时不可写或者发生了短写，安装写事件处理器
+    if (clientHasPendingReplies(c) &&
+        aeCreateFileEvent(c->reactor->el, c->fd, AE_WRITABLE, sendReplyToClient, c) == AE_ERR)
+        freeClient(c);
 }
 
+/*
+ * io_uring 后端下，为待写链表中的每个客户端发起一个 send （固定缓冲区或者回复链表的第一个节点），
+ * 在一次 io_uring_enter 中全部提交并等待完成。
+ * 返回处理的客户端数量
+ */
+int handleClientsWithPendingWritesUsingUring(void) {
+    list *pending = currentReactor->clients_pending_write;
+    aeEventLoop *el = currentReactor->el;
+    int processed = listLength(pending);
+
+    while(listLength(pending)) {
+        KVClient *c = listNodeValue(listFirst(pending));
+        char *ptr;
+        size_t len;
+        removeClientFromPendingWriteQueue(c);
 
+        // 没有需要写出的内容，交给 writeToClient 处理
+        if (!clientHasPendingReplies(c)) {
+            if (writeToClient(c,0) == AE_ERR) freeClient(c);
+            continue;
+        }
+        if (c->bufpos > 0) {
+            ptr = c->buf+c->sentlen;
+            len = c->bufpos-c->sentlen;
+        } else {
+            robj *o = listNodeValue(listFirst(c->reply));
+            ptr = ((char*)o->ptr)+c->sentlen;
+            len = sdslen(o->ptr)-c->sentlen;
+        }
+        // 本批已满，直接写出
+        if (aeUringQueueIO(el, AE_URING_SEND, c->fd, ptr, len, c) == AE_ERR) {
+            int nwritten = write(c->fd, ptr, len);
+            writeToClientUsingUringDone(el, c, nwritten == -1 ? -errno : nwritten);
+        }
+    }
+    aeUringSubmitIO(el, writeToClientUsingUringDone);
+    return processed;
+}
@@ -1,14 +1,62 @@
 #ifndef KVDATA_SERVER_H
 #define KVDATA_SERVER_H
 
+#include <limits.h>
+#include <stdint.h>
+#include <sys/uio.h>
 #include "events.h"
 #include "list.h"
 #include "client.h"
+#include "logger.h"
 
 #define KVDATA_MAX_WRITE_PER_EVENT (1024*64)  //单次可回复客户端的最大长度
+//一次 writev 最多写出的缓冲区数量
+#ifdef IOV_MAX
+#define KVDATA_IOV_MAX IOV_MAX
+#else
+#define KVDATA_IOV_MAX 1024
+#endif
 #define DB_NUM 1  //数据库数量
+/* 协议解析的限制 */
+#define KVDATA_INLINE_MAX_SIZE (1024*64)          //参数个数和参数长度所在行的最大长度
+#define KVDATA_MBULK_BIG_ARG (1024*32)            //不小于这个长度的参数直接读入查询缓冲区，不再复制
+#define KVDATA_PROTO_MAX_MULTIBULK_LEN (1024*1024) //单条命令的最大参数个数
+#define KVDATA_PROTO_MAX_BULK_LEN (512LL*1024*1024) //单个参数的最大长度
+#define KVDATA_DEFAULT_IO_THREADS 1  //默认 I/O 线程数量（包括主线程），即不开启 I/O 线程
+#define KVDATA_DEFAULT_MAXCLIENTS 10000  //默认最大客户端数量
+#define KVDATA_DEFAULT_TCP_BACKLOG 511   //默认 listen 的待连接队列长度
+#define KVDATA_MIN_RESERVED_FDS 32       //为监听套接字、RDB 文件、日志等保留的文件描述符数量
+#define KVDATA_DEFAULT_HZ 10             //默认每秒执行 serverCron 的次数
+#define KVDATA_MIN_HZ 1
+#define KVDATA_MAX_HZ 500
+#define KVDATA_REHASH_BUDGET_US 1000     //每次时间事件中后台 rehash 最多占用的时间（微秒）
+/* 定期删除过期键 */
+#define KVDATA_ACTIVE_EXPIRE_KEYS_PER_LOOP 20     //每轮从过期字典中抽样的键数量
+#define KVDATA_ACTIVE_EXPIRE_ACCEPTABLE_STALE 10  //抽样中已过期的键超过这个百分比时继续抽样
+#define KVDATA_ACTIVE_EXPIRE_SLOW_TIME_PERC 25    //serverCron 中定期删除最多占用的 CPU 时间百分比
+#define KVDATA_ACTIVE_EXPIRE_FAST_DURATION 1000   //beforeSleep 中快速定期删除最多占用的时间（微秒）
+#define KVDATA_ACTIVE_EXPIRE_CYCLE_SLOW 0
+#define KVDATA_ACTIVE_EXPIRE_CYCLE_FAST 1
+/* 瞬时指标，每 100 毫秒采样一次，取最近 KVDATA_METRIC_SAMPLES 次采样的平均值 */
+#define KVDATA_METRIC_SAMPLES 16
+#define KVDATA_METRIC_EXPIRED 0   //每秒过期的键数量
+#define KVDATA_METRIC_COUNT 1
+/* 命令的属性 */
+#define KVDATA_CMD_WRITE (1<<0)        /* 命令会修改数据库 */
+#define KVDATA_CMD_READONLY (1<<1)     /* 命令只读取数据库 */
+#define KVDATA_CMD_ADMIN (1<<2)        /* 管理命令，比如 SAVE 、 SLAVEOF */
+#define KVDATA_CMD_FAST (1<<3)         /* 命令的复杂度为 O(1) 或者 O(log(N)) */
+#define KVDATA_CMD_TRANSACTION (1<<4)  /* 事务控制命令，在事务中立即执行，不会入队 */
+/* 命令延迟直方图：小于 8 微秒的延迟每个值一个桶，之后每个 2 的幂区间分为 8 个桶，
+ * 相对误差不超过 12.5% ，最大记录到 2^40 微秒 */
+#define KVDATA_LATENCY_SUB_BITS 3
+#define KVDATA_LATENCY_MAX_EXP 40
+#define KVDATA_LATENCY_BUCKETS ((KVDATA_LATENCY_MAX_EXP-KVDATA_LATENCY_SUB_BITS+2)<<KVDATA_LATENCY_SUB_BITS)
+#define KVDATA_COMMAND_SLOTS 64        //命令完美哈希表的槽位数量，必须是 2 的幂，并且不少于命令数量的两倍
 /* 无用参数避免警告 */
 #define KVDATA_NOTUSED(V) ((void) V)
+/* 在 serverCron 中使用，每 _ms_ 毫秒执行一次后面的语句 */
+#define run_with_period(_ms_) if ((_ms_ <= 1000/server.hz) || !(server.cronloops%((_ms_)/(1000/server.hz))))
 
 typedef struct KVServer{
 
@@ -26,10 +74,83 @@ time_t unixtime;
 list *clients;          
 // 服务器时间事件每秒调用的次数
 int hz;   
+// serverCron 执行的次数
+long long cronloops;
 // 是否开启 SO_KEEPALIVE 选项
 int tcpkeepalive; 
-// 命令表,字典的键为命令的名字，字典的值为{命令名字，函数指针，参数数量}的结构
-dict *commands;     
+// 最大客户端数量，达到后新连接会被拒绝
+int maxclients;
+// listen 的待连接队列长度
+int tcp_backlog;
+// 当前已连接的客户端数量，多 reactor 模式下由各个线程原子地增减
+long connected_clients;
+// 因为达到最大客户端数量而被拒绝的连接数量
+long long stat_rejected_conn;
+// 服务器启动的时间
+time_t stat_starttime;
+// 因为过期而被删除的键的数量，多 reactor 模式下由各个线程原子地增加
+long long stat_expiredkeys;
+// 定期删除因为用完时间预算而提前结束的次数
+long long stat_expired_time_cap_reached_count;
+// 因为超过内存上限而被淘汰的键的数量，多 reactor 模式下由各个线程原子地增加
+long long stat_evictedkeys;
+// 内存上限（字节），为 0 时不限制
+unsigned long long maxmemory;
+// 超过内存上限时的淘汰策略
+int maxmemory_policy;
+// 淘汰时每个数据库每轮抽样的键数量
+int maxmemory_samples;
+// 是否开启主动碎片整理
+int active_defrag_enabled;
+// 碎片少于这么多字节时不整理
+unsigned long long active_defrag_ignore_bytes;
+// 碎片率（百分比）超过下限时开始整理，达到上限时以最大的力度整理
+int active_defrag_threshold_lower;
+int active_defrag_threshold_upper;
+// 整理占用的 CPU 时间百分比的范围
+int active_defrag_cycle_min;
+int active_defrag_cycle_max;
+// 整理当前占用的 CPU 时间百分比，0 表示没有在整理，由主线程每秒计算一次
+int active_defrag_running;
+// 碎片整理移动的和不需要移动的分配数量，多 reactor 模式下由各个线程原子地增加
+long long stat_active_defrag_hits;
+long long stat_active_defrag_misses;
+// 至少移动了一个分配的键和没有移动的键的数量
+long long stat_active_defrag_key_hits;
+long long stat_active_defrag_key_misses;
+// 瞬时指标的采样
+struct {
+    // 上一次采样的时间（毫秒）和计数器的值
+    long long last_sample_time;
+    long long last_sample_count;
+    // 最近 KVDATA_METRIC_SAMPLES 次采样得到的每秒增量
+    long long samples[KVDATA_METRIC_SAMPLES];
+    int idx;
+} inst_metric[KVDATA_METRIC_COUNT];
+// 执行时间超过这个值（微秒）的命令会被记录到慢查询日志中，负数表示关闭慢查询日志
+long long slowlog_log_slower_than;
+// 慢查询日志最多保存的条数
+unsigned long slowlog_max_len;
+// 日志级别，低于这个级别的日志不会被记录
+int verbosity;
+// 日志文件路径，为空字符串时写到标准输出
+char *logfile;
+// 等待在 beforeSleep 中写出回复的客户端链表
+list *clients_pending_write;
+// 等待 I/O 线程读取并解析命令的客户端链表，io_uring 后端下为等待批量读取的客户端链表
+list *clients_pending_read;
+// 事件处理器使用的多路复用后端，AE_BACKEND_EPOLL 或 AE_BACKEND_URING
+int event_backend;
+// I/O 线程数量（包括主线程），为 1 时不开启 I/O 线程
+int io_threads_num;
+// 是否由 I/O 线程读取和解析查询缓冲区
+int io_threads_do_reads;
+// I/O 线程当前是否处于活跃状态
+int io_threads_active;
+// reactor 数量，大于 1 时每个 reactor 在自己的线程上运行一个事件处理器，并拥有一个键空间分片
+int reactors_num;
+// reactor 数组，0 号 reactor 运行在主线程上
+struct kvReactor *reactors;
 //服务器当前数据库的数量
 int dbnum;
 //数据库数组
@@ -107,34 +228,82 @@ extern KVServer server;//全局服务器变量
 typedef void KVDataCommandProc(KVClient *c);
 struct KVDataCommand {
     // 命令名字
-    sds name;
+    char *name;
     // 命令执行函数
     KVDataCommandProc *proc;
     // 参数个数
     int counts;
     // 命令的长度
     int len;
+    // 命令的属性 KVDATA_CMD_*
+    int flags;
+    // 第一个键参数的位置，0 表示命令不访问键
+    int firstkey;
+    // 最后一个键参数的位置，负数表示从最后一个参数倒数
+    int lastkey;
+    // 相邻两个键参数之间的距离
+    int keystep;
+
+    // 以下统计信息在多 reactor 模式下由各个线程原子地更新
+    // 命令被执行的次数
+    long long calls;
+    // 命令执行的总耗时（微秒）
+    long long microseconds;
+    // 因为参数个数错误等原因被拒绝执行的次数
+    long long rejected_calls;
+    // 最长的一次执行耗时（微秒）
+    long long latency_max;
+    // 执行耗时的直方图
+    long long latency[KVDATA_LATENCY_BUCKETS];
 };
+void initCommand(void);
+struct KVDataCommand *lookupCommand(const char *name, size_t len);
 //服务器处理函数
 void initServer(KVServer *server);
+KVdataDb *createDatabases(int dbnum);
 void updateCachedTime(void);
+void adjustOpenFilesLimit(void);
+void checkTcpBacklogSettings(void);
 int serverCron(struct aeEventLoop *eventLoop, void *clientData);
+void databasesCron(KVdataDb *db);
+void activeExpireCycle(KVdataDb *db, int type);
+void trackInstantaneousMetric(int metric, long long current_reading);
+long long getInstantaneousMetric(int metric);
+void beforeSleep(struct aeEventLoop *eventLoop);
+int readQueryFromClient(KVClient *c);
+char *prepareQueryBuffer(KVClient *c, size_t *readlen);
+int readQueryFromClientDone(KVClient *c, int nread);
+int handleClientsWithPendingReadsUsingUring(aeEventLoop *eventLoop);
 void setProtocolError(KVClient *c, int pos);
 void processInputBuffer(KVClient *c);
 int processMultibulkBuffer(KVClient *c);
 int processCommand(KVClient *c);
 void call(KVClient *c, int flags);
+void recordCommandLatency(struct KVDataCommand *cmd, uint64_t duration);
+sds genInfoString(char *section);
+void infoCommand(KVClient *c);
 
 //回复客户端处理函数
 int prepareClientToWrite(KVClient *c);
+void putClientInPendingWriteQueue(KVClient *c);
+void removeClientFromPendingWriteQueue(KVClient *c);
 void addReply(KVClient *c, robj *obj);
 void addReplySds(KVClient *c, sds s);
 int addReplyToBuffer(KVClient *c, char *s, size_t len);
+void addReplyString(KVClient *c, char *s, size_t len);
+void addReplyBulkCBuffer(KVClient *c, char *p, size_t len);
 void addReplyObjectToList(KVClient *c, robj *o);
 void addReplyBulkLen(KVClient *c, robj *obj);
 void addReplyLongLongWithPrefix(KVClient *c, long long ll, char prefix);
 void addReplyBulk(KVClient *c, robj *obj);
+int clientHasPendingReplies(KVClient *c);
+void *dupClientReplyValue(void *o);
+int prepareClientReplyIov(KVClient *c, struct iovec *iov, int iovmax, size_t *bytes);
+void advanceClientReply(KVClient *c, size_t nwritten);
+int writeToClient(KVClient *c, int handler_installed);
 void sendReplyToClient(aeEventLoop *el, int fd, void *privdata, int mask);
+int handleClientsWithPendingWrites(void);
+int handleClientsWithPendingWritesUsingUring(void);
 
 //SET/GET命令
 void setGenericCommand(KVClient *c, robj *key, robj *val, robj *expire, int unit);
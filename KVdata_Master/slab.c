@@ -0,0 +1,208 @@
+#include "slab.h"
+#include <pthread.h>
+#include "zmalloc.h"
+#include "object.h"
+#include "list.h"
+#include "dict.h"
+
+/*
+ * 固定大小对象的 slab 池
+ *
+ * robj 、链表节点和字典节点在热路径上被频繁地分配和释放，大小固定并且很小。
+ * 每个对象池从 zmalloc 申请 KVDATA_SLAB_SIZE 大小的 slab ，切分成对象，
+ * 对象紧密地排列在 slab 中，不带有分配器的区块头，也不会在堆中留下碎片。
+ *
+ * 每个线程（主线程、I/O 线程、reactor）对每个池都有一个线程缓存，分配和释放只操作线程缓存，
+ * 不需要加锁。线程缓存为空时从池的全局空闲链表取出一批对象，
+ * 缓存中的对象达到两批时归还一批，只有这两种情况需要加锁。
+ * 对象可以在一个线程中分配、在另一个线程中释放（比如 I/O 线程解析出的参数对象）。
+ *
+ * 空闲的对象以链表的形式保存：对象的第一个字指向同一批中的下一个对象，
+ * 每批的第一个对象的第二个字指向全局空闲链表中的下一批，所以对象至少要有两个指针大小，
+ * 取出和归还一批对象都是 O(1) 的。
+ *
+ * slab 不会归还给 zmalloc ，释放的对象由之后分配的同类对象复用。
+ */
+
+// 空闲对象在批内的下一个对象
+#define slabNext(o) (((void**)(o))[0])
+// 批的第一个对象在全局空闲链表中的下一批
+#define slabNextBatch(o) (((void**)(o))[1])
+
+typedef struct slabPool {
+    // 池的名字，用于 INFO
+    const char *name;
+    // 对象大小
+    size_t size;
+    // 保护全局空闲链表
+    pthread_mutex_t lock;
+    // 全局空闲链表，每个元素是一批 KVDATA_SLAB_BATCH 个空闲对象
+    void *batches;
+    // 以下统计数据在锁内修改，INFO 不加锁读取
+    // 已申请的 slab 数量
+    unsigned long slabs;
+    // slab 中切分出的对象总数
+    unsigned long objects;
+    // 全局空闲链表中的对象数量，线程缓存中的对象不计入
+    unsigned long free;
+} slabPool;
+
+#define SLAB_POOL_INIT(name, type) {name, sizeof(type), PTHREAD_MUTEX_INITIALIZER, NULL, 0, 0, 0}
+
+static slabPool slabPools[KVDATA_SLAB_COUNT] = {
+    SLAB_POOL_INIT("robj", robj),
+    SLAB_POOL_INIT("listnode", listNode),
+    SLAB_POOL_INIT("dictentry", dictEntry),
+};
+
+/*
+ * 线程缓存，批内对象通过 slabNext 链接
+ */
+typedef struct slabCache {
+    void *head;
+    unsigned int count;
+} slabCache;
+
+static __thread slabCache slabCaches[KVDATA_SLAB_COUNT];
+
+/*
+ * 申请一个新的 slab ，切分成若干批对象放入全局空闲链表
+ * 调用时必须持有池的锁
+ */
+static void slabGrow(slabPool *pool) {
+    char *slab = zmalloc(KVDATA_SLAB_SIZE);
+    size_t batchsize = pool->size*KVDATA_SLAB_BATCH;
+    unsigned long nbatches = KVDATA_SLAB_SIZE/batchsize;
+
+    for (unsigned long b = 0; b < nbatches; b++) {
+        char *first = slab+b*batchsize;
+
+        for (int j = 0; j < KVDATA_SLAB_BATCH; j++) {
+            char *o = first+j*pool->size;
+            slabNext(o) = (j+1 < KVDATA_SLAB_BATCH) ? o+pool->size : NULL;
+        }
+        slabNextBatch(first) = pool->batches;
+        pool->batches = first;
+    }
+    __atomic_add_fetch(&pool->slabs,1,__ATOMIC_RELAXED);
+    __atomic_add_fetch(&pool->objects,nbatches*KVDATA_SLAB_BATCH,__ATOMIC_RELAXED);
+    __atomic_add_fetch(&pool->free,nbatches*KVDATA_SLAB_BATCH,__ATOMIC_RELAXED);
+}
+
+/*
+ * 线程缓存为空，从全局空闲链表中取出一批对象
+ */
+static void slabRefill(slabPool *pool, slabCache *cache) {
+    void *batch;
+
+    pthread_mutex_lock(&pool->lock);
+    if (pool->batches == NULL) slabGrow(pool);
+    batch = pool->batches;
+    pool->batches = slabNextBatch(batch);
+    __atomic_sub_fetch(&pool->free,KVDATA_SLAB_BATCH,__ATOMIC_RELAXED);
+    pthread_mutex_unlock(&pool->lock);
+
+    cache->head = batch;
+    cache->count = KVDATA_SLAB_BATCH;
+}
+
+/*
+ * 线程缓存中的对象太多，把最近释放的一批对象归还到全局空闲链表
+ */
+static void slabFlush(slabPool *pool, slabCache *cache) {
+    void *first = cache->head, *last = first;
+
+    for (int j = 1; j < KVDATA_SLAB_BATCH; j++) last = slabNext(last);
+    cache->head = slabNext(last);
+    cache->count -= KVDATA_SLAB_BATCH;
+    slabNext(last) = NULL;
+
+    pthread_mutex_lock(&pool->lock);
+    slabNextBatch(first) = pool->batches;
+    pool->batches = first;
+    __atomic_add_fetch(&pool->free,KVDATA_SLAB_BATCH,__ATOMIC_RELAXED);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/*
+ * 从 id 号对象池中分配一个对象
+ */
+void *slabAlloc(int id) {
+    slabCache *cache = &slabCaches[id];
+    void *o;
+
+    if (cache->head == NULL) slabRefill(&slabPools[id],cache);
+    o = cache->head;
+    cache->head = slabNext(o);
+    cache->count--;
+    return o;
+}
+
+/*
+ * 将对象 ptr 归还给 id 号对象池，ptr 可以是其他线程分配的
+ */
+void slabFree(int id, void *ptr) {
+    slabCache *cache = &slabCaches[id];
+
+    if (ptr == NULL) return;
+    slabNext(ptr) = cache->head;
+    cache->head = ptr;
+    if (++cache->count >= 2*KVDATA_SLAB_BATCH) slabFlush(&slabPools[id],cache);
+}
+
+/*
+ * fork 之前锁住所有对象池，保证子进程中的锁和空闲链表处于一致的状态
+ */
+static void slabAtForkPrepare(void) {
+    for (int j = 0; j < KVDATA_SLAB_COUNT; j++) pthread_mutex_lock(&slabPools[j].lock);
+}
+
+/*
+ * fork 之后在父进程和子进程中释放所有对象池的锁
+ */
+static void slabAtForkRelease(void) {
+    for (int j = KVDATA_SLAB_COUNT-1; j >= 0; j--) pthread_mutex_unlock(&slabPools[j].lock);
+}
+
+/*
+ * 初始化对象池，在创建其他线程之前调用
+ * 对象池本身是静态初始化的，这里只注册 fork 处理函数：
+ * RDB 子进程中只有 fork 的线程，如果 fork 时其他线程持有池的锁，子进程中的分配会死锁
+ */
+void slabInit(void) {
+    pthread_atfork(slabAtForkPrepare,slabAtForkRelease,slabAtForkRelease);
+}
+
+/*
+ * 返回所有对象池的全局空闲链表中对象占用的内存
+ * 这部分内存已经计入 used_memory ，但是会被之后分配的对象复用
+ */
+size_t slabFreeMemory(void) {
+    size_t bytes = 0;
+
+    for (int j = 0; j < KVDATA_SLAB_COUNT; j++)
+        bytes += __atomic_load_n(&slabPools[j].free,__ATOMIC_RELAXED)*slabPools[j].size;
+    return bytes;
+}
+
+/*
+ * 将各个对象池的使用情况追加到 INFO 的回复 info 中
+ * used 包括线程缓存中的空闲对象
+ */
+sds slabInfo(sds info) {
+    for (int j = 0; j < KVDATA_SLAB_COUNT; j++) {
+        slabPool *pool = &slabPools[j];
+        unsigned long free = __atomic_load_n(&pool->free,__ATOMIC_RELAXED);
+        unsigned long objects = __atomic_load_n(&pool->objects,__ATOMIC_RELAXED);
+
+        // 两次读取之间池可能增长，避免 used 下溢
+        if (free > objects) free = objects;
+
+        info = sdscatprintf(info,
+            "slab_%s:size=%zu,slabs=%lu,objects=%lu,used=%lu,free=%lu\r\n",
+            pool->name, pool->size,
+            __atomic_load_n(&pool->slabs,__ATOMIC_RELAXED),
+            objects, objects-free, free);
+    }
+    return info;
+}
@@ -0,0 +1,20 @@
+#ifndef KVDATA_SLAB_H
+#define KVDATA_SLAB_H
+#include <stddef.h>
+#include "sds.h"
+
+#define KVDATA_SLAB_SIZE (64*1024)  //每次向 zmalloc 申请的 slab 大小
+#define KVDATA_SLAB_BATCH 64        //线程缓存和全局空闲链表之间一次交换的对象数量
+
+/* 对象池，每个池只分配一种固定大小的对象 */
+#define KVDATA_SLAB_ROBJ 0        //robj
+#define KVDATA_SLAB_LISTNODE 1    //链表节点
+#define KVDATA_SLAB_DICTENTRY 2   //由字典分配的字典节点（不包括数据库节点）
+#define KVDATA_SLAB_COUNT 3
+
+void *slabAlloc(int id);
+void slabFree(int id, void *ptr);
+void slabInit(void);
+size_t slabFreeMemory(void);
+sds slabInfo(sds info);
+#endif
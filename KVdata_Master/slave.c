@@ -30,7 +30,7 @@ void slaveofCommand(KVClient *c) {
         if (server.masterhost) {
             // 让服务器取消复制，成为主服务器
             slaveofMyself();
-            printf("MASTER MODE enabled (user request).\n");
+            serverLog(KVDATA_NOTICE, "MASTER MODE enabled (user request).\n");
         }
     } else {
         long long port;
@@ -41,17 +41,17 @@ void slaveofCommand(KVClient *c) {
         // 如果是的话，向客户端返回 +OK ，不做其他动作
         if (server.masterhost && !strcasecmp(server.masterhost,c->argv[1]->ptr)
             && server.masterport == port) {
-            printf("SLAVE OF would result into synchronization with the master we are already connected with. No operation performed.\n");
+            serverLog(KVDATA_NOTICE, "SLAVE OF would result into synchronization with the master we are already connected with. No operation performed.\n");
             addReplySds(c,sdsnew("+OK Already connected to specified master\r\n"));
             return;
         }
         // 没有前任主服务器，或者客户端指定了新的主服务器
         // 开始执行复制操作
         replicationSetMaster(c->argv[1]->ptr, port);
-        printf("SLAVE OF %s:%d enabled (user request)\n", server.masterhost, server.masterport);
+        serverLog(KVDATA_NOTICE, "SLAVE OF %s:%d enabled (user request)\n", server.masterhost, server.masterport);
     }
     addReply(c,shared.ok);
-    printf("slaveof  succeseful.\n");
+    serverLog(KVDATA_NOTICE, "slaveof  succeseful.\n");
 }
 
 /*
@@ -98,7 +98,7 @@ void freeReplicationBacklog(void) {
 void replicationDiscardCachedMaster(void) {
 
     if (server.cached_master == NULL) return;
-    printf("Discarding previously cached master state.\n");
+    serverLog(KVDATA_NOTICE, "Discarding previously cached master state.\n");
     freeClient(server.cached_master);
     server.cached_master = NULL;
 }
@@ -136,7 +136,7 @@ int cancelReplicationHandshake(void) {
     }
     //将从服务器的复制状态变为SLAVEOF后的第一个待连接状态
     server.repl_state = KVDATA_REPL_CONNECT;
-    printf("Back to KVDATA_REPL_CONNECT 1.\n");
+    serverLog(KVDATA_VERBOSE, "Back to KVDATA_REPL_CONNECT 1.\n");
     return 1;
 }
 
@@ -165,7 +165,7 @@ void replicationSetMaster(char *ip, int port) {
     cancelReplicationHandshake();
     // 进入连接状态（重点）
     server.repl_state = KVDATA_REPL_CONNECT;
-    printf("slave repl_state is KVDATA_REPL_CONNECT now.\n");
+    serverLog(KVDATA_VERBOSE, "slave repl_state is KVDATA_REPL_CONNECT now.\n");
     server.master_reploff = 0;
 }
 
@@ -192,14 +192,14 @@ int connectWithMaster(void) {
     // 向主服务器发起connect连接请求，获得已连接文件描述符fd
     fd = anetTcpNonBlockConnect(NULL,server.masterhost,server.masterport);
     if (fd == -1) {
-        printf("Unable to connect to MASTER: %s\n",  strerror(errno));
+        serverLog(KVDATA_WARNING, "Unable to connect to MASTER: %s\n",  strerror(errno));
         return AE_ERR;
     }
     // 监听主服务器 fd 的读和写事件，并绑定文件事件处理器syncWithMaster，该函数用于处理主从节点间的握手过程
     if (aeCreateFileEvent(server.eventsLoop,fd,AE_READABLE|AE_WRITABLE,syncWithMaster,NULL) == AE_ERR)
     {
         close(fd);
-        printf("Can't create readable event for SYNC\n");
+        serverLog(KVDATA_WARNING, "Can't create readable event for SYNC\n");
         return AE_ERR;
     }
     // 更新最近一次主从服务器交互时间(从节点向主节点请求连接成功)
@@ -209,7 +209,7 @@ int connectWithMaster(void) {
 
     // 将状态改为KVDATA_REPL_CONNECTING，表示从节点正在向主节点建立连接
     server.repl_state = KVDATA_REPL_CONNECTING;
-    printf("slave repl_state is KVDATA_REPL_CONNECTING now.\n");
+    serverLog(KVDATA_VERBOSE, "slave repl_state is KVDATA_REPL_CONNECTING now.\n");
 
     return AE_OK;
 }
@@ -240,7 +240,7 @@ void syncWithMaster(aeEventLoop *el, int fd, void *privdata, int mask) {
     // 向主服务器发送一个非阻塞的 PING
     // 因为接下来的 RDB 文件发送非常耗时，所以我们想确认主服务器真的能访问
     if (server.repl_state == KVDATA_REPL_CONNECTING) {
-        printf("Non blocking connect for SYNC fired the event.\n");
+        serverLog(KVDATA_VERBOSE, "Non blocking connect for SYNC fired the event.\n");
         // 手动发送同步 PING ，暂时取消监听写事件
         // 因为后面我们希望保证此时主服务器对应的客户端回复缓冲区为空
         aeDeleteFileEvent(server.eventsLoop,fd,AE_WRITABLE);
@@ -267,7 +267,7 @@ void syncWithMaster(aeEventLoop *el, int fd, void *privdata, int mask) {
         // 接收 PONG
         if (read(fd,buf,sizeof(buf)) == -1)
         {
-            printf("I/O error reading PING reply from master: %s", strerror(errno));
+            serverLog(KVDATA_WARNING, "I/O error reading PING reply from master: %s", strerror(errno));
             goto error;
         }
 
@@ -276,7 +276,7 @@ void syncWithMaster(aeEventLoop *el, int fd, void *privdata, int mask) {
         if (strcmp(buf,"+PONG") != 0)
         {
             // 未接收到PONG
-            printf("Error reply to PING from master: %s\n",buf);
+            serverLog(KVDATA_WARNING, "Error reply to PING from master: %s\n",buf);
             goto error;
         } else {
             // 接收到 +PONG
@@ -291,7 +291,7 @@ void syncWithMaster(aeEventLoop *el, int fd, void *privdata, int mask) {
     }
     // 可以执行部分重同步
     if (psync_result == PSYNC_CONTINUE) {
-        printf("MASTER <-> SLAVE sync: Master accepted a Partial Resynchronization.\n");
+        serverLog(KVDATA_NOTICE, "MASTER <-> SLAVE sync: Master accepted a Partial Resynchronization.\n");
         // 返回
         return;
     }
@@ -300,13 +300,13 @@ void syncWithMaster(aeEventLoop *el, int fd, void *privdata, int mask) {
     snprintf(tmpfile,256, "temp-%d.%ld.rdb",(int)server.unixtime,(long int)getpid());
     int dfd = open(tmpfile,O_CREAT|O_WRONLY|O_EXCL,0644); 
     if (dfd == -1) {
-        printf("Opening the temp file needed for MASTER <-> SLAVE synchronization: %s",strerror(errno));
+        serverLog(KVDATA_WARNING, "Opening the temp file needed for MASTER <-> SLAVE synchronization: %s",strerror(errno));
         goto error;
     }
     // 设置一个读事件处理器，来读取主服务器的 RDB 文件
     if (aeCreateFileEvent(server.eventsLoop,fd, AE_READABLE,readSyncBulkPayload,NULL) == AE_ERR)
     {
-        printf("Can't create readable event for PSYNC: %s (fd=%d)\n", strerror(errno),fd);
+        serverLog(KVDATA_WARNING, "Can't create readable event for PSYNC: %s (fd=%d)\n", strerror(errno),fd);
         goto error;
     }
     // 设置复制状态为KVDATA_REPL_TRANSFER，表示开始接收主节点的RDB数据
@@ -365,7 +365,7 @@ void readSyncBulkPayload(aeEventLoop *el, int fd, void *privdata, int mask) {
 
         // 调用读函数，在server.repl_syncio_timeout*1000时间内从fd中读取一行内容到buf
         if (read(fd,buf,1024) == -1) {
-            printf("I/O error reading bulk count from MASTER: %s\n", strerror(errno));
+            serverLog(KVDATA_WARNING, "I/O error reading bulk count from MASTER: %s\n", strerror(errno));
             goto error;
         }
 
@@ -373,7 +373,7 @@ void readSyncBulkPayload(aeEventLoop *el, int fd, void *privdata, int mask) {
         //如果读取到的内容既不是上述两种情况，也不是'$'开头，则说明读取的内容格式错误
         if (buf[0] != '$') {
             // 读入的内容出错，和协议格式不符
-            printf("Bad protocol from MASTER, the first byte is not '$' (we received '%s'), are you sure the host and port are right?", buf);
+            serverLog(KVDATA_WARNING, "Bad protocol from MASTER, the first byte is not '$' (we received '%s'), are you sure the host and port are right?", buf);
             goto error;
         }
         
@@ -381,7 +381,7 @@ void readSyncBulkPayload(aeEventLoop *el, int fd, void *privdata, int mask) {
         server.repl_transfer_size = strtol(buf+1,NULL,10);
 
         //在日志中打印RDB文件的大小
-        printf("MASTER <-> SLAVE sync: receiving %lld bytes from master\n", (long long) server.repl_transfer_size);
+        serverLog(KVDATA_NOTICE, "MASTER <-> SLAVE sync: receiving %lld bytes from master\n", (long long) server.repl_transfer_size);
         return;
     }
     /*读数据*/
@@ -393,14 +393,14 @@ void readSyncBulkPayload(aeEventLoop *el, int fd, void *privdata, int mask) {
     // 从RDB文件中读取读取readlen长度内容到buf
     nread = read(fd,buf,readlen);
     if (nread <= 0) {
-        printf("I/O error trying to sync with MASTER: %s", (nread == -1) ? strerror(errno) : "connection lost");
+        serverLog(KVDATA_WARNING, "I/O error trying to sync with MASTER: %s", (nread == -1) ? strerror(errno) : "connection lost");
         goto error;
     }
     // 更新最近一次从 RDB 读入内容的时间
     server.repl_transfer_lastio = server.unixtime;
     //将从RDB读取到的内容写入保存 RDB 文件的临时文件的描述符中
     if (write(server.repl_transfer_fd,buf,nread) != nread) {
-        printf("Write error or short write writing to the DB dump file needed for MASTER <-> SLAVE synchronization: %s", strerror(errno));
+        serverLog(KVDATA_WARNING, "Write error or short write writing to the DB dump file needed for MASTER <-> SLAVE synchronization: %s", strerror(errno));
         goto error;
     }
     // 更新已读 RDB 文件内容的字节数
@@ -419,7 +419,7 @@ void readSyncBulkPayload(aeEventLoop *el, int fd, void *privdata, int mask) {
     if (server.repl_transfer_read == server.repl_transfer_size) {
 
         // 先清空旧数据库
-        printf( "MASTER <-> SLAVE sync: Flushing old data\n");
+        serverLog(KVDATA_NOTICE,  "MASTER <-> SLAVE sync: Flushing old data\n");
         //清空所有数据
         emptyDb();
 
@@ -429,13 +429,13 @@ void readSyncBulkPayload(aeEventLoop *el, int fd, void *privdata, int mask) {
 
         // 载入 RDB
         if (rdbLoad(server.repl_transfer_tmpfile) != AE_OK) {
-            printf("Failed trying to load the MASTER synchronization DB from disk\n");
+            serverLog(KVDATA_WARNING, "Failed trying to load the MASTER synchronization DB from disk\n");
             goto error;
         }
 
         // 如果传送完毕，将临时文件改名为 dump.rdb
         if (rename(server.repl_transfer_tmpfile,server.rdb_filename) == -1) {
-            printf("Failed trying to rename the temp DB into dump.rdb in MASTER <-> SLAVE synchronization: %s\n", strerror(errno));
+            serverLog(KVDATA_WARNING, "Failed trying to rename the temp DB into dump.rdb in MASTER <-> SLAVE synchronization: %s\n", strerror(errno));
             goto error;
         }
 
@@ -472,12 +472,15 @@ void replicationCacheMaster(KVClient *c) {
 
     //确保当前从服务器与主服务器存在连接，并且server.cached_master为空
     assert(server.master != NULL && server.cached_master == NULL);
-    printf("Caching the disconnected master state.\n");
+    serverLog(KVDATA_NOTICE, "Caching the disconnected master state.\n");
 
     // 从客户端链表中移除主服务器
-    ln = listSearchKey(server.clients,c);
+    ln = c->client_list_node;
     assert(ln != NULL);
-    listDelNode(server.clients,ln);
+    // 客户端结构会被缓存起来，只解除链接，不释放
+    listUnlinkNode(server.clients,ln);
+    c->client_list_node = NULL;
+    __atomic_sub_fetch(&server.connected_clients,1,__ATOMIC_RELAXED);
 
     // 迁移到备份的 master
     server.cached_master = server.master;
@@ -534,24 +537,24 @@ int slaveTryPartialResynchronization(int fd) {
         // 命令为 "PSYNC <master_run_id> <repl_offset>"
         psync_runid = server.cached_master->replrunid;
         snprintf(psync_offset,sizeof(psync_offset),"%lld", server.cached_master->reploff+1);
-        printf("Trying a partial resynchronization (request %s:%s).\n", psync_runid, psync_offset);
+        serverLog(KVDATA_NOTICE, "Trying a partial resynchronization (request %s:%s).\n", psync_runid, psync_offset);
     } else {
         // 缓存不存在
         // 发送 "PSYNC ? -1" ，要求完整重同步
-        printf("Partial resynchronization not possible (no cached master).\n");
+        serverLog(KVDATA_WARNING, "Partial resynchronization not possible (no cached master).\n");
         psync_runid = "?";
         memcpy(psync_offset,"-1",3);
     }
 
     // 向主服务器发送 PSYNC  <runid> <offset> 命令，并获得主服务器的回复reply
-    printf("Send to Master: %s  %s  %s","PSYN.\n",psync_runid,psync_offset);
+    serverLog(KVDATA_VERBOSE, "Send to Master: %s  %s  %s","PSYN.\n",psync_runid,psync_offset);
     ret = snprintf(cmd, sizeof(cmd),"*3\r\n$%ld\r\n%s\r\n$%ld\r\n%s\r\n$%ld\r\n%s\r\n", 
           strlen("PSYNC"),"PSYNC", strlen(psync_runid),psync_runid, strlen(psync_offset),psync_offset);
 
     //此处必须同步发送，否则接收到的数据不同步
     reply = sendSynchronousCommand(fd,cmd);
     // 接收到 "+FULLRESYNC <runid>  <offset>" ，进行完整重同步
-    printf("Reply from Master: %s.\n",reply);
+    serverLog(KVDATA_VERBOSE, "Reply from Master: %s.\n",reply);
     if (!strncmp(reply,"+FULLRESYNC",11)) {
         char *runid = NULL;
         char*offset = NULL;
@@ -566,7 +569,7 @@ int slaveTryPartialResynchronization(int fd) {
 
         // 检查 run id 的合法性
         if (!runid || !offset || (offset-runid-1) != KVDATA_RUN_ID_SIZE) {
-            printf("Master replied with wrong +FULLRESYNC syntax.\n");
+            serverLog(KVDATA_WARNING, "Master replied with wrong +FULLRESYNC syntax.\n");
             // 主服务器支持 PSYNC ，但是却发来了异常的 run id
             // 只好将 run id 设为 0 ，让下次 PSYNC 时失败
             memset(server.repl_master_runid,0,KVDATA_RUN_ID_SIZE+1);
@@ -577,7 +580,7 @@ int slaveTryPartialResynchronization(int fd) {
             // 保存主服务器可用于复制的初始复制偏移量 initial offset
             server.repl_master_initial_offset = strtoll(offset,NULL,10);
             // 打印日志，这是一个 FULL resync
-            printf("Full resync from master: %s:%lld\n", server.repl_master_runid, server.repl_master_initial_offset);
+            serverLog(KVDATA_NOTICE, "Full resync from master: %s:%lld\n", server.repl_master_runid, server.repl_master_initial_offset);
         }
         // 要开始完整重同步，不可能执行部分同步，备份中的 master 已经没用了，清除它
         replicationDiscardCachedMaster();
@@ -587,7 +590,7 @@ int slaveTryPartialResynchronization(int fd) {
     }
     // 接收到”+CONTINUE“，进行部分重同步
     else if (!strncmp(reply,"+CONTINUE",9)) {
-        printf("Successful partial resynchronization with master.\n");
+        serverLog(KVDATA_NOTICE, "Successful partial resynchronization with master.\n");
         sdsfree(reply);
         // 由于执行的是部分重同步，因此可以直接承接上次主服务器的客户端
         // 将缓存中的 master 设为当前 master
@@ -596,7 +599,7 @@ int slaveTryPartialResynchronization(int fd) {
         return PSYNC_CONTINUE;
     //其它回复一律认为是错误回复
     }else {
-        printf("Master does not support PSYNC or is in " "error state (reply: %s)\n", reply);
+        serverLog(KVDATA_WARNING, "Master does not support PSYNC or is in " "error state (reply: %s)\n", reply);
     }
     sdsfree(reply);
     //执行到这说明已经不可能执行部分同步，备份中的 master 已经没用了，清除它
@@ -627,9 +630,11 @@ void replicationResurrectCachedMaster(int newfd) {
 
     // 将 master 重新加入到客户端列表中
     listAddNodeTail(server.clients,server.master);
+    server.master->client_list_node = listLast(server.clients);
+    __atomic_add_fetch(&server.connected_clients,1,__ATOMIC_RELAXED);
     // 监听 master 的读事件
     if (aeCreateFileEvent(server.eventsLoop, newfd, AE_READABLE, recvData, server.master)) {
-        printf("Error resurrecting the cached master, impossible to add the readable handler: %s\n", strerror(errno));
+        serverLog(KVDATA_WARNING, "Error resurrecting the cached master, impossible to add the readable handler: %s\n", strerror(errno));
         //后期可以改成异步释放客户端
         freeClient(server.master); 
     }
@@ -637,7 +642,7 @@ void replicationResurrectCachedMaster(int newfd) {
     //如果写缓冲区中有挂起的数据，我们可能还需要安装写处理程序
     if (server.master->bufpos || listLength(server.master->reply)) {
         if (aeCreateFileEvent(server.eventsLoop, newfd, AE_WRITABLE,sendReplyToClient, server.master)) {
-            printf("Error resurrecting the cached master, impossible to add the writable handler: %s.\n", strerror(errno));
+            serverLog(KVDATA_WARNING, "Error resurrecting the cached master, impossible to add the writable handler: %s.\n", strerror(errno));
             freeClient(server.master); 
         }
     }
@@ -689,7 +694,7 @@ void createReplicationBacklog(void) {
  */
 void pingCommand(KVClient *c) {
     addReply(c,shared.pong);
-    printf("reply pong\n");
+    serverLog(KVDATA_DEBUG, "reply pong\n");
 }
 
 /* 
@@ -744,8 +749,11 @@ void copyClientOutputBuffer(KVClient *dst, KVClient *src) {
     memcpy(dst->buf,src->buf,src->bufpos);
 
     // 同步偏移量和字节数
+    // 回复链表中的缓冲块是复制出来的，分配的大小可能和 src 不同，需要重新统计
     dst->bufpos = src->bufpos;
-    dst->reply_bytes = src->reply_bytes;
+    dst->reply_bytes = 0;
+    for (listNode *ln = listFirst(dst->reply); ln != NULL; ln = ln->next)
+        dst->reply_bytes += zmalloc_size_sds(((robj*)listNodeValue(ln))->ptr);
 }
 
 
@@ -771,7 +779,7 @@ void syncCommand(KVClient *c) {
         return;
     }
 
-    printf("Slave asks for synchronization.\n");
+    serverLog(KVDATA_NOTICE, "Slave asks for synchronization.\n");
 
     /* 如果这是一个 PSYNC 命令：
      * （1）那么尝试进行部分重同步PSYNC;
@@ -805,20 +813,20 @@ void syncCommand(KVClient *c) {
             //因此，直接将B的复制状态直接置为KVDATA_REPL_WAIT_BGSAVE_END，等到后台RDB数据转储完成时，直接将该转储文件同时发送给从节点A和B即可。
             copyClientOutputBuffer(c,slave);
             c->replstate = KVDATA_REPL_WAIT_BGSAVE_END;
-            printf("Waiting for end of BGSAVE for SYNC\n");
+            serverLog(KVDATA_NOTICE, "Waiting for end of BGSAVE for SYNC\n");
 
         /* 情况2：如果找不到这样的从节点客户端，则主节点需要在当前的BGSAVE操作完成之后，重新执行一次BGSAVE操作*/
         } else {
             c->replstate = KVDATA_REPL_WAIT_BGSAVE_START;
-            printf("Waiting for next BGSAVE for SYNC\n");
+            serverLog(KVDATA_NOTICE, "Waiting for next BGSAVE for SYNC\n");
         }
 
     /* 情况3：如果当前没有子进程在进行RDB转储，则调用rdbSaveBackground开始进行BGSAVE操作*/
     } else {
         // 没有 BGSAVE 在进行，开始一个新的 BGSAVE
-        printf("Starting BGSAVE for SYNC\n");
+        serverLog(KVDATA_NOTICE, "Starting BGSAVE for SYNC\n");
         if (rdbSaveBackground(server.rdb_filename) != AE_OK) {
-            printf("Replication failed, can't BGSAVE.\n");
+            serverLog(KVDATA_WARNING, "Replication failed, can't BGSAVE.\n");
             addReplySds(c,sdsnew("Unable to perform background save"));
             return;
         }
@@ -866,11 +874,11 @@ int masterTryPartialResynchronization(KVClient *c) {
 
         // 从服务器欲要复制的主服务器运行id是否和当前主服务器运行id不一致,且<runid>参数不为'?'，即不是强制执行完整同步的命令
         if (master_runid[0] != '?') {
-            printf("Partial resynchronization not accepted: " "Runid mismatch (Client asked for runid '%s', my runid is '%s')\n", master_runid, server.serverid);
+            serverLog(KVDATA_WARNING, "Partial resynchronization not accepted: " "Runid mismatch (Client asked for runid '%s', my runid is '%s')\n", master_runid, server.serverid);
         
         // 从服务器提供的<runid>为 '?' ，表示强制完整重同步(FULL RESYNC)
         } else {
-            printf("Full resync requested by slave.\n");
+            serverLog(KVDATA_NOTICE, "Full resync requested by slave.\n");
         }
         //直接跳转到完整重同步
         goto need_full_resync;
@@ -886,10 +894,10 @@ int masterTryPartialResynchronization(KVClient *c) {
         psync_offset > (server.repl_backlog_off + server.repl_backlog_histlen))
     {
         // 执行 FULL RESYNC
-        printf("Unable to partial resync with the slave for lack of backlog (Slave request was: %lld).\n", psync_offset);
+        serverLog(KVDATA_WARNING, "Unable to partial resync with the slave for lack of backlog (Slave request was: %lld).\n", psync_offset);
         //如果从服务器欲要复制的起始偏移量大于全局偏移量，发出警告
         if (psync_offset > server.master_reploff) {
-            printf("Warning: slave tried to PSYNC with an offset that is greater than the master replication offset.\n");
+            serverLog(KVDATA_WARNING, "Warning: slave tried to PSYNC with an offset that is greater than the master replication offset.\n");
         }
         goto need_full_resync;
     }
@@ -918,7 +926,7 @@ int masterTryPartialResynchronization(KVClient *c) {
     }
     // 发送 backlog 中的内容（也即是从服务器缺失的那些内容）到从服务器
     psync_len = addReplyReplicationBacklog(c,psync_offset);
-    printf("Partial resynchronization request accepted. Sending %lld bytes of backlog starting from offset %lld.\n", psync_len, psync_offset);
+    serverLog(KVDATA_NOTICE, "Partial resynchronization request accepted. Sending %lld bytes of backlog starting from offset %lld.\n", psync_len, psync_offset);
 
     return AE_OK;
 
@@ -930,7 +938,7 @@ need_full_resync:
     if (server.repl_backlog == NULL) psync_offset++;
 
     // 向从服务器发送 +FULLRESYNC ，表示需要完整重同步
-    printf("Sends +FULLRESYNC to the slave server.\n");
+    serverLog(KVDATA_VERBOSE, "Sends +FULLRESYNC to the slave server.\n");
     buflen = snprintf(buf,sizeof(buf),"+FULLRESYNC %s %lld\r\n", server.serverid,psync_offset);
     if (write(c->fd,buf,buflen) != buflen) {
         freeClient(c);
@@ -946,39 +954,39 @@ long long addReplyReplicationBacklog(KVClient *c, long long offset) {
     long long j, skip, len;
 
     //打印服务器需要局部复制的起始偏移量
-    printf("[PSYNC] Slave request offset: %lld\n", offset);
+    serverLog(KVDATA_DEBUG, "[PSYNC] Slave request offset: %lld\n", offset);
 
     //判断复制积压缓冲区内无内容则直接返回
     if (server.repl_backlog_histlen == 0) {
-        printf("[PSYNC] Backlog history len is zero\n");
+        serverLog(KVDATA_DEBUG, "[PSYNC] Backlog history len is zero\n");
         return 0;
     }
 
     //打印复制积压缓冲区的大小
-    printf("[PSYNC] Backlog size: %lld\n", server.repl_backlog_size);
+    serverLog(KVDATA_DEBUG, "[PSYNC] Backlog size: %lld\n", server.repl_backlog_size);
     //打印复制积压缓冲区的首地址（可以被还原的第一个字节）的偏移量
-    printf("[PSYNC] First byte: %lld\n", server.repl_backlog_off);
+    serverLog(KVDATA_DEBUG, "[PSYNC] First byte: %lld\n", server.repl_backlog_off);
     //打印复制积压缓冲区中数据的长度
-    printf("[PSYNC] History len: %lld\n", server.repl_backlog_histlen);
+    serverLog(KVDATA_DEBUG, "[PSYNC] History len: %lld\n", server.repl_backlog_histlen);
     //打印复制积压缓冲区当前最新偏移量
-    printf("[PSYNC] Current index: %lld\n", server.repl_backlog_idx);
+    serverLog(KVDATA_DEBUG, "[PSYNC] Current index: %lld\n", server.repl_backlog_idx);
 
     //从offset开始复制，跳过前面无用的内容
     skip = offset - server.repl_backlog_off;
-    printf("[PSYNC] Skipping: %lld\n", skip);
+    serverLog(KVDATA_DEBUG, "[PSYNC] Skipping: %lld\n", skip);
 
     //计算获得当前最新偏移量在backlog中的索引
     j = (server.repl_backlog_idx +
         (server.repl_backlog_size-server.repl_backlog_histlen)) %
         server.repl_backlog_size;
-    printf("[PSYNC] Index of first byte: %lld\n", j);
+    serverLog(KVDATA_DEBUG, "[PSYNC] Index of first byte: %lld\n", j);
 
     //计算从服务器局部复制的起始偏移量在backlog中的索引
     j = (j + skip) % server.repl_backlog_size;
 
     //计算本次局部复制的内容长度
     len = server.repl_backlog_histlen - skip;
-    printf("[PSYNC] Reply total length: %lld\n", len);
+    serverLog(KVDATA_DEBUG, "[PSYNC] Reply total length: %lld\n", len);
     while(len) {
         //判断backlog中的内容是否已经成环
         //如果成环，则需要分两次取出内容，如果不成环，可以一次直接取出内容
@@ -986,7 +994,7 @@ long long addReplyReplicationBacklog(KVClient *c, long long offset) {
             ((server.repl_backlog_size - j) < len) ?
             (server.repl_backlog_size - j) : len;
         //打印出局部复制内容的长度
-        printf("[PSYNC] addReply() length: %lld\n", thislen);
+        serverLog(KVDATA_DEBUG, "[PSYNC] addReply() length: %lld\n", thislen);
         //将局部复制的内容以字符串对象的形式写入客户端c的回复缓冲区中
         addReplySds(c,sdsnewlen(server.repl_backlog + j, thislen));
         len -= thislen;
@@ -1005,9 +1013,9 @@ void replicationCron(void) {
     
     // 尝试连接主服务器
     if (server.repl_state == KVDATA_REPL_CONNECT) {
-        printf("Connecting to MASTER %s:%d\n", server.masterhost, server.masterport);
+        serverLog(KVDATA_NOTICE, "Connecting to MASTER %s:%d\n", server.masterhost, server.masterport);
         if (connectWithMaster() == AE_OK) {
-            printf("MASTER <-> SLAVE sync started\n");
+            serverLog(KVDATA_NOTICE, "MASTER <-> SLAVE sync started\n");
         }
     }
 }
@@ -1041,7 +1049,7 @@ void updateSlavesWaitingBgsave(int bgsaveerr) {
             if (bgsaveerr != AE_OK) {
                 // 释放临时 slave，继续遍历下一个从节点
                 freeClient(slave);
-                printf("SYNC failed. BGSAVE child returned an error\n");
+                serverLog(KVDATA_WARNING, "SYNC failed. BGSAVE child returned an error\n");
                 continue;
             }
             // 当存在从节点复制状态为KVDATA_REPL_WAIT_BGSAVE_END且当前BGSAVE成功时
@@ -1049,7 +1057,7 @@ void updateSlavesWaitingBgsave(int bgsaveerr) {
             if ((slave->repldbfd = open(server.rdb_filename,O_RDONLY)) == -1 ||
                 fstat(slave->repldbfd,&buf) == -1) {
                 freeClient(slave);
-                printf("SYNC failed. Can't open/stat DB after BGSAVE: %s\n", strerror(errno));
+                serverLog(KVDATA_WARNING, "SYNC failed. Can't open/stat DB after BGSAVE: %s\n", strerror(errno));
                 continue;
             }
             /*设置偏移量*/
@@ -1081,7 +1089,7 @@ void updateSlavesWaitingBgsave(int bgsaveerr) {
         //如果执行后台BGSAVE失败，则释放所有依赖该BGSAVE的从节点客户端
         if (rdbSaveBackground(server.rdb_filename) != AE_OK) {
             ln = server.slaves->head;
-            printf("SYNC failed. BGSAVE failed\n");
+            serverLog(KVDATA_WARNING, "SYNC failed. BGSAVE failed\n");
             while(ln != NULL) {
                 KVClient *slave = ln->value;
                 //释放所有复制状态为KVDATA_REPL_WAIT_BGSAVE_START的从节点
@@ -1121,14 +1129,14 @@ void sendBulkToSlave(aeEventLoop *el, int fd, void *privdata, int mask) {
     // 然后调用read，读取RDB文件中KVDATA_IOBUF_LEN个字节到buf中；
     //检查读取失败则打印日志，释放用于表示从节点的临时客户端
     if ((buflen = read(slave->repldbfd,buf,KVDATA_IOBUF_LEN)) <= 0) {
-        printf("Read error sending DB to slave: %s\n", (buflen == 0) ? "premature EOF" : strerror(errno));
+        serverLog(KVDATA_WARNING, "Read error sending DB to slave: %s\n", (buflen == 0) ? "premature EOF" : strerror(errno));
         freeClient(slave);
         return;
     }
     // 调用write，将已读取的数据发送给从节点客户端，write返回值为nwritten，将其加到slave->repldboff中。
     if ((nwritten = write(fd,buf,buflen)) == -1) {
         if (errno != EAGAIN) {
-            printf("Write error sending DB to slave: %s\n", strerror(errno));
+            serverLog(KVDATA_WARNING, "Write error sending DB to slave: %s\n", strerror(errno));
             freeClient(slave);
         }
         return;
@@ -1153,10 +1161,10 @@ void sendBulkToSlave(aeEventLoop *el, int fd, void *privdata, int mask) {
         // 将保存并发送 RDB 期间的回复全部发送给从服务器
         if (aeCreateFileEvent(server.eventsLoop, slave->fd, AE_WRITABLE,
             sendReplyToClient, slave) == AE_ERR) {
-            printf("Unable to register writable event for slave bulk transfer: %s\n", strerror(errno));
+            serverLog(KVDATA_WARNING, "Unable to register writable event for slave bulk transfer: %s\n", strerror(errno));
             freeClient(slave);
             return;
         }
-        printf("Synchronization with slave succeeded\n");
+        serverLog(KVDATA_NOTICE, "Synchronization with slave succeeded\n");
     }
 }
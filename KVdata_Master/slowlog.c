@@ -0,0 +1,162 @@
+#include "slowlog.h"
+#include <string.h>
+#include <strings.h>
+#include <pthread.h>
+#include "server.h"
+#include "zmalloc.h"
+#include "clock.h"
+extern struct sharedObjectsStruct shared;
+
+/*
+ * 慢查询日志
+ *
+ * 执行时间超过 server.slowlog_log_slower_than 微秒的命令被记录到一个固定大小的环形缓冲区中，
+ * 缓冲区满之后新的日志覆盖最旧的日志。
+ * 多 reactor 模式下多个线程会同时记录日志，缓冲区由互斥锁保护，
+ * 只有超过阈值的命令才需要加锁，正常的命令只有一次比较。
+ */
+static slowlogEntry *slowlog_ring;
+// 缓冲区中有效日志的数量
+static unsigned long slowlog_len;
+// 下一条日志写入的位置
+static unsigned long slowlog_head;
+// 下一条日志的 id
+static long long slowlog_entry_id;
+static pthread_mutex_t slowlog_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * 释放日志占用的内存
+ */
+static void slowlogFreeEntry(slowlogEntry *se) {
+    for (int j = 0; j < se->argc; j++) sdsfree(se->argv[j]);
+    zfree(se->argv);
+    sdsfree(se->peerid);
+    se->argv = NULL;
+    se->argc = 0;
+    se->peerid = NULL;
+}
+
+/*
+ * 根据命令的参数创建一条日志，保存在 se 中
+ */
+static void slowlogFillEntry(slowlogEntry *se, KVClient *c, robj **argv, int argc, long long duration) {
+    int slargc = argc;
+
+    if (slargc > SLOWLOG_ENTRY_MAX_ARGC) slargc = SLOWLOG_ENTRY_MAX_ARGC;
+    se->argc = slargc;
+    se->argv = zmalloc(sizeof(sds)*slargc);
+    for (int j = 0; j < slargc; j++) {
+        // 参数太多时，最后一个参数记录省略的参数个数
+        if (slargc != argc && j == slargc-1) {
+            se->argv[j] = sdscatprintf(sdsnewlen("",0),"... (%d more arguments)",
+                argc-slargc+1);
+            continue;
+        }
+        // 参数可能已经被命令编码为整数对象
+        robj *arg = getDecodedObject(argv[j]);
+        sds s = arg->ptr;
+        size_t len = sdslen(s);
+
+        // 参数太长时只保存开头的部分，并记录省略的字节数
+        if (len > SLOWLOG_ENTRY_MAX_STRING) {
+            se->argv[j] = sdsnewlen(s,SLOWLOG_ENTRY_MAX_STRING);
+            se->argv[j] = sdscatprintf(se->argv[j],"... (%lu more bytes)",
+                (unsigned long)(len-SLOWLOG_ENTRY_MAX_STRING));
+        } else {
+            se->argv[j] = sdsnewlen(s,len);
+        }
+        decrRefCount(arg);
+    }
+    se->time = clockUnixSec();
+    se->duration = duration;
+    se->peerid = sdscatprintf(sdsnewlen("",0),"%s:%d",c->ip,c->port);
+}
+
+/*
+ * 初始化慢查询日志，在载入配置之后调用
+ */
+void slowlogInit(void) {
+    slowlog_ring = NULL;
+    if (server.slowlog_max_len) {
+        slowlog_ring = zmalloc(sizeof(slowlogEntry)*server.slowlog_max_len);
+        memset(slowlog_ring,0,sizeof(slowlogEntry)*server.slowlog_max_len);
+    }
+    slowlog_len = slowlog_head = 0;
+    slowlog_entry_id = 0;
+}
+
+/*
+ * 命令执行完毕之后由 call 调用，执行时间超过阈值时记录一条日志
+ */
+void slowlogPushEntryIfNeeded(KVClient *c, robj **argv, int argc, long long duration) {
+    slowlogEntry *se;
+
+    // 阈值为负数时关闭慢查询日志
+    if (server.slowlog_log_slower_than < 0 || server.slowlog_max_len == 0) return;
+    if (duration < server.slowlog_log_slower_than) return;
+
+    pthread_mutex_lock(&slowlog_mutex);
+    se = slowlog_ring+slowlog_head;
+    // 缓冲区已满，覆盖最旧的日志
+    if (slowlog_len == server.slowlog_max_len) slowlogFreeEntry(se);
+    else slowlog_len++;
+    slowlogFillEntry(se,c,argv,argc,duration);
+    se->id = slowlog_entry_id++;
+    slowlog_head = (slowlog_head+1) % server.slowlog_max_len;
+    pthread_mutex_unlock(&slowlog_mutex);
+}
+
+/*
+ * 删除所有日志
+ */
+void slowlogReset(void) {
+    pthread_mutex_lock(&slowlog_mutex);
+    for (unsigned long j = 0; j < slowlog_len; j++) slowlogFreeEntry(slowlog_ring+j);
+    slowlog_len = slowlog_head = 0;
+    pthread_mutex_unlock(&slowlog_mutex);
+}
+
+/*
+ * SLOWLOG GET [count] 返回最近的 count 条日志，默认 10 条，从新到旧排列
+ * SLOWLOG LEN 返回日志的数量
+ * SLOWLOG RESET 删除所有日志
+ */
+void slowlogCommand(KVClient *c) {
+    if (c->argc == 2 && !strcasecmp(c->argv[1]->ptr,"reset")) {
+        slowlogReset();
+        addReply(c,shared.ok);
+    } else if (c->argc == 2 && !strcasecmp(c->argv[1]->ptr,"len")) {
+        pthread_mutex_lock(&slowlog_mutex);
+        unsigned long len = slowlog_len;
+        pthread_mutex_unlock(&slowlog_mutex);
+        addReplyLongLongWithPrefix(c,len,':');
+    } else if ((c->argc == 2 || c->argc == 3) && !strcasecmp(c->argv[1]->ptr,"get")) {
+        long long count = 10;
+
+        if (c->argc == 3 && (getLongLongFromObject(c->argv[2],&count) != AE_OK || count < 0)) {
+            addReplySds(c,sdsnew("-ERR value is out of range, must be positive\r\n"));
+            return;
+        }
+
+        pthread_mutex_lock(&slowlog_mutex);
+        if ((unsigned long long)count > slowlog_len) count = slowlog_len;
+        addReplyLongLongWithPrefix(c,count,'*');
+        for (long long j = 0; j < count; j++) {
+            // 从最新的日志开始
+            unsigned long idx = (slowlog_head+server.slowlog_max_len-1-j) % server.slowlog_max_len;
+            slowlogEntry *se = slowlog_ring+idx;
+
+            addReplyLongLongWithPrefix(c,5,'*');
+            addReplyLongLongWithPrefix(c,se->id,':');
+            addReplyLongLongWithPrefix(c,se->time,':');
+            addReplyLongLongWithPrefix(c,se->duration,':');
+            addReplyLongLongWithPrefix(c,se->argc,'*');
+            for (int i = 0; i < se->argc; i++)
+                addReplyBulkCBuffer(c,se->argv[i],sdslen(se->argv[i]));
+            addReplyBulkCBuffer(c,se->peerid,sdslen(se->peerid));
+        }
+        pthread_mutex_unlock(&slowlog_mutex);
+    } else {
+        addReplySds(c,sdsnew("-ERR Unknown SLOWLOG subcommand or wrong # of args. Try GET, RESET, LEN.\r\n"));
+    }
+}
@@ -0,0 +1,32 @@
+#ifndef KVDATA_SLOWLOG_H
+#define KVDATA_SLOWLOG_H
+#include <time.h>
+#include "client.h"
+
+#define KVDATA_SLOWLOG_LOG_SLOWER_THAN 10000  //默认记录执行时间超过 10 毫秒的命令（微秒）
+#define KVDATA_SLOWLOG_MAX_LEN 128            //慢查询日志默认最多保存的条数
+#define SLOWLOG_ENTRY_MAX_ARGC 32             //每条日志最多保存的参数个数
+#define SLOWLOG_ENTRY_MAX_STRING 128          //每个参数最多保存的字节数
+
+/*
+ * 慢查询日志
+ */
+typedef struct slowlogEntry {
+    // 命令的参数，超出的参数和内容被截断
+    sds *argv;
+    int argc;
+    // 唯一的日志 id
+    long long id;
+    // 命令的执行时间（微秒）
+    long long duration;
+    // 命令执行完毕时的 unix 时间
+    time_t time;
+    // 客户端的地址 ip:port
+    sds peerid;
+} slowlogEntry;
+
+void slowlogInit(void);
+void slowlogPushEntryIfNeeded(KVClient *c, robj **argv, int argc, long long duration);
+void slowlogReset(void);
+void slowlogCommand(KVClient *c);
+#endif
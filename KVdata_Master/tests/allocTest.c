@@ -0,0 +1,198 @@
+/*
+ * 读取路径的内存分配测试程序
+ *
+ * 通过回环连接向服务器的客户端发送流水线的 GET 命令，
+ * 像事件循环一样调用 recvData 读入、解析并执行命令，再由 handleClientsWithPendingWrites 写出回复，
+ * 统计这个过程中 zmalloc 、 zrealloc 和 slabAlloc 被调用的次数。
+ * 客户端预热之后（参数数组、参数对象池和回复缓冲区都已经分配），每条 GET 都不应该分配内存。
+ *
+ * 测试程序和除 main.c 之外的所有源文件链接在一起，通过链接器的 --wrap 选项统计分配次数，
+ * 在 KVdata_Master 目录下编译运行：
+ *
+ * gcc -I. $(ls *.c | grep -v '^main.c$') tests/allocTest.c -o /tmp/allocTest -lpthread \
+ *     -Wl,--wrap=zmalloc,--wrap=zrealloc,--wrap=slabAlloc && /tmp/allocTest [轮数] [每轮命令数]
+ *
+ * 全部通过时返回 0 ，否则打印失败的检查并返回 1 。
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "server.h"
+#include "client.h"
+#include "events.h"
+#include "reactor.h"
+#include "slowlog.h"
+#include "sds.h"
+#include "zmalloc.h"
+
+KVServer server;//全局服务器变量，被链接进来的源文件引用
+
+static int failed = 0;
+
+#define test_assert(cond) do { \
+        if (!(cond)) { \
+            printf("  FAILED %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+            failed++; \
+            return; \
+        } \
+    } while(0)
+
+/* 被统计的分配函数，由链接器的 --wrap 选项替换 */
+static long long alloc_calls = 0;
+
+void *__real_zmalloc(size_t size);
+void *__real_zrealloc(void *ptr, size_t size);
+void *__real_slabAlloc(int id);
+
+void *__wrap_zmalloc(size_t size) {
+    alloc_calls++;
+    return __real_zmalloc(size);
+}
+
+void *__wrap_zrealloc(void *ptr, size_t size) {
+    alloc_calls++;
+    return __real_zrealloc(ptr,size);
+}
+
+void *__wrap_slabAlloc(int id) {
+    alloc_calls++;
+    return __real_slabAlloc(id);
+}
+
+/*
+ * 创建一对回环 TCP 连接，*srvfd 交给服务器的客户端，*clifd 模拟远端
+ */
+static int createLoopbackPair(int *srvfd, int *clifd) {
+    struct sockaddr_in sa;
+    socklen_t salen = sizeof(sa);
+    int lfd = socket(AF_INET,SOCK_STREAM,0);
+
+    memset(&sa,0,sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    sa.sin_port = 0;
+    if (lfd == -1 || bind(lfd,(struct sockaddr*)&sa,sizeof(sa)) == -1 ||
+        listen(lfd,1) == -1 || getsockname(lfd,(struct sockaddr*)&sa,&salen) == -1) return -1;
+    if ((*clifd = socket(AF_INET,SOCK_STREAM,0)) == -1 ||
+        connect(*clifd,(struct sockaddr*)&sa,sizeof(sa)) == -1) return -1;
+    if ((*srvfd = accept(lfd,NULL,NULL)) == -1) return -1;
+    close(lfd);
+    return 0;
+}
+
+/*
+ * 写出全部内容，内容很少，不会被套接字缓冲区阻塞
+ */
+static int writeAll(int fd, const char *buf, size_t len) {
+    while (len) {
+        ssize_t n = write(fd,buf,len);
+
+        if (n <= 0) return -1;
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/*
+ * 读入恰好 len 字节
+ */
+static int readAll(int fd, char *buf, size_t len) {
+    while (len) {
+        ssize_t n = read(fd,buf,len);
+
+        if (n <= 0) return -1;
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/*
+ * 发送一批命令，由服务器读入、执行并写出回复，返回期间的分配次数；
+ * 远端读回的回复必须和 expected 一致
+ */
+static long long roundTrip(KVClient *c, int clifd, sds req, sds expected) {
+    long long before;
+    sds reply = sdsnewlen(NULL,sdslen(expected));
+
+    if (writeAll(clifd,req,sdslen(req)) == -1) {
+        sdsfree(reply);
+        return -1;
+    }
+    before = alloc_calls;
+    // 命令很少，一次读事件就能读入全部内容
+    recvData(server.eventsLoop,c->fd,c,AE_READABLE);
+    handleClientsWithPendingWrites();
+    before = alloc_calls-before;
+
+    if (readAll(clifd,reply,sdslen(expected)) == -1 ||
+        memcmp(reply,expected,sdslen(expected)) != 0) before = -1;
+    sdsfree(reply);
+    return before;
+}
+
+/*
+ * 预热之后，流水线 GET 的读入、解析、执行和回复都不分配内存
+ */
+static void testPipelinedGet(int rounds, int pipeline) {
+    int srvfd, clifd;
+    KVClient *c;
+    sds set = sdsnewlen("",0), setreply = sdsnewlen("+OK\r\n",5);
+    sds req = sdsnewlen("",0), expected = sdsnewlen("",0);
+    long long calls, total = 0;
+
+    test_assert(createLoopbackPair(&srvfd,&clifd) == 0);
+    test_assert((c = createClient(srvfd)) != NULL);
+
+    // 键和值都不能是共享整数，值足够长，使用普通的 STRING 编码
+    set = sdscatprintf(set,"*3\r\n$3\r\nSET\r\n$7\r\nalloc:1\r\n$64\r\n%064d\r\n",7);
+    test_assert(roundTrip(c,clifd,set,setreply) >= 0);
+
+    for (int j = 0; j < pipeline; j++) {
+        req = sdscatprintf(req,"*2\r\n$3\r\nGET\r\n$7\r\nalloc:1\r\n");
+        expected = sdscatprintf(expected,"$64\r\n%064d\r\n",7);
+    }
+
+    // 预热：分配参数数组、参数对象池和回复缓冲区
+    for (int j = 0; j < 3; j++) test_assert(roundTrip(c,clifd,req,expected) >= 0);
+
+    for (int j = 0; j < rounds; j++) {
+        calls = roundTrip(c,clifd,req,expected);
+        test_assert(calls >= 0);
+        total += calls;
+    }
+    printf("  %d pipelined GETs, %lld allocations (%.3f per command)\n",
+        rounds*pipeline, total, (double)total/(rounds*pipeline));
+    test_assert(total == 0);
+
+    freeClient(c);
+    close(clifd);
+    sdsfree(set);
+    sdsfree(setreply);
+    sdsfree(req);
+    sdsfree(expected);
+}
+
+int main(int argc, char **argv) {
+    int rounds = argc > 1 ? atoi(argv[1]) : 1000;
+    int pipeline = argc > 2 ? atoi(argv[2]) : 16;
+    int before;
+
+    // 和 main.c 一样初始化服务器，但是不监听端口
+    initServer(&server);
+    server.verbosity = KVDATA_WARNING;
+    slowlogInit();
+    server.eventsLoop = aeCreateEventLoop(1024);
+    initReactors(0);
+
+    before = failed;
+    testPipelinedGet(rounds,pipeline);
+    printf("[%s] pipelined GET does not allocate\n", failed == before ? "ok" : "FAIL");
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,604 @@
+/*
+ * 服务器的吞吐量和延迟基准测试客户端
+ *
+ * 启动若干个线程，每个线程通过 epoll 驱动一部分连接，
+ * 每个连接每次发送 pipeline 条命令，收齐回复之后再发送下一批，
+ * 统计每秒完成的命令数量，以及每批命令往返时间的 p50/p99/p99.9/max 。
+ * GET 测试开始之前先用 SET 写入 keyspace 个键，GET 总是命中。
+ *
+ * 比如测试 I/O 线程数量对吞吐量的影响，依次以不同的 --io-threads 启动服务器：
+ *
+ * ./go 6668 --io-threads 4
+ * /tmp/benchClient -p 6668 -c 200 -P 16 -n 4000000 -T 4 -t get
+ *
+ * 和测试程序一样与除 main.c 之外的所有源文件链接在一起，在 KVdata_Master 目录下编译：
+ *
+ * gcc -O2 -I. $(ls *.c | grep -v '^main.c$') tests/benchClient.c -o /tmp/benchClient -lpthread
+ *
+ * -p 可以给出逗号分隔的多个端口，依次对每个服务器执行相同的测试，最后并排输出结果，
+ * 比如对比 epoll 和 io_uring 后端：
+ *
+ * ./go 6668 & ./go 6669 --event-backend io_uring &
+ * /tmp/benchClient -p 6668,6669 -c 1000 -P 1 -n 2000000 -t get
+ *
+ * 选项：
+ * -h 服务器地址（默认 127.0.0.1） -p 端口，可以是逗号分隔的多个端口（默认 6668）
+ * -c 连接数量（默认 50） -n 命令总数（默认 1000000） -P 每批命令数量（默认 1）
+ * -T 客户端线程数量（默认 1） -t get|set（默认 get） -r 键的数量（默认 100000） -d 值的长度（默认 16）
+ * -I 测试之前建立并一直保持的空闲连接数量（默认 0）， -n 0 时只建立空闲连接
+ *
+ * 比如测试 10 万个空闲连接（服务器需要 --maxclients 100000 ，两边的打开文件数量限制都要足够）：
+ *
+ * /tmp/benchClient -p 6668 -I 100000 -c 50 -n 1000000
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include "server.h"
+#include "sds.h"
+#include "zmalloc.h"
+
+#define BENCH_LATENCY_BUCKETS 100000  //延迟直方图的桶数量，每个桶 1 微秒，更长的延迟计入最后一个桶
+#define BENCH_READ_LEN (1024*64)      //每个连接的读缓冲区大小
+#define BENCH_MAX_PORTS 8             //一次最多对比的服务器数量
+#define BENCH_CONNS_PER_SOURCE 20000  //空闲连接使用的每个回环源地址上的连接数量，不超过本地端口范围
+
+KVServer server;//全局服务器变量，被链接进来的源文件引用
+
+/* 测试配置 */
+static struct {
+    char *host;
+    int port;
+    int clients;
+    long long requests;
+    int pipeline;
+    int threads;
+    int set;
+    long keyspace;
+    int datasize;
+    int idle;
+} config = {"127.0.0.1", 6668, 50, 1000000, 1, 1, 0, 100000, 16, 0};
+
+/* 一次测试的结果 */
+typedef struct benchResult {
+    int port;
+    long long done;
+    long long errors;
+    double seconds;
+    double rps;
+    long long p50, p99, p999, max;
+} benchResult;
+
+/* 一个连接的状态 */
+typedef struct benchConn {
+    int fd;
+    // 本批次的命令，以及已经写出的字节数
+    sds obuf;
+    size_t opos;
+    // 已经读入、还没有解析的回复
+    char ibuf[BENCH_READ_LEN];
+    size_t ilen;
+    // 本批次还没有收到的回复数量
+    int pending;
+    // 本批次的发送时间（微秒）
+    long long start;
+    // 这个连接还需要发送的命令数量
+    long long remaining;
+} benchConn;
+
+/* 一个客户端线程的状态和统计数据 */
+typedef struct benchThread {
+    pthread_t tid;
+    benchConn *conns;
+    int nconns;
+    unsigned int seed;
+    long long done;
+    long long errors;
+    long long max_latency;
+    unsigned int *latency;
+} benchThread;
+
+static long long ustime(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (long long)ts.tv_sec*1000000+ts.tv_nsec/1000;
+}
+
+/*
+ * 连接服务器，成功返回套接字，失败返回 -1
+ * source 不小于 0 并且服务器在回环地址上时，从 127.0.0.(source+1) 发起连接，
+ * 一个源地址只有几万个本地端口，大量空闲连接需要分散到多个源地址上
+ */
+static int benchConnectFrom(int source) {
+    struct sockaddr_in sa;
+    int fd = socket(AF_INET,SOCK_STREAM,0), yes = 1;
+
+    if (fd == -1) return -1;
+    memset(&sa,0,sizeof(sa));
+    sa.sin_family = AF_INET;
+    if (source >= 0 && !strncmp(config.host,"127.",4)) {
+        sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK+source);
+        // 到 connect 时才选择本地端口，处于 TIME_WAIT 的端口可以被连接其他目的地址的套接字复用
+        setsockopt(fd,IPPROTO_IP,IP_BIND_ADDRESS_NO_PORT,&yes,sizeof(yes));
+        if (bind(fd,(struct sockaddr*)&sa,sizeof(sa)) == -1) {
+            close(fd);
+            return -1;
+        }
+    }
+    sa.sin_port = htons(config.port);
+    if (inet_pton(AF_INET,config.host,&sa.sin_addr) != 1 ||
+        connect(fd,(struct sockaddr*)&sa,sizeof(sa)) == -1) {
+        close(fd);
+        return -1;
+    }
+    setsockopt(fd,IPPROTO_TCP,TCP_NODELAY,&yes,sizeof(yes));
+    return fd;
+}
+
+static int benchConnect(void) {
+    return benchConnectFrom(-1);
+}
+
+/*
+ * 执行 INFO 命令，返回回复的内容，出错时退出
+ */
+static sds fetchInfo(void) {
+    static const char *req = "*2\r\n$4\r\nINFO\r\n$3\r\nall\r\n";
+    int fd = benchConnect();
+    sds info = sdsnewlen("",0);
+    char buf[BENCH_READ_LEN];
+    long long bulklen = -1;
+
+    if (fd == -1 || write(fd,req,strlen(req)) != (ssize_t)strlen(req)) {
+        fprintf(stderr,"Can't send INFO to %s:%d\n", config.host, config.port);
+        exit(1);
+    }
+    // 读入整个批量回复
+    while (bulklen == -1 || (long long)sdslen(info) < bulklen) {
+        ssize_t n = read(fd,buf,sizeof(buf));
+        char *nl;
+
+        if (n <= 0) exit(1);
+        info = sdscatlen(info,buf,n);
+        if (bulklen == -1 && (nl = strchr(info,'\n')) != NULL) {
+            bulklen = strtoll(info+1,NULL,10);
+            sdsrange(info,nl-info+1,-1);
+        }
+    }
+    close(fd);
+    return info;
+}
+
+/*
+ * 返回 INFO 内容中 field 的值，不存在时返回 -1
+ */
+static long long infoField(sds info, const char *field) {
+    size_t len = strlen(field);
+
+    for (char *p = info; p && *p; p = strchr(p,'\n') ? strchr(p,'\n')+1 : NULL) {
+        if (!strncmp(p,field,len) && p[len] == ':') return strtoll(p+len+1,NULL,10);
+    }
+    return -1;
+}
+
+/*
+ * 打开 n 个空闲连接并一直保持，输出建立连接的速度和服务器为每个连接增加的内存
+ * 返回连接数组，实际建立的连接数量保存在 *opened 中
+ */
+static int *openIdleConnections(int n, int *opened) {
+    struct rlimit limit;
+    int *fds = zmalloc(sizeof(int)*n);
+    long long start, elapsed, clients, waited = 0;
+    sds before = fetchInfo(), after;
+
+    // 提升打开文件数量的限制，加上测试连接和其他文件需要的数量
+    if (getrlimit(RLIMIT_NOFILE,&limit) == 0) {
+        rlim_t want = (rlim_t)n+config.clients+64;
+
+        limit.rlim_cur = want < limit.rlim_max ? want : limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE,&limit);
+        if (limit.rlim_cur < want)
+            fprintf(stderr,"Open files limit is %llu, fewer than %d idle connections may be opened\n",
+                (unsigned long long)limit.rlim_cur, n);
+    }
+
+    start = ustime();
+    for (*opened = 0; *opened < n; (*opened)++) {
+        if ((fds[*opened] = benchConnectFrom(*opened/BENCH_CONNS_PER_SOURCE)) == -1) {
+            fprintf(stderr,"Idle connection %d failed: %s\n", *opened, strerror(errno));
+            break;
+        }
+    }
+    elapsed = ustime()-start;
+
+    // 等待服务器接受全部连接
+    do {
+        after = fetchInfo();
+        clients = infoField(after,"connected_clients");
+        if (clients > *opened) break;
+        sdsfree(after);
+        usleep(100000);
+        waited += 100000;
+    } while (waited < 10000000);
+    if (clients <= *opened) after = fetchInfo();
+
+    printf("%d idle connections in %.2f seconds (%.0f per second), connected_clients %lld, rejected_connections %lld\n",
+        *opened, elapsed/1e6, *opened*1e6/(elapsed ? elapsed : 1), infoField(after,"connected_clients"),
+        infoField(after,"rejected_connections"));
+    if (*opened) {
+        printf("server memory per idle connection: used_memory %.0f bytes, used_memory_rss %.0f bytes\n",
+            (double)(infoField(after,"used_memory")-infoField(before,"used_memory"))/ *opened,
+            (double)(infoField(after,"used_memory_rss")-infoField(before,"used_memory_rss"))/ *opened);
+    }
+    sdsfree(before);
+    sdsfree(after);
+    return fds;
+}
+
+/*
+ * 返回 buf 开头一条完整回复的长度，回复不完整时返回 0
+ * 只需要处理 GET 和 SET 的回复：状态、错误、整数和批量回复
+ */
+static size_t replyLength(const char *buf, size_t len) {
+    const char *nl = memchr(buf,'\n',len);
+    long long bulklen;
+    size_t linelen;
+
+    if (nl == NULL) return 0;
+    linelen = nl-buf+1;
+    if (buf[0] != '$') return linelen;
+    bulklen = strtoll(buf+1,NULL,10);
+    if (bulklen < 0) return linelen;
+    if (len < linelen+bulklen+2) return 0;
+    return linelen+bulklen+2;
+}
+
+/*
+ * 生成一批命令，键从 keyspace 中随机选取
+ */
+static void prepareBatch(benchThread *t, benchConn *bc) {
+    int n = bc->remaining < config.pipeline ? bc->remaining : config.pipeline;
+
+    bc->obuf = sdscpylen(bc->obuf,"",0);
+    for (int j = 0; j < n; j++) {
+        char key[32];
+        int keylen = snprintf(key,sizeof(key),"key:%ld",(long)(rand_r(&t->seed) % config.keyspace));
+
+        if (config.set) {
+            bc->obuf = sdscatprintf(bc->obuf,"*3\r\n$3\r\nSET\r\n$%d\r\n%s\r\n$%d\r\n",keylen,key,config.datasize);
+            for (int k = 0; k < config.datasize; k++) bc->obuf = sdscatlen(bc->obuf,"x",1);
+            bc->obuf = sdscatlen(bc->obuf,"\r\n",2);
+        } else {
+            bc->obuf = sdscatprintf(bc->obuf,"*2\r\n$3\r\nGET\r\n$%d\r\n%s\r\n",keylen,key);
+        }
+    }
+    bc->opos = 0;
+    bc->pending = n;
+    bc->remaining -= n;
+    bc->start = ustime();
+}
+
+/*
+ * 写出本批次剩余的命令，写不完时等待可写事件
+ */
+static int writeBatch(int epfd, benchConn *bc) {
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = bc};
+
+    while (bc->opos < sdslen(bc->obuf)) {
+        ssize_t n = write(bc->fd,bc->obuf+bc->opos,sdslen(bc->obuf)-bc->opos);
+
+        if (n == -1 && errno == EAGAIN) {
+            ev.events |= EPOLLOUT;
+            break;
+        }
+        if (n <= 0) return -1;
+        bc->opos += n;
+    }
+    return epoll_ctl(epfd,EPOLL_CTL_MOD,bc->fd,&ev);
+}
+
+/*
+ * 读入回复，收齐一批之后记录往返时间并发送下一批
+ * 返回这个连接是否已经完成全部命令
+ */
+static int readReplies(benchThread *t, int epfd, benchConn *bc) {
+    ssize_t n = read(bc->fd,bc->ibuf+bc->ilen,BENCH_READ_LEN-bc->ilen);
+    size_t pos = 0, rlen;
+
+    if (n <= 0) {
+        if (n == -1 && errno == EAGAIN) return 0;
+        fprintf(stderr,"Connection lost: %s\n", n == 0 ? "EOF" : strerror(errno));
+        exit(1);
+    }
+    bc->ilen += n;
+    while (bc->pending && (rlen = replyLength(bc->ibuf+pos,bc->ilen-pos)) > 0) {
+        if (bc->ibuf[pos] == '-') t->errors++;
+        pos += rlen;
+        bc->pending--;
+        t->done++;
+    }
+    memmove(bc->ibuf,bc->ibuf+pos,bc->ilen-pos);
+    bc->ilen -= pos;
+    if (bc->ilen == BENCH_READ_LEN) {
+        fprintf(stderr,"Reply larger than the read buffer\n");
+        exit(1);
+    }
+    if (bc->pending) return 0;
+
+    long long latency = ustime()-bc->start;
+    t->latency[latency < BENCH_LATENCY_BUCKETS ? latency : BENCH_LATENCY_BUCKETS-1]++;
+    if (latency > t->max_latency) t->max_latency = latency;
+    if (bc->remaining == 0) return 1;
+    prepareBatch(t,bc);
+    if (writeBatch(epfd,bc) == -1) {
+        fprintf(stderr,"Write error: %s\n", strerror(errno));
+        exit(1);
+    }
+    return 0;
+}
+
+static void *benchThreadMain(void *arg) {
+    benchThread *t = arg;
+    int epfd = epoll_create1(0), active = 0;
+    struct epoll_event events[256];
+
+    for (int j = 0; j < t->nconns; j++) {
+        benchConn *bc = &t->conns[j];
+        struct epoll_event ev = {.events = EPOLLIN, .data.ptr = bc};
+
+        if (bc->remaining == 0) continue;
+        epoll_ctl(epfd,EPOLL_CTL_ADD,bc->fd,&ev);
+        prepareBatch(t,bc);
+        if (writeBatch(epfd,bc) == -1) {
+            fprintf(stderr,"Write error: %s\n", strerror(errno));
+            exit(1);
+        }
+        active++;
+    }
+
+    while (active) {
+        int n = epoll_wait(epfd,events,256,-1);
+
+        for (int j = 0; j < n; j++) {
+            benchConn *bc = events[j].data.ptr;
+
+            if ((events[j].events & EPOLLOUT) && writeBatch(epfd,bc) == -1) {
+                fprintf(stderr,"Write error: %s\n", strerror(errno));
+                exit(1);
+            }
+            if ((events[j].events & (EPOLLIN|EPOLLERR|EPOLLHUP)) && readReplies(t,epfd,bc)) {
+                epoll_ctl(epfd,EPOLL_CTL_DEL,bc->fd,NULL);
+                active--;
+            }
+        }
+    }
+    close(epfd);
+    return NULL;
+}
+
+/*
+ * GET 测试之前写入全部的键，每批 1000 条命令
+ */
+static void preloadKeys(void) {
+    int fd = benchConnect();
+    char buf[BENCH_READ_LEN];
+    size_t len = 0;
+
+    if (fd == -1) {
+        fprintf(stderr,"Can't connect to %s:%d\n", config.host, config.port);
+        exit(1);
+    }
+    for (long base = 0; base < config.keyspace; base += 1000) {
+        long n = config.keyspace-base < 1000 ? config.keyspace-base : 1000;
+        sds req = sdsnewlen("",0);
+
+        for (long j = base; j < base+n; j++) {
+            char key[32];
+            int keylen = snprintf(key,sizeof(key),"key:%ld",j);
+
+            req = sdscatprintf(req,"*3\r\n$3\r\nSET\r\n$%d\r\n%s\r\n$%d\r\n",keylen,key,config.datasize);
+            for (int k = 0; k < config.datasize; k++) req = sdscatlen(req,"x",1);
+            req = sdscatlen(req,"\r\n",2);
+        }
+        for (size_t pos = 0; pos < sdslen(req); ) {
+            ssize_t w = write(fd,req+pos,sdslen(req)-pos);
+            if (w <= 0) exit(1);
+            pos += w;
+        }
+        while (n) {
+            size_t rlen;
+            ssize_t r = read(fd,buf+len,sizeof(buf)-len);
+
+            if (r <= 0) exit(1);
+            len += r;
+            while (n && (rlen = replyLength(buf,len)) > 0) {
+                memmove(buf,buf+rlen,len-rlen);
+                len -= rlen;
+                n--;
+            }
+        }
+        sdsfree(req);
+    }
+    close(fd);
+}
+
+/*
+ * 返回直方图中第 p 百分位的延迟（微秒）
+ */
+static long long latencyPercentile(unsigned long long *latency, long long total, double p) {
+    unsigned long long seen = 0, rank = (unsigned long long)(total*p/100.0);
+
+    for (int j = 0; j < BENCH_LATENCY_BUCKETS; j++) {
+        seen += latency[j];
+        if (seen > rank) return j;
+    }
+    return BENCH_LATENCY_BUCKETS-1;
+}
+
+/*
+ * 对 config.port 上的服务器执行一次测试，结果保存在 r 中
+ */
+static void runBenchmark(benchResult *r) {
+    benchThread *threads;
+    unsigned long long *latency;
+    long long start, elapsed, done = 0, errors = 0, batches = 0, max_latency = 0;
+    long long per_conn;
+
+    if (!config.set) preloadKeys();
+
+    // 把命令平均分给各个连接，连接平均分给各个线程
+    // 每次测试使用相同的随机种子，对不同服务器发送完全相同的命令
+    per_conn = config.requests/config.clients;
+    threads = zmalloc(sizeof(benchThread)*config.threads);
+    for (int j = 0; j < config.threads; j++) {
+        benchThread *t = &threads[j];
+        int first = (long long)config.clients*j/config.threads;
+        int last = (long long)config.clients*(j+1)/config.threads;
+
+        t->nconns = last-first;
+        t->conns = zmalloc(sizeof(benchConn)*t->nconns);
+        t->seed = 12345+j;
+        t->done = t->errors = t->max_latency = 0;
+        t->latency = zmalloc(sizeof(unsigned int)*BENCH_LATENCY_BUCKETS);
+        memset(t->latency,0,sizeof(unsigned int)*BENCH_LATENCY_BUCKETS);
+        for (int k = 0; k < t->nconns; k++) {
+            benchConn *bc = &t->conns[k];
+
+            if ((bc->fd = benchConnect()) == -1) {
+                fprintf(stderr,"Can't connect to %s:%d: %s\n", config.host, config.port, strerror(errno));
+                exit(1);
+            }
+            fcntl(bc->fd,F_SETFL,fcntl(bc->fd,F_GETFL)|O_NONBLOCK);
+            bc->obuf = sdsnewlen("",0);
+            bc->ilen = 0;
+            bc->pending = 0;
+            bc->remaining = per_conn + (first+k < config.requests % config.clients);
+        }
+    }
+
+    start = ustime();
+    for (int j = 0; j < config.threads; j++)
+        pthread_create(&threads[j].tid,NULL,benchThreadMain,&threads[j]);
+    for (int j = 0; j < config.threads; j++)
+        pthread_join(threads[j].tid,NULL);
+    elapsed = ustime()-start;
+
+    latency = zmalloc(sizeof(unsigned long long)*BENCH_LATENCY_BUCKETS);
+    memset(latency,0,sizeof(unsigned long long)*BENCH_LATENCY_BUCKETS);
+    for (int j = 0; j < config.threads; j++) {
+        benchThread *t = &threads[j];
+
+        for (int k = 0; k < BENCH_LATENCY_BUCKETS; k++) {
+            latency[k] += t->latency[k];
+            batches += t->latency[k];
+        }
+        done += t->done;
+        errors += t->errors;
+        if (t->max_latency > max_latency) max_latency = t->max_latency;
+        for (int k = 0; k < t->nconns; k++) {
+            close(t->conns[k].fd);
+            sdsfree(t->conns[k].obuf);
+        }
+        zfree(t->conns);
+        zfree(t->latency);
+    }
+
+    r->port = config.port;
+    r->done = done;
+    r->errors = errors;
+    r->seconds = elapsed/1e6;
+    r->rps = done*1e6/elapsed;
+    r->p50 = latencyPercentile(latency,batches,50);
+    r->p99 = latencyPercentile(latency,batches,99);
+    r->p999 = latencyPercentile(latency,batches,99.9);
+    r->max = max_latency;
+    zfree(latency);
+    zfree(threads);
+}
+
+int main(int argc, char **argv) {
+    benchResult results[BENCH_MAX_PORTS];
+    int ports[BENCH_MAX_PORTS], nports = 0;
+
+    for (int j = 1; j < argc; j++) {
+        int last = j == argc-1;
+
+        if (!strcmp(argv[j],"-h") && !last) config.host = argv[++j];
+        else if (!strcmp(argv[j],"-p") && !last) {
+            // 逗号分隔的多个端口，依次测试并对比
+            char *p = argv[++j];
+
+            for (nports = 0; nports < BENCH_MAX_PORTS && *p; nports++) {
+                ports[nports] = atoi(p);
+                if ((p = strchr(p,',')) == NULL) { nports++; break; }
+                p++;
+            }
+        }
+        else if (!strcmp(argv[j],"-c") && !last) config.clients = atoi(argv[++j]);
+        else if (!strcmp(argv[j],"-n") && !last) config.requests = atoll(argv[++j]);
+        else if (!strcmp(argv[j],"-P") && !last) config.pipeline = atoi(argv[++j]);
+        else if (!strcmp(argv[j],"-T") && !last) config.threads = atoi(argv[++j]);
+        else if (!strcmp(argv[j],"-t") && !last) config.set = !strcasecmp(argv[++j],"set");
+        else if (!strcmp(argv[j],"-r") && !last) config.keyspace = atol(argv[++j]);
+        else if (!strcmp(argv[j],"-d") && !last) config.datasize = atoi(argv[++j]);
+        else if (!strcmp(argv[j],"-I") && !last) config.idle = atoi(argv[++j]);
+        else {
+            fprintf(stderr,"Unknown or incomplete option '%s'\n", argv[j]);
+            return 1;
+        }
+    }
+    if (config.clients < 1 || config.pipeline < 1 || config.keyspace < 1 || config.datasize < 0 ||
+        config.threads < 1 || config.threads > config.clients || config.requests < 0 || config.idle < 0) {
+        fprintf(stderr,"Invalid options\n");
+        return 1;
+    }
+    if (nports == 0) ports[nports++] = config.port;
+
+    printf("%s: %lld requests, %d clients, pipeline %d, %d threads\n",
+        config.set ? "SET" : "GET", config.requests, config.clients, config.pipeline, config.threads);
+    for (int j = 0; j < nports; j++) {
+        benchResult *r = &results[j];
+        int *idlefds = NULL, opened = 0;
+
+        config.port = ports[j];
+        // 先建立空闲连接，在保持这些连接的同时执行测试
+        if (config.idle) idlefds = openIdleConnections(config.idle,&opened);
+        if (config.requests) {
+            runBenchmark(r);
+        } else {
+            memset(r,0,sizeof(*r));
+            r->port = config.port;
+        }
+        for (int k = 0; k < opened; k++) close(idlefds[k]);
+        zfree(idlefds);
+        if (config.requests == 0) continue;
+        printf("port %d: %.2f seconds, %.0f requests per second, %lld errors\n",
+            r->port, r->seconds, r->rps, r->errors);
+        printf("port %d: batch latency (us): p50 %lld, p99 %lld, p99.9 %lld, max %lld\n",
+            r->port, r->p50, r->p99, r->p999, r->max);
+    }
+
+    // 测试了多个服务器时，并排输出对比
+    if (nports > 1) {
+        printf("\n%-8s %12s %8s %8s %8s %8s\n", "port", "req/s", "p50", "p99", "p99.9", "max");
+        for (int j = 0; j < nports; j++) {
+            benchResult *r = &results[j];
+
+            printf("%-8d %12.0f %8lld %8lld %8lld %8lld\n", r->port, r->rps, r->p50, r->p99, r->p999, r->max);
+        }
+    }
+    return 0;
+}
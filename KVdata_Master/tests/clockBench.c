@@ -0,0 +1,111 @@
+/*
+ * 缓存时钟的基准测试程序
+ *
+ * 分别测量每次读取时间的开销：
+ * time(NULL) 、 mstime() （gettimeofday）、 getMonotonicUs() 、刷新缓存时钟的 updateCachedClock() ，
+ * 以及从缓存中读取的 clockUnixSec() 和 commandTimeMs() 。
+ * 再测量读取一个带有过期时间的热点键的 GET 路径：
+ * 当前的 lookupKey 使用命令时间判断过期；原来的路径每次 GET 调用 mstime() 判断过期，
+ * 读事件还要调用 time(NULL) 记录最近活动时间。两者相减就是缓存时钟为每次 GET 节省的时间。
+ *
+ * 测试程序和除 main.c 之外的所有源文件链接在一起，在 KVdata_Master 目录下编译运行：
+ *
+ * gcc -O2 -I. $(ls *.c | grep -v '^main.c$') tests/clockBench.c -o /tmp/clockBench -lpthread && /tmp/clockBench [次数]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "server.h"
+#include "db.h"
+#include "object.h"
+#include "clock.h"
+#include "util.h"
+#include "sds.h"
+#include "zmalloc.h"
+
+KVServer server;//全局服务器变量，被链接进来的源文件引用
+
+static volatile long long sink;
+
+static long long nstime(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (long long)ts.tv_sec*1000000000+ts.tv_nsec;
+}
+
+static void report(const char *name, long long ns, long ops) {
+    printf("  %-40s %8.1f ns/op\n", name, (double)ns/ops);
+}
+
+/*
+ * 原来的 GET 路径：查找键，调用 mstime() 判断过期，读事件调用 time(NULL) 记录最近活动时间
+ */
+static robj *previousLookupKey(KVdataDb *db, robj *key, time_t *last_active) {
+    dictEntry *de = dictFind(db->DB,key->ptr);
+
+    *last_active = time(NULL);
+    if (de == NULL) return NULL;
+    if (de->expire && mstime() > (long long)de->expire) return NULL;
+    return dictGetVal(de);
+}
+
+int main(int argc, char **argv) {
+    long n = argc > 1 ? atol(argv[1]) : 10000000;
+    KVdataDb *db;
+    robj key = {.encoding = STRING, .refcount = 1, .ptr = sdsnewlen("clock:key",9)};
+    robj *val = createStringObject("value:0123456789",16);
+    long long start, cur, prev;
+    time_t last_active;
+
+    initServer(&server);
+    server.verbosity = KVDATA_WARNING;
+    updateCachedClock();
+    db = createDatabases(1);
+    setKey(db,&key,val);
+    decrRefCount(val);
+    setExpire(db,&key,clockUnixMs()+3600000);
+
+    printf("%ld calls each\n", n);
+    printf("reading the clock\n");
+    start = nstime();
+    for (long j = 0; j < n; j++) sink = time(NULL);
+    report("time(NULL)",nstime()-start,n);
+    start = nstime();
+    for (long j = 0; j < n; j++) sink = mstime();
+    report("mstime() (gettimeofday)",nstime()-start,n);
+    start = nstime();
+    for (long j = 0; j < n; j++) sink = getMonotonicUs();
+    report("getMonotonicUs()",nstime()-start,n);
+    start = nstime();
+    for (long j = 0; j < n; j++) updateCachedClock();
+    report("updateCachedClock()",nstime()-start,n);
+    start = nstime();
+    for (long j = 0; j < n; j++) sink = clockUnixSec();
+    report("clockUnixSec() (cached)",nstime()-start,n);
+    clockEnterCommand(getMonotonicUs());
+    start = nstime();
+    for (long j = 0; j < n; j++) sink = commandTimeMs();
+    report("commandTimeMs() (cached)",nstime()-start,n);
+
+    printf("GET of a hot key with a TTL\n");
+    start = nstime();
+    for (long j = 0; j < n; j++) sink = (long long)lookupKey(db,&key);
+    cur = nstime()-start;
+    report("lookupKey, command time",cur,n);
+    start = nstime();
+    for (long j = 0; j < n; j++) {
+        sink = (long long)previousLookupKey(db,&key,&last_active);
+        sink = last_active;
+    }
+    prev = nstime()-start;
+    report("previous, mstime() + time(NULL)",prev,n);
+    report("saved per GET",prev-cur,n);
+    clockLeaveCommand();
+
+    dictEmpty(db->expires);
+    dictEmpty(db->DB);
+    sdsfree(key.ptr);
+    return 0;
+}
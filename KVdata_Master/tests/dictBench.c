@@ -0,0 +1,132 @@
+/*
+ * 键空间字典的基准测试程序
+ *
+ * 对每个给定的键数量 N （默认 100 万和 1000 万），在一个新的数据库中：
+ * 通过 setKey 依次写入 N 个键（包括渐进式 rehash），统计每个键占用的内存（used_memory 和 RSS 的增量），
+ * 再测量随机 GET （lookupKey）命中和未命中、以及覆写已有键的 SET 的吞吐量。
+ * 键为 "key:<编号>" ，值为 16 字节的字符串，和 GET/SET 命令的执行路径相同，只是不经过网络和协议解析。
+ *
+ * 测试程序和除 main.c 之外的所有源文件链接在一起，在 KVdata_Master 目录下编译运行：
+ *
+ * gcc -O2 -I. $(ls *.c | grep -v '^main.c$') tests/dictBench.c -o /tmp/dictBench -lpthread && /tmp/dictBench [键数量 ...]
+ *
+ * 5000 万个键需要 6GB 以上的内存。
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "server.h"
+#include "db.h"
+#include "object.h"
+#include "sds.h"
+#include "zmalloc.h"
+
+#define BENCH_MAX_OPS 10000000  //每项读写测试最多执行的操作数量
+
+KVServer server;//全局服务器变量，被链接进来的源文件引用
+
+static long long nstime(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (long long)ts.tv_sec*1000000000+ts.tv_nsec;
+}
+
+static void report(const char *name, long long ns, long long ops) {
+    printf("  %-24s %12.0f ops/sec %8.1f ns/op\n", name, ops*1e9/ns, (double)ns/ops);
+}
+
+/*
+ * 把编号为 id 的键写入 key 中，复用 key 的空间，不分配内存
+ */
+static void setBenchKey(robj *key, long id) {
+    char buf[32];
+    int len = snprintf(buf,sizeof(buf),"key:%ld",id);
+
+    key->ptr = sdscpylen(key->ptr,buf,len);
+}
+
+static robj *benchValue(long id) {
+    char buf[32];
+    int len = snprintf(buf,sizeof(buf),"value:%010ld",id);
+
+    return createStringObject(buf,len);
+}
+
+static void benchKeys(long n) {
+    KVdataDb *db = createDatabases(1);
+    robj key = {.encoding = STRING, .refcount = 1, .ptr = sdsnewlen("",0)};
+    long ops = n < BENCH_MAX_OPS ? n : BENCH_MAX_OPS;
+    size_t mem = zmalloc_used_memory(), rss = zmalloc_get_rss();
+    long long start, sum = 0;
+
+    printf("%ld keys\n", n);
+
+    // 写入：键不存在，包括字典扩容和渐进式 rehash
+    start = nstime();
+    for (long j = 0; j < n; j++) {
+        robj *val = benchValue(j);
+
+        setBenchKey(&key,j);
+        setKey(db,&key,val);
+        decrRefCount(val);
+    }
+    report("SET (new keys)",nstime()-start,n);
+    // 完成剩余的 rehash ，之后的读写不受 rehash 影响
+    while (dictRehash(db->DB,1000)) {}
+    printf("  %-24s %12.1f bytes used_memory %8.1f bytes RSS\n", "memory per key",
+        (double)(zmalloc_used_memory()-mem)/n, (double)(zmalloc_get_rss()-rss)/n);
+
+    // 随机读取已有的键
+    start = nstime();
+    for (long j = 0; j < ops; j++) {
+        setBenchKey(&key,random()%n);
+        sum += lookupKey(db,&key) != NULL;
+    }
+    report("GET (hit)",nstime()-start,ops);
+
+    // 随机读取不存在的键
+    start = nstime();
+    for (long j = 0; j < ops; j++) {
+        setBenchKey(&key,n+random()%n);
+        sum += lookupKey(db,&key) != NULL;
+    }
+    report("GET (miss)",nstime()-start,ops);
+
+    // 随机覆写已有的键
+    start = nstime();
+    for (long j = 0; j < ops; j++) {
+        long id = random()%n;
+        robj *val = benchValue(id);
+
+        setBenchKey(&key,id);
+        setKey(db,&key,val);
+        decrRefCount(val);
+    }
+    report("SET (overwrite)",nstime()-start,ops);
+
+    if (sum != ops) printf("  unexpected GET results: %lld hits\n", sum);
+    dictEmpty(db->DB);
+    dictEmpty(db->expires);
+    dictEmpty(db->watched_keys);
+    zfree(db->DB);
+    zfree(db->expires);
+    zfree(db->watched_keys);
+    zfree(db);
+    sdsfree(key.ptr);
+}
+
+int main(int argc, char **argv) {
+    initServer(&server);
+    server.verbosity = KVDATA_WARNING;
+    srandom(12345);
+
+    if (argc > 1) {
+        for (int j = 1; j < argc; j++) benchKeys(atol(argv[j]));
+    } else {
+        benchKeys(1000000);
+        benchKeys(10000000);
+    }
+    return 0;
+}
@@ -0,0 +1,374 @@
+/*
+ * 字典的测试程序
+ *
+ * 测试程序和除 main.c 之外的所有源文件链接在一起，在 KVdata_Master 目录下编译运行：
+ *
+ * gcc -I. $(ls *.c | grep -v '^main.c$') tests/dictTest.c -o /tmp/dictTest -lpthread && /tmp/dictTest
+ *
+ * 全部通过时返回 0 ，否则打印失败的检查并返回 1 。
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "server.h"
+#include "dict.h"
+#include "sds.h"
+#include "zmalloc.h"
+#include "slab.h"
+
+KVServer server;//全局服务器变量，被链接进来的源文件引用
+
+static int failed = 0;
+
+#define test_assert(cond) do { \
+        if (!(cond)) { \
+            printf("  FAILED %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+            failed++; \
+            return; \
+        } \
+    } while(0)
+
+static dictType testDictType = {
+    dictSdsHash,            /* hash function */
+    dictSdsKeyCompare,      /* key compare */
+    dictSdsDestructor,      /* key destructor */
+    NULL,                   /* val destructor */
+    NULL                    /* entry destructor */
+};
+
+static sds testKey(long j) {
+    return sdscatprintf(sdsnewlen("",0),"key:%ld",j);
+}
+
+/*
+ * rehash 进行中 1 号哈希表必须能容纳两个哈希表中的所有节点
+ */
+static int rehashTargetFits(dict *d) {
+    if (!dictIsRehashing(d)) return 1;
+    return (d->ht[0].used+d->ht[1].used+d->ht[1].deleted)*DICT_MAX_LOAD_DEN <=
+           d->ht[1].size*DICT_MAX_LOAD_NUM;
+}
+
+/*
+ * 缩小之后 0 号哈希表很大而且很稀疏，rehash 没有推进时继续插入，
+ * 1 号哈希表需要随之扩展，不能一次性把 0 号哈希表迁移到放不下的 1 号哈希表中
+ */
+static void testShrinkThenInsert(void) {
+    dict *d = dictCreate(&testDictType);
+    long n = 1000000, keep = 100, added = 20000;
+
+    for (long j = 0; j < n; j++) test_assert(dictAdd(d,testKey(j),NULL) == DICT_OK);
+    // 完成插入过程中的 rehash
+    while (dictRehash(d,100));
+    for (long j = keep; j < n; j++) {
+        sds key = testKey(j);
+        test_assert(dictDelete(d,key) == DICT_OK);
+        sdsfree(key);
+    }
+    test_assert(dictSize(d) == (unsigned long)keep);
+    test_assert(dictNeedsShrink(d));
+    test_assert(dictResize(d) == DICT_OK);
+    test_assert(dictIsRehashing(d) && d->ht[1].size < d->ht[0].size);
+
+    // 只通过插入推进 rehash ，相当于 RDB 子进程存在时后台任务不做 rehash
+    for (long j = n; j < n+added; j++) {
+        test_assert(dictAdd(d,testKey(j),NULL) == DICT_OK);
+        test_assert(rehashTargetFits(d));
+    }
+    test_assert(dictSize(d) == (unsigned long)(keep+added));
+    for (long j = 0; j < n+added; j++) {
+        sds key = testKey(j);
+        int expected = j < keep || j >= n;
+        test_assert((dictFind(d,key) != NULL) == expected);
+        sdsfree(key);
+    }
+    dictEmpty(d);
+    zfree(d);
+}
+
+/* ---------------------------- 随机操作和参照集合 ---------------------------- */
+
+#define REF_KEYS (1<<16)   //随机操作使用的键的范围
+
+static unsigned char ref_present[REF_KEYS];
+static long ref_val[REF_KEYS];
+static unsigned long ref_size;
+
+/*
+ * 检查两个哈希表的结构：控制字节和 used/deleted 计数一致，满槽位的缓存哈希值正确
+ */
+static int checkTables(dict *d) {
+    for (int table = 0; table <= 1; table++) {
+        dictht *ht = &d->ht[table];
+        unsigned long used = 0, deleted = 0;
+
+        if (table == 1 && !dictIsRehashing(d)) return ht->table == NULL && ht->used == 0;
+        for (unsigned long j = 0; j < ht->size; j++) {
+            if (ht->ctrl[j] == DICT_CTRL_DELETED) {
+                deleted++;
+            } else if (!(ht->ctrl[j] & 0x80)) {
+                uint64_t h = dictHashKey(d,ht->table[j]->key);
+
+                if (ht->ctrl[j] != (h & 0x7f) || ht->hashes[j] != (uint32_t)(h >> 7)) return 0;
+                used++;
+            } else if (ht->ctrl[j] != DICT_CTRL_EMPTY) {
+                return 0;
+            }
+        }
+        if (used != ht->used || deleted != ht->deleted) return 0;
+    }
+    return 1;
+}
+
+/*
+ * 键的编号，键的格式为 key:<编号>
+ */
+static long keyId(dictEntry *de) {
+    return strtol((char*)de->key+4,NULL,10);
+}
+
+/*
+ * 用迭代器、随机抽样和查找三种方式，检查字典的内容和参照集合完全一致
+ */
+static int checkContents(dict *d) {
+    static unsigned char seen[REF_KEYS];
+    dictEntry *des[32];
+    dictIterator *di;
+    dictEntry *de;
+    unsigned long count = 0;
+    unsigned int n;
+
+    if (dictSize(d) != ref_size) return 0;
+
+    // 迭代器访问每个节点恰好一次
+    memset(seen,0,sizeof(seen));
+    di = dictGetIterator(d);
+    while ((de = dictNext(di)) != NULL) {
+        long id = keyId(de);
+
+        if (!ref_present[id] || seen[id] || (long)de->val != ref_val[id]) {
+            dictReleaseIterator(di);
+            return 0;
+        }
+        seen[id] = 1;
+        count++;
+    }
+    dictReleaseIterator(di);
+    if (count != ref_size) return 0;
+
+    // 抽样返回的节点互不相同，并且都在字典中
+    // 哈希表很稀疏时抽样可能一个节点都取不到，这是允许的
+    n = dictGetSomeKeys(d,des,32);
+    if (n > 32) return 0;
+    memset(seen,0,sizeof(seen));
+    for (unsigned int j = 0; j < n; j++) {
+        long id = keyId(des[j]);
+
+        if (!ref_present[id] || seen[id]) return 0;
+        seen[id] = 1;
+    }
+    return 1;
+}
+
+/*
+ * 模拟主动碎片整理，把每个节点移动到新分配的节点中
+ */
+static dictEntry *testDefragEntry(void *privdata, dictEntry *de) {
+    dictEntry *newde = slabAlloc(KVDATA_SLAB_DICTENTRY);
+
+    (*(long*)privdata)++;
+    *newde = *de;
+    // 释放前弄乱旧节点，之后还在使用旧节点时查找会失败
+    memset(de,0xaa,sizeof(*de));
+    slabFree(KVDATA_SLAB_DICTENTRY,de);
+    return newde;
+}
+
+/*
+ * 对字典执行一次随机操作，并和参照集合比较结果
+ * grow 为真时偏向插入，否则偏向删除，让字典反复扩展和缩小
+ */
+static int randomOperation(dict *d, int grow) {
+    long id = random() % REF_KEYS;
+    // 缩小阶段字典中的键很少，从随机位置开始找一个存在的键，否则删除很难命中
+    if (!grow && ref_size && random() % 2)
+        while (!ref_present[id]) id = (id+1) % REF_KEYS;
+    long val = random();
+    int r = random() % 100;
+    sds key = testKey(id);
+
+    if (r < 40) {
+        // 插入或者删除，按照当前阶段的方向
+        if (grow) {
+            int ret = dictAdd(d,key,(void*)val);
+
+            if ((ret == DICT_OK) != !ref_present[id]) return 0;
+            if (ret == DICT_OK) {
+                ref_present[id] = 1;
+                ref_val[id] = val;
+                ref_size++;
+                return 1;
+            }
+        } else {
+            if ((dictDelete(d,key) == DICT_OK) != ref_present[id]) return 0;
+            if (ref_present[id]) {
+                ref_present[id] = 0;
+                ref_size--;
+            }
+        }
+    } else if (r < 55) {
+        // 添加或者覆写
+        int ret = dictReplace(d,key,(void*)val);
+
+        if (ret != !ref_present[id]) return 0;
+        if (!ref_present[id]) ref_size++;
+        ref_present[id] = 1;
+        ref_val[id] = val;
+        if (ret == 1) return 1;
+    } else if (r < 65) {
+        // 和当前阶段相反的操作，在同一个组中留下墓碑之后再插入
+        if ((dictDelete(d,key) == DICT_OK) != ref_present[id]) return 0;
+        if (ref_present[id]) {
+            ref_present[id] = 0;
+            ref_size--;
+        }
+    } else {
+        dictEntry *de = dictFind(d,key);
+
+        if ((de != NULL) != ref_present[id]) return 0;
+        if (de && (long)de->val != ref_val[id]) return 0;
+    }
+    sdsfree(key);
+    return 1;
+}
+
+/*
+ * 随机插入、覆写、删除和查找，和参照集合比较，
+ * 期间不定期推进 rehash 、缩小哈希表（模拟后台任务）和整理节点，
+ * 字典会在 rehash 进行中反复扩展和缩小
+ */
+static void testRandomOperations(void) {
+    dict *d = dictCreate(&testDictType);
+    long ops = 0, moved = 0, shrinks = 0, target_grows = 0;
+    unsigned long defrag_cursor = 0;
+
+    memset(ref_present,0,sizeof(ref_present));
+    ref_size = 0;
+    for (int phase = 0; phase < 24; phase++) {
+        int grow = phase % 2 == 0;
+        // 一半的删除阶段中后台任务不缩小哈希表，0 号哈希表保持很大很稀疏，
+        // 下一个插入阶段开始时才缩小，之后的插入需要扩展 1 号哈希表
+        int cron_shrink = phase % 4 != 1;
+        // 每个阶段的目标大小，缩小阶段有时会删到很少的节点
+        unsigned long target = grow ? 1000 + random() % (REF_KEYS/2) : random() % 200;
+
+        // 插入阶段之前缩小哈希表，之后的插入在缩小的 rehash 进行中到达
+        if (grow && dictNeedsShrink(d)) {
+            test_assert(dictResize(d) == DICT_OK);
+            shrinks++;
+        }
+
+        while (grow ? ref_size < target : ref_size > target) {
+            unsigned long target_size = dictIsRehashing(d) ? d->ht[1].size : 0;
+
+            test_assert(randomOperation(d,grow));
+            // rehash 进行中 1 号哈希表被换成了更大的哈希表
+            if (target_size && dictIsRehashing(d) && d->ht[1].size > target_size) target_grows++;
+            ops++;
+            test_assert(rehashTargetFits(d));
+
+            switch (random() % 200) {
+            case 0:
+                // 后台任务推进 rehash
+                dictRehash(d,1+random()%4);
+                break;
+            case 1:
+                // 后台任务缩小哈希表
+                if (cron_shrink && dictNeedsShrink(d)) {
+                    test_assert(dictResize(d) == DICT_OK);
+                    shrinks++;
+                }
+                break;
+            case 2:
+                // 主动碎片整理，rehash 进行中时不做任何事情
+                defrag_cursor = dictDefragGroups(d,defrag_cursor,4,testDefragEntry,&moved);
+                break;
+            }
+            if (ops % 5000 == 0) {
+                test_assert(checkTables(d));
+                test_assert(checkContents(d));
+            }
+        }
+        test_assert(checkTables(d));
+        test_assert(checkContents(d));
+        for (long id = 0; id < REF_KEYS; id++) {
+            sds key = testKey(id);
+            dictEntry *de = dictFind(d,key);
+
+            sdsfree(key);
+            test_assert((de != NULL) == ref_present[id]);
+            test_assert(de == NULL || (long)de->val == ref_val[id]);
+        }
+    }
+    printf("  %ld operations, %ld shrinks, %ld rehash target grows, %ld entries moved\n",
+        ops, shrinks, target_grows, moved);
+    test_assert(shrinks > 0 && target_grows > 0 && moved > 0);
+    dictEmpty(d);
+    test_assert(dictSize(d) == 0 && !dictIsRehashing(d));
+    zfree(d);
+}
+
+/*
+ * 数据库节点被整理移动之后，dictReplaceEntry 只按指针修正槽位，rehash 进行中两个哈希表都要查找
+ */
+static void testReplaceEntryDuringRehash(void) {
+    dict *d = dictCreate(&testDictType);
+    long n = 5000;
+
+    for (long j = 0; j < n; j++) test_assert(dictAdd(d,testKey(j),(void*)j) == DICT_OK);
+    // 再插入一个节点时开始扩展，只推进一部分 rehash
+    while (!dictIsRehashing(d)) {
+        test_assert(dictAdd(d,testKey(n),(void*)n) == DICT_OK);
+        n++;
+    }
+    test_assert(dictIsRehashing(d));
+    for (long j = 0; j < n; j++) {
+        sds key = testKey(j);
+        dictEntry *de = dictFind(d,key), *newde;
+
+        sdsfree(key);
+        test_assert(de != NULL);
+        newde = slabAlloc(KVDATA_SLAB_DICTENTRY);
+        *newde = *de;
+        test_assert(dictReplaceEntry(d,de,newde) == DICT_OK);
+        slabFree(KVDATA_SLAB_DICTENTRY,de);
+        test_assert(dictReplaceEntry(d,de,newde) == DICT_ERR);
+    }
+    test_assert(checkTables(d));
+    for (long j = 0; j < n; j++) {
+        sds key = testKey(j);
+        dictEntry *de = dictFind(d,key);
+
+        sdsfree(key);
+        test_assert(de != NULL && (long)de->val == j);
+    }
+    dictEmpty(d);
+    zfree(d);
+}
+
+#define RUN_TEST(fn) do { \
+        int before = failed; \
+        fn(); \
+        printf("[%s] %s\n", failed == before ? "ok" : "FAIL", #fn); \
+    } while(0)
+
+int main(void) {
+    // 回归的表现可能是死循环，超时后由 SIGALRM 终止
+    alarm(120);
+    srandom(12345);
+    RUN_TEST(testShrinkThenInsert);
+    RUN_TEST(testRandomOperations);
+    RUN_TEST(testReplaceEntryDuringRehash);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,204 @@
+/*
+ * 近似 LRU 淘汰的命中率测试程序
+ *
+ * 按照 Zipf 分布生成访问序列，像 GET 之后未命中再 SET 的缓存一样回放：
+ * 键存在时通过 lookupKey 访问并更新访问时间，不存在时通过 dbAdd 写入，再调用 freeMemoryIfNeeded 淘汰。
+ * 同一个序列也交给精确的 LRU （链表加数组）回放，比较两者的命中率。
+ *
+ * 为了让两者的容量完全相同，测试通过链接器的 --wrap 选项替换内存统计：
+ * 每个键固定占用 1 字节， maxmemory 就是最多保存的键数量。
+ * 每次访问让 LRU 时钟前进 tick 个精度单位（默认 1），tick 为 0 时所有访问的时间相同。
+ *
+ * 测试程序和除 main.c 之外的所有源文件链接在一起，在 KVdata_Master 目录下编译运行：
+ *
+ * gcc -O2 -I. $(ls *.c | grep -v '^main.c$') tests/evictTest.c -o /tmp/evictTest -lpthread -lm \
+ *     -Wl,--wrap=zmalloc_used_memory,--wrap=slabFreeMemory && /tmp/evictTest [键数量] [访问次数] [zipf 指数] [tick]
+ *
+ * 默认抽样数量下的命中率和精确 LRU 相差不超过 EVICT_TEST_TOLERANCE 时返回 0 ，否则返回 1 。
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "server.h"
+#include "db.h"
+#include "evict.h"
+#include "object.h"
+#include "clock.h"
+#include "sds.h"
+#include "zmalloc.h"
+
+#define EVICT_TEST_TOLERANCE 0.02   //默认抽样数量下允许的命中率差距
+
+KVServer server;//全局服务器变量，被链接进来的源文件引用
+
+static int failed = 0;
+
+/* 内存统计：每个键占用 1 字节，对象池中没有空闲的对象 */
+size_t __wrap_zmalloc_used_memory(void) {
+    return dictSize(server.db[0].DB);
+}
+
+size_t __wrap_slabFreeMemory(void) {
+    return 0;
+}
+
+/* 访问序列 */
+static long nkeys, naccesses;
+static int *trace;
+
+/*
+ * 生成指数为 s 的 Zipf 分布访问序列，排名为 r 的键被访问的概率正比于 1/r^s
+ * 排名打乱之后再作为键的编号，热门的键不会集中在一起
+ */
+static void generateTrace(double s) {
+    double *cdf = zmalloc(sizeof(double)*nkeys), sum = 0;
+    int *perm = zmalloc(sizeof(int)*nkeys);
+
+    for (long j = 0; j < nkeys; j++) {
+        sum += 1.0/pow(j+1,s);
+        cdf[j] = sum;
+        perm[j] = j;
+    }
+    for (long j = nkeys-1; j > 0; j--) {
+        long k = random() % (j+1);
+        int tmp = perm[j];
+        perm[j] = perm[k];
+        perm[k] = tmp;
+    }
+
+    trace = zmalloc(sizeof(int)*naccesses);
+    for (long j = 0; j < naccesses; j++) {
+        double r = (double)random()/RAND_MAX*sum;
+        long lo = 0, hi = nkeys-1;
+
+        while (lo < hi) {
+            long mid = (lo+hi)/2;
+            if (cdf[mid] < r) lo = mid+1; else hi = mid;
+        }
+        trace[j] = perm[lo];
+    }
+    zfree(cdf);
+    zfree(perm);
+}
+
+/*
+ * 精确的 LRU ：双向链表按照访问时间排列，表头最近被访问，表尾最先被淘汰
+ * 前 warmup 次访问不计入命中率
+ */
+static double exactLRUHitRatio(long capacity, long warmup) {
+    int *prev = zmalloc(sizeof(int)*nkeys), *next = zmalloc(sizeof(int)*nkeys);
+    char *present = zmalloc(nkeys);
+    int head = -1, tail = -1;
+    long size = 0, hits = 0;
+
+    memset(present,0,nkeys);
+    for (long j = 0; j < naccesses; j++) {
+        int k = trace[j];
+
+        if (present[k]) {
+            if (j >= warmup) hits++;
+            if (k == head) continue;
+            // 从链表中取下
+            next[prev[k]] = next[k];
+            if (next[k] != -1) prev[next[k]] = prev[k]; else tail = prev[k];
+        } else {
+            present[k] = 1;
+            size++;
+        }
+        // 放到表头
+        prev[k] = -1;
+        next[k] = head;
+        if (head != -1) prev[head] = k;
+        head = k;
+        if (tail == -1) tail = k;
+
+        // 淘汰表尾
+        if (size > capacity) {
+            int victim = tail;
+
+            tail = prev[victim];
+            next[tail] = -1;
+            present[victim] = 0;
+            size--;
+        }
+    }
+    zfree(prev);
+    zfree(next);
+    zfree(present);
+    return (double)hits/(naccesses-warmup);
+}
+
+/*
+ * 通过 lookupKey 、 dbAdd 和 freeMemoryIfNeeded 回放访问序列
+ */
+static double sampledLRUHitRatio(long capacity, int samples, int tick, long warmup) {
+    KVdataDb *db = &server.db[0];
+    long hits = 0;
+    char buf[32];
+
+    server.maxmemory = capacity;
+    server.maxmemory_policy = KVDATA_MAXMEMORY_ALLKEYS_LRU;
+    server.maxmemory_samples = samples;
+    // 从第 1 秒开始，保证 LRU 时钟不会回绕
+    cachedClock.unix_us = 1000000;
+
+    for (long j = 0; j < naccesses; j++) {
+        int len = snprintf(buf,sizeof(buf),"key:%d",trace[j]);
+        robj key = {.encoding = STRING, .refcount = 1, .ptr = sdsnewlen(buf,len)};
+
+        cachedClock.unix_us += (long long)tick*KVDATA_LRU_CLOCK_RESOLUTION*1000;
+        if (lookupKey(db,&key)) {
+            if (j >= warmup) hits++;
+        } else {
+            dbAdd(db,&key,createStringObject("value",5));
+            freeMemoryIfNeeded(server.db);
+        }
+        sdsfree(key.ptr);
+    }
+    dictEmpty(db->DB);
+    return (double)hits/(naccesses-warmup);
+}
+
+int main(int argc, char **argv) {
+    static const double capacities[] = {0.01, 0.05, 0.1, 0.25};
+    static const int samples[] = {3, 5, 10};
+    double s;
+    int tick;
+
+    nkeys = argc > 1 ? atol(argv[1]) : 100000;
+    naccesses = argc > 2 ? atol(argv[2]) : 1000000;
+    s = argc > 3 ? atof(argv[3]) : 0.99;
+    tick = argc > 4 ? atoi(argv[4]) : 1;
+
+    initServer(&server);
+    server.verbosity = KVDATA_WARNING;
+    srandom(12345);
+    generateTrace(s);
+    printf("%ld keys, %ld accesses, zipf %.2f, %d LRU ticks per access\n", nkeys, naccesses, s, tick);
+    printf("%-10s %-10s", "capacity", "exact");
+    for (unsigned int k = 0; k < sizeof(samples)/sizeof(samples[0]); k++)
+        printf(" samples=%-3d", samples[k]);
+    printf("\n");
+
+    for (unsigned int j = 0; j < sizeof(capacities)/sizeof(capacities[0]); j++) {
+        long capacity = nkeys*capacities[j];
+        // 先填满缓存，之后再统计命中率
+        long warmup = naccesses/10;
+        double exact = exactLRUHitRatio(capacity,warmup);
+
+        printf("%-10ld %-10.4f", capacity, exact);
+        for (unsigned int k = 0; k < sizeof(samples)/sizeof(samples[0]); k++) {
+            double ratio = sampledLRUHitRatio(capacity,samples[k],tick,warmup);
+
+            printf(" %-11.4f", ratio);
+            if (samples[k] == KVDATA_DEFAULT_MAXMEMORY_SAMPLES && exact-ratio > EVICT_TEST_TOLERANCE) failed++;
+        }
+        printf("\n");
+    }
+
+    printf("[%s] sampled LRU with %d samples is within %.2f of exact LRU\n",
+        failed ? "FAIL" : "ok", KVDATA_DEFAULT_MAXMEMORY_SAMPLES, EVICT_TEST_TOLERANCE);
+    zfree(trace);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,170 @@
+/*
+ * 带过期时间的键的 GET 延迟基准测试程序
+ *
+ * 在一个新的数据库中写入 N 个键（默认 100 万个），其中一部分设置过期时间，
+ * 测量随机 GET （lookupKey）的吞吐量和延迟分布：
+ * (1) 没有键、一半的键、全部的键设置了（未到达的）过期时间时，当前的 lookupKey ，
+ *     以及按照原来的做法先查找过期字典、再两次查找数据库字典的路径；
+ * (2) 全部的键都有过期时间，其中 10% 已经过期，GET 会惰性删除过期键，
+ *     同时每 10000 次 GET 执行一次定期删除（activeExpireCycle），单独统计它的耗时。
+ *
+ * 单次查找只需要几十纳秒，计时本身的开销不可忽略，
+ * 所以延迟按照每 BENCH_BATCH 次 GET 的平均值统计分布。
+ *
+ * 测试程序和除 main.c 之外的所有源文件链接在一起，在 KVdata_Master 目录下编译运行：
+ *
+ * gcc -O2 -I. $(ls *.c | grep -v '^main.c$') tests/expireBench.c -o /tmp/expireBench -lpthread && /tmp/expireBench [键数量]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "server.h"
+#include "db.h"
+#include "object.h"
+#include "clock.h"
+#include "sds.h"
+#include "zmalloc.h"
+
+#define BENCH_OPS 5000000           //每项测试执行的 GET 数量
+#define BENCH_BATCH 100             //每次计时的 GET 数量
+#define BENCH_CYCLE_EVERY 10000     //有过期键时，每执行这么多次 GET 执行一次定期删除
+
+KVServer server;//全局服务器变量，被链接进来的源文件引用
+
+static long long sum = 0;
+
+static long long nstime(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (long long)ts.tv_sec*1000000000+ts.tv_nsec;
+}
+
+static int cmpLongLong(const void *a, const void *b) {
+    long long x = *(const long long*)a, y = *(const long long*)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * 把编号为 id 的键写入 key 中，复用 key 的空间，不分配内存
+ */
+static void setBenchKey(robj *key, long id) {
+    char buf[32];
+    int len = snprintf(buf,sizeof(buf),"key:%ld",id);
+
+    key->ptr = sdscpylen(key->ptr,buf,len);
+}
+
+/*
+ * 原来的读取路径：先查找过期字典判断是否过期，
+ * 再查找一次数据库字典确认键存在，最后查找一次数据库字典取出值
+ */
+static robj *previousLookupKey(KVdataDb *db, robj *key) {
+    dictEntry *de = dictFind(db->expires,key->ptr);
+
+    if (de && commandTimeMs() > (long long)de->expire) return NULL;
+    if (dictFind(db->DB,key->ptr) == NULL) return NULL;
+    de = dictFind(db->DB,key->ptr);
+    return de ? dictGetVal(de) : NULL;
+}
+
+/*
+ * 清空数据库，写入 n 个键，每 ttl_every 个键中有一个设置过期时间（0 表示没有），
+ * 每 expired_every 个键中有一个的过期时间已经过去（0 表示没有）
+ */
+static void fillDb(KVdataDb *db, long n, int ttl_every, int expired_every) {
+    robj key = {.encoding = STRING, .refcount = 1, .ptr = sdsnewlen("",0)};
+    long long now = clockUnixMs();
+
+    dictEmpty(db->expires);
+    dictEmpty(db->DB);
+    for (long j = 0; j < n; j++) {
+        robj *val = createStringObject("value:0123456789",16);
+
+        setBenchKey(&key,j);
+        setKey(db,&key,val);
+        decrRefCount(val);
+        if (ttl_every && j % ttl_every == 0)
+            setExpire(db,&key,(expired_every && j % expired_every == 0) ? now-1000 : now+3600000);
+    }
+    while (dictRehash(db->DB,1000)) {}
+    while (dictRehash(db->expires,1000)) {}
+    sdsfree(key.ptr);
+}
+
+/*
+ * 执行 BENCH_OPS 次随机 GET ，输出吞吐量和每次 GET 的平均延迟的分布，
+ * cycle 不为 0 时穿插执行定期删除
+ */
+static void benchGet(const char *name, KVdataDb *db, long n, int previous, int cycle) {
+    robj key = {.encoding = STRING, .refcount = 1, .ptr = sdsnewlen("",0)};
+    long batches = BENCH_OPS/BENCH_BATCH;
+    long long *lat = zmalloc(sizeof(long long)*batches);
+    long long total = 0, cycle_ns = 0, cycles = 0, start;
+    size_t before = dictSize(db->DB);
+
+    for (long b = 0; b < batches; b++) {
+        start = nstime();
+        for (int j = 0; j < BENCH_BATCH; j++) {
+            setBenchKey(&key,random()%n);
+            sum += (previous ? previousLookupKey(db,&key) : lookupKey(db,&key)) != NULL;
+        }
+        lat[b] = nstime()-start;
+        total += lat[b];
+
+        if (cycle && (b+1) % (BENCH_CYCLE_EVERY/BENCH_BATCH) == 0) {
+            start = nstime();
+            activeExpireCycle(db,KVDATA_ACTIVE_EXPIRE_CYCLE_SLOW);
+            cycle_ns += nstime()-start;
+            cycles++;
+        }
+    }
+    qsort(lat,batches,sizeof(long long),cmpLongLong);
+    printf("  %-32s %10.0f ops/sec   avg %6.1f  p50 %6.1f  p99 %6.1f  p99.9 %6.1f ns\n",
+        name, BENCH_OPS*1e9/total, (double)total/BENCH_OPS,
+        (double)lat[batches/2]/BENCH_BATCH, (double)lat[batches*99/100]/BENCH_BATCH,
+        (double)lat[batches*999/1000]/BENCH_BATCH);
+    if (cycle) {
+        printf("  %-32s %10lld keys removed, %lld cycles, avg %.1f us per cycle\n",
+            "", (long long)(before-dictSize(db->DB)), cycles, cycles ? cycle_ns/1000.0/cycles : 0);
+    }
+    zfree(lat);
+    sdsfree(key.ptr);
+}
+
+int main(int argc, char **argv) {
+    long n = argc > 1 ? atol(argv[1]) : 1000000;
+    KVdataDb *db;
+    static const struct {
+        const char *name;
+        int ttl_every;
+    } mixes[] = {
+        {"no keys with TTL", 0},
+        {"half of the keys with TTL", 2},
+        {"all keys with TTL", 1}
+    };
+
+    initServer(&server);
+    server.verbosity = KVDATA_WARNING;
+    updateCachedClock();
+    db = createDatabases(1);
+    srandom(12345);
+    printf("%ld keys, %d GETs per test, latency averaged over %d GETs\n", n, BENCH_OPS, BENCH_BATCH);
+
+    for (unsigned int j = 0; j < sizeof(mixes)/sizeof(mixes[0]); j++) {
+        printf("%s\n", mixes[j].name);
+        fillDb(db,n,mixes[j].ttl_every,0);
+        benchGet("lookupKey",db,n,0,0);
+        benchGet("previous (expires + 2x keyspace)",db,n,1,0);
+    }
+
+    printf("all keys with TTL, 10%% already expired\n");
+    fillDb(db,n,1,10);
+    benchGet("lookupKey + activeExpireCycle",db,n,0,1);
+
+    dictEmpty(db->expires);
+    dictEmpty(db->DB);
+    // 防止编译器把查找优化掉
+    return sum == -1;
+}
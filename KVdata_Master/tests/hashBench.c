@@ -0,0 +1,173 @@
+/*
+ * 字典哈希函数的基准测试程序
+ *
+ * 生成三组长度不同的键：短键 "key:<编号>" （约 10 字节）、中等长度的会话键（约 40 字节）
+ * 和类似 URL 的长键（约 100 到 200 字节），分别测量：
+ * 当前的 dictGenHashFunction （wyhash）和原来的 MurmurHash2 的吞吐量，
+ * 以及当前的 dictGenCaseHashFunction 和原来逐字节计算的 djb 大小写无关哈希的吞吐量。
+ * 同时把哈希值的低位映射到 2^16 个桶中，输出最大的桶和理想均匀分布的比值，检查低位的分布。
+ *
+ * 测试程序和除 main.c 之外的所有源文件链接在一起，在 KVdata_Master 目录下编译运行：
+ *
+ * gcc -O2 -I. $(ls *.c | grep -v '^main.c$') tests/hashBench.c -o /tmp/hashBench -lpthread && /tmp/hashBench [每组键数量]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include "server.h"
+#include "dict.h"
+#include "sds.h"
+#include "zmalloc.h"
+
+#define BENCH_ROUNDS 20             //每组键重复计算的轮数
+#define BENCH_BUCKETS (1<<16)       //检查分布时使用的桶数量
+
+KVServer server;//全局服务器变量，被链接进来的源文件引用
+
+static uint64_t sum = 0;
+
+static long long nstime(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (long long)ts.tv_sec*1000000000+ts.tv_nsec;
+}
+
+/* 原来的 MurmurHash2 ，种子固定为 5381 */
+static uint32_t murmurHash2(const void *key, size_t len) {
+    const uint32_t m = 0x5bd1e995;
+    const int r = 24;
+    uint32_t h = 5381 ^ (uint32_t)len;
+    const unsigned char *data = (const unsigned char *)key;
+
+    while (len >= 4) {
+        uint32_t k;
+
+        memcpy(&k,data,4);
+        k *= m;
+        k ^= k >> r;
+        k *= m;
+        h *= m;
+        h ^= k;
+        data += 4;
+        len -= 4;
+    }
+    switch (len) {
+    case 3: h ^= data[2] << 16; /* fall through */
+    case 2: h ^= data[1] << 8;  /* fall through */
+    case 1: h ^= data[0]; h *= m;
+    }
+    h ^= h >> 13;
+    h *= m;
+    h ^= h >> 15;
+    return h;
+}
+
+/* 原来的大小写无关哈希： hash * 33 + c */
+static uint32_t djbCaseHash(const void *key, size_t len) {
+    const unsigned char *buf = key;
+    uint32_t hash = 5381;
+
+    while (len--) hash = ((hash << 5) + hash) + (tolower(*buf++));
+    return hash;
+}
+
+static uint64_t wyHash(const void *key, size_t len) {
+    return dictGenHashFunction(key,len);
+}
+
+static uint64_t wyCaseHash(const void *key, size_t len) {
+    return dictGenCaseHashFunction(key,len);
+}
+
+static uint64_t murmurHash(const void *key, size_t len) {
+    return murmurHash2(key,len);
+}
+
+static uint64_t djbHash(const void *key, size_t len) {
+    return djbCaseHash(key,len);
+}
+
+typedef struct hashFunc {
+    const char *name;
+    uint64_t (*hash)(const void *key, size_t len);
+} hashFunc;
+
+/*
+ * 生成第 id 个键，kind 为 0 、 1 、 2 时分别是短键、中等长度的键和长键
+ */
+static sds benchKey(int kind, long id) {
+    switch (kind) {
+    case 0:
+        return sdscatprintf(sdsnewlen("",0),"key:%ld",id);
+    case 1:
+        return sdscatprintf(sdsnewlen("",0),"session:%08lx-%04lx-%04lx:user:%ld",
+            random(),random()&0xffff,random()&0xffff,id);
+    default: {
+        sds s = sdscatprintf(sdsnewlen("",0),"https://www.example.com/api/v2/users/%ld/orders?page=%ld&sort=Created_At",
+            id,random()%100);
+        long extra = random()%100;
+
+        // 路径后面再加上 0 到 99 字节的查询参数
+        for (long j = 0; j < extra; j++) s = sdscatlen(s,&"&Filter=x"[j%9],1);
+        return s;
+    }
+    }
+}
+
+static void benchKind(const char *name, int kind, long n) {
+    static const hashFunc funcs[] = {
+        {"dictGenHashFunction (wyhash)", wyHash},
+        {"MurmurHash2 (previous)", murmurHash},
+        {"dictGenCaseHashFunction", wyCaseHash},
+        {"djb case hash (previous)", djbHash}
+    };
+    sds *keys = zmalloc(sizeof(sds)*n);
+    unsigned int *buckets = zmalloc(sizeof(unsigned int)*BENCH_BUCKETS);
+    size_t bytes = 0;
+
+    for (long j = 0; j < n; j++) {
+        keys[j] = benchKey(kind,j);
+        bytes += sdslen(keys[j]);
+    }
+    printf("%s keys: %ld keys, average %.1f bytes\n", name, n, (double)bytes/n);
+
+    for (unsigned int f = 0; f < sizeof(funcs)/sizeof(funcs[0]); f++) {
+        long long start, ns;
+        unsigned int max = 0;
+
+        start = nstime();
+        for (int r = 0; r < BENCH_ROUNDS; r++)
+            for (long j = 0; j < n; j++) sum += funcs[f].hash(keys[j],sdslen(keys[j]));
+        ns = nstime()-start;
+
+        memset(buckets,0,sizeof(unsigned int)*BENCH_BUCKETS);
+        for (long j = 0; j < n; j++) {
+            unsigned int b = funcs[f].hash(keys[j],sdslen(keys[j])) & (BENCH_BUCKETS-1);
+            if (++buckets[b] > max) max = buckets[b];
+        }
+        printf("  %-30s %8.1f ns/key %8.2f GB/s   max bucket %.2fx of uniform\n",
+            funcs[f].name, (double)ns/(n*BENCH_ROUNDS), (double)bytes*BENCH_ROUNDS/ns,
+            max/((double)n/BENCH_BUCKETS));
+    }
+
+    for (long j = 0; j < n; j++) sdsfree(keys[j]);
+    zfree(keys);
+    zfree(buckets);
+}
+
+int main(int argc, char **argv) {
+    long n = argc > 1 ? atol(argv[1]) : 1000000;
+
+    server.verbosity = KVDATA_WARNING;
+    dictSetHashFunctionSeed(0x9e3779b97f4a7c15ULL);
+    srandom(12345);
+
+    benchKind("short",0,n);
+    benchKind("medium",1,n);
+    benchKind("long",2,n);
+    // 防止编译器把哈希计算优化掉
+    return sum == 1;
+}
@@ -0,0 +1,125 @@
+/*
+ * 每个键占用内存的基准测试程序
+ *
+ * 对每种键长度（8 到 128 字节）和值（共享整数、整数、不同长度的字符串）的组合，
+ * 在一个新的数据库中像 SET 一样写入 N 个键（默认 20 万个），输出：
+ * 每个键增加的内存（used_memory 减去对象池中空闲的部分）、数据库节点的实际分配大小（zmalloc_size）、值保存的位置，
+ * 以及扣除键和值本身的内容之后的额外开销。
+ * 开头列出各种 sds 头部的大小，和原来固定 8 字节的头部比较。
+ *
+ * 测试程序和除 main.c 之外的所有源文件链接在一起，在 KVdata_Master 目录下编译运行：
+ *
+ * gcc -O2 -I. $(ls *.c | grep -v '^main.c$') tests/keyMemoryBench.c -o /tmp/keyMemoryBench -lpthread && /tmp/keyMemoryBench [键数量]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "server.h"
+#include "db.h"
+#include "object.h"
+#include "slab.h"
+#include "sds.h"
+#include "zmalloc.h"
+
+#define BENCH_OLD_SDS_HEADER 8  //原来的 sds 头部：两个 int
+
+KVServer server;//全局服务器变量，被链接进来的源文件引用
+
+/*
+ * 把编号为 id 的键写入 key 中，长度固定为 keylen 字节
+ */
+static void setBenchKey(robj *key, int keylen, long id) {
+    char buf[256];
+    int len = snprintf(buf,sizeof(buf),"k%0*ld",keylen-1,id);
+
+    key->ptr = sdscpylen(key->ptr,buf,len);
+}
+
+/*
+ * 和 SET 命令一样创建值对象，vallen 为 -1 时是共享整数，为 0 时是不共享的整数
+ */
+static robj *benchValue(int vallen, long id) {
+    char buf[1024];
+
+    if (vallen == -1) return tryObjectEncoding(createStringObject("100",3));
+    if (vallen == 0) {
+        int len = snprintf(buf,sizeof(buf),"%ld",1000000000+id);
+        return tryObjectEncoding(createStringObject(buf,len));
+    }
+    memset(buf,'v',vallen);
+    return tryObjectEncoding(createStringObject(buf,vallen));
+}
+
+/*
+ * 正在使用的内存，不包括对象池中空闲的对象：前面的测试释放的对象留在池中，会被之后的测试复用
+ */
+static size_t usedMemory(void) {
+    return zmalloc_used_memory()-slabFreeMemory();
+}
+
+static void benchKeys(int keylen, int vallen, long n) {
+    KVdataDb *db = createDatabases(1);
+    robj key = {.encoding = STRING, .refcount = 1, .ptr = sdsnewlen("",0)};
+    size_t before = usedMemory();
+    double perkey;
+    dictEntry *de;
+    robj *val;
+    const char *where;
+    char label[16];
+    int payload;
+
+    for (long j = 0; j < n; j++) {
+        setBenchKey(&key,keylen,j);
+        val = benchValue(vallen,j);
+        setKey(db,&key,val);
+        decrRefCount(val);
+    }
+    while (dictRehash(db->DB,1000)) {}
+    perkey = (double)(usedMemory()-before)/n;
+
+    // 查看最后一个键的节点和值
+    de = dictFind(db->DB,key.ptr);
+    val = dictGetVal(de);
+    if (val->refcount == KVDATA_SHARED_REFCOUNT) where = "shared int";
+    else if (val->encoding == INT) where = "INT robj";
+    else if ((char*)val > (char*)de && (char*)val < (char*)de+zmalloc_size(de)) where = "in entry";
+    else if (val->encoding == EMBSTR) where = "EMBSTR robj";
+    else where = "robj + sds";
+    // 整数按照 8 字节计算内容
+    payload = keylen+(vallen > 0 ? vallen : 8);
+
+    if (vallen == -1) snprintf(label,sizeof(label),"int(sh)");
+    else if (vallen == 0) snprintf(label,sizeof(label),"int");
+    else snprintf(label,sizeof(label),"%d",vallen);
+
+    printf("%6d %8s %-12s %12.1f %10zu %10.1f\n", keylen, label, where,
+        perkey, zmalloc_size(de), perkey-payload);
+
+    dictEmpty(db->expires);
+    dictEmpty(db->DB);
+    dictEmpty(db->watched_keys);
+    zfree(db->DB);
+    zfree(db->expires);
+    zfree(db->watched_keys);
+    zfree(db);
+    sdsfree(key.ptr);
+}
+
+int main(int argc, char **argv) {
+    long n = argc > 1 ? atol(argv[1]) : 200000;
+    static const int keylens[] = {8, 16, 32, 64, 128};
+    static const int vallens[] = {-1, 0, 8, 40, 64, 65, 200, 1000};
+
+    initServer(&server);
+    server.verbosity = KVDATA_WARNING;
+
+    printf("sds header: sdshdr8 %zu, sdshdr16 %zu, sdshdr32 %zu, sdshdr64 %zu bytes (previously %d for every string)\n",
+        sizeof(struct sdshdr8), sizeof(struct sdshdr16), sizeof(struct sdshdr32), sizeof(struct sdshdr64),
+        BENCH_OLD_SDS_HEADER);
+    printf("%ld keys per row, integer values counted as 8 bytes of content\n", n);
+    printf("%6s %8s %-12s %12s %10s %10s\n", "key", "value", "value in", "bytes/key", "entry", "overhead");
+    for (unsigned int k = 0; k < sizeof(keylens)/sizeof(keylens[0]); k++)
+        for (unsigned int v = 0; v < sizeof(vallens)/sizeof(vallens[0]); v++)
+            benchKeys(keylens[k],vallens[v],n);
+    return 0;
+}
@@ -0,0 +1,123 @@
+/*
+ * 内存分配器的基准测试程序
+ *
+ * 按照接近实际的键值大小分布写入 N 个键（默认 200 万个）：
+ * 键为 10 到 40 字节，值 20% 是整数，50% 是 16 到 64 字节，25% 是 64 到 512 字节，5% 是 1KB 到 4KB 。
+ * 之后随机删除一半的键，调用 zmalloc_trim 归还空闲内存，再用更大的值重新写满，
+ * 每个阶段结束时输出 used_memory 、分配器的统计、 RSS 和碎片率，以及该阶段的耗时。
+ *
+ * 分别使用 glibc 和 jemalloc 编译，比较两个分配器，在 KVdata_Master 目录下编译运行：
+ *
+ * gcc -O2 -I. $(ls *.c | grep -v '^main.c$') tests/memoryBench.c -o /tmp/memoryBench -lpthread && /tmp/memoryBench [键数量]
+ * gcc -O2 -DUSE_JEMALLOC -I. $(ls *.c | grep -v '^main.c$') tests/memoryBench.c -o /tmp/memoryBench-je -lpthread -ljemalloc && /tmp/memoryBench-je [键数量]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "server.h"
+#include "db.h"
+#include "object.h"
+#include "sds.h"
+#include "zmalloc.h"
+
+KVServer server;//全局服务器变量，被链接进来的源文件引用
+
+static long long nstime(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (long long)ts.tv_sec*1000000000+ts.tv_nsec;
+}
+
+static void report(const char *phase, KVdataDb *db, long long ns) {
+    size_t used = zmalloc_used_memory(), rss = zmalloc_get_rss();
+    size_t allocated, active, resident;
+
+    zmalloc_get_allocator_info(&allocated,&active,&resident);
+    printf("%-22s %9lu %10.1f %10.1f %10.1f %10.1f %6.2f %6.2f %8.2f\n",
+        phase, dictSize(db->DB), used/1048576.0, allocated/1048576.0, active/1048576.0, rss/1048576.0,
+        allocated ? (double)active/allocated : 0, used ? (double)rss/used : 0, ns/1e9);
+}
+
+/*
+ * 把编号为 id 的键写入 key 中，长度为 10 到 40 字节
+ */
+static void setBenchKey(robj *key, long id) {
+    static const char pad[] = "abcdefghijklmnopqrstuvwxyz";
+    char buf[64];
+    int len = snprintf(buf,sizeof(buf),"user:%ld:%.*s",id,(int)(id*7%27),pad);
+
+    key->ptr = sdscpylen(key->ptr,buf,len);
+}
+
+/*
+ * 按照大小分布生成一个值，scale 为 2 时非整数的值加倍
+ */
+static robj *benchValue(int scale) {
+    static char buf[8192];
+    long r = random()%100, len;
+
+    if (r < 20) return createStringObjectFromLongLong(random()%1000000000);
+    if (r < 70) len = 16+random()%49;
+    else if (r < 95) len = 64+random()%449;
+    else len = 1024+random()%3073;
+    len *= scale;
+    memset(buf,'v',len);
+    return tryObjectEncoding(createStringObject(buf,len));
+}
+
+static void fill(KVdataDb *db, robj *key, long n, int scale) {
+    for (long j = 0; j < n; j++) {
+        robj *val;
+
+        setBenchKey(key,j);
+        if (dictFind(db->DB,key->ptr)) continue;
+        val = benchValue(scale);
+        setKey(db,key,val);
+        decrRefCount(val);
+    }
+}
+
+int main(int argc, char **argv) {
+    long n = argc > 1 ? atol(argv[1]) : 2000000;
+    robj key = {.encoding = STRING, .refcount = 1, .ptr = sdsnewlen("",0)};
+    KVdataDb *db;
+    long long start;
+
+    initServer(&server);
+    server.verbosity = KVDATA_WARNING;
+    db = createDatabases(1);
+    srandom(12345);
+
+    printf("allocator %s, %ld keys (sizes in MB, times in seconds)\n", ZMALLOC_LIB, n);
+    printf("%-22s %9s %10s %10s %10s %10s %6s %6s %8s\n",
+        "phase", "keys", "used", "allocated", "active", "rss", "frag", "rss/u", "time");
+    report("start",db,0);
+
+    start = nstime();
+    fill(db,&key,n,1);
+    report("load",db,nstime()-start);
+
+    start = nstime();
+    for (long j = 0; j < n; j++) {
+        if (random() & 1) continue;
+        setBenchKey(&key,j);
+        dbDelete(db,&key);
+    }
+    report("delete half",db,nstime()-start);
+
+    start = nstime();
+    zmalloc_trim();
+    report("trim",db,nstime()-start);
+
+    // 重新写满，新写入的值更大，原来的空闲区块大多不能直接复用
+    start = nstime();
+    fill(db,&key,n,2);
+    report("refill, 2x values",db,nstime()-start);
+
+    dictEmpty(db->expires);
+    dictEmpty(db->DB);
+    sdsfree(key.ptr);
+    return 0;
+}
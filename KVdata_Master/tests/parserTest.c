@@ -0,0 +1,293 @@
+/*
+ * 协议解析的测试程序
+ *
+ * 把随机生成的合法命令和不合法的协议内容编码成 RESP ，
+ * 按照随机的长度切分之后，像 readQueryFromClient 一样通过 prepareQueryBuffer 逐段读入查询缓冲区，
+ * 每读入一段就用 processMultibulkBuffer 解析，检查解析出的参数数组和生成的命令是否一致，
+ * 不合法的内容是否让客户端被标记为 KVDATA_CLOSE_AFTER_REPLY 。
+ *
+ * 测试程序和除 main.c 之外的所有源文件链接在一起，在 KVdata_Master 目录下编译运行：
+ *
+ * gcc -I. $(ls *.c | grep -v '^main.c$') tests/parserTest.c -o /tmp/parserTest -lpthread && /tmp/parserTest [轮数] [随机种子]
+ *
+ * 全部通过时返回 0 ，否则打印失败的检查并返回 1 。
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "server.h"
+#include "client.h"
+#include "object.h"
+#include "sds.h"
+#include "zmalloc.h"
+
+KVServer server;//全局服务器变量，被链接进来的源文件引用
+
+static int failed = 0;
+
+#define test_assert(cond) do { \
+        if (!(cond)) { \
+            printf("  FAILED %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+            failed++; \
+            return; \
+        } \
+    } while(0)
+
+/* 一条命令的参数 */
+typedef struct testCommand {
+    int argc;
+    sds *argv;
+} testCommand;
+
+/*
+ * 随机参数长度：大部分是短参数，少量是超过回复缓冲区和参数池限制的参数，
+ * 以及走大参数路径（直接读入查询缓冲区）的参数
+ */
+static size_t randomArgLen(void) {
+    int r = random() % 100;
+
+    if (r < 80) return random() % 40;
+    if (r < 95) return KVDATA_ARGV_POOL_MAX_LEN - 8 + random() % 16;
+    return KVDATA_MBULK_BIG_ARG - 2 + random() % (KVDATA_MBULK_BIG_ARG*2);
+}
+
+/*
+ * 随机参数内容，包括 '\r'、'\n'、'\0' 和 '$' 等协议中的特殊字符
+ */
+static sds randomArg(void) {
+    size_t len = randomArgLen();
+    sds s = sdsnewlen(NULL,len);
+
+    for (size_t j = 0; j < len; j++) {
+        static const char special[] = "\r\n\0$*";
+        s[j] = (random() % 8 == 0) ? special[random() % 5] : 'a' + random() % 26;
+    }
+    return s;
+}
+
+/*
+ * 随机生成一条命令，少量命令的参数个数超过参数数组第一次分配的 1024 个
+ */
+static void randomCommand(testCommand *cmd) {
+    int r = random() % 100;
+
+    cmd->argc = r < 97 ? 1 + random() % 8 : 1000 + random() % 100;
+    cmd->argv = zmalloc(sizeof(sds)*cmd->argc);
+    for (int j = 0; j < cmd->argc; j++) {
+        // 参数很多的命令只使用短参数，避免单条命令太大
+        if (cmd->argc > 8) {
+            cmd->argv[j] = sdscatprintf(sdsnewlen("",0),"arg%d",j);
+        } else {
+            cmd->argv[j] = randomArg();
+        }
+    }
+}
+
+static void freeCommand(testCommand *cmd) {
+    for (int j = 0; j < cmd->argc; j++) sdsfree(cmd->argv[j]);
+    zfree(cmd->argv);
+}
+
+/*
+ * 把命令按照协议格式追加到 s 中
+ */
+static sds encodeCommand(sds s, testCommand *cmd) {
+    s = sdscatprintf(s,"*%d\r\n",cmd->argc);
+    for (int j = 0; j < cmd->argc; j++) {
+        s = sdscatprintf(s,"$%zu\r\n",sdslen(cmd->argv[j]));
+        s = sdscatlen(s,cmd->argv[j],sdslen(cmd->argv[j]));
+        s = sdscatlen(s,"\r\n",2);
+    }
+    return s;
+}
+
+/*
+ * 随机生成一段不符合协议的内容，解析到这里时客户端必须被标记为关闭
+ */
+static sds encodeMalformed(sds s) {
+    switch (random() % 9) {
+    case 0: return sdscatprintf(s,"+PING\r\n");                                 // 不是 '*'
+    case 1: return sdscatprintf(s,"*abc\r\n");                                  // 参数个数不是整数
+    case 2: return sdscatprintf(s,"*%d\r\n",KVDATA_PROTO_MAX_MULTIBULK_LEN+1);  // 参数个数太多
+    case 3: return sdscatprintf(s,"*2\r\n$3\r\nGET\r\n:1\r\n");                 // 参数不是 '$'
+    case 4: return sdscatprintf(s,"*1\r\n$-1\r\n");                             // 参数长度为负数
+    case 5: return sdscatprintf(s,"*1\r\n$%lld\r\n",KVDATA_PROTO_MAX_BULK_LEN+1); // 参数太长
+    case 6: return sdscatprintf(s,"*1\r\n$3x\r\n");                             // 参数长度不是整数
+    case 7: {
+        // 参数个数所在的行太长
+        s = sdscatlen(s,"*",1);
+        for (int j = 0; j < KVDATA_INLINE_MAX_SIZE+16; j++) s = sdscatlen(s,"1",1);
+        return s;
+    }
+    default: {
+        // 参数长度所在的行太长
+        s = sdscatprintf(s,"*1\r\n$");
+        for (int j = 0; j < KVDATA_INLINE_MAX_SIZE+16; j++) s = sdscatlen(s,"1",1);
+        return s;
+    }
+    }
+}
+
+/*
+ * 随机的读入长度，偏向很短的读入，让每个协议元素都可能在任何位置被切开
+ */
+static size_t randomReadLen(void) {
+    int r = random() % 100;
+
+    if (r < 40) return 1 + random() % 4;
+    if (r < 80) return 1 + random() % 64;
+    return 1 + random() % (KVDATA_IOBUF_LEN*2);
+}
+
+/*
+ * 一轮测试：生成若干条命令（可能以不合法的内容结尾），切分读入并解析
+ */
+static void testRound(int malformed) {
+    int ncmds = 1 + random() % 10, parsed = 0;
+    testCommand *cmds = zmalloc(sizeof(testCommand)*ncmds);
+    sds stream = sdsnewlen("",0);
+    size_t off = 0;
+    KVClient *c = createClient(-1);
+
+    for (int j = 0; j < ncmds; j++) {
+        randomCommand(&cmds[j]);
+        // 偶尔插入空命令，解析器直接跳过它们
+        if (random() % 10 == 0) stream = sdscatlen(stream,"*0\r\n",4);
+        stream = encodeCommand(stream,&cmds[j]);
+    }
+    if (malformed) stream = encodeMalformed(stream);
+
+    while (off < sdslen(stream) && !(c->flags & KVDATA_CLOSE_AFTER_REPLY)) {
+        size_t readlen, n = randomReadLen();
+        char *buf = prepareQueryBuffer(c,&readlen);
+
+        if (n > readlen) n = readlen;
+        if (n > sdslen(stream)-off) n = sdslen(stream)-off;
+        memcpy(buf,stream+off,n);
+        off += n;
+        readQueryFromClientDone(c,n);
+
+        // 和 processInputBuffer 一样循环解析，但是不执行命令
+        while (sdslen(c->querybuf) > 0 && !(c->flags & KVDATA_CLOSE_AFTER_REPLY)) {
+            if (processMultibulkBuffer(c) != AE_OK) break;
+            if (c->argc == 0) {
+                resetClient(c);
+                continue;
+            }
+            if (parsed == ncmds) break;
+            if (c->argc != cmds[parsed].argc) goto mismatch;
+            for (int j = 0; j < c->argc; j++) {
+                robj *o = c->argv[j];
+
+                if (o->encoding != STRING ||
+                    sdslen(o->ptr) != sdslen(cmds[parsed].argv[j]) ||
+                    memcmp(o->ptr,cmds[parsed].argv[j],sdslen(o->ptr)) != 0) goto mismatch;
+            }
+            parsed++;
+            resetClient(c);
+        }
+    }
+
+    if (malformed) {
+        // 合法的命令全部解析出来之后，不合法的内容让客户端被标记为关闭
+        if (parsed != ncmds || !(c->flags & KVDATA_CLOSE_AFTER_REPLY)) {
+            printf("  malformed tail: parsed %d/%d, flags %d, stream tail '%.20s'\n",
+                parsed, ncmds, c->flags, stream+sdslen(stream)-(sdslen(stream) < 20 ? sdslen(stream) : 20));
+            failed++;
+        }
+    } else if (parsed != ncmds || (c->flags & KVDATA_CLOSE_AFTER_REPLY) || sdslen(c->querybuf) != 0) {
+        printf("  valid stream: parsed %d/%d, flags %d, querybuf %zu bytes left\n",
+            parsed, ncmds, c->flags, sdslen(c->querybuf));
+        failed++;
+    }
+    goto cleanup;
+
+mismatch:
+    printf("  argv mismatch in command %d (argc %d, expected %d)\n", parsed, c->argc, cmds[parsed].argc);
+    failed++;
+
+cleanup:
+    freeClient(c);
+    for (int j = 0; j < ncmds; j++) freeCommand(&cmds[j]);
+    zfree(cmds);
+    sdsfree(stream);
+}
+
+/*
+ * 随机字节：解析器可以报告错误或者等待更多内容，但是不能越界访问或者崩溃
+ */
+static void testRandomBytes(void) {
+    KVClient *c = createClient(-1);
+    size_t len = random() % 256;
+    size_t readlen;
+    char *buf = prepareQueryBuffer(c,&readlen);
+
+    if (len > readlen) len = readlen;
+    for (size_t j = 0; j < len; j++) {
+        static const char alphabet[] = "*$\r\n-0123456789x";
+        buf[j] = alphabet[random() % (sizeof(alphabet)-1)];
+    }
+    if (len) readQueryFromClientDone(c,len);
+    while (sdslen(c->querybuf) > 0 && !(c->flags & KVDATA_CLOSE_AFTER_REPLY)) {
+        if (processMultibulkBuffer(c) != AE_OK) break;
+        resetClient(c);
+    }
+    freeClient(c);
+}
+
+/*
+ * 最后一个参数为空串，并且结尾的 "\r\n" 单独读入时，
+ * 查询缓冲区中只剩两个字节，解析器也必须继续解析出这条命令
+ */
+static void testEmptyLastArgument(void) {
+    static const char *reads[] = {"*2\r\n$3\r\nget\r\n$0\r\n", "\r\n"};
+    KVClient *c = createClient(-1);
+    int parsed = 0;
+
+    for (int j = 0; j < 2; j++) {
+        size_t readlen, n = strlen(reads[j]);
+        char *buf = prepareQueryBuffer(c,&readlen);
+
+        memcpy(buf,reads[j],n);
+        readQueryFromClientDone(c,n);
+        while (sdslen(c->querybuf) > 0 && !(c->flags & KVDATA_CLOSE_AFTER_REPLY)) {
+            if (processMultibulkBuffer(c) != AE_OK) break;
+            if (c->argc == 2 && sdslen(c->argv[1]->ptr) == 0) parsed++;
+            resetClient(c);
+        }
+    }
+    if (parsed != 1 || sdslen(c->querybuf) != 0) {
+        printf("  empty last argument: parsed %d, querybuf %zu bytes left\n", parsed, sdslen(c->querybuf));
+        failed++;
+    }
+    freeClient(c);
+}
+
+int main(int argc, char **argv) {
+    int rounds = argc > 1 ? atoi(argv[1]) : 2000;
+    unsigned int seed = argc > 2 ? (unsigned int)atoi(argv[2]) : 12345;
+    int before;
+
+    // 测试中的协议错误是预期的，只输出警告级别的日志
+    server.verbosity = KVDATA_WARNING;
+    srandom(seed);
+    printf("seed %u, %d rounds\n", seed, rounds);
+
+    before = failed;
+    testEmptyLastArgument();
+    printf("[%s] empty last argument\n", failed == before ? "ok" : "FAIL");
+
+    before = failed;
+    for (int j = 0; j < rounds && failed < 10; j++) testRound(0);
+    printf("[%s] valid streams\n", failed == before ? "ok" : "FAIL");
+
+    before = failed;
+    for (int j = 0; j < rounds && failed < 10; j++) testRound(1);
+    printf("[%s] malformed streams\n", failed == before ? "ok" : "FAIL");
+
+    before = failed;
+    for (int j = 0; j < rounds*10; j++) testRandomBytes();
+    printf("[%s] random bytes\n", failed == before ? "ok" : "FAIL");
+
+    return failed ? 1 : 0;
+}
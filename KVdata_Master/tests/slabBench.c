@@ -0,0 +1,118 @@
+/*
+ * 对象池的基准测试程序
+ *
+ * 对 robj 、链表节点和字典节点三种大小，比较 slabAlloc/slabFree 和 zmalloc/zfree 的平均耗时：
+ * (1) LIFO ：分配之后立即释放；
+ * (2) 批量：连续分配 N 个（默认 100 万个），再按照分配的顺序全部释放；
+ * (3) 随机：保持 N 个存活的对象，每次随机释放其中一个，再分配一个新的填补。
+ * 每次分配之后写入对象的第一个字，和实际使用一样访问到对象所在的内存。
+ *
+ * 测试程序和除 main.c 之外的所有源文件链接在一起，在 KVdata_Master 目录下编译运行：
+ *
+ * gcc -O2 -I. $(ls *.c | grep -v '^main.c$') tests/slabBench.c -o /tmp/slabBench -lpthread && /tmp/slabBench [对象数量]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "server.h"
+#include "object.h"
+#include "list.h"
+#include "dict.h"
+#include "slab.h"
+#include "zmalloc.h"
+
+KVServer server;//全局服务器变量，被链接进来的源文件引用
+
+static long long nstime(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (long long)ts.tv_sec*1000000000+ts.tv_nsec;
+}
+
+/*
+ * 从对象池 id 中分配，slab 为 0 时用 zmalloc 分配 size 字节
+ */
+static void *benchAlloc(int slab, int id, size_t size) {
+    void *ptr = slab ? slabAlloc(id) : zmalloc(size);
+
+    *(void**)ptr = ptr;
+    return ptr;
+}
+
+static void benchFree(int slab, int id, void *ptr) {
+    if (slab) slabFree(id,ptr); else zfree(ptr);
+}
+
+/* 三种访问模式，返回每对分配和释放的平均纳秒数 */
+static double benchLIFO(int slab, int id, size_t size, long n) {
+    long long start = nstime();
+
+    for (long j = 0; j < n; j++) benchFree(slab,id,benchAlloc(slab,id,size));
+    return (double)(nstime()-start)/n;
+}
+
+static double benchBatch(int slab, int id, size_t size, void **ptrs, long n) {
+    long long start = nstime();
+
+    for (long j = 0; j < n; j++) ptrs[j] = benchAlloc(slab,id,size);
+    for (long j = 0; j < n; j++) benchFree(slab,id,ptrs[j]);
+    return (double)(nstime()-start)/n;
+}
+
+static double benchRandom(int slab, int id, size_t size, void **ptrs, long n) {
+    long long start;
+    double ns;
+
+    for (long j = 0; j < n; j++) ptrs[j] = benchAlloc(slab,id,size);
+    start = nstime();
+    for (long j = 0; j < n; j++) {
+        long k = random()%n;
+
+        benchFree(slab,id,ptrs[k]);
+        ptrs[k] = benchAlloc(slab,id,size);
+    }
+    ns = (double)(nstime()-start)/n;
+    for (long j = 0; j < n; j++) benchFree(slab,id,ptrs[j]);
+    return ns;
+}
+
+int main(int argc, char **argv) {
+    long n = argc > 1 ? atol(argv[1]) : 1000000;
+    void **ptrs;
+    static const struct {
+        const char *name;
+        int id;
+        size_t size;
+    } pools[] = {
+        {"robj", KVDATA_SLAB_ROBJ, sizeof(robj)},
+        {"listNode", KVDATA_SLAB_LISTNODE, sizeof(listNode)},
+        {"dictEntry", KVDATA_SLAB_DICTENTRY, sizeof(dictEntry)}
+    };
+
+    initServer(&server);
+    server.verbosity = KVDATA_WARNING;
+    ptrs = zmalloc(sizeof(void*)*n);
+    srandom(12345);
+
+    printf("%ld objects, ns per alloc+free pair\n", n);
+    printf("%-16s %10s %10s %10s %10s %10s %10s\n", "object",
+        "LIFO zm", "LIFO slab", "batch zm", "batch slab", "random zm", "random slab");
+    for (unsigned int j = 0; j < sizeof(pools)/sizeof(pools[0]); j++) {
+        char name[32];
+        double r[6];
+
+        for (int slab = 0; slab <= 1; slab++) {
+            r[slab] = benchLIFO(slab,pools[j].id,pools[j].size,n*10);
+            r[2+slab] = benchBatch(slab,pools[j].id,pools[j].size,ptrs,n);
+            r[4+slab] = benchRandom(slab,pools[j].id,pools[j].size,ptrs,n);
+        }
+        snprintf(name,sizeof(name),"%s (%zu B)",pools[j].name,pools[j].size);
+        printf("%-16s %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+            name, r[0], r[1], r[2], r[3], r[4], r[5]);
+    }
+
+    zfree(ptrs);
+    return 0;
+}
@@ -0,0 +1,136 @@
+/*
+ * 时间事件的基准测试程序
+ *
+ * 在一个事件处理器中注册 N 个（默认 10 万个）到达时间随机的时间事件，分别测量：
+ * 创建、查找最近的事件、没有事件到达时的 processTimeEvents 、随机顺序删除，
+ * 以及时间推进时事件陆续到达并执行（一半的事件执行后再次注册自己）的平均耗时。
+ * 作为对比，同时测量在 N 个节点的无序链表中查找最近事件（原来的 aeSearchNearestTimer）的耗时。
+ *
+ * 时间通过直接修改缓存的单调时钟推进，结果不受测试机器负载的影响。
+ *
+ * 测试程序和除 main.c 之外的所有源文件链接在一起，在 KVdata_Master 目录下编译运行：
+ *
+ * gcc -O2 -I. $(ls *.c | grep -v '^main.c$') tests/timerBench.c -o /tmp/timerBench -lpthread && /tmp/timerBench [事件数量]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "server.h"
+#include "events.h"
+#include "clock.h"
+#include "zmalloc.h"
+
+KVServer server;//全局服务器变量，被链接进来的源文件引用
+
+/* 原来的无序链表中的节点，只保留比较需要的域 */
+typedef struct listTimer {
+    long when_sec;
+    long when_ms;
+    struct listTimer *next;
+} listTimer;
+
+static long long fired = 0;
+
+static long long nstime(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (long long)ts.tv_sec*1000000000+ts.tv_nsec;
+}
+
+static int firedProc(struct aeEventLoop *eventLoop, void *clientData) {
+    KVDATA_NOTUSED(eventLoop);
+    fired++;
+    // 一半的事件 1 秒之后再次执行，另一半执行一次就释放
+    return ((long)clientData & 1) ? 1000 : AE_TIMECIRCLE;
+}
+
+static void report(const char *name, long long ns, long long ops) {
+    printf("%-46s %10lld ops %10.1f ns/op\n", name, ops, (double)ns/ops);
+}
+
+int main(int argc, char **argv) {
+    int n = argc > 1 ? atoi(argv[1]) : 100000;
+    int lookups = 1000000;
+    long long *ids = zmalloc(sizeof(long long)*n);
+    listTimer *list = NULL;
+    aeEventLoop *el;
+    long long start, ns, sum = 0;
+
+    server.verbosity = KVDATA_WARNING;
+    updateCachedClock();
+    el = aeCreateEventLoop(1024);
+    srandom(12345);
+    printf("%d timers\n", n);
+
+    // 创建：到达时间在 1 到 100 秒之间
+    start = nstime();
+    for (int j = 0; j < n; j++)
+        ids[j] = aeCreateTimeEvent(el,1000+random()%99000,firedProc,(void*)(long)j);
+    report("aeCreateTimeEvent",nstime()-start,n);
+
+    // 查找最近的事件
+    start = nstime();
+    for (int j = 0; j < lookups; j++) sum += aeSearchNearestTimer(el)->when_ms;
+    report("aeSearchNearestTimer",nstime()-start,lookups);
+
+    // 原来的做法：遍历无序链表
+    for (int j = 0; j < n; j++) {
+        listTimer *lt = zmalloc(sizeof(*lt));
+
+        lt->when_sec = random()%100;
+        lt->when_ms = random()%1000;
+        lt->next = list;
+        list = lt;
+    }
+    start = nstime();
+    for (int j = 0; j < 100; j++) {
+        listTimer *nearest = list;
+
+        for (listTimer *lt = list->next; lt; lt = lt->next) {
+            if (lt->when_sec < nearest->when_sec ||
+                (lt->when_sec == nearest->when_sec && lt->when_ms < nearest->when_ms))
+                nearest = lt;
+        }
+        sum += nearest->when_ms;
+    }
+    report("unsorted list scan (previous implementation)",nstime()-start,100);
+
+    // 没有事件到达时，每次事件循环迭代的时间事件处理
+    start = nstime();
+    for (int j = 0; j < lookups; j++) processTimeEvents(el);
+    report("processTimeEvents, nothing due",nstime()-start,lookups);
+
+    // 随机顺序删除
+    for (int j = n-1; j > 0; j--) {
+        int k = random()%(j+1);
+        long long tmp = ids[j];
+        ids[j] = ids[k];
+        ids[k] = tmp;
+    }
+    start = nstime();
+    for (int j = 0; j < n; j++) aeDeleteTimeEvent(el,ids[j]);
+    report("aeDeleteTimeEvent, random order",nstime()-start,n);
+
+    // 执行：到达时间在 0 到 999 毫秒之间，每次推进 1 毫秒，直到第一轮的事件全部到达，
+    // 一半的事件会在 1 秒之后再次到达
+    for (int j = 0; j < n; j++) aeCreateTimeEvent(el,random()%1000,firedProc,(void*)(long)j);
+    ns = 0;
+    for (int ms = 0; ms < 2000; ms++) {
+        cachedClock.mono_us += 1000;
+        start = nstime();
+        processTimeEvents(el);
+        ns += nstime()-start;
+    }
+    report("processTimeEvents, per fired timer",ns,fired);
+
+    while (list) {
+        listTimer *next = list->next;
+        zfree(list);
+        list = next;
+    }
+    zfree(ids);
+    // 防止编译器把查找优化掉
+    return sum == -1;
+}
@@ -1,11 +1,14 @@
+#include <stdio.h>
 #include <sys/time.h>
 #include <unistd.h>
 #include <ctype.h>
 #include "util.h"
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <limits.h>
 #include <stdint.h>
+#include <time.h>
 //对于服务器的运行ID采用随机生成
 //这样就可以用于用于判断是否访问的是同一个服务器，或者该服务器是否重启了
 void getRandomHexChars(char *p, unsigned int len) {
@@ -44,6 +47,78 @@ void getRandomHexChars(char *p, unsigned int len) {
     p[len] = '\0';
 }
 
+/*
+ * 用 /dev/urandom 中的随机字节填充 p ，用于哈希函数的种子等需要不可预测的值的地方
+ * /dev/urandom 不可用时退回到由时间、进程 ID 和 rand() 生成的字节
+ */
+void getRandomBytes(unsigned char *p, size_t len) {
+    FILE *fp = fopen("/dev/urandom","r");
+
+    if (fp != NULL && fread(p,len,1,fp) == 1) {
+        fclose(fp);
+        return;
+    }
+    if (fp) fclose(fp);
+
+    struct timeval tv;
+    gettimeofday(&tv,NULL);
+    srand(tv.tv_sec ^ tv.tv_usec ^ getpid());
+    for (size_t j = 0; j < len; j++)
+        p[j] = rand();
+}
+
+/*
+ * 将表示内存大小的字符串转换为字节数，比如 "1gb" 、 "512mb" 、 "100" ，
+ * 支持的单位有 b 、 k 、 kb 、 m 、 mb 、 g 、 gb ，不区分大小写，
+ * k/m/g 以 1000 为进制， kb/mb/gb 以 1024 为进制。
+ * 格式错误时 *err 被设置为 1 并返回 0 ，否则 *err 被设置为 0 。
+ */
+long long memtoll(const char *p, int *err) {
+    const char *u;
+    char buf[128];
+    long mul;
+    long long val;
+    unsigned int digits;
+
+    if (err) *err = 0;
+    // 找到单位的开始位置
+    u = p;
+    if (*u == '-') u++;
+    while (*u && isdigit((unsigned char)*u)) u++;
+    if (*u == '\0' || !strcasecmp(u,"b")) {
+        mul = 1;
+    } else if (!strcasecmp(u,"k")) {
+        mul = 1000;
+    } else if (!strcasecmp(u,"kb")) {
+        mul = 1024;
+    } else if (!strcasecmp(u,"m")) {
+        mul = 1000*1000;
+    } else if (!strcasecmp(u,"mb")) {
+        mul = 1024*1024;
+    } else if (!strcasecmp(u,"g")) {
+        mul = 1000L*1000*1000;
+    } else if (!strcasecmp(u,"gb")) {
+        mul = 1024L*1024*1024;
+    } else {
+        if (err) *err = 1;
+        return 0;
+    }
+
+    // 复制数字部分并转换
+    digits = u-p;
+    if (digits == 0 || digits >= sizeof(buf)) {
+        if (err) *err = 1;
+        return 0;
+    }
+    memcpy(buf,p,digits);
+    buf[digits] = '\0';
+    if (!string2ll(buf,digits,&val)) {
+        if (err) *err = 1;
+        return 0;
+    }
+    return val*mul;
+}
+
 /* Convert a string into a long long. Returns 1 if the string could be parsed
  * into a (non-overflowing) long long, 0 otherwise. The value will be set to
  * the parsed value when appropriate. */
@@ -134,3 +209,14 @@ int ll2string(char *s, size_t len, long long value) {
 }
 
 
+
+/*
+ * 返回单调时钟的微秒数，只用来计算时间间隔
+ * CLOCK_MONOTONIC 不受系统时间调整的影响，并且通过 vDSO 读取，不需要进入内核
+ */
+uint64_t getMonotonicUs(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return ((uint64_t)ts.tv_sec)*1000000+ts.tv_nsec/1000;
+}
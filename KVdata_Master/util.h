@@ -1,8 +1,13 @@
 #ifndef KVDATA_UTIL_H
 #define KVDATA_UTIL_H
+#include <stdint.h>
+#include <stddef.h>
 
 void getRandomHexChars(char *p, unsigned int len);
+void getRandomBytes(unsigned char *p, size_t len);
+long long memtoll(const char *p, int *err);
 int string2ll(const char *s, size_t slen, long long *value);
 int ll2string(char *s, size_t len, long long value);
+uint64_t getMonotonicUs(void);
 
 #endif
\ No newline at end of file
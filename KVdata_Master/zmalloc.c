@@ -1,35 +1,19 @@
 #include <stdio.h>
 #include <stdlib.h>
-#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include "zmalloc.h"
 //其中\用于宏定义和字符串换行
 
 
 // 实时统计数据库内存管理模块已经申请了多少空间
 static size_t used_memory = 0;
 
-//静态初始化线程锁，由于内存分配可能发生在各个线程中，所以对这个数据的管理要做到原子性。
-pthread_mutex_t used_memory_mutex = PTHREAD_MUTEX_INITIALIZER;
-
-//一般来说，锁操作比原子操作慢。但是在不支持原子操作的系统上只能使用锁机制了。
-//采用线程安全的模式更新数据库中内存管理模块申请的空间大小
-#ifdef HAVE_ATOMIC
-#define update_zmalloc_stat_add(n) __sync_add_and_fetch(&used_memory, (n))
-#define update_zmalloc_stat_sub(n) __sync_sub_and_fetch(&used_memory, (n))
-#else
-#define update_zmalloc_stat_add(n) do { \
-    pthread_mutex_lock(&used_memory_mutex); \
-    used_memory += (n); \
-    pthread_mutex_unlock(&used_memory_mutex); \
-} while(0)
-
-#define update_zmalloc_stat_sub(n) do { \
-    pthread_mutex_lock(&used_memory_mutex); \
-    used_memory -= (n); \
-    pthread_mutex_unlock(&used_memory_mutex); \
-} while(0)
-#endif
-
-
+//内存分配可能发生在各个线程中（主线程、I/O 线程、reactor ），
+//used_memory 通过原子操作更新，不需要加锁；只要求最终的值正确，不需要和其他内存访问排序
+#define update_zmalloc_stat_add(n) __atomic_add_fetch(&used_memory, (n), __ATOMIC_RELAXED)
+#define update_zmalloc_stat_sub(n) __atomic_sub_fetch(&used_memory, (n), __ATOMIC_RELAXED)
 
 
 
@@ -49,12 +33,14 @@ pthread_mutex_t used_memory_mutex = PTHREAD_MUTEX_INITIALIZER;
 } while(0)
 
 
+// glibc 中不小于这个大小的区块通过 mmap 单独分配（M_MMAP_THRESHOLD 的默认值），碎片整理时不移动
+#define ZMALLOC_DEFRAG_MAX_SIZE (128*1024)
 
 /*
-tcmalloc 和 Mac平台下的 malloc 函数族提供了计算已分配空间大小的函数
-（分别是tcmallocsize和mallocsize），所以就不需要单独分配一段空间记录大小了。
+jemalloc 和 glibc 的 malloc 函数族提供了查询区块实际大小的函数（malloc_usable_size），
+所以就不需要单独分配一段空间记录大小了，zmalloc.h 中会定义 HAVE_MALLOC_SIZE 。
 
-而针对linux和sun平台则要记录分配空间大小。对于linux，使用sizeof(sizet)定长字段记录；
+而其他平台则要记录分配空间大小。对于linux，使用sizeof(sizet)定长字段记录；
 对于sun os，使用sizeof(long long)定长字段记录。
 
 因此当宏HAVE_MALLOC_SIZE没有被定义的时候，就需要在多分配出的空间内记录下当前申请的内存空间的大小。
@@ -181,4 +167,144 @@ size_t zmalloc_size(void *ptr) {
     if (size&(sizeof(long)-1)) size += sizeof(long)-(size&(sizeof(long)-1));
     return size+PREFIX_SIZE;
 }
-#endif
\ No newline at end of file
+#endif
+/*
+ * 获取已经分配的内存总量
+ */
+size_t zmalloc_used_memory(void) {
+    return __atomic_load_n(&used_memory,__ATOMIC_RELAXED);
+}
+
+/*
+ * 获取进程的常驻内存（RSS）大小
+ * 读取 /proc/self/statm ，失败时返回已经分配的内存总量
+ */
+size_t zmalloc_get_rss(void) {
+    unsigned long size, resident;
+    long page = sysconf(_SC_PAGESIZE);
+    FILE *fp = fopen("/proc/self/statm","r");
+
+    if (fp == NULL) return zmalloc_used_memory();
+    if (fscanf(fp,"%lu %lu",&size,&resident) != 2) resident = 0;
+    fclose(fp);
+    if (resident == 0) return zmalloc_used_memory();
+    return (size_t)resident*page;
+}
+
+/*
+ * 获取内存分配器的统计数据
+ * allocated 为程序正在使用的区块的总大小，
+ * active 为分配器中包含正在使用的区块的页面（或者从系统申请的内存）的总大小，
+ * resident 为分配器占用的常驻内存大小。
+ * active/allocated 反映分配器内部的碎片，resident/active 反映分配器还没有归还系统的内存。
+ * 分配器不提供统计数据时都设为 0 并返回 0 ，否则返回 1
+ */
+#if defined(USE_JEMALLOC)
+int zmalloc_get_allocator_info(size_t *allocated, size_t *active, size_t *resident) {
+    uint64_t epoch = 1;
+    size_t sz;
+
+    *allocated = *active = *resident = 0;
+    // jemalloc 的统计数据是缓存的，先推进 epoch 刷新
+    sz = sizeof(epoch);
+    mallctl("epoch",&epoch,&sz,&epoch,sz);
+    sz = sizeof(size_t);
+    mallctl("stats.allocated",allocated,&sz,NULL,0);
+    mallctl("stats.active",active,&sz,NULL,0);
+    mallctl("stats.resident",resident,&sz,NULL,0);
+    return 1;
+}
+#elif defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+int zmalloc_get_allocator_info(size_t *allocated, size_t *active, size_t *resident) {
+    // mallinfo2 汇总所有 arena 的数据，会短暂地锁住每个 arena ，只在 INFO 中调用
+    struct mallinfo2 mi = mallinfo2();
+
+    // 正在使用的区块，包括通过 mmap 单独分配的大区块
+    *allocated = mi.uordblks + mi.hblkhd;
+    // 从系统申请的内存，包括 arena 中的空闲区块
+    *active = mi.arena + mi.hblkhd;
+    // glibc 不统计常驻内存，使用整个进程的 RSS
+    *resident = zmalloc_get_rss();
+    return 1;
+}
+#else
+int zmalloc_get_allocator_info(size_t *allocated, size_t *active, size_t *resident) {
+    *allocated = *active = *resident = 0;
+    return 0;
+}
+#endif
+
+/*
+ * 主动碎片整理：判断区块 ptr 是否位于利用率低的位置，是的话把它移动到新的区块
+ * 返回新的区块，调用者负责修正所有指向旧区块的指针；不需要移动时返回 NULL ，ptr 仍然有效
+ *
+ * jemalloc 中，如果 ptr 所在的 slab 比同一大小类别的平均利用率低，就不经过线程缓存重新分配，
+ * 新的区块会落在利用率更高的 slab 中，利用率低的 slab 被腾空后整个归还系统。
+ * glibc 中，只有重新分配得到的区块地址更低时才移动，把正在使用的区块压向堆的低地址，
+ * 高地址的空闲区块合并成整页，之后由 zmalloc_trim 归还系统。
+ */
+#if defined(USE_JEMALLOC)
+void *zmalloc_defrag(void *ptr) {
+    // 查询结果：ptr 所在 slab 的空闲/总区块数、区块大小、同类 slab 的空闲/总区块数、当前分配使用的 slab
+    struct {
+        size_t nfree, nregs, size, bin_nfree, bin_nregs;
+        void *slabcur_addr;
+    } util;
+    size_t sz = sizeof(util), size;
+    void *newptr;
+
+    if (mallctl("experimental.utilization.query",&util,&sz,&ptr,sizeof(ptr)) != 0) return NULL;
+    // 大区块（nregs 为 0）单独占用页面，已经满了的 slab 和正在分配的 slab 不需要腾空
+    if (util.nregs == 0 || util.nfree == 0 || util.bin_nregs == 0) return NULL;
+    if (util.slabcur_addr != NULL && (char*)ptr >= (char*)util.slabcur_addr &&
+        (char*)ptr < (char*)util.slabcur_addr+util.size*util.nregs) return NULL;
+    // slab 的利用率不低于平均利用率：(nregs-nfree)/nregs >= (bin_nregs-bin_nfree)/bin_nregs
+    if ((util.nregs-util.nfree)*util.bin_nregs >= (util.bin_nregs-util.bin_nfree)*util.nregs) return NULL;
+
+    size = zmalloc_size(ptr);
+    newptr = mallocx(size,MALLOCX_TCACHE_NONE);
+    if (newptr == NULL) return NULL;
+    memcpy(newptr,ptr,size);
+    update_zmalloc_stat_free(size);
+    update_zmalloc_stat_alloc(zmalloc_size(newptr));
+    dallocx(ptr,MALLOCX_TCACHE_NONE);
+    return newptr;
+}
+#elif defined(__GLIBC__)
+void *zmalloc_defrag(void *ptr) {
+    size_t size = zmalloc_size(ptr);
+    void *newptr;
+
+    // 通过 mmap 单独分配的大区块释放时直接归还系统，不会产生碎片
+    if (size >= ZMALLOC_DEFRAG_MAX_SIZE) return NULL;
+    // calloc 不经过线程缓存（tcache），否则每次都会拿回刚刚因为地址更高而释放的区块
+    newptr = calloc(1,size);
+    if (newptr == NULL) return NULL;
+    if ((char*)newptr > (char*)ptr || malloc_usable_size(newptr) != size) {
+        free(newptr);
+        return NULL;
+    }
+    memcpy(newptr,ptr,size);
+    free(ptr);
+    return newptr;
+}
+#else
+void *zmalloc_defrag(void *ptr) {
+    (void)ptr;
+    return NULL;
+}
+#endif
+
+/*
+ * 将分配器中的空闲页面归还系统，在一轮碎片整理结束时调用
+ */
+void zmalloc_trim(void) {
+#if defined(USE_JEMALLOC)
+    char name[64];
+
+    snprintf(name,sizeof(name),"arena.%d.purge",MALLCTL_ARENAS_ALL);
+    mallctl(name,NULL,NULL,NULL,0);
+#elif defined(__GLIBC__)
+    malloc_trim(0);
+#endif
+}
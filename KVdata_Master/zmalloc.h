@@ -1,10 +1,43 @@
 #ifndef KVDATA_ZMALLOC_H
 #define KVDATA_ZMALLOC_H
+#include <stddef.h>
+#include <stdlib.h>
 
+/*
+ * 选择内存分配器
+ * 编译时定义 USE_JEMALLOC 并链接 jemalloc 时使用 jemalloc ：
+ *
+ * gcc -DUSE_JEMALLOC *.c -o go -lpthread -ljemalloc
+ *
+ * 否则使用 libc 的 malloc 。
+ * jemalloc 和 glibc 都可以查询区块的实际大小，不需要在每个区块前面多分配空间记录大小。
+ */
+#define __xstr(s) __str(s)
+#define __str(s) #s
 
+#if defined(USE_JEMALLOC)
+#include <jemalloc/jemalloc.h>
+#define ZMALLOC_LIB ("jemalloc-" __xstr(JEMALLOC_VERSION_MAJOR) "." __xstr(JEMALLOC_VERSION_MINOR) "." __xstr(JEMALLOC_VERSION_BUGFIX))
+#define HAVE_MALLOC_SIZE 1
+#define zmalloc_size(p) malloc_usable_size(p)
+#elif defined(__GLIBC__)
+#include <malloc.h>
+#define ZMALLOC_LIB "libc"
+#define HAVE_MALLOC_SIZE 1
+#define zmalloc_size(p) malloc_usable_size(p)
+#else
+#define ZMALLOC_LIB "libc"
+#endif
 
 void *zmalloc(size_t size);
 void *zrealloc(void *ptr, size_t size);
 void zfree(void *ptr);
+#ifndef HAVE_MALLOC_SIZE
 size_t zmalloc_size(void *ptr);
-#endif
\ No newline at end of file
+#endif
+size_t zmalloc_used_memory(void);
+size_t zmalloc_get_rss(void);
+int zmalloc_get_allocator_info(size_t *allocated, size_t *active, size_t *resident);
+void *zmalloc_defrag(void *ptr);
+void zmalloc_trim(void);
+#endif